@@ -0,0 +1,279 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cglm/cglm.h>
+#include "adaptive_expansion.h"
+#include "mesh_lod.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// The ways in which a symbol that could be expanded further may be handled.
+typedef enum {
+  SUBTREE_SKIP,
+  SUBTREE_COARSE,
+  SUBTREE_EXPAND,
+} SubtreeAction;
+
+AdaptiveExpander* CreateAdaptiveExpander(LSystemConfig *config) {
+  AdaptiveExpander *e = NULL;
+  e = (AdaptiveExpander *) calloc(1, sizeof(*e));
+  if (!e) {
+    printf("Failed allocating adaptive expansion state.\n");
+    return NULL;
+  }
+  e->scratch = CreateTurtle3D();
+  if (!e->scratch) {
+    free(e);
+    return NULL;
+  }
+  e->config = config;
+  e->model_depth = -1;
+  e->max_segments = DEFAULT_ADAPTIVE_MAX_SEGMENTS;
+  return e;
+}
+
+void DestroyAdaptiveExpander(AdaptiveExpander *e) {
+  if (!e) return;
+  DestroyTurtle3D(e->scratch);
+  memset(e, 0, sizeof(*e));
+  free(e);
+}
+
+// Converts a direction relative to the turtle's orientation in p to the
+// turtle's coordinates.
+static void DirectionToWorld(TurtlePosition *p, vec3 local, vec3 world) {
+  vec3 right;
+  glm_vec3_cross(p->forward, p->up, right);
+  glm_vec3_scale(p->forward, local[0], world);
+  glm_vec3_muladds(p->up, local[1], world);
+  glm_vec3_muladds(right, local[2], world);
+}
+
+// Converts a point relative to the turtle's position and orientation in p to
+// the turtle's coordinates.
+static void PointToWorld(TurtlePosition *p, vec3 local, vec3 world) {
+  DirectionToWorld(p, local, world);
+  glm_vec3_add(p->position, world, world);
+}
+
+// Computes a box, in the turtle's coordinates, containing the model's bounds
+// when it's applied at the position and orientation in p.
+static void ModelBounds(TurtlePosition *p, SymbolModel *m, vec3 min,
+    vec3 max) {
+  vec3 corner, world;
+  int i;
+  glm_vec3_broadcast(FLT_MAX, min);
+  glm_vec3_broadcast(-FLT_MAX, max);
+  for (i = 0; i < 8; i++) {
+    corner[0] = (i & 1) ? m->max_bounds[0] : m->min_bounds[0];
+    corner[1] = (i & 2) ? m->max_bounds[1] : m->min_bounds[1];
+    corner[2] = (i & 4) ? m->max_bounds[2] : m->min_bounds[2];
+    PointToWorld(p, corner, world);
+    glm_vec3_minv(min, world, min);
+    glm_vec3_maxv(max, world, max);
+  }
+}
+
+int ApplySymbolModel(Turtle3D *t, SymbolModel *m, int draw) {
+  TurtlePosition start = t->p;
+  vec3 min, max, position, forward, up, tmp;
+  int i;
+  ModelBounds(&start, m, min, max);
+  ExpandTurtleBounds(t, min, max);
+  PointToWorld(&start, m->position, position);
+  DirectionToWorld(&start, m->forward, forward);
+  DirectionToWorld(&start, m->up, up);
+  // Keep rounding errors from accumulating in the turtle's orientation.
+  glm_vec3_normalize(forward);
+  glm_vec3_scale(forward, glm_vec3_dot(up, forward), tmp);
+  glm_vec3_sub(up, tmp, up);
+  glm_vec3_normalize(up);
+  for (i = 0; i < 4; i++) {
+    if (m->color[i] >= 0) t->color[i] = m->color[i];
+  }
+  if (!draw || !m->draws) return JumpTurtle(t, position, forward, up, 0);
+  if (glm_vec3_distance(start.position, position) > 0) {
+    return JumpTurtle(t, position, forward, up, 1);
+  }
+  // The symbol returns to where it started, so draw across its bounds
+  // instead.
+  if (!JumpTurtle(t, min, forward, up, 0)) return 0;
+  if (!JumpTurtle(t, max, forward, up, 1)) return 0;
+  return JumpTurtle(t, position, forward, up, 0);
+}
+
+// Runs the actions for a single character. Returns 0 on error.
+static int RunActions(LSystemConfig *config, Turtle3D *t, uint8_t c) {
+  ActionRule *r = config->actions + c;
+  int i;
+  for (i = 0; i < r->length; i++) {
+    if (!r->instructions[i](t, r->args[i])) {
+      printf("Failed running instruction %d for char %c.\n", i, (char) c);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Like RunActions, but used on the scratch turtle when computing models.
+// Returns 0 without printing anything if the actions pop more than the
+// enclosing symbol pushed, since that just means the symbol can't be modeled.
+static int RunModelActions(LSystemConfig *config, Turtle3D *t, uint8_t c) {
+  ActionRule *r = config->actions + c;
+  int i;
+  for (i = 0; i < r->length; i++) {
+    if ((r->instructions[i] == PopTurtlePosition) &&
+      (t->position_stack.size == 0)) {
+      return 0;
+    }
+    if ((r->instructions[i] == PopTurtleColor) &&
+      (t->color_stack.size == 0)) {
+      return 0;
+    }
+    if (!r->instructions[i](t, r->args[i])) return 0;
+  }
+  return 1;
+}
+
+// Computes the model for the given symbol expanded to the given depth. Models
+// for all lower depths must already be computed.
+static void ComputeModel(AdaptiveExpander *e, int depth, uint8_t c) {
+  SymbolModel *m = e->models[depth] + c;
+  SymbolModel *child_model = NULL;
+  ReplacementRule *r = e->config->replacements + c;
+  ReplacementRule *child_rule = NULL;
+  Turtle3D *t = e->scratch;
+  uint8_t child;
+  int i, valid = 1, draws = 0;
+  if ((depth > 0) && !r->used) {
+    *m = e->models[0][c];
+    return;
+  }
+  memset(m, 0, sizeof(*m));
+  ResetTurtle3D(t);
+  glm_vec4_broadcast(-1.0, t->color);
+  if (depth == 0) {
+    valid = RunModelActions(e->config, t, c);
+    draws = t->vertex_count > 0;
+  } else {
+    for (i = 0; i < r->length; i++) {
+      child = r->replacement[i];
+      child_rule = e->config->replacements + child;
+      if ((depth == 1) || !child_rule->used) {
+        if (!RunModelActions(e->config, t, child)) {
+          valid = 0;
+          break;
+        }
+        if (t->vertex_count > 0) draws = 1;
+        t->vertex_count = 0;
+        continue;
+      }
+      child_model = e->models[depth - 1] + child;
+      if (!child_model->valid || !ApplySymbolModel(t, child_model, 0)) {
+        valid = 0;
+        break;
+      }
+      if (child_model->draws) draws = 1;
+    }
+  }
+  t->vertex_count = 0;
+  if ((t->position_stack.size != 0) || (t->color_stack.size != 0)) valid = 0;
+  if (!valid) return;
+  m->valid = 1;
+  m->draws = draws;
+  glm_vec3_copy(t->p.position, m->position);
+  glm_vec3_copy(t->p.forward, m->forward);
+  glm_vec3_copy(t->p.up, m->up);
+  glm_vec3_copy(t->min_bounds, m->min_bounds);
+  glm_vec3_copy(t->max_bounds, m->max_bounds);
+  glm_vec4_copy(t->color, m->color);
+}
+
+void ComputeSymbolModels(AdaptiveExpander *e, int depth) {
+  int d, c;
+  for (d = e->model_depth + 1; d <= depth; d++) {
+    for (c = 0; c < 128; c++) {
+      ComputeModel(e, d, c);
+    }
+  }
+  if (depth > e->model_depth) e->model_depth = depth;
+}
+
+// Decides what to do with a symbol that could be expanded further, based on
+// its bounds in the current view.
+static SubtreeAction ChooseSubtreeAction(AdaptiveExpander *e, Turtle3D *t,
+    SymbolModel *m, LODView *view) {
+  vec3 min, max;
+  float size;
+  if (!view) return SUBTREE_SKIP;
+  ModelBounds(&(t->p), m, min, max);
+  if (BoxOutsideLODView(view, min, max)) return SUBTREE_SKIP;
+  if (((t->flushed_vertex_count + t->vertex_count) / 2) >= e->max_segments) {
+    return SUBTREE_COARSE;
+  }
+  size = ProjectedLODSize(view, min, max, glm_vec3_distance(min, max));
+  if (size <= view->pixel_error) return SUBTREE_COARSE;
+  return SUBTREE_EXPAND;
+}
+
+int RunAdaptiveExpansion(AdaptiveExpander *e, Turtle3D *t, uint32_t depth,
+    LODView *view) {
+  ExpansionFrame *f = NULL;
+  ReplacementRule *r = NULL;
+  SymbolModel *m = NULL;
+  uint32_t stack_size;
+  uint8_t c;
+  if (depth > ADAPTIVE_MAX_DEPTH) {
+    printf("Can't expand to depth %u. The limit is %d.\n", (unsigned) depth,
+      ADAPTIVE_MAX_DEPTH);
+    return 0;
+  }
+  ComputeSymbolModels(e, depth);
+  e->symbols_expanded = 0;
+  e->subtrees_culled = 0;
+  e->subtrees_coarse = 0;
+  f = e->stack;
+  f->s = e->config->init;
+  f->length = strlen(e->config->init);
+  f->index = 0;
+  f->depth = depth;
+  stack_size = 1;
+  while (stack_size > 0) {
+    f = e->stack + stack_size - 1;
+    if (f->index >= f->length) {
+      stack_size--;
+      continue;
+    }
+    c = f->s[f->index];
+    f->index++;
+    r = e->config->replacements + c;
+    if ((f->depth == 0) || !r->used) {
+      if (!RunActions(e->config, t, c)) return 0;
+      continue;
+    }
+    m = e->models[f->depth] + c;
+    if (m->valid) {
+      switch (ChooseSubtreeAction(e, t, m, view)) {
+      case SUBTREE_SKIP:
+        e->subtrees_culled++;
+        if (!ApplySymbolModel(t, m, 0)) return 0;
+        continue;
+      case SUBTREE_COARSE:
+        e->subtrees_coarse++;
+        if (!ApplySymbolModel(t, m, 1)) return 0;
+        continue;
+      case SUBTREE_EXPAND:
+        break;
+      }
+    }
+    e->symbols_expanded++;
+    e->stack[stack_size].s = r->replacement;
+    e->stack[stack_size].length = r->length;
+    e->stack[stack_size].index = 0;
+    e->stack[stack_size].depth = f->depth - 1;
+    stack_size++;
+  }
+  return 1;
+}
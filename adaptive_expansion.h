@@ -0,0 +1,94 @@
+// Runs the turtle over an L-system without materializing the expanded string.
+// Each symbol is only replaced while its bounds are visible and cover more
+// than a threshold number of pixels on screen; smaller subtrees are drawn as
+// a single coarse segment and subtrees outside of the view are skipped. The
+// bounds of each subtree come from a per-symbol model of the turtle's net
+// movement, computed ahead of time for every depth.
+#ifndef ADAPTIVE_EXPANSION_H
+#define ADAPTIVE_EXPANSION_H
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "mesh_lod.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// The maximum depth to which symbols can be expanded.
+#define ADAPTIVE_MAX_DEPTH (64)
+
+// The default limit on the number of segments to draw. Once this many
+// segments have been drawn, every remaining subtree is drawn coarsely.
+#define DEFAULT_ADAPTIVE_MAX_SEGMENTS (4 * 1024 * 1024)
+
+// Describes the effect of running the turtle over a symbol expanded to some
+// depth. Everything is relative to the turtle's position and orientation
+// before the symbol: x is along the turtle's forward vector, y is along its up
+// vector, and z is to its right.
+typedef struct {
+  // Zero if the symbol's effect can't be summarized, e.g. because it pops
+  // a position it didn't push. Such symbols are always expanded.
+  int valid;
+  // Nonzero if the symbol draws any segments.
+  int draws;
+  // The turtle's position and orientation afterwards.
+  vec3 position;
+  vec3 forward;
+  vec3 up;
+  // Bounds containing every position the turtle visits.
+  vec3 min_bounds;
+  vec3 max_bounds;
+  // The turtle's color afterwards. Negative channels are left unchanged.
+  vec4 color;
+} SymbolModel;
+
+// One level of the stack of partially-expanded strings.
+typedef struct {
+  const char *s;
+  uint32_t length;
+  uint32_t index;
+  // The remaining number of times to expand the symbols in s.
+  uint32_t depth;
+} ExpansionFrame;
+
+// Holds the state needed to adaptively expand a single config.
+typedef struct {
+  LSystemConfig *config;
+  // Used when computing models; never drawn.
+  Turtle3D *scratch;
+  // Models have been computed for every depth up to and including this, or
+  // it's -1 if no models have been computed.
+  int model_depth;
+  SymbolModel models[ADAPTIVE_MAX_DEPTH + 1][128];
+  ExpansionFrame stack[ADAPTIVE_MAX_DEPTH + 1];
+  // Once the turtle has drawn this many segments, stop refining.
+  uint32_t max_segments;
+  // Statistics about the most recent RunAdaptiveExpansion call.
+  uint64_t symbols_expanded;
+  uint64_t subtrees_culled;
+  uint64_t subtrees_coarse;
+} AdaptiveExpander;
+
+// Allocates an expander for the given config, which must remain valid for as
+// long as the expander is used. Returns NULL on error.
+AdaptiveExpander* CreateAdaptiveExpander(LSystemConfig *config);
+
+// Frees the expander. The pointer is no longer valid after this returns.
+void DestroyAdaptiveExpander(AdaptiveExpander *e);
+
+// Makes sure models have been computed for every depth up to the given one,
+// which must not exceed ADAPTIVE_MAX_DEPTH.
+void ComputeSymbolModels(AdaptiveExpander *e, int depth);
+
+// Moves the turtle as if it ran over the symbol described by the model. If
+// draw is nonzero and the symbol draws anything, this draws a single coarse
+// segment in its place. Returns 0 on error.
+int ApplySymbolModel(Turtle3D *t, SymbolModel *m, int draw);
+
+// Runs the turtle over the config's initial string, expanded to at most the
+// given depth. The view's pixel_error is the projected size below which a
+// subtree is drawn coarsely. If view is NULL, every subtree with a valid
+// model is skipped; this is enough to get the turtle's full bounds cheaply.
+// The turtle is not reset first. Returns 0 on error.
+int RunAdaptiveExpansion(AdaptiveExpander *e, Turtle3D *t, uint32_t depth,
+    LODView *view);
+
+#endif  // ADAPTIVE_EXPANSION_H
@@ -0,0 +1,525 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "benchmark_corpus.h"
+#include "mesh_vertex.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+#include "utilities.h"
+
+// The most whitespace-separated fields on a single line of a corpus file.
+#define CORPUS_MAX_FIELDS (6)
+
+// The characters used for turning in generated configs, in pairs of opposite
+// turns.
+static const char turn_symbols[] = "+-&^/\\";
+
+const char* CorpusShapeName(CorpusShape shape) {
+  switch (shape) {
+  case CORPUS_SHAPE_BRANCHING:
+    return "branching";
+  case CORPUS_SHAPE_BRACKETS:
+    return "brackets";
+  case CORPUS_SHAPE_DELETION:
+    return "deletion";
+  case CORPUS_SHAPE_COLORS:
+    return "colors";
+  case CORPUS_SHAPE_COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+void DestroyBenchmarkCorpus(BenchmarkCorpus *c) {
+  uint32_t i;
+  if (!c) return;
+  for (i = 0; i < c->entry_count; i++) {
+    free(c->entries[i].name);
+    free(c->entries[i].config_path);
+  }
+  free(c->entries);
+  memset(c, 0, sizeof(*c));
+  free(c);
+}
+
+// Splits the line into whitespace-separated fields, modifying it in place.
+// Returns the number of fields, which may be more than CORPUS_MAX_FIELDS, in
+// which case only the first CORPUS_MAX_FIELDS are set.
+static int SplitFields(char *line, char **fields) {
+  int count = 0;
+  while (1) {
+    while ((*line == ' ') || (*line == '\t') || (*line == '\r')) {
+      *line = 0;
+      line++;
+    }
+    if (*line == 0) break;
+    if (count < CORPUS_MAX_FIELDS) fields[count] = line;
+    count++;
+    while (*line && (*line != ' ') && (*line != '\t') && (*line != '\r')) {
+      line++;
+    }
+  }
+  return count;
+}
+
+// Parses an unsigned integer field. Returns 0 if it's invalid.
+static int ParseCorpusNumber(const char *s, uint64_t *value) {
+  char *end = NULL;
+  unsigned long long v;
+  errno = 0;
+  v = strtoull(s, &end, 10);
+  if ((errno != 0) || (end == s) || (*end != 0) || (s[0] == '-')) return 0;
+  *value = v;
+  return 1;
+}
+
+// Returns nonzero if the name can be used as a file name without escaping.
+static int IsValidEntryName(const char *name) {
+  const char *c;
+  for (c = name; *c; c++) {
+    if (((*c >= 'a') && (*c <= 'z')) || ((*c >= 'A') && (*c <= 'Z')) ||
+      ((*c >= '0') && (*c <= '9')) || (*c == '_') || (*c == '-')) {
+      continue;
+    }
+    return 0;
+  }
+  return c != name;
+}
+
+// Sets the entry's config path to its name in the given directory, which is
+// either empty or ends with a path separator. Returns 0 on error.
+static int SetConfigPath(CorpusEntry *e, const char *directory,
+    size_t directory_length) {
+  size_t length = directory_length + strlen(e->name) + strlen(".txt") + 1;
+  e->config_path = (char *) calloc(length, 1);
+  if (!e->config_path) return 0;
+  memcpy(e->config_path, directory, directory_length);
+  strcat(e->config_path, e->name);
+  strcat(e->config_path, ".txt");
+  return 1;
+}
+
+// Parses a single line of a corpus file, other than a "budget" line, and
+// adds it to the corpus's entries. Returns 0 on error.
+static int ParseCorpusEntry(BenchmarkCorpus *c, char **fields,
+    int field_count, const char *directory, size_t directory_length) {
+  CorpusEntry *e = c->entries + c->entry_count;
+  uint64_t iterations;
+  int i;
+  if ((field_count != 3) && (field_count != 5)) {
+    printf("Expected a name, shape and seed, optionally followed by the "
+      "iterations and estimated bytes.\n");
+    return 0;
+  }
+  if (!IsValidEntryName(fields[0])) {
+    printf("Invalid corpus entry name: %s\n", fields[0]);
+    return 0;
+  }
+  for (i = 0; i < CORPUS_SHAPE_COUNT; i++) {
+    if (strcmp(fields[1], CorpusShapeName(i)) == 0) break;
+  }
+  if (i >= CORPUS_SHAPE_COUNT) {
+    printf("Invalid corpus shape: %s\n", fields[1]);
+    return 0;
+  }
+  e->shape = i;
+  if (!ParseCorpusNumber(fields[2], &(e->seed))) {
+    printf("Invalid seed: %s\n", fields[2]);
+    return 0;
+  }
+  if (field_count == 5) {
+    if (!ParseCorpusNumber(fields[3], &iterations) ||
+      (iterations > CORPUS_MAX_ITERATIONS) ||
+      !ParseCorpusNumber(fields[4], &(e->estimated_bytes))) {
+      printf("Invalid iterations or estimated bytes for %s.\n", fields[0]);
+      return 0;
+    }
+    e->has_iterations = 1;
+    e->iterations = iterations;
+  }
+  // Count the entry before allocating anything, so it's always freed.
+  c->entry_count++;
+  e->name = strdup(fields[0]);
+  if (!e->name || !SetConfigPath(e, directory, directory_length)) {
+    printf("Failed allocating corpus entry.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Parses the lines of a corpus file, which is modified in place. The entries
+// must have been allocated to hold at least one entry per line. Returns 0 on
+// error.
+static int ParseCorpusLines(BenchmarkCorpus *c, char *content,
+    const char *path) {
+  const char *separator = strrchr(path, '/');
+  size_t directory_length = separator ? (separator - path) + 1 : 0;
+  char *fields[CORPUS_MAX_FIELDS];
+  char *line = content;
+  char *next = NULL;
+  uint64_t budget_mb;
+  uint32_t line_number = 0;
+  int field_count;
+#ifdef _WIN32
+  if (strrchr(path, '\\') > separator) {
+    directory_length = (strrchr(path, '\\') - path) + 1;
+  }
+#endif
+  while (line) {
+    line_number++;
+    next = strchr(line, '\n');
+    if (next) {
+      *next = 0;
+      next++;
+    }
+    field_count = SplitFields(line, fields);
+    if ((field_count == 0) || (fields[0][0] == '#')) {
+      line = next;
+      continue;
+    }
+    if (strcmp(fields[0], "budget") == 0) {
+      if ((field_count != 2) || !ParseCorpusNumber(fields[1], &budget_mb) ||
+        (budget_mb == 0) || (budget_mb > (UINT64_MAX >> 20))) {
+        printf("Invalid budget on line %u of %s.\n", (unsigned) line_number,
+          path);
+        return 0;
+      }
+      c->budget_bytes = budget_mb << 20;
+    } else if (!ParseCorpusEntry(c, fields, field_count, path,
+      directory_length)) {
+      printf("Failed parsing line %u of %s.\n", (unsigned) line_number,
+        path);
+      return 0;
+    }
+    line = next;
+  }
+  return 1;
+}
+
+BenchmarkCorpus* LoadBenchmarkCorpus(const char *path) {
+  BenchmarkCorpus *c = NULL;
+  char *content = NULL;
+  uint32_t line_count = 1;
+  char *current = NULL;
+  content = ReadFullFile(path);
+  if (!content) return NULL;
+  for (current = content; *current; current++) {
+    if (*current == '\n') line_count++;
+  }
+  c = (BenchmarkCorpus *) calloc(1, sizeof(*c));
+  if (!c) {
+    printf("Failed allocating benchmark corpus.\n");
+    free(content);
+    return NULL;
+  }
+  c->budget_bytes = ((uint64_t) DEFAULT_CORPUS_BUDGET_MB) << 20;
+  c->entries = (CorpusEntry *) calloc(line_count, sizeof(CorpusEntry));
+  if (!c->entries) {
+    printf("Failed allocating benchmark corpus entries.\n");
+    free(content);
+    DestroyBenchmarkCorpus(c);
+    return NULL;
+  }
+  if (!ParseCorpusLines(c, content, path)) {
+    free(content);
+    DestroyBenchmarkCorpus(c);
+    return NULL;
+  }
+  free(content);
+  if (c->entry_count == 0) {
+    printf("The corpus file %s doesn't list any configs.\n", path);
+    DestroyBenchmarkCorpus(c);
+    return NULL;
+  }
+  return c;
+}
+
+// Returns the next number from a splitmix64 generator. Unlike rand(), this
+// produces the same numbers on every platform. The arguments of a function
+// call may be evaluated in any order, so the generators below never draw more
+// than one random number per call, keeping the configs the same across
+// compilers.
+static uint64_t NextRandom(uint64_t *state) {
+  uint64_t z;
+  *state += 0x9e3779b97f4a7c15ULL;
+  z = *state;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Returns a random number between 0 and limit - 1.
+static uint32_t RandomBelow(uint64_t *state, uint32_t limit) {
+  return NextRandom(state) % limit;
+}
+
+// Returns a random number between min and max.
+static float RandomRange(uint64_t *state, float min, float max) {
+  double t = ((double) (NextRandom(state) >> 11)) / ((double) (1ULL << 53));
+  return min + t * (max - min);
+}
+
+static char RandomTurn(uint64_t *state) {
+  return turn_symbols[RandomBelow(state, sizeof(turn_symbols) - 1)];
+}
+
+// Returns the symbol used for one of the rules that recursively expand.
+static char RuleSymbol(uint32_t index) {
+  return 'A' + index;
+}
+
+// Returns the symbol for the given link of a deletion chain, or the given
+// color in a "colors" config. There are at most 36.
+static char IndexedSymbol(uint32_t index) {
+  if (index < 10) return '0' + index;
+  return 'a' + (index - 10);
+}
+
+// Writes rules with several bracketed branches, each ending in a random rule.
+static void WriteBranchingRules(uint64_t *state, FILE *f) {
+  uint32_t rule_count = 2 + RandomBelow(state, 3);
+  uint32_t branch_count, i, j;
+  for (i = 0; i < rule_count; i++) {
+    fprintf(f, "%c F", RuleSymbol(i));
+    branch_count = 3 + RandomBelow(state, 4);
+    for (j = 0; j < branch_count; j++) {
+      fputc('(', f);
+      fputc(RandomTurn(state), f);
+      if (RandomBelow(state, 2)) fputc(RandomTurn(state), f);
+      fputc(RuleSymbol(RandomBelow(state, rule_count)), f);
+      fputc(')', f);
+    }
+    if (RandomBelow(state, 2)) {
+      fputc('F', f);
+      fputc(RandomTurn(state), f);
+      fputc(RuleSymbol(RandomBelow(state, rule_count)), f);
+    }
+    fputc('\n', f);
+  }
+  if (RandomBelow(state, 3) == 0) fprintf(f, "F FF\n");
+}
+
+// Writes rules nesting several levels of brackets, with a rule at the
+// innermost level and after the outermost one, so the stacks get deeper by
+// several levels every iteration.
+static void WriteBracketRules(uint64_t *state, FILE *f) {
+  uint32_t rule_count = 2 + RandomBelow(state, 2);
+  uint32_t depth, i, j;
+  for (i = 0; i < rule_count; i++) {
+    fprintf(f, "%c ", RuleSymbol(i));
+    depth = 4 + RandomBelow(state, 5);
+    for (j = 0; j < depth; j++) {
+      fprintf(f, "F%c(", RandomTurn(state));
+    }
+    fputc(RuleSymbol(RandomBelow(state, rule_count)), f);
+    for (j = 0; j < depth; j++) {
+      fputc(')', f);
+      if ((j == (depth - 1)) || (RandomBelow(state, 3) == 0)) {
+        fputc(RandomTurn(state), f);
+        fputc(RuleSymbol(RandomBelow(state, rule_count)), f);
+      }
+    }
+    fputc('\n', f);
+  }
+}
+
+// Writes rules that start a chain of symbols, each of which is replaced by
+// the next link every iteration, until the last one is deleted. The links
+// draw short segments, so the chains also affect the turtle. Returns the
+// chain's length.
+static uint32_t WriteDeletionRules(uint64_t *state, FILE *f) {
+  uint32_t chain_length = 8 + RandomBelow(state, 9);
+  uint32_t reference_count, i, j;
+  for (i = 0; i < 2; i++) {
+    fprintf(f, "%c ", RuleSymbol(i));
+    reference_count = 2 + RandomBelow(state, 2);
+    for (j = 0; j < reference_count; j++) {
+      fputc(IndexedSymbol(0), f);
+      fputc(IndexedSymbol(RandomBelow(state, chain_length)), f);
+      fputc(RandomTurn(state), f);
+      fputc('(', f);
+      fputc(RuleSymbol(RandomBelow(state, 2)), f);
+      fputc(')', f);
+    }
+    fprintf(f, "F\n");
+  }
+  for (i = 0; i < (chain_length - 1); i++) {
+    fprintf(f, "%c %c\n", IndexedSymbol(i), IndexedSymbol(i + 1));
+  }
+  fprintf(f, "%c\n", IndexedSymbol(chain_length - 1));
+  return chain_length;
+}
+
+// Writes rules drawing branches with a different color each, where about
+// half of the colors turn into the next color every iteration. Returns the
+// number of colors.
+static uint32_t WriteColorRules(uint64_t *state, FILE *f) {
+  uint32_t color_count = 16 + RandomBelow(state, 11);
+  uint32_t rule_count = 2 + RandomBelow(state, 2);
+  uint32_t branch_count, i, j;
+  for (i = 0; i < rule_count; i++) {
+    fprintf(f, "%c ", RuleSymbol(i));
+    branch_count = 2 + RandomBelow(state, 3);
+    for (j = 0; j < branch_count; j++) {
+      fputc('(', f);
+      fputc(IndexedSymbol(RandomBelow(state, color_count)), f);
+      fputc(RandomTurn(state), f);
+      fputc(RuleSymbol(RandomBelow(state, rule_count)), f);
+      fputc(')', f);
+    }
+    fprintf(f, "%cF\n", IndexedSymbol(RandomBelow(state, color_count)));
+  }
+  for (i = 0; i < color_count; i++) {
+    if (!RandomBelow(state, 2)) continue;
+    fprintf(f, "%c %c\n", IndexedSymbol(i),
+      IndexedSymbol((i + 1) % color_count));
+  }
+  return color_count;
+}
+
+// Writes the actions shared by every shape: brackets pushing and popping the
+// position and color, F moving forward, and the turns.
+static void WriteCommonActions(uint64_t *state, FILE *f) {
+  const char *turn_names[] = {"rotate", "pitch", "roll"};
+  float angle;
+  int i;
+  fprintf(f, "\nactions\n\n(\npush_position 0\npush_color 0\n\n)\n"
+    "pop_color 0\npop_position 0\n\nF\nmove_forward %.3f\n",
+    RandomRange(state, 0.5, 1.0));
+  for (i = 0; i < 3; i++) {
+    angle = RandomRange(state, 10.0, 90.0);
+    fprintf(f, "\n%c\n%s %.3f\n\n%c\n%s %.3f\n", turn_symbols[i * 2],
+      turn_names[i], angle, turn_symbols[i * 2 + 1], turn_names[i], -angle);
+  }
+}
+
+int WriteCorpusConfig(CorpusShape shape, uint64_t seed, FILE *f) {
+  uint64_t state = seed;
+  float length, angle;
+  uint32_t count, i;
+  fprintf(f, "# Generated by l_system_corpus from the \"%s\" shape with seed "
+    "%llu.\ninit A\n", CorpusShapeName(shape), (unsigned long long) seed);
+  switch (shape) {
+  case CORPUS_SHAPE_BRANCHING:
+    WriteBranchingRules(&state, f);
+    WriteCommonActions(&state, f);
+    break;
+  case CORPUS_SHAPE_BRACKETS:
+    WriteBracketRules(&state, f);
+    WriteCommonActions(&state, f);
+    break;
+  case CORPUS_SHAPE_DELETION:
+    count = WriteDeletionRules(&state, f);
+    WriteCommonActions(&state, f);
+    for (i = 0; i < count; i++) {
+      length = RandomRange(&state, 0.1, 0.5);
+      angle = RandomRange(&state, -45.0, 45.0);
+      fprintf(f, "\n%c\nmove_forward %.3f\nrotate %.3f\n", IndexedSymbol(i),
+        length, angle);
+    }
+    break;
+  case CORPUS_SHAPE_COLORS:
+    count = WriteColorRules(&state, f);
+    WriteCommonActions(&state, f);
+    for (i = 0; i < count; i++) {
+      fprintf(f, "\n%c\n", IndexedSymbol(i));
+      fprintf(f, "set_color_r %.3f\n", RandomRange(&state, 0, 1));
+      fprintf(f, "set_color_g %.3f\n", RandomRange(&state, 0, 1));
+      fprintf(f, "set_color_b %.3f\n", RandomRange(&state, 0, 1));
+    }
+    break;
+  default:
+    printf("Invalid corpus shape: %d\n", (int) shape);
+    return 0;
+  }
+  return !ferror(f);
+}
+
+// Adds two counts, saturating rather than overflowing.
+static uint64_t AddCounts(uint64_t a, uint64_t b) {
+  if ((UINT64_MAX - a) < b) return UINT64_MAX;
+  return a + b;
+}
+
+// Returns the estimated bytes used by the previous and current strings and
+// the vertices for the given number of segments, saturating at UINT64_MAX.
+static uint64_t EstimateBytes(uint64_t previous_length, uint64_t length,
+    uint64_t segments) {
+  uint64_t vertex_bytes = 2 * sizeof(MeshVertex);
+  if (segments > (UINT64_MAX / vertex_bytes)) return UINT64_MAX;
+  return AddCounts(AddCounts(previous_length, length),
+    segments * vertex_bytes);
+}
+
+void PredictIterationsForBudget(LSystemConfig *config,
+    uint32_t max_iterations, uint64_t budget_bytes, int count_vertices,
+    uint32_t *iterations, uint64_t *bytes) {
+  // The length of the string and the number of segments produced by each
+  // symbol at the previous and current numbers of iterations.
+  uint64_t lengths[2][128];
+  uint64_t segments[2][128];
+  uint64_t length, segment_count, previous_length, estimate;
+  const uint8_t *init = (const uint8_t *) config->init;
+  ReplacementRule *r = NULL;
+  ActionRule *a = NULL;
+  uint32_t n, current, previous, i;
+  int c, j;
+  for (c = 0; c < 128; c++) {
+    lengths[0][c] = 1;
+    segments[0][c] = 0;
+    a = config->actions + c;
+    for (j = 0; j < a->length; j++) {
+      if (a->instructions[j] == MoveTurtleForward) segments[0][c]++;
+    }
+  }
+  previous_length = 0;
+  *iterations = 0;
+  *bytes = 0;
+  for (n = 0; n <= max_iterations; n++) {
+    current = n & 1;
+    previous = !current;
+    if (n > 0) {
+      for (c = 0; c < 128; c++) {
+        r = config->replacements + c;
+        if (!r->used) {
+          lengths[current][c] = 1;
+          segments[current][c] = segments[previous][c];
+          continue;
+        }
+        lengths[current][c] = 0;
+        segments[current][c] = 0;
+        for (j = 0; j < r->length; j++) {
+          i = (uint8_t) r->replacement[j];
+          lengths[current][c] = AddCounts(lengths[current][c],
+            lengths[previous][i]);
+          segments[current][c] = AddCounts(segments[current][c],
+            segments[previous][i]);
+        }
+      }
+    }
+    length = 0;
+    segment_count = 0;
+    for (i = 0; init[i]; i++) {
+      length = AddCounts(length, lengths[current][init[i] & 127]);
+      segment_count = AddCounts(segment_count,
+        segments[current][init[i] & 127]);
+    }
+    if (!count_vertices) segment_count = 0;
+    estimate = EstimateBytes(previous_length, length, segment_count);
+    // The initial string always fits.
+    if ((n > 0) && ((estimate > budget_bytes) || (length > UINT32_MAX))) {
+      break;
+    }
+    *iterations = n;
+    *bytes = estimate;
+    previous_length = length;
+  }
+}
+
+void CorpusIterationsForBudget(LSystemConfig *config, uint64_t budget_bytes,
+    uint32_t *iterations, uint64_t *bytes) {
+  PredictIterationsForBudget(config, CORPUS_MAX_ITERATIONS, budget_bytes, 1,
+    iterations, bytes);
+}
@@ -0,0 +1,89 @@
+// Generates random L-system configs from seeds, so that benchmarks always run
+// on the same workloads. Each config has one of a fixed set of shapes,
+// stressing a different part of the expansion and turtle, and is given the
+// largest number of iterations whose string and vertices fit in a memory
+// budget. Doesn't use OpenGL.
+//
+// A corpus file lists the configs, one per line, as a name, a shape and a
+// seed. A "budget" line sets the memory budget in MB. Corpus files written by
+// l_system_corpus also list the number of iterations and the estimated bytes
+// used at that number of iterations after each seed. Blank lines and lines
+// starting with '#' are ignored.
+#ifndef BENCHMARK_CORPUS_H
+#define BENCHMARK_CORPUS_H
+#include <stdint.h>
+#include <stdio.h>
+#include "parse_config.h"
+
+// The memory budget used if the corpus file doesn't set one, in MB.
+#define DEFAULT_CORPUS_BUDGET_MB (256)
+
+// Configs that fit in the budget at any number of iterations, i.e. that
+// don't grow, are limited to this many.
+#define CORPUS_MAX_ITERATIONS (40)
+
+typedef enum {
+  // Rules with many bracketed branches, so the string grows quickly.
+  CORPUS_SHAPE_BRANCHING = 0,
+  // Rules nesting brackets several levels deep, so the turtle's position and
+  // color stacks get deep.
+  CORPUS_SHAPE_BRACKETS,
+  // Rules producing long chains of symbols which are renamed every
+  // iteration until they're deleted.
+  CORPUS_SHAPE_DELETION,
+  // Many symbols setting colors, which change every iteration.
+  CORPUS_SHAPE_COLORS,
+  CORPUS_SHAPE_COUNT,
+} CorpusShape;
+
+typedef struct {
+  char *name;
+  CorpusShape shape;
+  uint64_t seed;
+  // Nonzero if the corpus file listed the iterations and estimated bytes.
+  int has_iterations;
+  uint32_t iterations;
+  uint64_t estimated_bytes;
+  // The path of the generated config: the entry's name, followed by .txt, in
+  // the same directory as the corpus file.
+  char *config_path;
+} CorpusEntry;
+
+typedef struct {
+  uint64_t budget_bytes;
+  CorpusEntry *entries;
+  uint32_t entry_count;
+} BenchmarkCorpus;
+
+// Returns the name of the shape, as used in corpus files.
+const char* CorpusShapeName(CorpusShape shape);
+
+// Loads the corpus file at the given path. Returns NULL on error.
+BenchmarkCorpus* LoadBenchmarkCorpus(const char *path);
+
+void DestroyBenchmarkCorpus(BenchmarkCorpus *c);
+
+// Writes a config with the given shape, generated from the given seed, to f.
+// The same shape and seed always produce the same config. Returns 0 on
+// error.
+int WriteCorpusConfig(CorpusShape shape, uint64_t seed, FILE *f);
+
+// Finds the largest number of iterations, up to CORPUS_MAX_ITERATIONS, at
+// which the previous and current strings and the turtle's vertices take at
+// most budget_bytes, and sets *bytes to the estimated size at that number of
+// iterations. The string's length can't exceed UINT32_MAX. Doesn't expand
+// anything, so it's fast even for large budgets.
+void CorpusIterationsForBudget(LSystemConfig *config, uint64_t budget_bytes,
+    uint32_t *iterations, uint64_t *bytes);
+
+// Like CorpusIterationsForBudget, but stops at max_iterations instead of
+// CORPUS_MAX_ITERATIONS. If count_vertices is 0, only the strings are
+// counted, for programs that pass the turtle's vertices to a sink instead of
+// keeping them. The estimate grows with the work needed to expand and draw
+// the config, so it can also be used to predict which configs will take the
+// longest.
+void PredictIterationsForBudget(LSystemConfig *config,
+    uint32_t max_iterations, uint64_t budget_bytes, int count_vertices,
+    uint32_t *iterations, uint64_t *bytes);
+
+#endif  // BENCHMARK_CORPUS_H
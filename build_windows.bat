@@ -1,14 +1,37 @@
 gcc -Wall -Werror -O3 -o l_system_3d ^
   l_system_3d.c ^
   l_system_mesh.c ^
+  mesh_buffers.c ^
+  mesh_lod.c ^
+  mesh_residency.c ^
+  shader_cache.c ^
+  frame_capture.c ^
+  input_script.c ^
+  headless_context.c ^
+  line_rasterizer.c ^
+  capsule_bvh.c ^
+  path_tracer.c ^
+  thread_group.c ^
+  segment_writer.c ^
+  tube_mesh.c ^
+  gltf_writer.c ^
+  offscreen_target.c ^
+  pixel_readback.c ^
+  png_writer.c ^
+  adaptive_expansion.c ^
   turtle_3d.c ^
   parse_config.c ^
+  l_system_string.c ^
+  memory_budget.c ^
+  trace.c ^
   utilities.c ^
+  gl_utilities.c ^
   glad\src\glad.c ^
   -I cglm\include ^
   -I glad\include ^
   -I C:\bin\glfw-3.3.3\include ^
   -L C:\bin\glfw-3.3.3\lib-static-ucrt ^
   -lglfw3dll ^
+  -lpthread ^
   -lm
 
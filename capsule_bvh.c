@@ -0,0 +1,878 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "capsule_bvh.h"
+#include "thread_group.h"
+
+typedef struct {
+  float min[3];
+  float max[3];
+} Bounds;
+
+typedef struct {
+  Bounds bounds;
+  uint32_t count;
+} SAHBin;
+
+// A range of indices that still needs to be turned into the subtree under
+// the given node.
+typedef struct {
+  uint32_t node;
+  uint32_t first;
+  uint32_t count;
+  uint32_t depth;
+} BuildTask;
+
+// A growable list of tasks.
+typedef struct {
+  BuildTask *tasks;
+  uint32_t count;
+  uint32_t capacity;
+} TaskList;
+
+struct BVHBuild;
+
+// The state of one of the threads building the tree.
+typedef struct {
+  struct BVHBuild *build;
+  int index;
+  // This thread's share of the node being split by every thread.
+  Bounds bounds;
+  Bounds centroids;
+  SAHBin bins[3][SAH_BINS];
+  uint32_t left_count;
+  uint32_t left_cursor;
+  uint32_t right_cursor;
+  // The subtrees this thread still needs to build on its own.
+  TaskList stack;
+  int error;
+} BVHBuildThread;
+
+typedef struct BVHBuild {
+  CapsuleBVH *b;
+  int thread_count;
+  BVHBuildThread *threads;
+  // The segment indices, reordered as the tree is built so that every node
+  // covers a contiguous range of them. Partitioning a node's range goes
+  // through the same range in scratch, so that it's stable.
+  uint32_t *indices;
+  uint32_t *scratch;
+  // The node being split by every thread, and its split.
+  BuildTask split;
+  Bounds split_centroids;
+  int split_axis;
+  int split_bin;
+  // The subtrees left for the threads to build on their own.
+  TaskList tasks;
+  pthread_mutex_t lock;
+  uint32_t next_task;
+} BVHBuild;
+
+CapsuleBVH* CreateCapsuleBVH(float radius) {
+  CapsuleBVH *b = (CapsuleBVH *) calloc(1, sizeof(*b));
+  if (!b) {
+    printf("Failed allocating capsule BVH.\n");
+    return NULL;
+  }
+  b->radius = radius;
+  return b;
+}
+
+void DestroyCapsuleBVH(CapsuleBVH *b) {
+  if (!b) return;
+  free(b->ends);
+  free(b->colors);
+  free(b->nodes);
+  free(b->packets);
+  memset(b, 0, sizeof(*b));
+  free(b);
+}
+
+int AddCapsule(CapsuleBVH *b, vec3 start, vec3 end, uint32_t start_color,
+    uint32_t end_color) {
+  uint32_t new_capacity;
+  float *new_ends = NULL;
+  uint32_t *new_colors = NULL;
+  float *dst = NULL;
+  if (b->segment_count >= b->segment_capacity) {
+    if (b->segment_capacity >= 0x40000000) {
+      printf("Too many segments for the capsule BVH.\n");
+      return 0;
+    }
+    new_capacity = b->segment_capacity ? b->segment_capacity * 2 : 4096;
+    new_ends = (float *) realloc(b->ends,
+      ((size_t) new_capacity) * 6 * sizeof(float));
+    if (!new_ends) {
+      printf("Failed allocating space for %u capsules.\n",
+        (unsigned) new_capacity);
+      return 0;
+    }
+    b->ends = new_ends;
+    new_colors = (uint32_t *) realloc(b->colors,
+      ((size_t) new_capacity) * 2 * sizeof(uint32_t));
+    if (!new_colors) {
+      printf("Failed allocating space for %u capsule colors.\n",
+        (unsigned) new_capacity);
+      return 0;
+    }
+    b->colors = new_colors;
+    b->segment_capacity = new_capacity;
+  }
+  dst = b->ends + ((uint64_t) b->segment_count) * 6;
+  glm_vec3_copy(start, dst);
+  glm_vec3_copy(end, dst + 3);
+  b->colors[b->segment_count * 2] = start_color;
+  b->colors[b->segment_count * 2 + 1] = end_color;
+  b->segment_count++;
+  return 1;
+}
+
+// Used instead of fminf and fmaxf, which handle NaNs and so usually aren't
+// inlined.
+static float MinFloat(float a, float b) {
+  return a < b ? a : b;
+}
+
+static float MaxFloat(float a, float b) {
+  return a > b ? a : b;
+}
+
+static void EmptyBounds(Bounds *b) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    b->min[i] = INFINITY;
+    b->max[i] = -INFINITY;
+  }
+}
+
+static void GrowBounds(Bounds *b, Bounds *other) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    b->min[i] = MinFloat(b->min[i], other->min[i]);
+    b->max[i] = MaxFloat(b->max[i], other->max[i]);
+  }
+}
+
+static float SurfaceArea(Bounds *b) {
+  float x = b->max[0] - b->min[0];
+  float y = b->max[1] - b->min[1];
+  float z = b->max[2] - b->min[2];
+  if ((x < 0) || (y < 0) || (z < 0)) return 0;
+  return 2 * (x * y + y * z + z * x);
+}
+
+// Gets the bounds of a segment's capsule, along with the bounds of its
+// midpoint (i.e. the same point as both min and max).
+static void CapsuleBounds(CapsuleBVH *b, uint32_t segment, Bounds *bounds,
+    Bounds *centroid) {
+  float *ends = b->ends + ((uint64_t) segment) * 6;
+  int i;
+  for (i = 0; i < 3; i++) {
+    bounds->min[i] = MinFloat(ends[i], ends[i + 3]) - b->radius;
+    bounds->max[i] = MaxFloat(ends[i], ends[i + 3]) + b->radius;
+    centroid->min[i] = (ends[i] + ends[i + 3]) * 0.5f;
+    centroid->max[i] = centroid->min[i];
+  }
+}
+
+// Finds the bounds of the capsules and of their midpoints for a range of
+// indices.
+static void FindRangeBounds(CapsuleBVH *b, uint32_t *indices, uint32_t first,
+    uint32_t count, Bounds *bounds, Bounds *centroids) {
+  Bounds capsule, centroid;
+  uint32_t i;
+  EmptyBounds(bounds);
+  EmptyBounds(centroids);
+  for (i = first; i < (first + count); i++) {
+    CapsuleBounds(b, indices[i], &capsule, &centroid);
+    GrowBounds(bounds, &capsule);
+    GrowBounds(centroids, &centroid);
+  }
+}
+
+// Returns the bin along the given axis for a segment's midpoint.
+static int BinIndex(Bounds *centroids, int axis, Bounds *centroid) {
+  float extent = centroids->max[axis] - centroids->min[axis];
+  int bin = (int) (((centroid->min[axis] - centroids->min[axis]) / extent) *
+    SAH_BINS);
+  if (bin < 0) return 0;
+  if (bin >= SAH_BINS) return SAH_BINS - 1;
+  return bin;
+}
+
+static void EmptyBins(SAHBin bins[3][SAH_BINS]) {
+  int axis, i;
+  for (axis = 0; axis < 3; axis++) {
+    for (i = 0; i < SAH_BINS; i++) {
+      EmptyBounds(&(bins[axis][i].bounds));
+      bins[axis][i].count = 0;
+    }
+  }
+}
+
+// Adds each segment in the range to its bin along every axis with a nonzero
+// extent.
+static void BinRange(CapsuleBVH *b, uint32_t *indices, uint32_t first,
+    uint32_t count, Bounds *centroids, SAHBin bins[3][SAH_BINS]) {
+  Bounds capsule, centroid;
+  SAHBin *bin = NULL;
+  uint32_t i;
+  int axis;
+  for (i = first; i < (first + count); i++) {
+    CapsuleBounds(b, indices[i], &capsule, &centroid);
+    for (axis = 0; axis < 3; axis++) {
+      if (centroids->max[axis] <= centroids->min[axis]) continue;
+      bin = bins[axis] + BinIndex(centroids, axis, &centroid);
+      GrowBounds(&(bin->bounds), &capsule);
+      bin->count++;
+    }
+  }
+}
+
+// Picks the axis and bin with the lowest SAH cost for a split where
+// segments in bins up to and including the chosen one go on the left.
+// Returns 0 if the segments can't be split this way, e.g. if their midpoints
+// are all in the same place.
+static int ChooseSplit(SAHBin bins[3][SAH_BINS], int *split_axis,
+    int *split_bin) {
+  float right_areas[SAH_BINS];
+  uint32_t right_counts[SAH_BINS];
+  Bounds left, right;
+  uint32_t left_count, right_count;
+  float cost, best_cost = INFINITY;
+  int axis, i;
+  for (axis = 0; axis < 3; axis++) {
+    EmptyBounds(&right);
+    right_count = 0;
+    for (i = SAH_BINS - 1; i > 0; i--) {
+      GrowBounds(&right, &(bins[axis][i].bounds));
+      right_count += bins[axis][i].count;
+      right_areas[i] = SurfaceArea(&right);
+      right_counts[i] = right_count;
+    }
+    EmptyBounds(&left);
+    left_count = 0;
+    for (i = 0; i < (SAH_BINS - 1); i++) {
+      GrowBounds(&left, &(bins[axis][i].bounds));
+      left_count += bins[axis][i].count;
+      if ((left_count == 0) || (right_counts[i + 1] == 0)) continue;
+      cost = SurfaceArea(&left) * left_count + right_areas[i + 1] *
+        right_counts[i + 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        *split_axis = axis;
+        *split_bin = i;
+      }
+    }
+  }
+  return best_cost < INFINITY;
+}
+
+static int GoesLeft(CapsuleBVH *b, uint32_t segment, Bounds *centroids,
+    int axis, int split_bin) {
+  Bounds capsule, centroid;
+  CapsuleBounds(b, segment, &capsule, &centroid);
+  return BinIndex(centroids, axis, &centroid) <= split_bin;
+}
+
+static int PushTask(TaskList *l, BuildTask t) {
+  uint32_t new_capacity;
+  BuildTask *tmp = NULL;
+  if (l->count >= l->capacity) {
+    new_capacity = l->capacity ? l->capacity * 2 : 64;
+    tmp = (BuildTask *) realloc(l->tasks, new_capacity * sizeof(BuildTask));
+    if (!tmp) {
+      printf("Failed allocating BVH build task list.\n");
+      return 0;
+    }
+    l->tasks = tmp;
+    l->capacity = new_capacity;
+  }
+  l->tasks[l->count] = t;
+  l->count++;
+  return 1;
+}
+
+static void SetNodeBounds(BVHNode *n, Bounds *bounds) {
+  memcpy(n->min, bounds->min, sizeof(n->min));
+  memcpy(n->max, bounds->max, sizeof(n->max));
+}
+
+// Turns the task's node into a leaf.
+static void MakeLeaf(BVHBuild *build, BuildTask *t) {
+  CapsuleBVH *b = build->b;
+  BVHNode *n = b->nodes + t->node;
+  uint32_t packet_index = __atomic_fetch_add(&(b->packet_count), 1,
+    __ATOMIC_RELAXED);
+  CapsulePacket *p = b->packets + packet_index;
+  uint32_t segment;
+  float *ends = NULL;
+  int lane, i;
+  for (lane = 0; lane < LANE_COUNT; lane++) {
+    segment = build->indices[t->first + (lane < t->count ? lane : 0)];
+    ends = b->ends + ((uint64_t) segment) * 6;
+    for (i = 0; i < 3; i++) {
+      p->start[i][lane] = ends[i];
+      p->end[i][lane] = ends[i + 3];
+    }
+    p->segments[lane] = segment;
+  }
+  n->index = packet_index;
+  n->count = t->count;
+}
+
+// Turns the task's node into an internal node whose left child covers the
+// first left_count indices, and writes the tasks for its children.
+static void SplitTask(BVHBuild *build, BuildTask *t, uint32_t left_count,
+    BuildTask *left, BuildTask *right) {
+  BVHNode *n = build->b->nodes + t->node;
+  n->index = __atomic_fetch_add(&(build->b->node_count), 2, __ATOMIC_RELAXED);
+  n->count = 0;
+  left->node = n->index;
+  left->first = t->first;
+  left->count = left_count;
+  left->depth = t->depth + 1;
+  right->node = n->index + 1;
+  right->first = t->first + left_count;
+  right->count = t->count - left_count;
+  right->depth = t->depth + 1;
+}
+
+// Builds one node of a subtree on a single thread, pushing its children onto
+// the thread's stack. Returns 0 on error.
+static int BuildNode(BVHBuildThread *t, BuildTask *task) {
+  BVHBuild *build = t->build;
+  CapsuleBVH *b = build->b;
+  uint32_t *indices = build->indices;
+  uint32_t *scratch = build->scratch;
+  Bounds bounds, centroids;
+  BuildTask left, right;
+  uint32_t i, left_count, right_cursor;
+  int axis, bin, j;
+  FindRangeBounds(b, indices, task->first, task->count, &bounds, &centroids);
+  SetNodeBounds(b->nodes + task->node, &bounds);
+  if (task->count <= LANE_COUNT) {
+    MakeLeaf(build, task);
+    return 1;
+  }
+  left_count = task->count / 2;
+  if (task->depth < BVH_MEDIAN_SPLIT_DEPTH) {
+    EmptyBins(t->bins);
+    BinRange(b, indices, task->first, task->count, &centroids, t->bins);
+    if (ChooseSplit(t->bins, &axis, &bin)) {
+      left_count = 0;
+      right_cursor = task->first + t->bins[axis][bin].count;
+      for (j = 0; j < bin; j++) {
+        right_cursor += t->bins[axis][j].count;
+      }
+      for (i = task->first; i < (task->first + task->count); i++) {
+        if (GoesLeft(b, indices[i], &centroids, axis, bin)) {
+          scratch[task->first + left_count] = indices[i];
+          left_count++;
+        } else {
+          scratch[right_cursor] = indices[i];
+          right_cursor++;
+        }
+      }
+      memcpy(indices + task->first, scratch + task->first, task->count *
+        sizeof(uint32_t));
+    }
+  }
+  SplitTask(build, task, left_count, &left, &right);
+  return PushTask(&(t->stack), right) && PushTask(&(t->stack), left);
+}
+
+// Claims subtrees from the shared list and builds each of them.
+static void* BuildSubtreesThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  BVHBuild *build = t->build;
+  BuildTask task;
+  uint32_t index;
+  while (!t->error) {
+    pthread_mutex_lock(&(build->lock));
+    index = build->next_task;
+    build->next_task++;
+    pthread_mutex_unlock(&(build->lock));
+    if (index >= build->tasks.count) break;
+    t->stack.count = 0;
+    if (!PushTask(&(t->stack), build->tasks.tasks[index])) {
+      t->error = 1;
+      break;
+    }
+    while (t->stack.count > 0) {
+      t->stack.count--;
+      task = t->stack.tasks[t->stack.count];
+      if (!BuildNode(t, &task)) {
+        t->error = 1;
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Gets the part of the node being split that the thread is responsible for.
+static void GetThreadSlice(BVHBuildThread *t, uint32_t *first,
+    uint32_t *count) {
+  BuildTask *split = &(t->build->split);
+  int thread_count = t->build->thread_count;
+  uint32_t start = split->first + (((uint64_t) split->count) * t->index) /
+    thread_count;
+  uint32_t end = split->first + (((uint64_t) split->count) * (t->index + 1)) /
+    thread_count;
+  *first = start;
+  *count = end - start;
+}
+
+static void* FindBoundsThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  uint32_t first, count;
+  GetThreadSlice(t, &first, &count);
+  FindRangeBounds(t->build->b, t->build->indices, first, count, &(t->bounds),
+    &(t->centroids));
+  return NULL;
+}
+
+static void* BinThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  uint32_t first, count;
+  GetThreadSlice(t, &first, &count);
+  EmptyBins(t->bins);
+  BinRange(t->build->b, t->build->indices, first, count,
+    &(t->build->split_centroids), t->bins);
+  return NULL;
+}
+
+static void* CountLeftThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  BVHBuild *build = t->build;
+  uint32_t first, count, i;
+  GetThreadSlice(t, &first, &count);
+  t->left_count = 0;
+  for (i = first; i < (first + count); i++) {
+    if (GoesLeft(build->b, build->indices[i], &(build->split_centroids),
+      build->split_axis, build->split_bin)) {
+      t->left_count++;
+    }
+  }
+  return NULL;
+}
+
+static void* ScatterThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  BVHBuild *build = t->build;
+  uint32_t first, count, i;
+  GetThreadSlice(t, &first, &count);
+  for (i = first; i < (first + count); i++) {
+    if (GoesLeft(build->b, build->indices[i], &(build->split_centroids),
+      build->split_axis, build->split_bin)) {
+      build->scratch[t->left_cursor] = build->indices[i];
+      t->left_cursor++;
+    } else {
+      build->scratch[t->right_cursor] = build->indices[i];
+      t->right_cursor++;
+    }
+  }
+  return NULL;
+}
+
+static void* CopyBackThread(void *arg) {
+  BVHBuildThread *t = (BVHBuildThread *) arg;
+  uint32_t first, count;
+  GetThreadSlice(t, &first, &count);
+  memcpy(t->build->indices + first, t->build->scratch + first, count *
+    sizeof(uint32_t));
+  return NULL;
+}
+
+static int RunBuildThreads(BVHBuild *build, const char *name,
+    ThreadGroupFunction f) {
+  return RunThreadGroup(name, build->thread_count, f, build->threads,
+    sizeof(BVHBuildThread));
+}
+
+// Splits a large node using every thread, in the same way as BuildNode.
+// Returns 0 on error.
+static int SplitInParallel(BVHBuild *build, BuildTask *task, BuildTask *left,
+    BuildTask *right) {
+  BVHBuildThread *threads = build->threads;
+  Bounds bounds;
+  uint32_t left_count, left_cursor, right_cursor, first, count;
+  int i, axis, bin;
+  build->split = *task;
+  if (!RunBuildThreads(build, "Find BVH split bounds", FindBoundsThread)) {
+    return 0;
+  }
+  EmptyBounds(&bounds);
+  EmptyBounds(&(build->split_centroids));
+  for (i = 0; i < build->thread_count; i++) {
+    GrowBounds(&bounds, &(threads[i].bounds));
+    GrowBounds(&(build->split_centroids), &(threads[i].centroids));
+  }
+  SetNodeBounds(build->b->nodes + task->node, &bounds);
+  left_count = task->count / 2;
+  if (task->depth >= BVH_MEDIAN_SPLIT_DEPTH) {
+    SplitTask(build, task, left_count, left, right);
+    return 1;
+  }
+  if (!RunBuildThreads(build, "Bin BVH capsules", BinThread)) return 0;
+  for (i = 1; i < build->thread_count; i++) {
+    for (axis = 0; axis < 3; axis++) {
+      for (bin = 0; bin < SAH_BINS; bin++) {
+        GrowBounds(&(threads[0].bins[axis][bin].bounds),
+          &(threads[i].bins[axis][bin].bounds));
+        threads[0].bins[axis][bin].count += threads[i].bins[axis][bin].count;
+      }
+    }
+  }
+  if (ChooseSplit(threads[0].bins, &(build->split_axis),
+    &(build->split_bin))) {
+    if (!RunBuildThreads(build, "Count BVH split sides", CountLeftThread)) {
+      return 0;
+    }
+    left_count = 0;
+    for (i = 0; i < build->thread_count; i++) {
+      left_count += threads[i].left_count;
+    }
+    // Each thread writes its segments after those of the previous threads on
+    // either side, so the partition keeps them in order.
+    left_cursor = task->first;
+    right_cursor = task->first + left_count;
+    for (i = 0; i < build->thread_count; i++) {
+      GetThreadSlice(threads + i, &first, &count);
+      threads[i].left_cursor = left_cursor;
+      threads[i].right_cursor = right_cursor;
+      left_cursor += threads[i].left_count;
+      right_cursor += count - threads[i].left_count;
+    }
+    if (!RunBuildThreads(build, "Scatter BVH capsules", ScatterThread)) {
+      return 0;
+    }
+    if (!RunBuildThreads(build, "Copy BVH capsules", CopyBackThread)) return 0;
+  }
+  SplitTask(build, task, left_count, left, right);
+  return 1;
+}
+
+static void FreeBuild(BVHBuild *build) {
+  int i;
+  if (build->threads) {
+    for (i = 0; i < build->thread_count; i++) {
+      free(build->threads[i].stack.tasks);
+    }
+  }
+  free(build->threads);
+  free(build->indices);
+  free(build->scratch);
+  free(build->tasks.tasks);
+  pthread_mutex_destroy(&(build->lock));
+  memset(build, 0, sizeof(*build));
+}
+
+// Splits every node with at least threshold segments using all of the
+// threads, leaving the smaller subtrees in build->tasks. Returns 0 on error.
+static int SplitLargeNodes(BVHBuild *build, uint32_t threshold) {
+  TaskList large;
+  BuildTask task, children[2];
+  int i, result = 1;
+  memset(&large, 0, sizeof(large));
+  task.node = 0;
+  task.first = 0;
+  task.count = build->b->segment_count;
+  task.depth = 0;
+  result = PushTask(&large, task);
+  while (result && (large.count > 0)) {
+    large.count--;
+    task = large.tasks[large.count];
+    if (task.count < threshold) {
+      result = PushTask(&(build->tasks), task);
+      continue;
+    }
+    result = SplitInParallel(build, &task, children, children + 1);
+    for (i = 0; result && (i < 2); i++) {
+      result = PushTask(&large, children[i]);
+    }
+  }
+  free(large.tasks);
+  return result;
+}
+
+int BuildCapsuleBVH(CapsuleBVH *b, int thread_count) {
+  BVHBuild build;
+  uint32_t n = b->segment_count;
+  uint32_t i, threshold;
+  int result = 1;
+  if (thread_count < 1) thread_count = 1;
+  free(b->nodes);
+  free(b->packets);
+  b->nodes = NULL;
+  b->packets = NULL;
+  b->node_count = 0;
+  b->packet_count = 0;
+  if (n == 0) return 1;
+  memset(&build, 0, sizeof(build));
+  pthread_mutex_init(&(build.lock), NULL);
+  build.b = b;
+  build.thread_count = thread_count;
+  // A binary tree with at most n leaves has fewer than 2n nodes.
+  b->nodes = (BVHNode *) malloc(((uint64_t) n) * 2 * sizeof(BVHNode));
+  b->packets = (CapsulePacket *) malloc(((uint64_t) n) *
+    sizeof(CapsulePacket));
+  build.indices = (uint32_t *) malloc(((uint64_t) n) * sizeof(uint32_t));
+  build.scratch = (uint32_t *) malloc(((uint64_t) n) * sizeof(uint32_t));
+  build.threads = (BVHBuildThread *) calloc(thread_count,
+    sizeof(BVHBuildThread));
+  if (!b->nodes || !b->packets || !build.indices || !build.scratch ||
+    !build.threads) {
+    printf("Failed allocating BVH for %u segments.\n", (unsigned) n);
+    FreeBuild(&build);
+    return 0;
+  }
+  for (i = 0; i < n; i++) {
+    build.indices[i] = i;
+  }
+  for (i = 0; i < (uint32_t) thread_count; i++) {
+    build.threads[i].build = &build;
+    build.threads[i].index = i;
+  }
+  b->node_count = 1;
+
+  // Only split nodes using every thread until there are enough subtrees to
+  // keep the threads busy on their own.
+  threshold = n / (thread_count * 16);
+  if (threshold < BVH_MIN_PARALLEL_SPLIT) threshold = BVH_MIN_PARALLEL_SPLIT;
+  if (thread_count == 1) threshold = 0xffffffff;
+  result = SplitLargeNodes(&build, threshold);
+  if (result) result = RunBuildThreads(&build, "Build BVH subtrees",
+    BuildSubtreesThread);
+  for (i = 0; result && (i < (uint32_t) thread_count); i++) {
+    if (build.threads[i].error) result = 0;
+  }
+  FreeBuild(&build);
+  if (!result) {
+    printf("Failed building the capsule BVH.\n");
+    return 0;
+  }
+  // The packets hold copies of the endpoints, so they're no longer needed.
+  free(b->ends);
+  b->ends = NULL;
+  b->segment_capacity = 0;
+  return 1;
+}
+
+// A ray, along with the reciprocal of its direction for testing boxes.
+typedef struct {
+  float origin[3];
+  float direction[3];
+  float inverse[3];
+} Ray;
+
+static void InitRay(Ray *r, vec3 origin, vec3 direction) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    r->origin[i] = origin[i];
+    r->direction[i] = direction[i];
+    r->inverse[i] = 1.0f / direction[i];
+  }
+}
+
+// Returns the distance at which the ray enters the node's box, or INFINITY
+// if it misses the box or only enters it after max_distance.
+static float HitNode(BVHNode *n, Ray *r, float max_distance) {
+  float near = 0, far = max_distance;
+  float t0, t1, tmp;
+  int i;
+  for (i = 0; i < 3; i++) {
+    t0 = (n->min[i] - r->origin[i]) * r->inverse[i];
+    t1 = (n->max[i] - r->origin[i]) * r->inverse[i];
+    if (t0 > t1) {
+      tmp = t0;
+      t0 = t1;
+      t1 = tmp;
+    }
+    if (t0 > near) near = t0;
+    if (t1 < far) far = t1;
+  }
+  if (near > far) return INFINITY;
+  return near;
+}
+
+// Returns the distance along the ray to each lane's capsule, or INFINITY for
+// lanes that it misses. Based on Inigo Quilez's ray-capsule intersection.
+static LaneFloats IntersectPacket(CapsulePacket *p, Ray *r, float radius) {
+  LaneFloats zero = {0};
+  LaneFloats dx = zero + r->direction[0];
+  LaneFloats dy = zero + r->direction[1];
+  LaneFloats dz = zero + r->direction[2];
+  LaneFloats bax = p->end[0] - p->start[0];
+  LaneFloats bay = p->end[1] - p->start[1];
+  LaneFloats baz = p->end[2] - p->start[2];
+  LaneFloats oax = r->origin[0] - p->start[0];
+  LaneFloats oay = r->origin[1] - p->start[1];
+  LaneFloats oaz = r->origin[2] - p->start[2];
+  LaneFloats baba = bax * bax + bay * bay + baz * baz;
+  LaneFloats rdoa = dx * oax + dy * oay + dz * oaz;
+  LaneFloats skip, bard, baoa, oaoa, a, b, c, h, t, y, ocx, ocy, ocz;
+  LaneFloats cap_b, cap_h, cap_t;
+  LaneMask hit, body, cap;
+  float r2 = radius * radius;
+  // Start the ray just in front of the capsule, to avoid losing precision
+  // when the capsule is small compared to its distance.
+  skip = MaxLanes(-rdoa - SqrtLanes(baba) - radius, zero);
+  oax += skip * dx;
+  oay += skip * dy;
+  oaz += skip * dz;
+  rdoa += skip;
+  bard = bax * dx + bay * dy + baz * dz;
+  baoa = bax * oax + bay * oay + baz * oaz;
+  oaoa = oax * oax + oay * oay + oaz * oaz;
+  a = baba - bard * bard;
+  b = baba * rdoa - baoa * bard;
+  c = baba * oaoa - baoa * baoa - r2 * baba;
+  h = b * b - a * c;
+  hit = h >= zero;
+  t = (-b - SqrtLanes(MaxLanes(h, zero))) / a;
+  y = baoa + t * bard;
+  body = hit & (y > zero) & (y < baba);
+  // Where the ray misses the cylinder's body, try the sphere at whichever
+  // end is nearer.
+  ocx = SelectLanes(y <= zero, oax, oax - bax);
+  ocy = SelectLanes(y <= zero, oay, oay - bay);
+  ocz = SelectLanes(y <= zero, oaz, oaz - baz);
+  cap_b = dx * ocx + dy * ocy + dz * ocz;
+  cap_h = cap_b * cap_b - (ocx * ocx + ocy * ocy + ocz * ocz - r2);
+  cap = hit & ~body & (cap_h > zero);
+  cap_t = -cap_b - SqrtLanes(MaxLanes(cap_h, zero));
+  t = SelectLanes(body, t, SelectLanes(cap, cap_t, zero - 1));
+  return SelectLanes(t >= zero, t + skip, zero + INFINITY);
+}
+
+int IntersectCapsuleBVH(CapsuleBVH *b, vec3 origin, vec3 direction,
+    float max_distance, CapsuleHit *hit) {
+  uint32_t stack[BVH_MAX_DEPTH];
+  float stack_distances[BVH_MAX_DEPTH];
+  uint32_t stack_size = 0;
+  uint32_t node = 0, near, far, segment;
+  BVHNode *n = NULL;
+  LaneFloats t;
+  Ray r;
+  float best = max_distance, near_t, far_t;
+  int lane, found = 0;
+  if (b->node_count == 0) return 0;
+  InitRay(&r, origin, direction);
+  if (HitNode(b->nodes, &r, best) == INFINITY) return 0;
+  while (1) {
+    n = b->nodes + node;
+    if (n->count) {
+      t = IntersectPacket(b->packets + n->index, &r, b->radius);
+      for (lane = 0; lane < LANE_COUNT; lane++) {
+        if (t[lane] > best) continue;
+        segment = b->packets[n->index].segments[lane];
+        if ((t[lane] == best) && (!found || (segment >= hit->segment))) {
+          continue;
+        }
+        best = t[lane];
+        found = 1;
+        hit->distance = best;
+        hit->segment = segment;
+        hit->packet = n->index;
+        hit->lane = lane;
+      }
+    } else {
+      near = n->index;
+      far = near + 1;
+      near_t = HitNode(b->nodes + near, &r, best);
+      far_t = HitNode(b->nodes + far, &r, best);
+      if (far_t < near_t) {
+        near = far;
+        far = n->index;
+        t[0] = near_t;
+        near_t = far_t;
+        far_t = t[0];
+      }
+      if (near_t != INFINITY) {
+        if (far_t != INFINITY) {
+          stack[stack_size] = far;
+          stack_distances[stack_size] = far_t;
+          stack_size++;
+        }
+        node = near;
+        continue;
+      }
+    }
+    // Move on to the nearest remaining node that may still be closer than
+    // the best hit so far.
+    while (1) {
+      if (stack_size == 0) return found;
+      stack_size--;
+      if (stack_distances[stack_size] <= best) break;
+    }
+    node = stack[stack_size];
+  }
+  return found;
+}
+
+int CapsuleBVHOccluded(CapsuleBVH *b, vec3 origin, vec3 direction,
+    float max_distance) {
+  uint32_t stack[BVH_MAX_DEPTH];
+  uint32_t stack_size = 0;
+  uint32_t node = 0;
+  BVHNode *n = NULL;
+  LaneFloats t;
+  Ray r;
+  int hit_left, hit_right;
+  if (b->node_count == 0) return 0;
+  InitRay(&r, origin, direction);
+  if (HitNode(b->nodes, &r, max_distance) == INFINITY) return 0;
+  while (1) {
+    n = b->nodes + node;
+    if (n->count) {
+      t = IntersectPacket(b->packets + n->index, &r, b->radius);
+      if (AnyLanes(t < max_distance)) return 1;
+    } else {
+      hit_left = HitNode(b->nodes + n->index, &r, max_distance) != INFINITY;
+      hit_right = HitNode(b->nodes + n->index + 1, &r, max_distance) !=
+        INFINITY;
+      if (hit_left) {
+        if (hit_right) {
+          stack[stack_size] = n->index + 1;
+          stack_size++;
+        }
+        node = n->index;
+        continue;
+      }
+      if (hit_right) {
+        node = n->index + 1;
+        continue;
+      }
+    }
+    if (stack_size == 0) return 0;
+    stack_size--;
+    node = stack[stack_size];
+  }
+  return 0;
+}
+
+float CapsuleHitNormal(CapsuleBVH *b, CapsuleHit *hit, vec3 point,
+    vec3 normal) {
+  CapsulePacket *p = b->packets + hit->packet;
+  vec3 start, axis, offset;
+  float length_squared, along;
+  int i;
+  for (i = 0; i < 3; i++) {
+    start[i] = p->start[i][hit->lane];
+    axis[i] = p->end[i][hit->lane] - start[i];
+  }
+  glm_vec3_sub(point, start, offset);
+  length_squared = glm_vec3_norm2(axis);
+  along = 0;
+  if (length_squared > 0) {
+    along = glm_clamp(glm_vec3_dot(offset, axis) / length_squared, 0, 1);
+  }
+  glm_vec3_muladds(axis, -along, offset);
+  glm_vec3_normalize_to(offset, normal);
+  return along;
+}
@@ -0,0 +1,108 @@
+// A bounding volume hierarchy over the turtle's segments, each treated as a
+// capsule (a cylinder with rounded ends) with the same radius, used by the
+// CPU path tracer. It doesn't use OpenGL.
+//
+// The tree is built using the surface area heuristic, with each node's split
+// chosen from SAH_BINS bins along each axis. Nodes with many segments are
+// split one at a time using every thread to bin and partition them, and the
+// remaining subtrees are then built in parallel, one per thread at a time.
+// Each leaf holds up to LANE_COUNT segments, stored so that a ray can be
+// tested against all of them at once.
+#ifndef CAPSULE_BVH_H
+#define CAPSULE_BVH_H
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "lanes.h"
+
+// The number of bins along each axis used to choose each node's split.
+#define SAH_BINS (16)
+
+// Nodes this deep in the tree are split in half by count rather than using
+// the SAH, so that badly-distributed segments can't make the tree too deep.
+#define BVH_MEDIAN_SPLIT_DEPTH (48)
+
+// The maximum depth of the tree, which bounds the traversal stack.
+#define BVH_MAX_DEPTH (BVH_MEDIAN_SPLIT_DEPTH + 32)
+
+// Nodes with at least this many segments are always split using every
+// thread.
+#define BVH_MIN_PARALLEL_SPLIT (64 * 1024)
+
+typedef struct {
+  float min[3];
+  // For internal nodes, the index of the first of the node's two children,
+  // which are adjacent. For leaves, the index of the leaf's packet.
+  uint32_t index;
+  float max[3];
+  // The number of segments in a leaf, or 0 for internal nodes.
+  uint32_t count;
+} BVHNode;
+
+// The segments in a single leaf, with one segment per lane. Leaves with fewer
+// than LANE_COUNT segments repeat their first one.
+typedef struct {
+  LaneFloats start[3];
+  LaneFloats end[3];
+  uint32_t segments[LANE_COUNT];
+} CapsulePacket;
+
+typedef struct {
+  float radius;
+  // The start and end points of each segment, six floats per segment. Only
+  // kept until the tree is built.
+  float *ends;
+  // The colors at the start and end of each segment, as packed 8-bit RGBA
+  // values with red in the lowest byte.
+  uint32_t *colors;
+  uint32_t segment_count;
+  uint32_t segment_capacity;
+  // The tree. The root is node 0. Only valid after BuildCapsuleBVH succeeds.
+  BVHNode *nodes;
+  uint32_t node_count;
+  CapsulePacket *packets;
+  uint32_t packet_count;
+} CapsuleBVH;
+
+// Where a ray hit a segment.
+typedef struct {
+  // The distance along the ray.
+  float distance;
+  uint32_t segment;
+  // The packet and lane holding the segment.
+  uint32_t packet;
+  uint32_t lane;
+} CapsuleHit;
+
+// Allocates an empty tree whose segments all have the given radius. Returns
+// NULL on error.
+CapsuleBVH* CreateCapsuleBVH(float radius);
+
+// Frees the tree. The pointer is no longer valid after this returns.
+void DestroyCapsuleBVH(CapsuleBVH *b);
+
+// Adds a segment from start to end. Must be called before BuildCapsuleBVH.
+// Returns 0 on error.
+int AddCapsule(CapsuleBVH *b, vec3 start, vec3 end, uint32_t start_color,
+    uint32_t end_color);
+
+// Builds the tree over every segment that was added, using the given number
+// of threads. Returns 0 on error.
+int BuildCapsuleBVH(CapsuleBVH *b, int thread_count);
+
+// Finds the closest segment hit by the ray with the given origin and
+// normalized direction, closer than max_distance. Returns 0 if nothing was
+// hit. Ties are broken in favor of the segment that was added first.
+int IntersectCapsuleBVH(CapsuleBVH *b, vec3 origin, vec3 direction,
+    float max_distance, CapsuleHit *hit);
+
+// Returns nonzero if the ray hits any segment closer than max_distance.
+int CapsuleBVHOccluded(CapsuleBVH *b, vec3 origin, vec3 direction,
+    float max_distance);
+
+// Sets normal to the direction from the hit segment's axis to the given point
+// on its surface. Returns how far along the segment the point is, from 0 at
+// its start to 1 at its end.
+float CapsuleHitNormal(CapsuleBVH *b, CapsuleHit *hit, vec3 point,
+    vec3 normal);
+
+#endif  // CAPSULE_BVH_H
@@ -0,0 +1,20 @@
+#version 330 core
+
+in VS_OUT {
+  vec3 frag_position;
+  vec3 normal;
+  vec4 color;
+} fs_in;
+
+out vec4 frag_color;
+
+//INCLUDE_SHARED_UNIFORMS
+
+void main() {
+  // Light the cylinders from the camera's position, so their sides darken
+  // as they curve away from the viewer.
+  vec3 to_camera = normalize(shared_uniforms.camera_position.xyz -
+    fs_in.frag_position);
+  float diffuse = abs(dot(normalize(fs_in.normal), to_camera));
+  frag_color = vec4(fs_in.color.rgb * (0.3 + 0.7 * diffuse), fs_in.color.a);
+}
@@ -0,0 +1,54 @@
+#version 330 core
+// One vertex of the shared cylinder shape. x and y are the direction away
+// from the cylinder's axis, and z is 0 at the start of the segment and 1 at
+// the end.
+layout (location = 0) in vec3 shape_in;
+// The rest of the inputs are per-instance, one instance per line segment.
+layout (location = 1) in vec3 start_in;
+layout (location = 2) in vec3 end_in;
+layout (location = 3) in vec3 forward_in;
+layout (location = 4) in vec3 up_in;
+layout (location = 5) in vec4 color_in;
+
+uniform mat4 model;
+uniform mat3 normal;
+
+// Added to the location of each vertex to center the overall mesh on 0,0,0.
+uniform vec3 location_offset;
+
+out VS_OUT {
+  vec3 frag_position;
+  vec3 normal;
+  vec4 color;
+} vs_out;
+
+//INCLUDE_SHARED_UNIFORMS
+
+void main() {
+  vec3 start = (model * vec4(start_in + location_offset, 1)).xyz;
+  vec3 end = (model * vec4(end_in + location_offset, 1)).xyz;
+  vec3 forward = normalize(normal * forward_in);
+  vec3 up = normalize(normal * up_in);
+
+  // The turtle's up vector isn't necessarily perpendicular to the segment,
+  // so build a basis around the segment's actual direction.
+  vec3 axis = end - start;
+  if (dot(axis, axis) > 1.0e-12) {
+    forward = normalize(axis);
+  }
+  if (abs(dot(forward, up)) > 0.99) {
+    up = abs(forward.y) < 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+  }
+  vec3 right = normalize(cross(forward, up));
+  up = cross(right, forward);
+
+  float radius = shared_uniforms.geometry_thickness *
+    shared_uniforms.size_scale * 0.5;
+  vec3 outward = shape_in.x * right + shape_in.y * up;
+  vec3 position = mix(start, end, shape_in.z) + radius * outward;
+  gl_Position = shared_uniforms.projection * shared_uniforms.view *
+    vec4(position, 1);
+  vs_out.frag_position = position;
+  vs_out.normal = outward;
+  vs_out.color = color_in;
+}
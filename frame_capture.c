@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_capture.h"
+#include "pixel_readback.h"
+#include "png_writer.h"
+#include "trace.h"
+#include "utilities.h"
+
+// Writes a single frame in the capture's format. Runs on the writer thread.
+// Returns 0 on error.
+static int WriteFrame(FrameCapture *c, CapturedFrame *f) {
+  char path[1024];
+  int64_t row_bytes = ((int64_t) c->width) * 3;
+  // glReadPixels returns the bottom row first.
+  uint8_t *top_row = f->pixels + (c->height - 1) * row_bytes;
+  int y;
+  if (c->format == CAPTURE_FORMAT_RAW) {
+    for (y = 0; y < c->height; y++) {
+      if (fwrite(top_row - y * row_bytes, row_bytes, 1, c->raw_file) != 1) {
+        printf("Failed writing captured frame %d: %s\n", (int) f->frame,
+          strerror(errno));
+        return 0;
+      }
+    }
+    return 1;
+  }
+  snprintf(path, sizeof(path), "%s%06d.png", c->output_prefix,
+    (int) f->frame);
+  return WritePNG(path, top_row, -row_bytes, c->width, c->height, 3);
+}
+
+// The writer thread's main loop. Writes queued frames in order until asked to
+// stop.
+static void* RunWriterThread(void *arg) {
+  FrameCapture *c = (FrameCapture *) arg;
+  CapturedFrame f;
+  double start_time;
+  int result;
+  SetTraceThreadName("Frame capture writer");
+  pthread_mutex_lock(&(c->lock));
+  while (1) {
+    while ((c->frames_written == c->frames_queued) && !c->stop) {
+      pthread_cond_wait(&(c->changed), &(c->lock));
+    }
+    if (c->frames_written == c->frames_queued) break;
+    f = c->queue[c->frames_written % READBACK_SLOTS];
+    pthread_mutex_unlock(&(c->lock));
+    start_time = BeginTraceEvent();
+    result = WriteFrame(c, &f);
+    EndTraceEventArg("Write frame", start_time, "frame", f.frame);
+    pthread_mutex_lock(&(c->lock));
+    if (!result) c->error = 1;
+    c->frames_written++;
+    pthread_cond_broadcast(&(c->changed));
+  }
+  pthread_mutex_unlock(&(c->lock));
+  return NULL;
+}
+
+FrameCapture* CreateFrameCapture(const char *output_prefix,
+    CaptureFormat format, int width, int height) {
+  FrameCapture *c = NULL;
+  char path[1024];
+  c = (FrameCapture *) calloc(1, sizeof(*c));
+  if (!c) {
+    printf("Failed allocating frame capture info.\n");
+    return NULL;
+  }
+  c->format = format;
+  c->width = width;
+  c->height = height;
+  pthread_mutex_init(&(c->lock), NULL);
+  pthread_cond_init(&(c->changed), NULL);
+  c->output_prefix = strdup(output_prefix);
+  if (!c->output_prefix) {
+    printf("Failed copying capture output prefix.\n");
+    DestroyFrameCapture(c);
+    return NULL;
+  }
+  if (format == CAPTURE_FORMAT_RAW) {
+    snprintf(path, sizeof(path), "%s.rgb", output_prefix);
+    c->raw_file = fopen(path, "wb");
+    if (!c->raw_file) {
+      printf("Failed opening %s: %s\n", path, strerror(errno));
+      DestroyFrameCapture(c);
+      return NULL;
+    }
+  }
+  c->readback = CreatePixelReadback(width, height);
+  if (!c->readback) {
+    DestroyFrameCapture(c);
+    return NULL;
+  }
+  if (pthread_create(&(c->writer), NULL, RunWriterThread, c) != 0) {
+    printf("Failed starting the frame capture writer thread.\n");
+    DestroyFrameCapture(c);
+    return NULL;
+  }
+  c->writer_started = 1;
+  c->start_time = CurrentSeconds();
+  c->last_report_time = c->start_time;
+  if (format == CAPTURE_FORMAT_RAW) {
+    printf("Capturing %dx%d raw RGB frames to %s.\n", width, height, path);
+  } else {
+    printf("Capturing %dx%d frames to %s*.png.\n", width, height,
+      output_prefix);
+  }
+  return c;
+}
+
+// Waits for the oldest pending readback, and passes it to the writer thread.
+// Returns 0 on error.
+static int QueueFrame(FrameCapture *c) {
+  CapturedFrame f;
+  f.pixels = WaitPixelReadback(c->readback, &(f.frame));
+  if (!f.pixels) return 0;
+  pthread_mutex_lock(&(c->lock));
+  c->queue[c->frames_queued % READBACK_SLOTS] = f;
+  c->frames_queued++;
+  pthread_cond_broadcast(&(c->changed));
+  pthread_mutex_unlock(&(c->lock));
+  return 1;
+}
+
+// Releases the slots of any frames the writer has finished. If wait is
+// nonzero, blocks until at least one slot has been released. Returns 0 if the
+// writer encountered an error.
+static int ReleaseWrittenFrames(FrameCapture *c, int wait) {
+  uint64_t written;
+  int error;
+  pthread_mutex_lock(&(c->lock));
+  while (wait && (c->frames_written == c->frames_released) && !c->error) {
+    pthread_cond_wait(&(c->changed), &(c->lock));
+  }
+  written = c->frames_written;
+  error = c->error;
+  pthread_mutex_unlock(&(c->lock));
+  while (c->frames_released < written) {
+    ReleasePixelReadback(c->readback);
+    c->frames_released++;
+  }
+  if (error) {
+    printf("Failed writing captured frames.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Prints the number of frames captured per second since the given time.
+static void PrintCaptureRate(FrameCapture *c, uint64_t frames,
+    double since) {
+  double elapsed = CurrentSeconds() - since;
+  if (elapsed <= 0) return;
+  printf("Captured %llu frames at %.02f FPS (%llu render loop stalls so "
+    "far).\n", (unsigned long long) frames, ((double) frames) / elapsed,
+    (unsigned long long) c->stalls);
+}
+
+int CaptureFrame(FrameCapture *c) {
+  double now;
+  if (!ReleaseWrittenFrames(c, 0)) return 0;
+  // Hand every finished readback to the writer without blocking.
+  while (PixelReadbackFinished(c->readback)) {
+    if (!QueueFrame(c)) return 0;
+  }
+  if (!PixelReadbackSlotFree(c->readback)) {
+    c->stalls++;
+    if (PixelReadbackPending(c->readback) && !QueueFrame(c)) return 0;
+    if (!ReleaseWrittenFrames(c, 1)) return 0;
+  }
+  if (!StartPixelReadback(c->readback, c->frames_started)) return 0;
+  c->frames_started++;
+
+  now = CurrentSeconds();
+  if ((now - c->last_report_time) >= CAPTURE_REPORT_INTERVAL) {
+    PrintCaptureRate(c, c->frames_started - c->last_report_frames,
+      c->last_report_time);
+    c->last_report_time = now;
+    c->last_report_frames = c->frames_started;
+  }
+  return 1;
+}
+
+int DestroyFrameCapture(FrameCapture *c) {
+  int to_return = 1;
+  if (!c) return 1;
+  if (c->writer_started) {
+    while (PixelReadbackPending(c->readback)) {
+      if (!QueueFrame(c)) {
+        to_return = 0;
+        break;
+      }
+    }
+    pthread_mutex_lock(&(c->lock));
+    c->stop = 1;
+    pthread_cond_broadcast(&(c->changed));
+    pthread_mutex_unlock(&(c->lock));
+    pthread_join(c->writer, NULL);
+    if (c->error) {
+      printf("Failed writing captured frames.\n");
+      to_return = 0;
+    }
+    printf("Finished capture. ");
+    PrintCaptureRate(c, c->frames_started, c->start_time);
+  }
+  DestroyPixelReadback(c->readback);
+  if (c->raw_file && (fclose(c->raw_file) != 0)) {
+    printf("Failed closing raw capture file: %s\n", strerror(errno));
+    to_return = 0;
+  }
+  free(c->output_prefix);
+  pthread_mutex_destroy(&(c->lock));
+  pthread_cond_destroy(&(c->changed));
+  memset(c, 0, sizeof(*c));
+  free(c);
+  return to_return;
+}
@@ -0,0 +1,76 @@
+// Saves every frame drawn in the window to disk without stalling the render
+// loop. Each frame is copied into a pixel readback slot, and once the copy
+// has finished (usually a frame or two later), a writer thread encodes it and
+// writes it to disk while rendering continues. The render loop only waits if
+// the writer falls behind by more than READBACK_SLOTS frames.
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pixel_readback.h"
+
+// The number of seconds between printing the capture's frame rate.
+#define CAPTURE_REPORT_INTERVAL (5.0)
+
+typedef enum {
+  // Writes each frame to a separate PNG file.
+  CAPTURE_FORMAT_PNG = 0,
+  // Appends every frame to a single file of raw 8-bit RGB pixels, with the
+  // top row of each frame first.
+  CAPTURE_FORMAT_RAW,
+} CaptureFormat;
+
+// A frame that's been read back and is waiting for the writer thread.
+typedef struct {
+  uint8_t *pixels;
+  int64_t frame;
+} CapturedFrame;
+
+typedef struct {
+  PixelReadback *readback;
+  CaptureFormat format;
+  char *output_prefix;
+  // The file that raw frames are appended to.
+  FILE *raw_file;
+  int width;
+  int height;
+  // The number of frames passed to StartPixelReadback, and the number whose
+  // slots have been released after being written.
+  uint64_t frames_started;
+  uint64_t frames_released;
+  // The number of times the render loop had to wait for a free slot.
+  uint64_t stalls;
+  double start_time;
+  double last_report_time;
+  uint64_t last_report_frames;
+  pthread_t writer;
+  int writer_started;
+  // Everything below is protected by the lock.
+  pthread_mutex_t lock;
+  // Signaled when a frame is queued, a frame is written, or the writer needs
+  // to stop.
+  pthread_cond_t changed;
+  CapturedFrame queue[READBACK_SLOTS];
+  uint64_t frames_queued;
+  uint64_t frames_written;
+  int stop;
+  int error;
+} FrameCapture;
+
+// Starts capturing frames of the given size. Output files are named using
+// the given prefix: <prefix>000000.png, <prefix>000001.png, etc., or
+// <prefix>.rgb for raw frames. Returns NULL on error.
+FrameCapture* CreateFrameCapture(const char *output_prefix,
+    CaptureFormat format, int width, int height);
+
+// Writes any remaining frames, stops the writer thread, prints the capture's
+// statistics, and frees the capture. The pointer is no longer valid after
+// this returns. Returns 0 if an error occurred while writing any frame.
+int DestroyFrameCapture(FrameCapture *c);
+
+// Starts reading back the current frame from the read framebuffer. Must be
+// called after drawing, before swapping buffers. Returns 0 on error.
+int CaptureFrame(FrameCapture *c);
+
+#endif  // FRAME_CAPTURE_H
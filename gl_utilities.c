@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <glad/glad.h>
+#include "gl_utilities.h"
+
+static void PrintGLErrorString(GLenum error) {
+  switch (error) {
+  case GL_NO_ERROR:
+    printf("No OpenGL error");
+    return;
+  case GL_INVALID_ENUM:
+    printf("Invalid enum");
+    return;
+  case GL_INVALID_VALUE:
+    printf("Invalid value");
+    return;
+  case GL_INVALID_OPERATION:
+    printf("Invalid operation");
+    return;
+  // GL_STACK_OVERFLOW is undefined; bug in GLAD
+  case 0x503:
+    printf("Stack overflow");
+    return;
+  // GL_STACK_UNDERFLOW is undefined; bug in GLAD
+  case 0x504:
+    printf("Stack underflow");
+    return;
+  case GL_OUT_OF_MEMORY:
+    printf("Out of memory");
+    return;
+  default:
+    break;
+  }
+  printf("Unknown OpenGL error: %d", (int) error);
+}
+
+int CheckGLErrors(void) {
+  GLenum error = glGetError();
+  if (error == GL_NO_ERROR) return 1;
+  while (error != GL_NO_ERROR) {
+    printf("Got OpenGL error: ");
+    PrintGLErrorString(error);
+    printf("\n");
+    error = glGetError();
+  }
+  return 0;
+}
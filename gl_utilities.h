@@ -0,0 +1,15 @@
+// Helpers that need OpenGL. Everything in utilities.h is usable without it.
+#ifndef GL_UTILITIES_H
+#define GL_UTILITIES_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns 0 if any OpenGL errors are detected. Otherwise, prints the errors
+// and returns nonzero.
+int CheckGLErrors(void);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // GL_UTILITIES_H
@@ -0,0 +1,713 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cglm/cglm.h>
+#include "adaptive_expansion.h"
+#include "gltf_writer.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// The size of each vertex in the file: a float position and an RGBA color.
+#define GLTF_VERTEX_SIZE (3 * sizeof(float) + 4)
+
+// glTF constants for component types and buffer targets.
+#define GLTF_FLOAT (5126)
+#define GLTF_UNSIGNED_BYTE (5121)
+#define GLTF_ARRAY_BUFFER (34962)
+#define GLTF_LINES (1)
+
+// Adds two segment counts, saturating rather than overflowing.
+static uint64_t AddCounts(uint64_t a, uint64_t b) {
+  if ((UINT64_MAX - a) < b) return UINT64_MAX;
+  return a + b;
+}
+
+// Fills in the number of segments drawn by every symbol at every depth up to
+// and including the given one.
+static void CountSegments(GLTFWriter *w, uint32_t depth) {
+  LSystemConfig *config = w->expander->config;
+  ReplacementRule *r = NULL;
+  ActionRule *a = NULL;
+  uint64_t count;
+  uint32_t d;
+  int c, i;
+  for (c = 0; c < 128; c++) {
+    a = config->actions + c;
+    count = 0;
+    for (i = 0; i < a->length; i++) {
+      if (a->instructions[i] == MoveTurtleForward) count++;
+    }
+    w->segment_counts[0][c] = count;
+  }
+  for (d = 1; d <= depth; d++) {
+    for (c = 0; c < 128; c++) {
+      r = config->replacements + c;
+      if (!r->used) {
+        w->segment_counts[d][c] = w->segment_counts[0][c];
+        continue;
+      }
+      count = 0;
+      for (i = 0; i < r->length; i++) {
+        count = AddCounts(count,
+          w->segment_counts[d - 1][(uint8_t) r->replacement[i]]);
+      }
+      w->segment_counts[d][c] = count;
+    }
+  }
+}
+
+// Writes the stream's data to its file. Returns 0 on error.
+static int FlushVertexStream(GLTFVertexStream *s) {
+  if (!s->f || (s->size == 0)) return 1;
+  if (fwrite(s->data, s->size, 1, s->f) != 1) {
+    printf("Failed writing glTF vertices: %s\n", strerror(errno));
+    return 0;
+  }
+  s->size = 0;
+  return 1;
+}
+
+// Makes sure there's space for at least size more bytes in the stream,
+// either by writing it to its file or by growing it. Returns 0 on error.
+static int ReserveVertexStream(GLTFVertexStream *s, size_t size) {
+  size_t new_capacity;
+  uint8_t *new_data = NULL;
+  if ((s->size + size) <= s->capacity) return 1;
+  if (s->f) {
+    if (!FlushVertexStream(s)) return 0;
+    if (size <= s->capacity) return 1;
+  }
+  new_capacity = s->capacity ? s->capacity * 2 : (64 * 1024);
+  while (new_capacity < (s->size + size)) new_capacity *= 2;
+  new_data = (uint8_t *) realloc(s->data, new_capacity);
+  if (!new_data) {
+    printf("Failed allocating %llu bytes of glTF vertices.\n",
+      (unsigned long long) new_capacity);
+    return 0;
+  }
+  s->data = new_data;
+  s->capacity = new_capacity;
+  return 1;
+}
+
+// Empties the stream, without freeing its buffer.
+static void ResetVertexStream(GLTFVertexStream *s) {
+  s->size = 0;
+  s->vertex_count = 0;
+  glm_vec3_zero(s->min_bounds);
+  glm_vec3_zero(s->max_bounds);
+  s->inherited_color = 0;
+}
+
+static uint8_t ColorByte(float v) {
+  if (v < 0) v = 0;
+  if (v > 1) v = 1;
+  return (uint8_t) (v * 255.0 + 0.5);
+}
+
+// Converts the turtle's vertices and adds them to the GLTFVertexStream. The
+// arguments match a TurtleVertexSink. Returns 0 on error.
+static int WriteGLTFVertices(void *stream, MeshVertex *vertices,
+    uint32_t count) {
+  GLTFVertexStream *s = (GLTFVertexStream *) stream;
+  MeshVertex *v = NULL;
+  uint8_t *dst = NULL;
+  uint32_t i;
+  int j;
+  for (i = 0; i < count; i++) {
+    if (!ReserveVertexStream(s, GLTF_VERTEX_SIZE)) return 0;
+    v = vertices + i;
+    dst = s->data + s->size;
+    memcpy(dst, v->location, 3 * sizeof(float));
+    for (j = 0; j < 4; j++) {
+      if (v->color[j] < 0) s->inherited_color = 1;
+      dst[3 * sizeof(float) + j] = ColorByte(v->color[j]);
+    }
+    s->size += GLTF_VERTEX_SIZE;
+    if (s->vertex_count == 0) {
+      glm_vec3_copy(v->location, s->min_bounds);
+      glm_vec3_copy(v->location, s->max_bounds);
+    } else {
+      glm_vec3_minv(s->min_bounds, v->location, s->min_bounds);
+      glm_vec3_maxv(s->max_bounds, v->location, s->max_bounds);
+    }
+    s->vertex_count++;
+  }
+  return 1;
+}
+
+// Runs the actions for a single character. Returns 0 on error.
+static int RunActions(LSystemConfig *config, Turtle3D *t, uint8_t c) {
+  ActionRule *r = config->actions + c;
+  int i;
+  for (i = 0; i < r->length; i++) {
+    if (!r->instructions[i](t, r->args[i])) {
+      printf("Failed running instruction %d for char %c.\n", i, (char) c);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int CheckInstance(GLTFWriter *w, Turtle3D *t, uint8_t c,
+    uint32_t depth, int *instanced);
+
+// Runs the turtle over the symbol expanded to the given depth. If instancing
+// is nonzero, subtrees that can be instanced are skipped over and recorded
+// as instances instead of being drawn. Returns 0 on error.
+static int ExpandSymbol(GLTFWriter *w, Turtle3D *t, uint8_t c,
+    uint32_t depth, int instancing) {
+  ReplacementRule *r = w->expander->config->replacements + c;
+  int i, instanced = 0;
+  if ((depth == 0) || !r->used) {
+    return RunActions(w->expander->config, t, c);
+  }
+  if (instancing) {
+    if (!CheckInstance(w, t, c, depth, &instanced)) return 0;
+    if (instanced) return 1;
+  }
+  for (i = 0; i < r->length; i++) {
+    if (!ExpandSymbol(w, t, r->replacement[i], depth - 1, instancing)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Packs the color into the bytes of an integer, as it will be written.
+static uint32_t PackColor(vec4 color) {
+  uint32_t to_return = 0;
+  int i;
+  for (i = 0; i < 4; i++) {
+    to_return |= ((uint32_t) ColorByte(color[i])) << (i * 8);
+  }
+  return to_return;
+}
+
+// Runs the scratch turtle over the symbol expanded to the given depth,
+// starting from its initial position and orientation with the given color,
+// and collects the vertices in mesh_vertices. Returns 0 on error.
+static int GenerateMesh(GLTFWriter *w, uint8_t c, uint32_t depth,
+    vec4 color) {
+  GLTFVertexStream *s = &(w->mesh_vertices);
+  Turtle3D *t = w->scratch;
+  int result;
+  ResetVertexStream(s);
+  ResetTurtle3D(t);
+  glm_vec4_copy(color, t->color);
+  SetTurtleVertexSink(t, WriteGLTFVertices, s);
+  result = ExpandSymbol(w, t, c, depth, 0) && FlushTurtleVertices(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  return result;
+}
+
+// Generates a mesh for the symbol expanded to the given depth, when starting
+// with the given color, and adds it to the list of meshes for the symbol and
+// depth. Sets *index to the new mesh's index, or -1 if the symbol can't be
+// instanced. Returns 0 on error.
+static int CreateMesh(GLTFWriter *w, uint8_t c, uint32_t depth,
+    vec4 entry_color, int32_t *index) {
+  GLTFVertexStream *s = &(w->mesh_vertices);
+  GLTFMesh *new_meshes = NULL;
+  GLTFMesh *m = NULL;
+  vec4 unknown_color;
+  int32_t last;
+  int inherits_color = 1;
+  *index = -1;
+  if (w->mesh_indices[depth][c] == GLTF_MESH_UNKNOWN) {
+    // Any segment drawn before the symbol sets the color will be negative.
+    glm_vec4_broadcast(-1.0, unknown_color);
+    if (!GenerateMesh(w, c, depth, unknown_color)) return 0;
+    if (s->vertex_count == 0) {
+      w->mesh_indices[depth][c] = -1;
+      return 1;
+    }
+    inherits_color = s->inherited_color;
+  }
+  if (inherits_color && !GenerateMesh(w, c, depth, entry_color)) return 0;
+  if (w->mesh_count >= w->mesh_capacity) {
+    w->mesh_capacity = w->mesh_capacity ? w->mesh_capacity * 2 : 16;
+    new_meshes = (GLTFMesh *) realloc(w->meshes, w->mesh_capacity *
+      sizeof(GLTFMesh));
+    if (!new_meshes) {
+      printf("Failed allocating glTF mesh list.\n");
+      return 0;
+    }
+    w->meshes = new_meshes;
+  }
+  if (fwrite(s->data, s->size, 1, w->meshes_file) != 1) {
+    printf("Failed writing glTF mesh to temporary file: %s\n",
+      strerror(errno));
+    return 0;
+  }
+  m = w->meshes + w->mesh_count;
+  memset(m, 0, sizeof(*m));
+  m->symbol = c;
+  m->depth = depth;
+  m->inherits_color = inherits_color;
+  if (inherits_color) m->entry_color = PackColor(entry_color);
+  m->next = -1;
+  m->vertex_count = s->vertex_count;
+  glm_vec3_copy(s->min_bounds, m->min_bounds);
+  glm_vec3_copy(s->max_bounds, m->max_bounds);
+  m->offset = w->meshes_size;
+  w->meshes_size += s->size;
+  // Append the mesh to the end of the symbol's list.
+  last = w->mesh_indices[depth][c];
+  if (last < 0) {
+    w->mesh_indices[depth][c] = w->mesh_count;
+  } else {
+    while (w->meshes[last].next >= 0) last = w->meshes[last].next;
+    w->meshes[last].next = w->mesh_count;
+  }
+  *index = w->mesh_count;
+  w->mesh_count++;
+  return 1;
+}
+
+// Sets *index to the mesh for the symbol at the given depth, starting with
+// the turtle's current color, creating it if needed, or to -1 if the symbol
+// can't be instanced. Returns 0 on error.
+static int FindMesh(GLTFWriter *w, Turtle3D *t, uint8_t c, uint32_t depth,
+    int32_t *index) {
+  uint32_t color = PackColor(t->color);
+  int32_t i = w->mesh_indices[depth][c];
+  GLTFMesh *m = NULL;
+  *index = -1;
+  if (i == -1) return 1;
+  while (i >= 0) {
+    m = w->meshes + i;
+    if (!m->inherits_color || (m->entry_color == color)) {
+      *index = i;
+      return 1;
+    }
+    i = m->next;
+  }
+  return CreateMesh(w, c, depth, t->color, index);
+}
+
+// Adds an instance of the given mesh at the turtle's current position and
+// orientation. Returns 0 on error.
+static int AddInstance(GLTFWriter *w, Turtle3D *t, uint32_t mesh) {
+  GLTFInstance *new_instances = NULL;
+  GLTFInstance *instance = NULL;
+  mat4 rotation;
+  if (w->instance_count >= w->instance_capacity) {
+    w->instance_capacity = w->instance_capacity ?
+      w->instance_capacity * 2 : 1024;
+    new_instances = (GLTFInstance *) realloc(w->instances,
+      w->instance_capacity * sizeof(GLTFInstance));
+    if (!new_instances) {
+      printf("Failed allocating glTF instance list.\n");
+      return 0;
+    }
+    w->instances = new_instances;
+  }
+  instance = w->instances + w->instance_count;
+  instance->mesh = mesh;
+  glm_vec3_copy(t->p.position, instance->translation);
+  // The mesh's x, y, and z axes map to the turtle's forward, up, and right
+  // vectors.
+  glm_mat4_identity(rotation);
+  glm_vec3_copy(t->p.forward, rotation[0]);
+  glm_vec3_copy(t->p.up, rotation[1]);
+  glm_vec3_cross(t->p.forward, t->p.up, rotation[2]);
+  glm_mat4_quat(rotation, instance->rotation);
+  glm_quat_normalize(instance->rotation);
+  w->meshes[mesh].instance_count++;
+  w->instance_count++;
+  return 1;
+}
+
+// Checks whether the symbol, at the given depth, should be instanced. If so,
+// records the instance, moves the turtle past the symbol without drawing
+// anything, and sets *instanced to 1. Returns 0 on error.
+static int CheckInstance(GLTFWriter *w, Turtle3D *t, uint8_t c,
+    uint32_t depth, int *instanced) {
+  SymbolModel *m = w->expander->models[depth] + c;
+  uint64_t segments = w->segment_counts[depth][c];
+  int32_t index;
+  *instanced = 0;
+  if (!m->valid || !m->draws) return 1;
+  if ((segments < GLTF_MIN_INSTANCE_SEGMENTS) ||
+    (segments > GLTF_MAX_INSTANCE_SEGMENTS)) {
+    return 1;
+  }
+  if (!FindMesh(w, t, c, depth, &index)) return 0;
+  if (index < 0) return 1;
+  if (!AddInstance(w, t, index)) return 0;
+  if (!ApplySymbolModel(t, m, 0)) return 0;
+  *instanced = 1;
+  return 1;
+}
+
+// Sorts the instances by mesh, and sets each mesh's first_instance. Returns 0
+// on error.
+static int SortInstances(GLTFWriter *w) {
+  GLTFInstance *sorted = NULL;
+  GLTFMesh *m = NULL;
+  uint64_t i, next = 0;
+  uint32_t j;
+  if (w->instance_count == 0) return 1;
+  sorted = (GLTFInstance *) calloc(w->instance_count, sizeof(GLTFInstance));
+  if (!sorted) {
+    printf("Failed allocating sorted glTF instances.\n");
+    return 0;
+  }
+  for (j = 0; j < w->mesh_count; j++) {
+    w->meshes[j].first_instance = next;
+    next += w->meshes[j].instance_count;
+    // Used as the insertion cursor below; restored afterwards.
+    w->meshes[j].instance_count = 0;
+  }
+  for (i = 0; i < w->instance_count; i++) {
+    m = w->meshes + w->instances[i].mesh;
+    sorted[m->first_instance + m->instance_count] = w->instances[i];
+    m->instance_count++;
+  }
+  free(w->instances);
+  w->instances = sorted;
+  w->instance_capacity = w->instance_count;
+  return 1;
+}
+
+// Appends the temporary file holding the meshes to the .bin file. Returns 0
+// on error.
+static int CopyMeshes(GLTFWriter *w) {
+  uint8_t *buffer = NULL;
+  size_t size;
+  int to_return = 1;
+  if (w->meshes_size == 0) return 1;
+  buffer = (uint8_t *) malloc(GLTF_BUFFER_SIZE);
+  if (!buffer) {
+    printf("Failed allocating buffer for copying glTF meshes.\n");
+    return 0;
+  }
+  rewind(w->meshes_file);
+  while ((size = fread(buffer, 1, GLTF_BUFFER_SIZE, w->meshes_file)) > 0) {
+    if (fwrite(buffer, size, 1, w->bin) != 1) {
+      to_return = 0;
+      break;
+    }
+  }
+  if (ferror(w->meshes_file)) to_return = 0;
+  if (!to_return) printf("Failed copying glTF meshes: %s\n", strerror(errno));
+  free(buffer);
+  return to_return;
+}
+
+// Writes every instance's translation, followed by every instance's rotation,
+// to the .bin file, for EXT_mesh_gpu_instancing. Returns 0 on error.
+static int WriteInstanceTransforms(GLTFWriter *w) {
+  uint64_t i;
+  for (i = 0; i < w->instance_count; i++) {
+    if (fwrite(w->instances[i].translation, 3 * sizeof(float), 1, w->bin)
+      != 1) {
+      return 0;
+    }
+  }
+  for (i = 0; i < w->instance_count; i++) {
+    if (fwrite(w->instances[i].rotation, 4 * sizeof(float), 1, w->bin) != 1) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Writes a comma before every item in a JSON list but the first.
+static void WriteSeparator(FILE *f, uint64_t index) {
+  if (index > 0) fprintf(f, ",");
+}
+
+// Writes the POSITION and COLOR_0 accessors for a mesh whose vertices start
+// at the given offset in the vertex buffer view.
+static void WriteVertexAccessors(FILE *f, uint64_t offset, uint64_t count,
+    vec3 min, vec3 max) {
+  fprintf(f, "{\"bufferView\":0,\"byteOffset\":%llu,\"componentType\":%d,"
+    "\"count\":%llu,\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],"
+    "\"max\":[%.9g,%.9g,%.9g]},", (unsigned long long) offset, GLTF_FLOAT,
+    (unsigned long long) count, min[0], min[1], min[2], max[0], max[1],
+    max[2]);
+  fprintf(f, "{\"bufferView\":0,\"byteOffset\":%llu,\"componentType\":%d,"
+    "\"normalized\":true,\"count\":%llu,\"type\":\"VEC4\"}",
+    (unsigned long long) (offset + 3 * sizeof(float)), GLTF_UNSIGNED_BYTE,
+    (unsigned long long) count);
+}
+
+// Writes the .gltf file's JSON. The .bin file must already be complete.
+// Returns 0 on error.
+static int WriteJSON(GLTFWriter *w, const char *path) {
+  FILE *f = NULL;
+  GLTFMesh *m = NULL;
+  GLTFInstance *instance = NULL;
+  int has_base = w->base_vertices.vertex_count > 0;
+  int extension = (w->instancing == GLTF_INSTANCING_EXTENSION) &&
+    (w->instance_count > 0);
+  uint64_t base_size = w->base_vertices.vertex_count * GLTF_VERTEX_SIZE;
+  uint64_t vertex_size = base_size + w->meshes_size;
+  uint64_t translation_size = 0, rotation_size = 0;
+  uint64_t node_count, i;
+  uint32_t j, accessor;
+  int result;
+  if (extension) {
+    translation_size = w->instance_count * 3 * sizeof(float);
+    rotation_size = w->instance_count * 4 * sizeof(float);
+  }
+  node_count = has_base;
+  if (extension) {
+    node_count += w->mesh_count;
+  } else {
+    node_count += w->instance_count;
+  }
+  f = fopen(path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  fprintf(f, "{\"asset\":{\"version\":\"2.0\",\"generator\":\"l_system_3d\"}");
+  if (extension) {
+    fprintf(f, ",\"extensionsUsed\":[\"EXT_mesh_gpu_instancing\"],"
+      "\"extensionsRequired\":[\"EXT_mesh_gpu_instancing\"]");
+  }
+  fprintf(f, ",\"scene\":0,\"scenes\":[{");
+  if (node_count > 0) {
+    fprintf(f, "\"nodes\":[");
+    for (i = 0; i < node_count; i++) {
+      WriteSeparator(f, i);
+      fprintf(f, "%llu", (unsigned long long) i);
+    }
+    fprintf(f, "]");
+  }
+  fprintf(f, "}]");
+  if (vertex_size == 0) goto done;
+
+  fprintf(f, ",\"nodes\":[");
+  if (has_base) fprintf(f, "{\"mesh\":0}");
+  for (j = 0; j < w->mesh_count; j++) {
+    m = w->meshes + j;
+    if (extension) {
+      WriteSeparator(f, has_base + j);
+      accessor = 2 * (has_base + w->mesh_count) + 2 * j;
+      fprintf(f, "{\"mesh\":%u,\"extensions\":{\"EXT_mesh_gpu_instancing\":"
+        "{\"attributes\":{\"TRANSLATION\":%u,\"ROTATION\":%u}}}}",
+        (unsigned) (has_base + j), (unsigned) accessor,
+        (unsigned) (accessor + 1));
+      continue;
+    }
+    for (i = 0; i < m->instance_count; i++) {
+      instance = w->instances + m->first_instance + i;
+      WriteSeparator(f, has_base + m->first_instance + i);
+      fprintf(f, "{\"mesh\":%u,\"translation\":[%.9g,%.9g,%.9g],"
+        "\"rotation\":[%.9g,%.9g,%.9g,%.9g]}", (unsigned) (has_base + j),
+        instance->translation[0], instance->translation[1],
+        instance->translation[2], instance->rotation[0],
+        instance->rotation[1], instance->rotation[2], instance->rotation[3]);
+    }
+  }
+  fprintf(f, "]");
+
+  fprintf(f, ",\"meshes\":[");
+  for (j = 0; j < (has_base + w->mesh_count); j++) {
+    WriteSeparator(f, j);
+    fprintf(f, "{\"primitives\":[{\"attributes\":{\"POSITION\":%u,"
+      "\"COLOR_0\":%u},\"mode\":%d}]}", (unsigned) (2 * j),
+      (unsigned) (2 * j + 1), GLTF_LINES);
+  }
+  fprintf(f, "]");
+
+  fprintf(f, ",\"buffers\":[{\"uri\":\"%s\",\"byteLength\":%llu}]",
+    w->bin_uri, (unsigned long long) (vertex_size + translation_size +
+    rotation_size));
+  fprintf(f, ",\"bufferViews\":[{\"buffer\":0,\"byteLength\":%llu,"
+    "\"byteStride\":%d,\"target\":%d}", (unsigned long long) vertex_size,
+    (int) GLTF_VERTEX_SIZE, GLTF_ARRAY_BUFFER);
+  if (extension) {
+    fprintf(f, ",{\"buffer\":0,\"byteOffset\":%llu,\"byteLength\":%llu}",
+      (unsigned long long) vertex_size, (unsigned long long) translation_size);
+    fprintf(f, ",{\"buffer\":0,\"byteOffset\":%llu,\"byteLength\":%llu}",
+      (unsigned long long) (vertex_size + translation_size),
+      (unsigned long long) rotation_size);
+  }
+  fprintf(f, "]");
+
+  fprintf(f, ",\"accessors\":[");
+  if (has_base) {
+    WriteVertexAccessors(f, 0, w->base_vertices.vertex_count,
+      w->base_vertices.min_bounds, w->base_vertices.max_bounds);
+  }
+  for (j = 0; j < w->mesh_count; j++) {
+    m = w->meshes + j;
+    WriteSeparator(f, has_base + j);
+    WriteVertexAccessors(f, base_size + m->offset, m->vertex_count,
+      m->min_bounds, m->max_bounds);
+  }
+  for (j = 0; extension && (j < w->mesh_count); j++) {
+    m = w->meshes + j;
+    fprintf(f, ",{\"bufferView\":1,\"byteOffset\":%llu,\"componentType\":%d,"
+      "\"count\":%llu,\"type\":\"VEC3\"}",
+      (unsigned long long) (m->first_instance * 3 * sizeof(float)),
+      GLTF_FLOAT, (unsigned long long) m->instance_count);
+    fprintf(f, ",{\"bufferView\":2,\"byteOffset\":%llu,\"componentType\":%d,"
+      "\"count\":%llu,\"type\":\"VEC4\"}",
+      (unsigned long long) (m->first_instance * 4 * sizeof(float)),
+      GLTF_FLOAT, (unsigned long long) m->instance_count);
+  }
+  fprintf(f, "]");
+
+done:
+  fprintf(f, "}\n");
+  result = !ferror(f);
+  if (fclose(f) != 0) result = 0;
+  if (!result) printf("Failed writing %s: %s\n", path, strerror(errno));
+  return result;
+}
+
+// Picks the .bin file's path, replacing the .gltf extension if there is one,
+// and its name relative to the .gltf file. Returns 0 on error.
+static int SetBinPath(GLTFWriter *w, const char *path) {
+  size_t length = strlen(path);
+  const char *c = NULL;
+  if ((length >= 5) && (strcmp(path + length - 5, ".gltf") == 0)) {
+    length -= 5;
+  }
+  w->bin_path = (char *) calloc(1, length + 5);
+  if (!w->bin_path) {
+    printf("Failed allocating .bin path.\n");
+    return 0;
+  }
+  memcpy(w->bin_path, path, length);
+  memcpy(w->bin_path + length, ".bin", 4);
+  w->bin_uri = w->bin_path;
+  for (c = w->bin_path; *c; c++) {
+    if ((*c == '/') || (*c == '\\')) w->bin_uri = c + 1;
+  }
+  return 1;
+}
+
+static void DestroyGLTFWriter(GLTFWriter *w) {
+  if (!w) return;
+  if (w->bin) fclose(w->bin);
+  if (w->meshes_file) fclose(w->meshes_file);
+  DestroyTurtle3D(w->turtle);
+  DestroyTurtle3D(w->scratch);
+  free(w->base_vertices.data);
+  free(w->mesh_vertices.data);
+  free(w->meshes);
+  free(w->instances);
+  free(w->bin_path);
+  memset(w, 0, sizeof(*w));
+  free(w);
+}
+
+// Allocates the writer and opens its files. Returns NULL on error.
+static GLTFWriter* CreateGLTFWriter(AdaptiveExpander *e, const char *path,
+    GLTFInstancing instancing) {
+  GLTFWriter *w = NULL;
+  uint32_t d, c;
+  w = (GLTFWriter *) calloc(1, sizeof(*w));
+  if (!w) {
+    printf("Failed allocating glTF writer.\n");
+    return NULL;
+  }
+  w->expander = e;
+  w->instancing = instancing;
+  for (d = 0; d <= ADAPTIVE_MAX_DEPTH; d++) {
+    for (c = 0; c < 128; c++) {
+      w->mesh_indices[d][c] = GLTF_MESH_UNKNOWN;
+    }
+  }
+  w->turtle = CreateTurtle3D();
+  w->scratch = CreateTurtle3D();
+  w->base_vertices.data = (uint8_t *) malloc(GLTF_BUFFER_SIZE);
+  if (!w->turtle || !w->scratch || !w->base_vertices.data) {
+    printf("Failed allocating glTF writer state.\n");
+    DestroyGLTFWriter(w);
+    return NULL;
+  }
+  w->base_vertices.capacity = GLTF_BUFFER_SIZE;
+  if (!SetBinPath(w, path)) {
+    DestroyGLTFWriter(w);
+    return NULL;
+  }
+  w->bin = fopen(w->bin_path, "wb");
+  if (!w->bin) {
+    printf("Failed opening %s: %s\n", w->bin_path, strerror(errno));
+    DestroyGLTFWriter(w);
+    return NULL;
+  }
+  w->base_vertices.f = w->bin;
+  w->meshes_file = tmpfile();
+  if (!w->meshes_file) {
+    printf("Failed creating temporary file for glTF meshes: %s\n",
+      strerror(errno));
+    DestroyGLTFWriter(w);
+    return NULL;
+  }
+  return w;
+}
+
+int WriteGLTF(AdaptiveExpander *e, uint32_t depth, const char *path,
+    GLTFInstancing instancing, GLTFStats *stats) {
+  GLTFWriter *w = NULL;
+  Turtle3D *t = NULL;
+  const char *init = e->config->init;
+  uint16_t endian_test = 1;
+  uint64_t stored_vertices;
+  uint32_t j;
+  int result;
+  if (*((uint8_t *) &endian_test) == 0) {
+    printf("glTF files can only be written on little-endian machines.\n");
+    return 0;
+  }
+  if (depth > ADAPTIVE_MAX_DEPTH) {
+    printf("Can't write glTF files for more than %d iterations.\n",
+      ADAPTIVE_MAX_DEPTH);
+    return 0;
+  }
+  w = CreateGLTFWriter(e, path, instancing);
+  if (!w) return 0;
+  if (instancing != GLTF_INSTANCING_OFF) {
+    ComputeSymbolModels(e, depth);
+    CountSegments(w, depth);
+  }
+  t = w->turtle;
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, WriteGLTFVertices, &(w->base_vertices));
+  result = 1;
+  for (; result && *init; init++) {
+    result = ExpandSymbol(w, t, *init, depth,
+      instancing != GLTF_INSTANCING_OFF);
+  }
+  result = result && FlushTurtleVertices(t) &&
+    FlushVertexStream(&(w->base_vertices)) && CopyMeshes(w) &&
+    SortInstances(w);
+  SetTurtleVertexSink(t, NULL, NULL);
+  if (result && (instancing == GLTF_INSTANCING_EXTENSION) &&
+    !WriteInstanceTransforms(w)) {
+    printf("Failed writing glTF instances: %s\n", strerror(errno));
+    result = 0;
+  }
+  if (result && (fclose(w->bin) != 0)) {
+    printf("Failed closing %s: %s\n", w->bin_path, strerror(errno));
+    result = 0;
+  }
+  w->bin = NULL;
+  result = result && WriteJSON(w, path);
+  if (result && stats) {
+    memset(stats, 0, sizeof(*stats));
+    stored_vertices = w->base_vertices.vertex_count;
+    stats->segment_count = w->base_vertices.vertex_count / 2;
+    for (j = 0; j < w->mesh_count; j++) {
+      stored_vertices += w->meshes[j].vertex_count;
+      stats->segment_count += (w->meshes[j].vertex_count / 2) *
+        w->meshes[j].instance_count;
+    }
+    stats->stored_segment_count = stored_vertices / 2;
+    stats->mesh_count = w->mesh_count;
+    stats->instance_count = w->instance_count;
+  }
+  DestroyGLTFWriter(w);
+  return result;
+}
@@ -0,0 +1,153 @@
+// Writes the turtle's segments to a glTF 2.0 file, as line primitives with
+// per-vertex colors, so they can be loaded by other programs. It doesn't use
+// OpenGL.
+//
+// L-systems repeat themselves, so rather than writing every segment, large
+// subtrees are written once as their own mesh, in the turtle's coordinates
+// when starting from its initial position and orientation, and every place
+// the subtree occurs is written as a rotation and translation of that mesh.
+// A subtree is identified by its symbol and remaining expansion depth, whose
+// geometry is always the same up to the turtle's position and orientation,
+// as long as it has a valid SymbolModel (i.e. it doesn't pop anything it
+// didn't push). The segments' colors may also depend on the turtle's color
+// from before the subtree started, so subtrees that don't set the color of
+// every segment they draw get a separate mesh for every starting color.
+// Occurrences are either
+// written as one node each, which every glTF loader supports, or as a single
+// node per mesh using the EXT_mesh_gpu_instancing extension. Everything that
+// isn't instanced is written to a single mesh.
+//
+// The JSON is written to the given .gltf path, and the vertices and instance
+// transforms to a .bin file next to it. Vertices are written as they're
+// generated, so memory use only depends on the number of instances.
+#ifndef GLTF_WRITER_H
+#define GLTF_WRITER_H
+#include <stdint.h>
+#include <stdio.h>
+#include <cglm/cglm.h>
+#include "adaptive_expansion.h"
+#include "mesh_vertex.h"
+#include "turtle_3d.h"
+
+// Subtrees drawing fewer segments than this are never instanced, since a node
+// per occurrence would take more space than the segments themselves.
+#define GLTF_MIN_INSTANCE_SEGMENTS (256)
+
+// Subtrees drawing more segments than this are split into smaller subtrees
+// instead of being instanced, so that each mesh can be generated in memory.
+#define GLTF_MAX_INSTANCE_SEGMENTS (64 * 1024)
+
+// Marks symbols and depths that haven't been checked for instancing yet.
+#define GLTF_MESH_UNKNOWN (-2)
+
+// The number of bytes of vertices buffered before writing them to the file.
+#define GLTF_BUFFER_SIZE (4 * 1024 * 1024)
+
+typedef enum {
+  // Writes a node with its own transform for every occurrence of a subtree.
+  GLTF_INSTANCING_NODES = 0,
+  // Writes a single node per subtree using EXT_mesh_gpu_instancing.
+  GLTF_INSTANCING_EXTENSION,
+  // Writes every segment in a single mesh, without detecting subtrees.
+  GLTF_INSTANCING_OFF,
+} GLTFInstancing;
+
+// Receives vertices from a turtle, and converts them to the file's vertex
+// format: a float position followed by an 8-bit RGBA color.
+typedef struct {
+  // If this isn't NULL, the data is written to it whenever it exceeds
+  // GLTF_BUFFER_SIZE. Otherwise the data just grows.
+  FILE *f;
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  uint64_t vertex_count;
+  vec3 min_bounds;
+  vec3 max_bounds;
+  // Set if any vertex had a negative color channel. Meshes for subtrees are
+  // generated starting with a negative color, so this means the subtree
+  // relies on the turtle's color from before it started.
+  int inherited_color;
+} GLTFVertexStream;
+
+// A subtree that's written once and instanced.
+typedef struct {
+  uint8_t symbol;
+  uint32_t depth;
+  // Nonzero if the mesh uses the turtle's color from before the subtree, in
+  // which case it's only used for subtrees starting with entry_color, as
+  // 8-bit RGBA values packed into the bytes of the integer, with red in the
+  // lowest byte.
+  int inherits_color;
+  uint32_t entry_color;
+  // The index of another mesh for the same symbol and depth, but a different
+  // entry_color, or -1 if there are no more.
+  int32_t next;
+  uint64_t vertex_count;
+  vec3 min_bounds;
+  vec3 max_bounds;
+  // Where the mesh's vertices start in the temporary file holding every
+  // mesh.
+  uint64_t offset;
+  uint64_t instance_count;
+  // The index of the mesh's first instance, once they're sorted by mesh.
+  uint64_t first_instance;
+} GLTFMesh;
+
+// A single occurrence of an instanced subtree.
+typedef struct {
+  uint32_t mesh;
+  vec3 translation;
+  // The rotation as a quaternion, in x, y, z, w order.
+  vec4 rotation;
+} GLTFInstance;
+
+// Statistics about a written file.
+typedef struct {
+  // The number of segments drawn, counting every instance.
+  uint64_t segment_count;
+  // The number of segments actually stored in the file.
+  uint64_t stored_segment_count;
+  uint32_t mesh_count;
+  uint64_t instance_count;
+} GLTFStats;
+
+typedef struct {
+  AdaptiveExpander *expander;
+  GLTFInstancing instancing;
+  // The path of the .bin file, and its name relative to the .gltf file.
+  char *bin_path;
+  const char *bin_uri;
+  FILE *bin;
+  // Holds the instanced meshes' vertices until every segment that isn't
+  // instanced has been written to the .bin file.
+  FILE *meshes_file;
+  uint64_t meshes_size;
+  // Draws everything that isn't instanced, into base_vertices.
+  Turtle3D *turtle;
+  GLTFVertexStream base_vertices;
+  // Generates the meshes for subtrees, into mesh_vertices.
+  Turtle3D *scratch;
+  GLTFVertexStream mesh_vertices;
+  // The index of the first mesh for each symbol and depth, GLTF_MESH_UNKNOWN
+  // if it hasn't been considered yet, or -1 if it can't be instanced.
+  int32_t mesh_indices[ADAPTIVE_MAX_DEPTH + 1][128];
+  // The number of segments drawn by each symbol at each depth, saturating
+  // at UINT64_MAX.
+  uint64_t segment_counts[ADAPTIVE_MAX_DEPTH + 1][128];
+  GLTFMesh *meshes;
+  uint32_t mesh_count;
+  uint32_t mesh_capacity;
+  GLTFInstance *instances;
+  uint64_t instance_count;
+  uint64_t instance_capacity;
+} GLTFWriter;
+
+// Expands the expander's config to the given depth, which can't exceed
+// ADAPTIVE_MAX_DEPTH, and writes the segments to the .gltf file at the given
+// path, along with a .bin file named after it. If stats isn't NULL, it's
+// filled in once the file has been written. Returns 0 on error.
+int WriteGLTF(AdaptiveExpander *e, uint32_t depth, const char *path,
+    GLTFInstancing instancing, GLTFStats *stats);
+
+#endif  // GLTF_WRITER_H
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "headless_context.h"
+
+#ifdef _WIN32
+
+HeadlessContext* CreateHeadlessContext(void) {
+  printf("Headless rendering requires EGL, which isn't supported on "
+    "Windows.\n");
+  return NULL;
+}
+
+void DestroyHeadlessContext(HeadlessContext *c) {
+  free(c);
+}
+
+void* GetHeadlessProcAddress(const char *name) {
+  return NULL;
+}
+
+#else
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// The oldest OpenGL 4.x minor version to accept if 4.6 isn't available.
+#define MIN_GL_MINOR_VERSION (3)
+
+// The maximum number of EGL devices to look through.
+#define MAX_EGL_DEVICES (16)
+
+// Returns an initialized EGL display that doesn't need a window system, or
+// EGL_NO_DISPLAY on error.
+static EGLDisplay GetHeadlessDisplay(void) {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
+  PFNEGLQUERYDEVICESEXTPROC query_devices = NULL;
+  EGLDeviceEXT devices[MAX_EGL_DEVICES];
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLint device_count = 0;
+  get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress(
+    "eglGetPlatformDisplayEXT");
+  query_devices = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress(
+    "eglQueryDevicesEXT");
+  if (get_platform_display) {
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+      EGL_DEFAULT_DISPLAY, NULL);
+    if ((display != EGL_NO_DISPLAY) && eglInitialize(display, NULL, NULL)) {
+      return display;
+    }
+    if (query_devices && query_devices(MAX_EGL_DEVICES, devices,
+      &device_count) && (device_count > 0)) {
+      display = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[0],
+        NULL);
+      if ((display != EGL_NO_DISPLAY) && eglInitialize(display, NULL, NULL)) {
+        return display;
+      }
+    }
+  }
+  display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if ((display != EGL_NO_DISPLAY) && eglInitialize(display, NULL, NULL)) {
+    return display;
+  }
+  return EGL_NO_DISPLAY;
+}
+
+HeadlessContext* CreateHeadlessContext(void) {
+  HeadlessContext *c = NULL;
+  // Nothing is drawn to EGL surfaces, so accept any surface type.
+  EGLint config_attributes[] = {
+    EGL_SURFACE_TYPE, 0,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE,
+  };
+  EGLint context_attributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 6,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE,
+  };
+  EGLConfig config;
+  EGLint config_count = 0;
+  EGLContext context = EGL_NO_CONTEXT;
+  int minor;
+  c = (HeadlessContext *) calloc(1, sizeof(*c));
+  if (!c) {
+    printf("Failed allocating headless context.\n");
+    return NULL;
+  }
+  c->display = GetHeadlessDisplay();
+  if (c->display == EGL_NO_DISPLAY) {
+    printf("Failed initializing a headless EGL display.\n");
+    DestroyHeadlessContext(c);
+    return NULL;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    printf("The EGL display doesn't support desktop OpenGL.\n");
+    DestroyHeadlessContext(c);
+    return NULL;
+  }
+  if (!eglChooseConfig(c->display, config_attributes, &config, 1,
+    &config_count) || (config_count < 1)) {
+    printf("Failed finding an EGL config for OpenGL.\n");
+    DestroyHeadlessContext(c);
+    return NULL;
+  }
+  for (minor = 6; minor >= MIN_GL_MINOR_VERSION; minor--) {
+    context_attributes[3] = minor;
+    context = eglCreateContext(c->display, config, EGL_NO_CONTEXT,
+      context_attributes);
+    if (context != EGL_NO_CONTEXT) break;
+  }
+  if (context == EGL_NO_CONTEXT) {
+    printf("Failed creating an OpenGL 4.%d or later EGL context.\n",
+      MIN_GL_MINOR_VERSION);
+    DestroyHeadlessContext(c);
+    return NULL;
+  }
+  c->context = context;
+  if (!eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    printf("Failed making the headless context current.\n");
+    DestroyHeadlessContext(c);
+    return NULL;
+  }
+  return c;
+}
+
+void DestroyHeadlessContext(HeadlessContext *c) {
+  if (!c) return;
+  if (c->display != EGL_NO_DISPLAY) {
+    eglMakeCurrent(c->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+      EGL_NO_CONTEXT);
+    if (c->context != EGL_NO_CONTEXT) {
+      eglDestroyContext(c->display, c->context);
+    }
+    eglTerminate(c->display);
+  }
+  memset(c, 0, sizeof(*c));
+  free(c);
+}
+
+void* GetHeadlessProcAddress(const char *name) {
+  return (void *) eglGetProcAddress(name);
+}
+
+#endif  // _WIN32
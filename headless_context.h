@@ -0,0 +1,26 @@
+// Creates an OpenGL context without a window or display, so that images can be
+// rendered on servers. This uses EGL, first trying Mesa's surfaceless
+// platform, then the first EGL device (for GPU drivers that support
+// EGL_EXT_platform_device), and finally the default display. Since there's no
+// default framebuffer, everything must be drawn to a framebuffer object.
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// Holds the EGL objects. They're stored as void pointers so that this header
+// doesn't require the EGL headers.
+typedef struct {
+  void *display;
+  void *context;
+} HeadlessContext;
+
+// Creates an OpenGL 4.6 core profile context (or the newest 4.x version
+// available), and makes it current. Returns NULL on error.
+HeadlessContext* CreateHeadlessContext(void);
+
+// Destroys the context. The pointer is no longer valid after this returns.
+void DestroyHeadlessContext(HeadlessContext *c);
+
+// Looks up an OpenGL function, for use with gladLoadGLLoader.
+void* GetHeadlessProcAddress(const char *name);
+
+#endif  // HEADLESS_CONTEXT_H
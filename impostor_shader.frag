@@ -0,0 +1,86 @@
+#version 430 core
+
+in VS_OUT {
+  vec4 world_position;
+  flat vec3 start;
+  flat vec3 end;
+  flat float radius;
+  flat vec4 color;
+} fs_in;
+
+// The quad is drawn at the depth of the cylinder's closest point, so the
+// depth written here is never smaller, and early depth tests still work.
+layout (depth_greater) out float gl_FragDepth;
+
+out vec4 frag_color;
+
+//INCLUDE_SHARED_UNIFORMS
+
+// Returns the distance along the ray to the closest intersection with the
+// capped cylinder, or a negative number if the ray misses it. Sets
+// surface_normal to the normal at the intersection.
+float IntersectCylinder(vec3 origin, vec3 direction, out vec3 surface_normal) {
+  vec3 axis = fs_in.end - fs_in.start;
+  vec3 offset = origin - fs_in.start;
+  float axis_length2 = dot(axis, axis);
+  float axis_direction = dot(axis, direction);
+  float axis_offset = dot(axis, offset);
+  surface_normal = vec3(0);
+  if (axis_length2 < 1.0e-12) return -1.0;
+
+  // Solve for where the ray hits the infinite cylinder, using the parts of
+  // the ray perpendicular to the axis.
+  float a = axis_length2 - axis_direction * axis_direction;
+  float b = axis_length2 * dot(offset, direction) - axis_offset *
+    axis_direction;
+  float c = axis_length2 * dot(offset, offset) - axis_offset * axis_offset -
+    fs_in.radius * fs_in.radius * axis_length2;
+  float discriminant = b * b - a * c;
+  if (discriminant < 0.0) return -1.0;
+  discriminant = sqrt(discriminant);
+
+  // The side is hit if the intersection lies between the two ends.
+  float t = (-b - discriminant) / a;
+  float along_axis = axis_offset + t * axis_direction;
+  if ((along_axis > 0.0) && (along_axis < axis_length2)) {
+    surface_normal = (offset + t * direction - axis * along_axis /
+      axis_length2) / fs_in.radius;
+    return t;
+  }
+
+  // Otherwise, check the cap on the side the ray hit the infinite cylinder.
+  if (abs(axis_direction) < 1.0e-12) return -1.0;
+  t = (((along_axis < 0.0) ? 0.0 : axis_length2) - axis_offset) /
+    axis_direction;
+  if (abs(b + a * t) < discriminant) {
+    surface_normal = axis * sign(along_axis) / sqrt(axis_length2);
+    return t;
+  }
+  return -1.0;
+}
+
+void main() {
+  vec3 origin = shared_uniforms.camera_position.xyz;
+  vec3 direction = normalize(fs_in.world_position.xyz /
+    fs_in.world_position.w - origin);
+  vec3 surface_normal;
+  // Start the ray just in front of the cylinder rather than at the camera.
+  // Otherwise, thin cylinders far from the camera lose most of their
+  // precision to cancellation in IntersectCylinder, and their shading and
+  // edges become noisy.
+  float skip = max(dot(fs_in.start - origin, direction) -
+    (distance(fs_in.start, fs_in.end) + fs_in.radius), 0.0);
+  origin += skip * direction;
+  float t = IntersectCylinder(origin, direction, surface_normal);
+  if (t < 0.0) discard;
+  vec3 hit = origin + t * direction;
+
+  vec4 clip = shared_uniforms.projection * shared_uniforms.view *
+    vec4(hit, 1);
+  gl_FragDepth = ((clip.z / clip.w) * (gl_DepthRange.far -
+    gl_DepthRange.near) + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+
+  // Light the cylinders the same way as the instanced cylinders.
+  float diffuse = abs(dot(surface_normal, direction));
+  frag_color = vec4(fs_in.color.rgb * (0.3 + 0.7 * diffuse), fs_in.color.a);
+}
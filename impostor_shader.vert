@@ -0,0 +1,102 @@
+#version 430 core
+// Draws one screen-aligned quad per line segment, covering the segment's
+// cylinder. There are no vertex attributes: the segment is read from the
+// mesh's buffer, using gl_VertexID, and the fragment shader ray-casts the
+// cylinder itself.
+
+// Matches the layout of MeshVertex.
+struct Vertex {
+  vec4 location;
+  vec4 forward;
+  vec4 up;
+  vec4 color;
+};
+
+// The binding must match IMPOSTOR_STORAGE_BINDING.
+layout (std430, binding = 0) readonly buffer MeshVertices {
+  Vertex vertices[];
+};
+
+uniform mat4 model;
+uniform mat3 normal;
+
+// Added to the location of each vertex to center the overall mesh on 0,0,0.
+uniform vec3 location_offset;
+
+out VS_OUT {
+  // The quad's position in world space, in homogeneous coordinates so that
+  // it can be interpolated linearly in screen space.
+  vec4 world_position;
+  flat vec3 start;
+  flat vec3 end;
+  flat float radius;
+  flat vec4 color;
+} vs_out;
+
+//INCLUDE_SHARED_UNIFORMS
+
+// The corners of the two triangles making up each quad.
+const vec2 quad_corners[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(1, 1),
+  vec2(0, 0), vec2(1, 1), vec2(0, 1));
+
+void main() {
+  int segment = gl_VertexID / 6;
+  Vertex a = vertices[segment * 2];
+  Vertex b = vertices[segment * 2 + 1];
+  vec3 start = (model * vec4(a.location.xyz + location_offset, 1)).xyz;
+  vec3 end = (model * vec4(b.location.xyz + location_offset, 1)).xyz;
+  float radius = shared_uniforms.geometry_thickness *
+    shared_uniforms.size_scale * 0.5;
+
+  // Build a box around the cylinder, the same way as the instanced cylinders
+  // build their basis.
+  vec3 forward = normalize(normal * a.forward.xyz);
+  vec3 up = normalize(normal * a.up.xyz);
+  vec3 axis = end - start;
+  if (dot(axis, axis) > 1.0e-12) {
+    forward = normalize(axis);
+  }
+  if (abs(dot(forward, up)) > 0.99) {
+    up = abs(forward.y) < 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+  }
+  vec3 right = normalize(cross(forward, up));
+  up = cross(right, forward);
+
+  // Find the box's bounds on the screen, along with the depth of its closest
+  // point. If any corner is behind the camera, cover the whole screen.
+  mat4 view_projection = shared_uniforms.projection * shared_uniforms.view;
+  vec2 min_bounds = vec2(1.0e30);
+  vec2 max_bounds = vec2(-1.0e30);
+  float near_depth = 1.0;
+  bool behind_camera = false;
+  for (int i = 0; i < 8; i++) {
+    vec3 corner = ((i & 1) != 0) ? end : start;
+    corner += (((i & 2) != 0) ? radius : -radius) * right;
+    corner += (((i & 4) != 0) ? radius : -radius) * up;
+    vec4 clip = view_projection * vec4(corner, 1);
+    if (clip.w <= 1.0e-6) {
+      behind_camera = true;
+      continue;
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    min_bounds = min(min_bounds, ndc.xy);
+    max_bounds = max(max_bounds, ndc.xy);
+    near_depth = min(near_depth, ndc.z);
+  }
+  if (behind_camera) {
+    min_bounds = vec2(-1);
+    max_bounds = vec2(1);
+    near_depth = -1.0;
+  }
+  min_bounds = max(min_bounds, vec2(-1));
+  max_bounds = min(max_bounds, vec2(1));
+  near_depth = max(near_depth, -1.0);
+
+  vec2 position = mix(min_bounds, max_bounds, quad_corners[gl_VertexID % 6]);
+  gl_Position = vec4(position, near_depth, 1);
+  vs_out.world_position = inverse(view_projection) * gl_Position;
+  vs_out.start = start;
+  vs_out.end = end;
+  vs_out.radius = radius;
+  vs_out.color = a.color;
+}
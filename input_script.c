@@ -0,0 +1,252 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Only GLFW's key codes are needed, not any OpenGL headers.
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include "input_script.h"
+
+typedef struct {
+  int key;
+  const char *name;
+} KeyName;
+
+// Every key handled by the viewer, other than escape.
+static const KeyName key_names[] = {
+  {GLFW_KEY_UP, "UP"},
+  {GLFW_KEY_DOWN, "DOWN"},
+  {GLFW_KEY_R, "R"},
+  {GLFW_KEY_M, "M"},
+  {GLFW_KEY_L, "L"},
+  {GLFW_KEY_A, "A"},
+  {GLFW_KEY_T, "T"},
+};
+
+#define KEY_NAME_COUNT ((int) (sizeof(key_names) / sizeof(KeyName)))
+
+const char* InputKeyName(int key) {
+  int i;
+  for (i = 0; i < KEY_NAME_COUNT; i++) {
+    if (key_names[i].key == key) return key_names[i].name;
+  }
+  return NULL;
+}
+
+// Returns the key with the given name, or 0 if there isn't one.
+static int KeyFromName(const char *name) {
+  int i;
+  for (i = 0; i < KEY_NAME_COUNT; i++) {
+    if (strcmp(key_names[i].name, name) == 0) return key_names[i].key;
+  }
+  return 0;
+}
+
+InputRecorder* CreateInputRecorder(const char *path) {
+  InputRecorder *r = (InputRecorder *) calloc(1, sizeof(*r));
+  if (!r) return NULL;
+  r->path = strdup(path);
+  if (!r->path) {
+    free(r);
+    return NULL;
+  }
+  r->file = fopen(path, "wb");
+  if (!r->file) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    free(r->path);
+    free(r);
+    return NULL;
+  }
+  fprintf(r->file, "# Seconds since starting, and the key pressed.\n");
+  return r;
+}
+
+void RecordKeyPress(InputRecorder *r, double time, int key) {
+  const char *name = InputKeyName(key);
+  if (!name) return;
+  fprintf(r->file, "%.6f %s\n", time, name);
+  r->event_count++;
+}
+
+int DestroyInputRecorder(InputRecorder *r) {
+  int result = 1;
+  if (!r) return 1;
+  if (ferror(r->file)) result = 0;
+  if (fclose(r->file) != 0) result = 0;
+  if (result) {
+    printf("Recorded %u key presses to %s.\n", (unsigned) r->event_count,
+      r->path);
+  } else {
+    printf("Failed writing %s.\n", r->path);
+  }
+  free(r->path);
+  memset(r, 0, sizeof(*r));
+  free(r);
+  return result;
+}
+
+// Parses a single line of a recording, appending its event to r->events if
+// it has one. Returns 0 if the line is invalid.
+static int ParseReplayLine(InputReplay *r, char *line, int line_number) {
+  char name[32];
+  InputEvent *e = NULL;
+  double time;
+  int key;
+  while ((*line == ' ') || (*line == '\t')) line++;
+  if ((*line == '#') || (*line == '\n') || (*line == '\r') || (*line == 0)) {
+    return 1;
+  }
+  if (sscanf(line, "%lf %31s", &time, name) != 2) {
+    printf("Line %d: expected a time and a key name.\n", line_number);
+    return 0;
+  }
+  key = KeyFromName(name);
+  if (!key) {
+    printf("Line %d: unknown key %s.\n", line_number, name);
+    return 0;
+  }
+  if (!isfinite(time) || (time < 0) || ((r->event_count != 0) &&
+    (time < r->events[r->event_count - 1].time))) {
+    printf("Line %d: key presses must be in order, at non-negative times.\n",
+      line_number);
+    return 0;
+  }
+  if (r->event_count >= MAX_INPUT_EVENTS) {
+    printf("Line %d: recordings may contain at most %d key presses.\n",
+      line_number, MAX_INPUT_EVENTS);
+    return 0;
+  }
+  e = r->events + r->event_count;
+  e->time = time;
+  e->key = key;
+  e->latency = -1.0;
+  r->event_count++;
+  return 1;
+}
+
+InputReplay* LoadInputReplay(const char *path) {
+  InputReplay *r = NULL;
+  char line[256];
+  int line_number = 0;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  r = (InputReplay *) calloc(1, sizeof(*r));
+  if (!r) goto error;
+  r->events = (InputEvent *) calloc(MAX_INPUT_EVENTS, sizeof(InputEvent));
+  if (!r->events) goto error;
+  while (fgets(line, sizeof(line), f)) {
+    line_number++;
+    if (!ParseReplayLine(r, line, line_number)) goto error;
+  }
+  if (ferror(f)) {
+    printf("Failed reading %s.\n", path);
+    goto error;
+  }
+  fclose(f);
+  printf("Loaded %u key presses from %s.\n", (unsigned) r->event_count, path);
+  return r;
+error:
+  printf("Failed loading the recording %s.\n", path);
+  DestroyInputReplay(r);
+  fclose(f);
+  return NULL;
+}
+
+void DestroyInputReplay(InputReplay *r) {
+  if (!r) return;
+  free(r->events);
+  memset(r, 0, sizeof(*r));
+  free(r);
+}
+
+void AdvanceInputReplay(InputReplay *r, double time, int keys_released) {
+  InputEvent *e = NULL;
+  if (r->held_key) {
+    r->held_key = 0;
+    return;
+  }
+  if (!keys_released || (r->next_event >= r->event_count)) return;
+  e = r->events + r->next_event;
+  if (time < e->time) return;
+  e->pressed_time = time;
+  r->held_key = e->key;
+  r->next_event++;
+}
+
+int ReplayKeyDown(InputReplay *r, int key) {
+  return r->held_key == key;
+}
+
+int InputReplayFramePending(InputReplay *r) {
+  return r->finished_count < r->next_event;
+}
+
+void FinishInputReplayFrame(InputReplay *r, double time) {
+  InputEvent *e = NULL;
+  if (!InputReplayFramePending(r)) return;
+  e = r->events + r->finished_count;
+  e->latency = time - e->time;
+  r->finished_count++;
+}
+
+int InputReplayDone(InputReplay *r) {
+  return (r->finished_count == r->event_count) && !r->held_key;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *((const double *) a);
+  double y = *((const double *) b);
+  if (x < y) return -1;
+  if (x > y) return 1;
+  return 0;
+}
+
+// Returns the given percentile, between 0 and 100, of the sorted samples,
+// using the nearest-rank method.
+static double SortedPercentile(double *samples, uint32_t count,
+    double percentile) {
+  uint32_t rank = (uint32_t) ceil((percentile / 100.0) * count);
+  if (rank < 1) rank = 1;
+  return samples[rank - 1];
+}
+
+void PrintInputLatencies(InputReplay *r) {
+  InputEvent *e = NULL;
+  double *samples = NULL;
+  uint32_t count, i;
+  int k;
+  printf("Key press latencies, from when the key was due to be pressed until "
+    "the first\nframe drawn after handling it had finished:\n");
+  printf("  %8s %-5s %10s %12s\n", "time (s)", "key", "delay (ms)",
+    "latency (ms)");
+  for (i = 0; i < r->finished_count; i++) {
+    e = r->events + i;
+    printf("  %8.03f %-5s %10.02f %12.02f\n", e->time, InputKeyName(e->key),
+      (e->pressed_time - e->time) * 1000.0, e->latency * 1000.0);
+  }
+  samples = (double *) calloc(r->finished_count + 1, sizeof(double));
+  if (!samples) {
+    printf("Failed allocating latency summary.\n");
+    return;
+  }
+  printf("  %-5s %6s %12s %12s %12s\n", "key", "count", "median (ms)",
+    "p95 (ms)", "max (ms)");
+  for (k = 0; k < KEY_NAME_COUNT; k++) {
+    count = 0;
+    for (i = 0; i < r->finished_count; i++) {
+      e = r->events + i;
+      if (e->key == key_names[k].key) samples[count++] = e->latency * 1000.0;
+    }
+    if (count == 0) continue;
+    qsort(samples, count, sizeof(double), CompareDoubles);
+    printf("  %-5s %6u %12.02f %12.02f %12.02f\n", key_names[k].name,
+      (unsigned) count, SortedPercentile(samples, count, 50),
+      SortedPercentile(samples, count, 95), samples[count - 1]);
+  }
+  free(samples);
+}
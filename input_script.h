@@ -0,0 +1,101 @@
+// Records the keys pressed in the viewer's window, along with when they were
+// pressed, and replays them later to measure how long each one takes to show
+// up on screen. Replaying the same recording before and after a change shows
+// whether the stalls after pressing a key got shorter.
+//
+// Recordings are text files with one key press per line: the number of
+// seconds since the main loop started, and the key's name, e.g. "2.500 UP".
+// Lines starting with # are ignored. Only presses are recorded; a replayed
+// key is held down for a single frame.
+//
+// Doesn't use OpenGL, but key codes are GLFW's.
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+#include <stdint.h>
+#include <stdio.h>
+
+// The most key presses a recording may contain.
+#define MAX_INPUT_EVENTS (65536)
+
+// Appends each key press to a file as it happens.
+typedef struct {
+  FILE *file;
+  char *path;
+  uint32_t event_count;
+} InputRecorder;
+
+typedef struct {
+  // When the key should be pressed, in seconds since the replay started.
+  double time;
+  int key;
+  // When the key was actually pressed. This is later than time if the viewer
+  // was still busy handling an earlier key.
+  double pressed_time;
+  // The number of seconds from time until the first frame drawn after the
+  // key was handled had finished, or negative if it hasn't yet.
+  double latency;
+} InputEvent;
+
+typedef struct {
+  InputEvent *events;
+  uint32_t event_count;
+  // The next event to be pressed.
+  uint32_t next_event;
+  // The key currently held down by the replay, or 0 if none is.
+  int held_key;
+  // The number of events that have been pressed and whose frames have
+  // finished.
+  uint32_t finished_count;
+} InputReplay;
+
+// Returns a short name for the key, e.g. "UP", or NULL if it can't be
+// recorded.
+const char* InputKeyName(int key);
+
+// Creates the file at the given path and returns a recorder writing to it.
+// Returns NULL on error.
+InputRecorder* CreateInputRecorder(const char *path);
+
+// Records that the key was pressed at the given time, in seconds since the
+// main loop started. Errors writing the file are reported when the recorder
+// is destroyed.
+void RecordKeyPress(InputRecorder *r, double time, int key);
+
+// Closes the recording's file and frees the recorder. Returns 0 if anything
+// failed to be written. Does nothing if r is NULL.
+int DestroyInputRecorder(InputRecorder *r);
+
+// Loads a recording written by an InputRecorder. Returns NULL on error.
+InputReplay* LoadInputReplay(const char *path);
+
+// Frees the replay. Does nothing if r is NULL.
+void DestroyInputReplay(InputReplay *r);
+
+// Must be called at the start of each frame, before the keys are checked,
+// with the number of seconds since the main loop started. Releases the key
+// pressed during the previous frame, and presses the next one if it's due.
+// keys_released must be nonzero only if the viewer has seen every key
+// released, so that the next press isn't ignored.
+void AdvanceInputReplay(InputReplay *r, double time, int keys_released);
+
+// Returns nonzero if the replay is holding the key down during this frame.
+int ReplayKeyDown(InputReplay *r, int key);
+
+// Returns nonzero if a key was pressed during this frame, so the frame's
+// latency needs to be measured once it's finished.
+int InputReplayFramePending(InputReplay *r);
+
+// Must be called once each frame has finished being drawn, with the number of
+// seconds since the main loop started. Records the latency of the key
+// pressed during the frame, if there was one.
+void FinishInputReplayFrame(InputReplay *r, double time);
+
+// Returns nonzero once every key has been pressed and its frame has
+// finished.
+int InputReplayDone(InputReplay *r);
+
+// Prints the latency of every key press, followed by the median, 95th
+// percentile and maximum latency for each key.
+void PrintInputLatencies(InputReplay *r);
+
+#endif  // INPUT_SCRIPT_H
@@ -7,8 +7,25 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include "adaptive_expansion.h"
+#include "frame_capture.h"
+#include "gl_utilities.h"
+#include "gltf_writer.h"
 #include "l_system_mesh.h"
+#include "l_system_string.h"
+#include "headless_context.h"
+#include "input_script.h"
+#include "line_rasterizer.h"
+#include "memory_budget.h"
+#include "mesh_lod.h"
+#include "offscreen_target.h"
 #include "parse_config.h"
+#include "path_tracer.h"
+#include "pixel_readback.h"
+#include "png_writer.h"
+#include "segment_writer.h"
+#include "trace.h"
+#include "tube_mesh.h"
 #include "turtle_3d.h"
 #include "utilities.h"
 #include "l_system_3d.h"
@@ -18,6 +35,39 @@
 #define DEFAULT_FPS (60.0)
 #define DEFAULT_GEOMETRY_THICKNESS (0.125)
 
+// The number of camera angles, evenly spaced around the camera's orbit,
+// rendered in headless mode by default.
+#define DEFAULT_HEADLESS_VIEWS (8)
+
+// In headless mode, the most frames to draw each view while waiting for a
+// streamed mesh's nodes to be uploaded.
+#define HEADLESS_MAX_STREAMING_FRAMES (256)
+
+// The number of frames drawn in each rendering mode by --bench-render by
+// default, and the number drawn before measuring anything.
+#define DEFAULT_BENCH_FRAMES (120)
+#define BENCH_WARMUP_FRAMES (10)
+
+// The default size of the tiles used to render a --poster image. The whole
+// image's width times the tile height is buffered before being written.
+#define DEFAULT_TILE_WIDTH (2048)
+#define DEFAULT_TILE_HEIGHT (1024)
+
+// The number of rows of a --poster image passed to the PNG writer at once.
+// This limits the size of the writer's own buffers.
+#define POSTER_ROWS_PER_WRITE (64)
+
+// In adaptive mode, symbols stop being expanded once they're smaller than
+// this many pixels on screen.
+#define ADAPTIVE_PIXEL_SIZE (4.0)
+
+// The number of seconds between regenerating the vertices in adaptive mode,
+// so that they follow the camera.
+#define ADAPTIVE_REFRESH_INTERVAL (0.25)
+
+// The fraction of physical memory used as the memory budget by default.
+#define DEFAULT_MEMORY_BUDGET_FRACTION (0.75)
+
 static ApplicationState* AllocateApplicationState(void) {
   ApplicationState *to_return = NULL;
   to_return = calloc(1, sizeof(*to_return));
@@ -28,6 +78,16 @@ static ApplicationState* AllocateApplicationState(void) {
     ((float) to_return->window_height);
   to_return->frame_duration = 1.0 / DEFAULT_FPS;
   to_return->shared_uniforms.geometry_thickness = DEFAULT_GEOMETRY_THICKNESS;
+  to_return->tile_width = DEFAULT_TILE_WIDTH;
+  to_return->tile_height = DEFAULT_TILE_HEIGHT;
+  to_return->cpu_threads = ProcessorCount();
+  to_return->trace_samples = DEFAULT_TRACE_SAMPLES;
+  to_return->trace_ao_samples = DEFAULT_AO_SAMPLES;
+  to_return->tube_sides = DEFAULT_TUBE_SIDES;
+  to_return->tube_radius = DEFAULT_GEOMETRY_THICKNESS * 0.5;
+  to_return->memory_budget = PhysicalMemoryBytes() *
+    DEFAULT_MEMORY_BUDGET_FRACTION;
+  to_return->gpu_memory_budget = DEFAULT_GPU_MEMORY_BUDGET;
   return to_return;
 }
 
@@ -35,10 +95,28 @@ static void FreeApplicationState(ApplicationState *s) {
   if (!s) return;
   if (s->mesh) DestroyLSystemMesh(s->mesh);
   if (s->turtle) DestroyTurtle3D(s->turtle);
+  DestroyAdaptiveExpander(s->expander);
   if (s->config) DestroyLSystemConfig(s->config);
+  TrackedFree(s->l_system_string);
   free(s->config_file_path);
-  glDeleteBuffers(1, &(s->ubo));
+  free(s->output_prefix);
+  free(s->poster_path);
+  free(s->bench_report_path);
+  free(s->cpu_image_path);
+  free(s->trace_image_path);
+  free(s->export_path);
+  free(s->tube_mesh_path);
+  free(s->gltf_path);
+  free(s->capture_prefix);
+  free(s->trace_events_path);
+  free(s->record_input_path);
+  free(s->replay_input_path);
+  DestroyInputRecorder(s->input_recorder);
+  DestroyInputReplay(s->input_replay);
+  DestroyFrameCapture(s->capture);
+  if (s->ubo) glDeleteBuffers(1, &(s->ubo));
   if (s->window) glfwDestroyWindow(s->window);
+  DestroyHeadlessContext(s->headless);
   memset(s, 0, sizeof(*s));
   free(s);
 }
@@ -92,33 +170,82 @@ static int SetupUniformBuffer(ApplicationState *s) {
   return CheckGLErrors();
 }
 
-// This generates the vertices for the L-system, and updates the mesh. Returns
-// 0 on error.
-static int GenerateVertices(ApplicationState *s) {
+// Used as the turtle's vertex sink, so vertices are copied into the mesh as
+// they're generated.
+static int MeshVertexSink(void *data, MeshVertex *vertices, uint32_t count) {
+  return AppendMeshVertices((LSystemMesh *) data, vertices, count);
+}
+
+// Finishes routing the turtle's vertices into the mesh. Returns 0 on error.
+static int FinishTurtleMesh(Turtle3D *t, LSystemMesh *m) {
+  if (!FlushTurtleVertices(t) || !FinishMeshVertices(m)) {
+    printf("Failed setting vertices.\n");
+    return 0;
+  }
+  SetTurtleVertexSink(t, NULL, NULL);
+  return 1;
+}
+
+// Generates the vertices using adaptive expansion, and updates the mesh.
+// Returns 0 on error.
+static int GenerateAdaptiveVertices(ApplicationState *s) {
   Turtle3D *t = s->turtle;
-  ActionRule *r = NULL;
-  int result;
-  uint32_t char_index, inst_index;
-  uint8_t c;
+  LSystemMesh *m = s->mesh;
+  LODView view;
+  double start_time;
   float size_scale;
+  if (!s->expander) {
+    s->expander = CreateAdaptiveExpander(s->config);
+    if (!s->expander) return 0;
+  }
+  // Skipping every subtree first gives the bounds of the entire L-system, so
+  // the mesh's transform doesn't depend on how much ends up being expanded.
   ResetTurtle3D(t);
-  for (char_index = 0; char_index < s->l_system_length; char_index++) {
-    c = s->l_system_string[char_index];
-    r = s->config->actions + c;
-    for (inst_index = 0; inst_index < r->length; inst_index++) {
-      result = r->instructions[inst_index](t, r->args[inst_index]);
-      if (!result) {
-        printf("Failed running instruction %d for char %c.\n", (int) inst_index,
-          (char) c);
-        return 0;
-      }
-    }
+  SetTurtleVertexSink(t, NULL, NULL);
+  start_time = BeginTraceEvent();
+  if (!RunAdaptiveExpansion(s->expander, t, s->adaptive_depth, NULL)) {
+    return 0;
   }
-
-  if (!SetMeshVertices(s->mesh, t->vertices, t->vertex_count)) {
-    printf("Failed setting vertices.\n");
+  EndTraceEvent("Adaptive expansion bounds", start_time);
+  if (!SetTransformInfo(t, m->model, m->normal, m->location_offset,
+    &size_scale)) {
+    printf("Failed getting transform matrices.\n");
+    return 0;
+  }
+  s->shared_uniforms.size_scale = size_scale;
+  SetupLODView(&view, s->shared_uniforms.projection, s->shared_uniforms.view,
+    m->model, m->location_offset, s->window_height, ADAPTIVE_PIXEL_SIZE);
+  ResetTurtle3D(t);
+  BeginMeshVertices(m);
+  SetTurtleVertexSink(t, MeshVertexSink, m);
+  start_time = BeginTraceEvent();
+  if (!RunAdaptiveExpansion(s->expander, t, s->adaptive_depth, &view)) {
     return 0;
   }
+  EndTraceEvent("Adaptive expansion", start_time);
+  if (!FinishTurtleMesh(t, m)) return 0;
+  s->last_adaptive_update = s->scene_time;
+  return 1;
+}
+
+// Runs the turtle's instructions for every character in the L-system string.
+// Returns 0 on error.
+static int RunTurtle(ApplicationState *s) {
+  return RunLSystemString(s->config, s->turtle, s->l_system_string,
+    s->l_system_length);
+}
+
+// This generates the vertices for the L-system, and updates the mesh. Returns
+// 0 on error.
+static int GenerateVertices(ApplicationState *s) {
+  Turtle3D *t = s->turtle;
+  float size_scale;
+  if (s->adaptive_mode) return GenerateAdaptiveVertices(s);
+  ResetTurtle3D(t);
+  BeginMeshVertices(s->mesh);
+  SetTurtleVertexSink(t, MeshVertexSink, s->mesh);
+  if (!RunTurtle(s)) return 0;
+  if (!FinishTurtleMesh(t, s->mesh)) return 0;
   if (!SetTransformInfo(s->turtle, s->mesh->model, s->mesh->normal,
     s->mesh->location_offset, &size_scale)) {
     printf("Failed getting transform matrices.\n");
@@ -137,47 +264,11 @@ static float ToMB(uint64_t bytes) {
 // mesh.
 static int IncreaseIterations(ApplicationState *s) {
   uint32_t new_length = 0;
-  ReplacementRule *r = NULL;
   uint8_t *new_buffer = NULL;
-  uint8_t *dst = NULL;
-  uint8_t *loc = s->l_system_string;
-  uint8_t c;
-  // First iterate over the string to pre-calcuate the size of the buffer we'll
-  // need.
-  while (*loc) {
-    c = *loc;
-    loc++;
-    r = s->config->replacements + c;
-    if (!r->used) {
-      new_length++;
-      continue;
-    }
-    new_length += r->length;
-  }
-  // +1 to ensure a null terminator.
-  new_buffer = (uint8_t *) calloc(1, new_length + 1);
-  if (!new_buffer) {
-    printf("Failed allocating new %f MB L-system string.\n", ToMB(new_length));
-    return 0;
-  }
-  // Iterate over the string again, this time populating the new buffer.
-  dst = new_buffer;
-  loc = s->l_system_string;
-  while (*loc) {
-    c = *loc;
-    loc++;
-    r = s->config->replacements + c;
-    if (!r->used) {
-      // Keep the same char if no replacement was defined.
-      *dst = c;
-      dst++;
-      continue;
-    }
-    memcpy(dst, r->replacement, r->length);
-    dst += r->length;
-    continue;
-  }
-  free(s->l_system_string);
+  new_buffer = ExpandLSystemString(s->config, s->l_system_string,
+    s->l_system_length, &new_length);
+  if (!new_buffer) return 0;
+  TrackedFree(s->l_system_string);
   s->l_system_string = new_buffer;
   s->l_system_length = new_length;
   s->l_system_iterations++;
@@ -186,8 +277,13 @@ static int IncreaseIterations(ApplicationState *s) {
 
 // Sets the current number of iterations to 0. Used after reloading the config.
 static int SetIterationsTo0(ApplicationState *s) {
-  free(s->l_system_string);
-  s->l_system_string = (uint8_t *) strdup(s->config->init);
+  // Cleared before allocating, so that the memory pressure callback never
+  // sees the freed string.
+  TrackedFree(s->l_system_string);
+  s->l_system_string = NULL;
+  s->l_system_length = 0;
+  s->l_system_string = (uint8_t *) TrackedStrdup(MEMORY_STRINGS,
+    s->config->init);
   if (!s->l_system_string) {
     printf("Failed copying the initial L-system string.\n");
     return 0;
@@ -220,12 +316,17 @@ static int DecreaseIterations(ApplicationState *s) {
 static void ReloadConfig(ApplicationState *s) {
   LSystemConfig *new_config = NULL;
   LSystemConfig *old_config = s->config;
+  double start_time = BeginTraceEvent();
   new_config = LoadLSystemConfig(s->config_file_path);
+  EndTraceEvent("Load config", start_time);
   if (!new_config) {
     printf("Failed reloading the config file.\n");
     return;
   }
   s->config = new_config;
+  // The expander's models refer to the old config.
+  DestroyAdaptiveExpander(s->expander);
+  s->expander = NULL;
   DestroyLSystemConfig(old_config);
   printf("Config %s updated OK.\n", s->config_file_path);
   if (!(SetIterationsTo0(s) && GenerateVertices(s))) {
@@ -235,88 +336,228 @@ static void ReloadConfig(ApplicationState *s) {
 }
 
 static void PrintMemoryUsage(ApplicationState *s) {
-  float vbo_size_mb = ToMB(sizeof(MeshVertex) * s->mesh->vertex_count);
-  printf("L-system size is now %.02f MB.\n", ToMB(s->l_system_length));
-  printf("Drawing %u vertices, taking %.02f MB.\n",
-    (unsigned) s->mesh->vertex_count, vbo_size_mb);
+  printf("Drawing %u vertices, with %u LOD tree nodes.\n",
+    (unsigned) s->mesh->vertex_count, (unsigned) s->mesh->lod->node_count);
+  PrintMemoryReport();
+  if (s->mesh->residency && s->mesh->needs_streaming) {
+    printf("The GPU ran out of memory for the mesh, so it's streamed.\n");
+  } else if (s->mesh->residency) {
+    printf("This exceeds the GPU memory budget of %.02f MB, so the mesh is "
+      "streamed.\n", ToMB(s->mesh->gpu_memory_budget));
+  }
 }
 
-static int ProcessInputs(ApplicationState *s) {
-  int pressed;
-  if (glfwGetKey(s->window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
-    glfwSetWindowShouldClose(s->window, 1);
+static void PrintAdaptiveStats(ApplicationState *s) {
+  AdaptiveExpander *e = s->expander;
+  printf("Adaptive expansion to depth %u: expanded %llu symbols, drew %llu "
+    "coarsely, skipped %llu outside the view.\n", (unsigned) s->adaptive_depth,
+    (unsigned long long) e->symbols_expanded,
+    (unsigned long long) e->subtrees_coarse,
+    (unsigned long long) e->subtrees_culled);
+  PrintMemoryUsage(s);
+}
+
+// The memory pressure callback. The expanded string isn't used in adaptive
+// mode, so it's freed to make room, and recreated when adaptive mode is turned
+// off. IncreaseIterations is never called in adaptive mode, so the string
+// can't be in the middle of being expanded.
+static int ReleaseCachedMemory(void *data, uint64_t needed) {
+  ApplicationState *s = (ApplicationState *) data;
+  if (!s->adaptive_mode || !s->l_system_string) return 0;
+  printf("Freeing the %.02f MB L-system string to stay within the memory "
+    "budget.\n", ToMB(s->l_system_length));
+  TrackedFree(s->l_system_string);
+  s->l_system_string = NULL;
+  s->l_system_length = 0;
+  return 1;
+}
+
+// Recreates the expanded string at s->l_system_iterations, if it was freed by
+// ReleaseCachedMemory. Must not be called in adaptive mode. Returns 0 if it
+// can't be recreated, in which case it's left freed.
+static int RestoreLSystemString(ApplicationState *s) {
+  uint32_t target_iterations = s->l_system_iterations;
+  if (s->l_system_string) return 1;
+  printf("Regenerating the L-system string at %u iterations.\n",
+    (unsigned) target_iterations);
+  if (SetIterationsTo0(s)) {
+    while (s->l_system_iterations < target_iterations) {
+      if (!IncreaseIterations(s)) break;
+    }
+  }
+  if (s->l_system_string && (s->l_system_iterations == target_iterations)) {
     return 1;
   }
-  // TODO: Replace this key-press logic with a single function that checks
-  // the state of key_pressed_tmp, setting or unsetting it if necessary and
-  // returning true on a "new" press.
+  TrackedFree(s->l_system_string);
+  s->l_system_string = NULL;
+  s->l_system_length = 0;
+  s->l_system_iterations = target_iterations;
+  return 0;
+}
 
-  // s->key_pressed_tmp is used to prevent counting one press multiple times,
-  // and to prevent up and down from being pressed together.
-  pressed = glfwGetKey(s->window, GLFW_KEY_UP) == GLFW_PRESS;
-  if (!s->key_pressed_tmp && pressed) {
-    // Nothing pressed -> up pressed
-    s->key_pressed_tmp = GLFW_KEY_UP;
-    if (!(IncreaseIterations(s) && GenerateVertices(s))) return 0;
+// Returns nonzero if the next iteration should fit in the memory budget. The
+// new string is allocated while the current one still exists, and the mesh is
+// assumed to grow by the same factor as the string.
+static int NextIterationFitsBudget(ApplicationState *s) {
+  uint64_t new_length = ExpandedLSystemLength(s->config, s->l_system_string,
+    s->l_system_length);
+  uint64_t needed = new_length + 1;
+  double growth = 1.0;
+  if (s->l_system_length != 0) {
+    growth = ((double) new_length) / ((double) s->l_system_length);
+  }
+  if (growth > 1.0) {
+    needed += TrackedBytes(MEMORY_MESH) * (growth - 1.0);
+  }
+  if ((new_length <= UINT32_MAX) && MemoryBudgetAllows(needed)) return 1;
+  printf("The next iteration needs about %.02f MB more memory, which would "
+    "exceed the\nbudget of %.02f MB with %.02f MB already in use.\n",
+    ToMB(needed), ToMB(GetMemoryBudget()), ToMB(TotalTrackedBytes()));
+  return 0;
+}
+
+// Switches between generating vertices from the fully-expanded L-system
+// string and adaptive expansion. Returns 0 on error.
+static int ToggleAdaptiveMode(ApplicationState *s) {
+  s->adaptive_mode = !s->adaptive_mode;
+  if (!s->adaptive_mode) {
+    if (!RestoreLSystemString(s)) {
+      printf("The L-system string doesn't fit in the memory budget. Staying "
+        "in adaptive mode.\n");
+      s->adaptive_mode = 1;
+      return 1;
+    }
+    printf("Adaptive expansion disabled. Back to %u iterations.\n",
+      (unsigned) s->l_system_iterations);
+    if (!GenerateVertices(s)) return 0;
     PrintMemoryUsage(s);
-  } else if ((s->key_pressed_tmp == GLFW_KEY_UP) && !pressed) {
-    // Up pressed -> up released
-    s->key_pressed_tmp = 0;
+    return 1;
+  }
+  s->adaptive_depth = s->l_system_iterations;
+  printf("Adaptive expansion enabled.\n");
+  if (!GenerateVertices(s)) return 0;
+  PrintAdaptiveStats(s);
+  return 1;
+}
+
+// Changes the adaptive expansion depth by the given amount, which must be 1
+// or -1. Returns 0 on error.
+static int ChangeAdaptiveDepth(ApplicationState *s, int change) {
+  if ((change < 0) && (s->adaptive_depth == 0)) {
+    printf("Can't decrease iterations. Already at 0 iterations.\n");
+    return 1;
+  }
+  if ((change > 0) && (s->adaptive_depth >= ADAPTIVE_MAX_DEPTH)) {
+    printf("Can't increase iterations. Already at the limit of %d.\n",
+      ADAPTIVE_MAX_DEPTH);
+    return 1;
+  }
+  s->adaptive_depth += change;
+  if (!GenerateVertices(s)) return 0;
+  PrintAdaptiveStats(s);
+  return 1;
+}
+
+// Returns nonzero if the key has just been pressed. s->key_pressed_tmp is
+// used to prevent counting one press multiple times, and to prevent two keys
+// (e.g. up and down) from being pressed together. When replaying a recording,
+// the key's state comes from the recording instead of the window.
+static int NewKeyPress(ApplicationState *s, int key) {
+  int pressed;
+  if (s->input_replay) {
+    pressed = ReplayKeyDown(s->input_replay, key);
+  } else {
+    pressed = glfwGetKey(s->window, key) == GLFW_PRESS;
   }
-  pressed = glfwGetKey(s->window, GLFW_KEY_DOWN) == GLFW_PRESS;
   if (!s->key_pressed_tmp && pressed) {
-    // Nothing pressed -> down pressed
-    s->key_pressed_tmp = GLFW_KEY_DOWN;
-    if (!(DecreaseIterations(s) && GenerateVertices(s))) return 0;
-    PrintMemoryUsage(s);
-  } else if ((s->key_pressed_tmp == GLFW_KEY_DOWN) && !pressed) {
-    // Down pressed -> down released
+    // Nothing pressed -> key pressed
+    s->key_pressed_tmp = key;
+    if (s->input_recorder) {
+      RecordKeyPress(s->input_recorder, s->scene_time, key);
+    }
+    return 1;
+  }
+  if ((s->key_pressed_tmp == key) && !pressed) {
+    // Key pressed -> key released
     s->key_pressed_tmp = 0;
   }
-  pressed = glfwGetKey(s->window, GLFW_KEY_R) == GLFW_PRESS;
-  if (!s->key_pressed_tmp && pressed) {
-    // Nothing pressed -> R pressed
-    s->key_pressed_tmp = GLFW_KEY_R;
+  return 0;
+}
+
+static int ProcessInputs(ApplicationState *s) {
+  if (glfwGetKey(s->window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
+    glfwSetWindowShouldClose(s->window, 1);
+    return 1;
+  }
+  if (NewKeyPress(s, GLFW_KEY_UP)) {
+    if (s->adaptive_mode) {
+      if (!ChangeAdaptiveDepth(s, 1)) return 0;
+    } else if (!NextIterationFitsBudget(s)) {
+      // Adaptive expansion never stores the expanded string, and only
+      // expands what's visible, so it can keep going.
+      printf("Switching to adaptive expansion instead.\n");
+      s->adaptive_mode = 1;
+      s->adaptive_depth = s->l_system_iterations;
+      if (!ChangeAdaptiveDepth(s, 1)) return 0;
+    } else {
+      if (!(IncreaseIterations(s) && GenerateVertices(s))) return 0;
+      PrintMemoryUsage(s);
+    }
+  }
+  if (NewKeyPress(s, GLFW_KEY_DOWN)) {
+    if (s->adaptive_mode) {
+      if (!ChangeAdaptiveDepth(s, -1)) return 0;
+    } else {
+      if (!(DecreaseIterations(s) && GenerateVertices(s))) return 0;
+      PrintMemoryUsage(s);
+    }
+  }
+  if (NewKeyPress(s, GLFW_KEY_R)) {
     ReloadConfig(s);
     if (!GenerateVertices(s)) return 0;
-  } else if ((s->key_pressed_tmp == GLFW_KEY_R) && !pressed) {
-    // R pressed -> R released
-    s->key_pressed_tmp = 0;
   }
-  pressed = glfwGetKey(s->window, GLFW_KEY_M) == GLFW_PRESS;
-  if (!s->key_pressed_tmp && pressed) {
-    // Nothing pressed -> M pressed
-    s->key_pressed_tmp = GLFW_KEY_M;
+  if (NewKeyPress(s, GLFW_KEY_M)) {
     if (!SwitchRenderingModes(s->mesh)){
       printf("Failed switching rendering modes.\n");
       return 0;
     }
-  } else if ((s->key_pressed_tmp == GLFW_KEY_M) && !pressed) {
-    // M pressed -> M released
-    s->key_pressed_tmp = 0;
+  }
+  if (NewKeyPress(s, GLFW_KEY_L)) ToggleMeshLOD(s->mesh);
+  if (NewKeyPress(s, GLFW_KEY_A)) {
+    if (!ToggleAdaptiveMode(s)) return 0;
+  }
+  if (NewKeyPress(s, GLFW_KEY_T)) {
+    // Failing to write the trace isn't fatal; tracing continues and it can
+    // be written again later.
+    if (TracingEnabled()) WriteTrace(s->trace_events_path);
   }
   return 1;
 }
 
-static void UpdateCamera(ApplicationState *s) {
+// Places the camera at the given angle, in radians, along its orbit around
+// the origin.
+static void SetCameraAngle(ApplicationState *s, float angle) {
   vec3 position, target, up;
-  float tmp;
-  // TODO (eventually): Change camera based on user input; allow flying around.
   glm_mat4_identity(s->shared_uniforms.view);
   glm_vec3_zero(position);
   glm_vec3_zero(target);
   glm_vec3_zero(up);
   up[1] = 1.0;
-  tmp = glfwGetTime();
-  s->shared_uniforms.current_time = tmp;
-  tmp /= 4.0;
-  position[0] = sin(tmp) * 5.0;
+  position[0] = sin(angle) * 5.0;
   position[1] = 2.0;
-  position[2] = cos(tmp) * 5.0;
+  position[2] = cos(angle) * 5.0;
   glm_lookat(position, target, up, s->shared_uniforms.view);
   glm_vec4(position, 0, s->shared_uniforms.camera_position);
 }
 
+static void UpdateCamera(ApplicationState *s) {
+  float tmp;
+  // TODO (eventually): Change camera based on user input; allow flying around.
+  tmp = s->scene_time;
+  s->shared_uniforms.current_time = tmp;
+  SetCameraAngle(s, tmp / 4.0);
+}
+
 // Sleeps for s number of seconds.
 static void SleepSeconds(double s) {
   struct timespec t;
@@ -333,75 +574,1309 @@ static int WaitNextFrame(ApplicationState *s) {
   return 1;
 }
 
-static int RunMainLoop(ApplicationState *s) {
+// Sets the OpenGL state used when drawing every frame.
+static void SetupRenderState(void) {
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
   glCullFace(GL_BACK);
   glClearColor(0, 0, 0, 1.0);
+}
+
+// Copies the shared uniforms to the GPU and draws the mesh using the current
+// camera, into a viewport with the given height. Returns 0 on error.
+static int DrawScene(ApplicationState *s, int viewport_height) {
+  SetMeshViewInfo(s->mesh, s->shared_uniforms.projection,
+    s->shared_uniforms.view, viewport_height);
+  glBindBuffer(GL_UNIFORM_BUFFER, s->ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SharedUniforms),
+    (void *) &(s->shared_uniforms));
+  return DrawMesh(s->mesh);
+}
+
+// Passes the frame that was just drawn to the frame capture. Capturing stops
+// if the window is resized. Returns 0 on error.
+static int CaptureWindowFrame(ApplicationState *s) {
+  int result;
+  if ((s->window_width == s->capture->width) &&
+    (s->window_height == s->capture->height)) {
+    return CaptureFrame(s->capture);
+  }
+  printf("The window was resized, so frame capture has stopped.\n");
+  result = DestroyFrameCapture(s->capture);
+  s->capture = NULL;
+  return result;
+}
+
+// Opens the files for --record-input and --replay-input, if they were given.
+// Returns 0 on error.
+static int StartInputScripts(ApplicationState *s) {
+  if (s->record_input_path) {
+    s->input_recorder = CreateInputRecorder(s->record_input_path);
+    if (!s->input_recorder) return 0;
+  }
+  if (s->replay_input_path) {
+    s->input_replay = LoadInputReplay(s->replay_input_path);
+    if (!s->input_replay) return 0;
+  }
+  s->input_start_time = glfwGetTime();
+  return 1;
+}
+
+// Called after each frame is drawn when replaying a recording. If a key was
+// pressed during the frame, waits for the frame to finish and records the
+// key's latency. Closes the window once every key has been replayed.
+static void FinishReplayFrame(ApplicationState *s) {
+  if (InputReplayFramePending(s->input_replay)) {
+    glFinish();
+    FinishInputReplayFrame(s->input_replay,
+      glfwGetTime() - s->input_start_time);
+  }
+  if (InputReplayDone(s->input_replay)) {
+    printf("Finished replaying %s.\n", s->replay_input_path);
+    glfwSetWindowShouldClose(s->window, 1);
+  }
+}
+
+// Prints the latencies measured while replaying, and finishes writing the
+// recording, if either was being done. Returns 0 on error.
+static int FinishInputScripts(ApplicationState *s) {
+  int result;
+  if (s->input_replay) PrintInputLatencies(s->input_replay);
+  result = DestroyInputRecorder(s->input_recorder);
+  s->input_recorder = NULL;
+  return result;
+}
+
+static int RunMainLoop(ApplicationState *s) {
+  double frame_start_time, start_time;
+  SetupRenderState();
+  if (s->capture_prefix) {
+    s->capture = CreateFrameCapture(s->capture_prefix, s->capture_format,
+      s->window_width, s->window_height);
+    if (!s->capture) return 0;
+  }
+  if (!StartInputScripts(s)) return 0;
   while (!glfwWindowShouldClose(s->window)) {
     s->frame_start = glfwGetTime();
+    s->scene_time = s->frame_start - s->input_start_time;
+    if (s->input_replay) {
+      AdvanceInputReplay(s->input_replay, s->scene_time, !s->key_pressed_tmp);
+    }
+    frame_start_time = BeginTraceEvent();
+    start_time = BeginTraceEvent();
     if (!ProcessInputs(s)) {
       printf("Error processing inputs.\n");
       return 0;
     }
+    EndTraceEvent("Process inputs", start_time);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     UpdateCamera(s);
-    glBindBuffer(GL_UNIFORM_BUFFER, s->ubo);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SharedUniforms),
-      (void *) &(s->shared_uniforms));
-    if (!DrawMesh(s->mesh)) return 0;
+    if (s->adaptive_mode && ((s->scene_time - s->last_adaptive_update) >=
+      ADAPTIVE_REFRESH_INTERVAL)) {
+      if (!GenerateVertices(s)) return 0;
+    }
+    start_time = BeginTraceEvent();
+    if (!DrawScene(s, s->window_height)) return 0;
+    EndTraceEvent("Draw scene", start_time);
+    if (s->capture && !CaptureWindowFrame(s)) return 0;
 
+    start_time = BeginTraceEvent();
     glfwSwapBuffers(s->window);
+    EndTraceEvent("Swap buffers", start_time);
+    if (s->input_replay) FinishReplayFrame(s);
     glfwPollEvents();
     if (!CheckGLErrors()) {
       printf("Error drawing window.\n");
       return 0;
     }
+    // The wait for the next frame isn't included, so the frame's event shows
+    // how long it took to produce.
+    EndTraceEvent("Frame", frame_start_time);
     if (!WaitNextFrame(s)) return 0;
   }
+  if (s->capture) {
+    if (!DestroyFrameCapture(s->capture)) {
+      s->capture = NULL;
+      return 0;
+    }
+    s->capture = NULL;
+  }
+  return FinishInputScripts(s);
+}
+
+// Waits for the oldest image being read back from the GPU, and saves it to a
+// PNG file named using the output prefix and the view's index. Returns 0 on
+// error.
+static int SaveHeadlessImage(ApplicationState *s, PixelReadback *r) {
+  char path[1024];
+  uint8_t *pixels = NULL;
+  int64_t row_bytes = ((int64_t) r->width) * 3;
+  int64_t view;
+  int result;
+  pixels = WaitPixelReadback(r, &view);
+  if (!pixels) return 0;
+  snprintf(path, sizeof(path), "%s%04d.png", s->output_prefix, (int) view);
+  // glReadPixels returns the bottom row first.
+  result = WritePNG(path, pixels + (r->height - 1) * row_bytes, -row_bytes,
+    r->width, r->height, 3);
+  ReleasePixelReadback(r);
+  if (!result) {
+    printf("Failed saving %s.\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+// Draws a single view in headless mode, into a viewport with the given
+// height. Streamed meshes are redrawn until every node selected for the view
+// has been uploaded. Returns 0 on error, including if the nodes still aren't
+// all uploaded after HEADLESS_MAX_STREAMING_FRAMES, since the view would be
+// missing parts of the mesh.
+static int DrawHeadlessView(ApplicationState *s, int viewport_height) {
+  MeshResidency *r = s->mesh->residency;
+  int i;
+  for (i = 0; i < HEADLESS_MAX_STREAMING_FRAMES; i++) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (!DrawScene(s, viewport_height)) return 0;
+    if (!r || (r->request_count == 0)) return 1;
+  }
+  printf("The streamed mesh still had %u nodes waiting to be uploaded after "
+    "%d frames.\n", (unsigned) r->request_count,
+    HEADLESS_MAX_STREAMING_FRAMES);
+  return 0;
+}
+
+// Expands the L-system to the number of iterations requested for --headless
+// or --poster images, and switches to the requested rendering mode. Returns 0
+// on error.
+static int SetupHeadlessMesh(ApplicationState *s) {
+  while (s->l_system_iterations < s->headless_iterations) {
+    if (!IncreaseIterations(s)) return 0;
+  }
+  if (!GenerateVertices(s)) return 0;
+  PrintMemoryUsage(s);
+  return SetMeshRenderingMode(s->mesh, s->headless_rendering_mode);
+}
+
+// Renders the L-system at the requested number of iterations from each
+// camera angle, saving the images to PNG files. Images are copied from the
+// GPU asynchronously, so each one is compressed and saved while the following
+// views are drawn. Returns 0 on error.
+static int RenderHeadlessImages(ApplicationState *s) {
+  OffscreenTarget *target = NULL;
+  PixelReadback *readback = NULL;
+  double start_time = CurrentSeconds();
+  double elapsed;
+  uint32_t i;
+  int result = 1;
+  if (!SetupHeadlessMesh(s)) return 0;
+  target = CreateOffscreenTarget(s->window_width, s->window_height);
+  if (!target) return 0;
+  readback = CreatePixelReadback(s->window_width, s->window_height);
+  if (!readback) {
+    DestroyOffscreenTarget(target);
+    return 0;
+  }
+  glViewport(0, 0, s->window_width, s->window_height);
+  SetupRenderState();
+  for (i = 0; i < s->headless_views; i++) {
+    if (!PixelReadbackSlotFree(readback)) {
+      result = SaveHeadlessImage(s, readback);
+      if (!result) break;
+    }
+    SetCameraAngle(s, (2.0 * GLM_PI * i) / s->headless_views);
+    result = DrawHeadlessView(s, s->window_height) &&
+      StartPixelReadback(readback, i);
+    if (!result) break;
+  }
+  while (result && PixelReadbackPending(readback)) {
+    result = SaveHeadlessImage(s, readback);
+  }
+  DestroyPixelReadback(readback);
+  DestroyOffscreenTarget(target);
+  if (!result) return 0;
+  elapsed = CurrentSeconds() - start_time;
+  printf("Rendered %u %dx%d images in %.03f seconds (%.02f images/s).\n",
+    (unsigned) s->headless_views, s->window_width, s->window_height, elapsed,
+    ((double) s->headless_views) / elapsed);
+  return 1;
+}
+
+// Returns the name used for the rendering mode on the command line, and in
+// --bench-render reports.
+static const char* RenderingModeArgument(RenderingMode mode) {
+  switch (mode) {
+  case RENDERING_MODE_LINES:
+    return "lines";
+  case RENDERING_MODE_PIPES:
+    return "pipes";
+  case RENDERING_MODE_CYLINDERS:
+    return "cylinders";
+  case RENDERING_MODE_IMPOSTORS:
+    return "impostors";
+  case RENDERING_MODE_COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *((const double *) a);
+  double y = *((const double *) b);
+  if (x < y) return -1;
+  if (x > y) return 1;
+  return 0;
+}
+
+// Sorts the samples, and returns the given percentile, between 0 and 100,
+// using the nearest-rank method.
+static double SamplePercentile(double *samples, uint32_t count,
+    double percentile) {
+  uint32_t rank;
+  qsort(samples, count, sizeof(double), CompareDoubles);
+  rank = (uint32_t) ceil((percentile / 100.0) * count);
+  if (rank < 1) rank = 1;
+  return samples[rank - 1];
+}
+
+// Draws a single --bench-render frame from the given angle, recording the
+// CPU time spent issuing the draw, the time until the frame is finished, and
+// a GPU timestamp before and after it. DrawMesh uses its own GL_TIME_ELAPSED
+// queries, which can't be nested, so timestamps are used instead. Returns 0
+// on error.
+static int DrawBenchmarkFrame(ApplicationState *s, float angle,
+    GLuint queries[2], double *cpu_ms, double *frame_ms) {
+  double start_time;
+  SetCameraAngle(s, angle);
+  start_time = CurrentSeconds();
+  glQueryCounter(queries[0], GL_TIMESTAMP);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  if (!DrawScene(s, s->window_height)) return 0;
+  glQueryCounter(queries[1], GL_TIMESTAMP);
+  *cpu_ms = (CurrentSeconds() - start_time) * 1000.0;
+  glFinish();
+  *frame_ms = (CurrentSeconds() - start_time) * 1000.0;
+  return 1;
+}
+
+// Draws bench_frames frames in the mesh's current rendering mode, along a
+// full orbit of the camera, as fast as possible, and writes a row of the
+// report. The samples array must hold 3 * bench_frames values, and the
+// queries array 2 * bench_frames queries. Returns 0 on error.
+static int BenchmarkRenderingMode(ApplicationState *s, FILE *report,
+    GLuint *queries, double *samples) {
+  RenderingMode mode = s->mesh->rendering_mode;
+  uint32_t frames = s->bench_frames;
+  double *cpu_ms = samples;
+  double *frame_ms = samples + frames;
+  double *gpu_ms = samples + 2 * frames;
+  double cpu_mean = 0, unused;
+  GLuint64 start, end;
+  uint32_t i;
+  // Let shaders finish compiling and streamed meshes finish uploading before
+  // anything is measured.
+  for (i = 0; i < BENCH_WARMUP_FRAMES; i++) {
+    if (!DrawBenchmarkFrame(s, 0, queries, &unused, &unused)) return 0;
+  }
+  for (i = 0; i < frames; i++) {
+    s->shared_uniforms.current_time = i * s->frame_duration;
+    if (!DrawBenchmarkFrame(s, (2.0 * GLM_PI * i) / frames,
+      queries + 2 * i, cpu_ms + i, frame_ms + i)) {
+      return 0;
+    }
+    cpu_mean += cpu_ms[i];
+  }
+  cpu_mean /= frames;
+  // Every frame has finished, so none of these wait.
+  for (i = 0; i < frames; i++) {
+    glGetQueryObjectui64v(queries[2 * i], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(queries[2 * i + 1], GL_QUERY_RESULT, &end);
+    gpu_ms[i] = ((double) (end - start)) / 1.0e6;
+  }
+  if (!CheckGLErrors()) return 0;
+  fprintf(report, "%s,%u,%d,%d,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f\n",
+    RenderingModeArgument(mode), (unsigned) s->l_system_iterations,
+    s->window_width, s->window_height, (unsigned) frames,
+    SamplePercentile(cpu_ms, frames, 50), SamplePercentile(cpu_ms, frames, 95),
+    cpu_mean, SamplePercentile(frame_ms, frames, 50),
+    SamplePercentile(frame_ms, frames, 95),
+    SamplePercentile(gpu_ms, frames, 50), SamplePercentile(gpu_ms, frames, 95),
+    1000.0 / SamplePercentile(frame_ms, frames, 50));
+  printf("%s: median CPU time %.03f ms, frame time %.03f ms (p95 %.03f ms), "
+    "GPU time %.03f ms (p95 %.03f ms).\n", RenderingModeArgument(mode),
+    SamplePercentile(cpu_ms, frames, 50), SamplePercentile(frame_ms, frames,
+    50), SamplePercentile(frame_ms, frames, 95), SamplePercentile(gpu_ms,
+    frames, 50), SamplePercentile(gpu_ms, frames, 95));
+  return !ferror(report);
+}
+
+// Draws the same camera path in every rendering mode, and writes the frame
+// times in each mode to s->bench_report_path as CSV. Modes that fail to load,
+// e.g. because the driver doesn't support their shaders, are skipped. Returns
+// 0 on error.
+static int BenchmarkRendering(ApplicationState *s) {
+  OffscreenTarget *target = NULL;
+  FILE *report = NULL;
+  GLuint *queries = NULL;
+  double *samples = NULL;
+  int mode, result = 1;
+  if (!SetupHeadlessMesh(s)) return 0;
+  target = CreateOffscreenTarget(s->window_width, s->window_height);
+  if (!target) return 0;
+  queries = (GLuint *) calloc(2 * s->bench_frames, sizeof(GLuint));
+  samples = (double *) calloc(3 * s->bench_frames, sizeof(double));
+  if (!queries || !samples) {
+    printf("Failed allocating benchmark samples.\n");
+    result = 0;
+    goto cleanup;
+  }
+  glGenQueries(2 * s->bench_frames, queries);
+  report = fopen(s->bench_report_path, "wb");
+  if (!report) {
+    printf("Failed opening %s: %s\n", s->bench_report_path, strerror(errno));
+    result = 0;
+    goto cleanup;
+  }
+  fprintf(report, "mode,iterations,width,height,frames,cpu_median_ms,"
+    "cpu_p95_ms,cpu_mean_ms,frame_median_ms,frame_p95_ms,gpu_median_ms,"
+    "gpu_p95_ms,fps\n");
+  glViewport(0, 0, s->window_width, s->window_height);
+  SetupRenderState();
+  for (mode = 0; result && (mode < RENDERING_MODE_COUNT); mode++) {
+    if (!SetMeshRenderingMode(s->mesh, mode)) {
+      printf("Skipping the %s rendering mode, which failed to load.\n",
+        RenderingModeArgument(mode));
+      // Clear any errors left behind by the failed mode.
+      CheckGLErrors();
+      continue;
+    }
+    result = BenchmarkRenderingMode(s, report, queries, samples);
+  }
+  if (fclose(report) != 0) result = 0;
+  if (!result) printf("Failed writing %s.\n", s->bench_report_path);
+cleanup:
+  if (queries) glDeleteQueries(2 * s->bench_frames, queries);
+  free(queries);
+  free(samples);
+  DestroyOffscreenTarget(target);
+  return result;
+}
+
+// Replaces the projection matrix with one that only covers the given
+// rectangle of the full image, in pixels from its bottom left corner. The
+// rectangle is mapped to the entire viewport, and may extend past the edges
+// of the image. Used for drawing one tile of a --poster image.
+static void SetTileProjection(ApplicationState *s, int x, int y, int width,
+    int height) {
+  mat4 tile, full;
+  UpdateProjectionMatrix(s);
+  glm_mat4_copy(s->shared_uniforms.projection, full);
+  // Scales and offsets the full image's normalized device coordinates, so
+  // this is the same as applying it after the perspective divide.
+  glm_mat4_identity(tile);
+  tile[0][0] = ((float) s->window_width) / ((float) width);
+  tile[1][1] = ((float) s->window_height) / ((float) height);
+  tile[3][0] = ((float) (s->window_width - 2 * x - width)) / ((float) width);
+  tile[3][1] = ((float) (s->window_height - 2 * y - height)) /
+    ((float) height);
+  glm_mat4_mul(tile, full, s->shared_uniforms.projection);
+}
+
+// Waits for the oldest tile being read back from the GPU, and copies the part
+// of it that's within the image into the strip of rows being assembled. Each
+// tile's readback tag is its column. Returns 0 on error.
+static int CopyPosterTile(ApplicationState *s, PixelReadback *r,
+    uint8_t *strip) {
+  uint8_t *pixels = NULL;
+  int64_t row_bytes = ((int64_t) r->width) * 3;
+  int64_t strip_row_bytes = ((int64_t) s->window_width) * 3;
+  int64_t column;
+  int x, y, width;
+  pixels = WaitPixelReadback(r, &column);
+  if (!pixels) return 0;
+  x = column * r->width;
+  width = r->width;
+  if ((x + width) > s->window_width) width = s->window_width - x;
+  // The readback's rows are bottom-up, but the strip's are top-down. Rows
+  // below the bottom of the image are copied too, but never written.
+  for (y = 0; y < r->height; y++) {
+    memcpy(strip + y * strip_row_bytes + x * 3,
+      pixels + (r->height - 1 - y) * row_bytes, width * 3);
+  }
+  ReleasePixelReadback(r);
+  return 1;
+}
+
+// Limits the tile size to what the GL implementation can draw, and to the
+// size of the image.
+static void ClampPosterTileSize(ApplicationState *s) {
+  GLint max_renderbuffer = 0;
+  GLint max_viewport[2] = {0, 0};
+  int max_width, max_height;
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer);
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+  max_width = max_renderbuffer;
+  if (max_viewport[0] < max_width) max_width = max_viewport[0];
+  max_height = max_renderbuffer;
+  if (max_viewport[1] < max_height) max_height = max_viewport[1];
+  if ((s->tile_width > max_width) || (s->tile_height > max_height)) {
+    if (s->tile_width > max_width) s->tile_width = max_width;
+    if (s->tile_height > max_height) s->tile_height = max_height;
+    printf("Reduced the tile size to the %dx%d maximum.\n", max_width,
+      max_height);
+  }
+  if (s->tile_width > s->window_width) s->tile_width = s->window_width;
+  if (s->tile_height > s->window_height) s->tile_height = s->window_height;
+}
+
+// Renders a single image, of any size, in tiles. Each tile is drawn with its
+// own projection, so the mesh's LOD selection culls everything outside of
+// it. A row of tiles is assembled into a strip of rows, which is appended to
+// the PNG file before the next row is drawn, so the full image is never held
+// in memory. Returns 0 on error.
+static int RenderPoster(ApplicationState *s) {
+  OffscreenTarget *target = NULL;
+  PixelReadback *readback = NULL;
+  PNGWriter *writer = NULL;
+  uint8_t *strip = NULL;
+  double start_time = CurrentSeconds();
+  int64_t strip_row_bytes = ((int64_t) s->window_width) * 3;
+  int columns, rows, row, column, strip_rows, y, count;
+  int result = 1;
+  if (!SetupHeadlessMesh(s)) return 0;
+  ClampPosterTileSize(s);
+  columns = (s->window_width + s->tile_width - 1) / s->tile_width;
+  rows = (s->window_height + s->tile_height - 1) / s->tile_height;
+  strip = (uint8_t *) calloc(s->tile_height, strip_row_bytes);
+  if (!strip) {
+    printf("Failed allocating a %.02f MB strip of poster rows.\n",
+      ToMB(s->tile_height * strip_row_bytes));
+    return 0;
+  }
+  target = CreateOffscreenTarget(s->tile_width, s->tile_height);
+  readback = CreatePixelReadback(s->tile_width, s->tile_height);
+  writer = OpenPNGWriter(s->poster_path, s->window_width, s->window_height,
+    3);
+  if (!target || !readback || !writer) {
+    result = 0;
+    goto cleanup;
+  }
+  printf("Rendering a %dx%d image in %dx%d tiles of %dx%d pixels.\n",
+    s->window_width, s->window_height, columns, rows, s->tile_width,
+    s->tile_height);
+  glViewport(0, 0, s->tile_width, s->tile_height);
+  SetupRenderState();
+  SetCameraAngle(s, s->headless_angle * GLM_PI / 180.0);
+  for (row = 0; row < rows; row++) {
+    for (column = 0; column < columns; column++) {
+      if (!PixelReadbackSlotFree(readback)) {
+        result = CopyPosterTile(s, readback, strip);
+        if (!result) goto cleanup;
+      }
+      // Rows are counted from the top of the image, but the projection's
+      // coordinates start at the bottom.
+      SetTileProjection(s, column * s->tile_width,
+        s->window_height - (row + 1) * s->tile_height, s->tile_width,
+        s->tile_height);
+      result = DrawHeadlessView(s, s->tile_height) &&
+        StartPixelReadback(readback, column);
+      if (!result) goto cleanup;
+    }
+    while (PixelReadbackPending(readback)) {
+      result = CopyPosterTile(s, readback, strip);
+      if (!result) goto cleanup;
+    }
+    strip_rows = s->window_height - row * s->tile_height;
+    if (strip_rows > s->tile_height) strip_rows = s->tile_height;
+    for (y = 0; y < strip_rows; y += count) {
+      count = strip_rows - y;
+      if (count > POSTER_ROWS_PER_WRITE) count = POSTER_ROWS_PER_WRITE;
+      result = WritePNGRows(writer, strip + y * strip_row_bytes,
+        strip_row_bytes, count);
+      if (!result) goto cleanup;
+    }
+  }
+  result = ClosePNGWriter(writer);
+  writer = NULL;
+  if (result) {
+    printf("Saved %s in %.03f seconds.\n", s->poster_path,
+      CurrentSeconds() - start_time);
+  }
+cleanup:
+  if (writer) ClosePNGWriter(writer);
+  DestroyPixelReadback(readback);
+  DestroyOffscreenTarget(target);
+  free(strip);
+  UpdateProjectionMatrix(s);
+  return result;
+}
+
+// Used as the turtle's vertex sink when only the turtle's bounds are needed.
+static int DiscardVertexSink(void *data, MeshVertex *vertices,
+    uint32_t count) {
+  return 1;
+}
+
+// Expands the L-system for one of the CPU renderers, and sets up the camera
+// for the image. The turtle runs once to find the bounds that the model
+// matrix depends on, so that the renderer can then take each batch of
+// vertices straight from the turtle and the full vertex array is never held
+// in memory. Sets model_transform to the model matrix, including the
+// location offset. Returns 0 on error.
+static int PrepareCPUImage(ApplicationState *s, mat4 model_transform,
+    float *size_scale) {
+  Turtle3D *t = s->turtle;
+  mat3 normal;
+  vec3 location_offset;
+  while (s->l_system_iterations < s->headless_iterations) {
+    if (!IncreaseIterations(s)) return 0;
+  }
+  printf("L-system size is now %.02f MB.\n", ToMB(s->l_system_length));
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, DiscardVertexSink, NULL);
+  if (!RunTurtle(s) || !FlushTurtleVertices(t)) return 0;
+  if (!SetTransformInfo(t, model_transform, normal, location_offset,
+    size_scale)) {
+    printf("Failed getting transform matrices.\n");
+    return 0;
+  }
+  glm_translate(model_transform, location_offset);
+  UpdateProjectionMatrix(s);
+  SetCameraAngle(s, s->headless_angle * GLM_PI / 180.0);
+  return 1;
+}
+
+// Renders a single image on the CPU, without using OpenGL, by rasterizing the
+// segments as lines. Returns 0 on error.
+static int RenderCPUImage(ApplicationState *s) {
+  LineRasterizer *r = NULL;
+  Turtle3D *t = s->turtle;
+  mat4 model, tmp, clip_transform;
+  float size_scale;
+  double start_time;
+  int result;
+  if (!PrepareCPUImage(s, model, &size_scale)) return 0;
+  glm_mat4_mul(s->shared_uniforms.projection, s->shared_uniforms.view, tmp);
+  glm_mat4_mul(tmp, model, clip_transform);
+
+  r = CreateLineRasterizer(s->window_width, s->window_height, s->cpu_threads);
+  if (!r) return 0;
+  BeginRasterizedLines(r, clip_transform);
+  start_time = CurrentSeconds();
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, AddRasterizedLines, r);
+  result = RunTurtle(s) && FlushTurtleVertices(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  if (!result) {
+    DestroyLineRasterizer(r);
+    return 0;
+  }
+  printf("Generated and projected %llu segments (%u visible) in %.03f "
+    "seconds.\n", (unsigned long long) (t->flushed_vertex_count / 2),
+    (unsigned) r->segment_count, CurrentSeconds() - start_time);
+  start_time = CurrentSeconds();
+  result = RasterizeLines(r);
+  if (result) {
+    printf("Rasterized a %dx%d image using %d threads in %.03f seconds.\n",
+      r->width, r->height, r->thread_count, CurrentSeconds() - start_time);
+    result = WritePNG(s->cpu_image_path, r->pixels, ((int64_t) r->width) * 3,
+      r->width, r->height, 3);
+    if (!result) printf("Failed saving %s.\n", s->cpu_image_path);
+  }
+  DestroyLineRasterizer(r);
+  return result;
+}
+
+// Renders a single image on the CPU, without using OpenGL, by ray tracing the
+// segments as capsules with the same radius as the GPU's pipes. Returns 0 on
+// error.
+static int RenderTracedImage(ApplicationState *s) {
+  PathTracer *p = NULL;
+  Turtle3D *t = s->turtle;
+  mat4 model, view_projection;
+  float size_scale;
+  double start_time, seconds;
+  uint64_t ray_count = 0;
+  int result, i;
+  if (!PrepareCPUImage(s, model, &size_scale)) return 0;
+  glm_mat4_mul(s->shared_uniforms.projection, s->shared_uniforms.view,
+    view_projection);
+  p = CreatePathTracer(s->window_width, s->window_height, s->cpu_threads,
+    s->shared_uniforms.geometry_thickness * size_scale * 0.5);
+  if (!p) return 0;
+  p->samples = s->trace_samples;
+  p->ao_samples = s->trace_ao_samples;
+  SetTracedModelTransform(p, model);
+  start_time = CurrentSeconds();
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, AddTracedSegments, p);
+  result = RunTurtle(s) && FlushTurtleVertices(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  if (!result) {
+    DestroyPathTracer(p);
+    return 0;
+  }
+  printf("Generated %u segments in %.03f seconds.\n",
+    (unsigned) p->bvh->segment_count, CurrentSeconds() - start_time);
+  start_time = CurrentSeconds();
+  if (!BuildTracedScene(p)) {
+    DestroyPathTracer(p);
+    return 0;
+  }
+  printf("Built a BVH with %u nodes using %d threads in %.03f seconds.\n",
+    (unsigned) p->bvh->node_count, p->thread_count,
+    CurrentSeconds() - start_time);
+  start_time = CurrentSeconds();
+  result = TraceImage(p, view_projection);
+  if (result) {
+    seconds = CurrentSeconds() - start_time;
+    for (i = 0; i < p->thread_count; i++) {
+      ray_count += p->threads[i].ray_count;
+    }
+    printf("Traced a %dx%d image using %d threads in %.03f seconds (%.02f "
+      "million rays per second).\n", p->width, p->height, p->thread_count,
+      seconds, (((double) ray_count) / seconds) / 1e6);
+    result = WritePNG(s->trace_image_path, p->pixels,
+      ((int64_t) p->width) * 3, p->width, p->height, 3);
+    if (!result) printf("Failed saving %s.\n", s->trace_image_path);
+  }
+  DestroyPathTracer(p);
+  return result;
+}
+
+// Expands the L-system, and writes its segments to s->export_path as the
+// turtle generates them. Returns 0 on error.
+static int ExportSegments(ApplicationState *s) {
+  SegmentWriter *w = NULL;
+  Turtle3D *t = s->turtle;
+  double start_time;
+  int result;
+  while (s->l_system_iterations < s->headless_iterations) {
+    if (!IncreaseIterations(s)) return 0;
+  }
+  printf("L-system size is now %.02f MB.\n", ToMB(s->l_system_length));
+  w = OpenSegmentWriter(s->export_path, s->export_format);
+  if (!w) return 0;
+  start_time = CurrentSeconds();
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, WriteSegments, w);
+  result = RunTurtle(s) && FlushTurtleVertices(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  if (!CloseSegmentWriter(w)) result = 0;
+  if (!result) {
+    printf("Failed writing %s.\n", s->export_path);
+    return 0;
+  }
+  printf("Wrote %llu segments (%llu vertices) to %s in %.03f seconds.\n",
+    (unsigned long long) (t->flushed_vertex_count / 2),
+    (unsigned long long) t->flushed_vertex_count, s->export_path,
+    CurrentSeconds() - start_time);
+  return 1;
+}
+
+// Expands the L-system, and writes a triangle mesh of tubes around its
+// segments to s->tube_mesh_path as the turtle generates them. Returns 0 on
+// error.
+static int WriteTubeMesh(ApplicationState *s) {
+  TubeWriter *w = NULL;
+  Turtle3D *t = s->turtle;
+  uint64_t triangle_count = 0;
+  double start_time;
+  int result;
+  while (s->l_system_iterations < s->headless_iterations) {
+    if (!IncreaseIterations(s)) return 0;
+  }
+  printf("L-system size is now %.02f MB.\n", ToMB(s->l_system_length));
+  w = OpenTubeWriter(s->tube_mesh_path, s->tube_format, s->tube_sides,
+    s->tube_radius, s->cpu_threads);
+  if (!w) return 0;
+  start_time = CurrentSeconds();
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, WriteTubeSegments, w);
+  result = RunTurtle(s) && FlushTurtleVertices(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  if (!CloseTubeWriter(w, &triangle_count)) result = 0;
+  if (!result) {
+    printf("Failed writing %s.\n", s->tube_mesh_path);
+    return 0;
+  }
+  printf("Wrote %llu triangles for %llu segments to %s using %d threads in "
+    "%.03f seconds.\n", (unsigned long long) triangle_count,
+    (unsigned long long) (t->flushed_vertex_count / 2), s->tube_mesh_path,
+    (int) s->cpu_threads, CurrentSeconds() - start_time);
+  return 1;
+}
+
+// Expands the L-system without materializing its string, and writes it to
+// s->gltf_path, instancing repeated subtrees. Returns 0 on error.
+static int ExportGLTF(ApplicationState *s) {
+  GLTFStats stats;
+  double start_time;
+  if (!s->expander) {
+    s->expander = CreateAdaptiveExpander(s->config);
+    if (!s->expander) return 0;
+  }
+  start_time = CurrentSeconds();
+  if (!WriteGLTF(s->expander, s->headless_iterations, s->gltf_path,
+    s->gltf_instancing, &stats)) {
+    printf("Failed writing %s.\n", s->gltf_path);
+    return 0;
+  }
+  printf("Wrote %llu segments to %s in %.03f seconds, storing %llu segments "
+    "in %u instanced meshes with %llu instances plus the rest.\n",
+    (unsigned long long) stats.segment_count, s->gltf_path,
+    CurrentSeconds() - start_time,
+    (unsigned long long) stats.stored_segment_count,
+    (unsigned) stats.mesh_count, (unsigned long long) stats.instance_count);
+  return 1;
+}
+
+static void PrintUsage(const char *program) {
+  printf("Usage: %s [options] [config file path]\n", program);
+  printf("   or: %s --headless <iterations> <output prefix> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --poster <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --bench-render <iterations> <report path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --cpu-render <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --path-trace <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --export <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --tube-mesh <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("   or: %s --gltf <iterations> <output path> [options] "
+    "[config file path]\n", program);
+  printf("\nOptions:\n");
+  printf("  --capture <output prefix>: Save every frame to disk.\n");
+  printf("  --capture-format <png|raw>: Save frames as separate PNG files "
+    "(the\n    default), or append them to a single file of raw RGB "
+    "pixels.\n");
+  printf("  --memory-budget <MB>: The most memory the L-system's string, "
+    "turtle, config\n    and mesh may use, or 0 for no limit. Default: %d%% "
+    "of physical memory.\n", (int) (DEFAULT_MEMORY_BUDGET_FRACTION * 100));
+  printf("  --gpu-memory-budget <MB>: The most GPU memory the mesh's vertices "
+    "may use\n    before it's streamed instead. Default: %d.\n",
+    (int) (DEFAULT_GPU_MEMORY_BUDGET / (1024 * 1024)));
+  printf("  --trace-events <path>: Record how long loading, expanding, "
+    "generating and\n    drawing take, and write it as Chrome trace-event "
+    "JSON on exit or when T\n    is pressed.\n");
+  printf("  --record-input <path>: Save every key pressed, and when, to a "
+    "file.\n");
+  printf("  --replay-input <path>: Press the keys saved by --record-input "
+    "at the same\n    times, ignoring the keyboard, print how long each "
+    "took to show up on\n    screen, and exit.\n");
+  printf("\nThe --headless mode renders images without a window or display, "
+    "saving\nthem to <output prefix>0000.png, <output prefix>0001.png, etc. "
+    "Options:\n");
+  printf("  --views <count>: The number of camera angles around the orbit. "
+    "Default: %d.\n", DEFAULT_HEADLESS_VIEWS);
+  printf("  --size <width>x<height>: The image size. Default: %dx%d.\n",
+    DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
+  printf("  --mode <lines|pipes|cylinders|impostors>: The rendering mode. "
+    "Default:\n    lines.\n");
+  printf("\nThe --poster mode renders a single image, which may be larger "
+    "than the\nmaximum framebuffer size, in tiles. It accepts the --size "
+    "and --mode options\nabove, along with:\n");
+  printf("  --tile-size <width>x<height>: The size of each tile. Default: "
+    "%dx%d.\n", DEFAULT_TILE_WIDTH, DEFAULT_TILE_HEIGHT);
+  printf("  --angle <degrees>: The camera's angle along its orbit. Default: "
+    "0.\n");
+  printf("\nThe --bench-render mode draws the same camera orbit in every "
+    "rendering mode\nwithout a window, as fast as possible, and writes the "
+    "CPU, frame and GPU times\nof each mode to a CSV report. It accepts the "
+    "--size option above, along with:\n");
+  printf("  --frames <count>: The number of frames measured in each mode. "
+    "Default: %d.\n", DEFAULT_BENCH_FRAMES);
+  printf("\nThe --cpu-render mode draws a single image as lines on the CPU, "
+    "without\nOpenGL. It accepts the --size and --angle options above, along "
+    "with:\n");
+  printf("  --threads <count>: The number of threads. Default: the number of "
+    "processors.\n");
+  printf("\nThe --path-trace mode ray traces a single image of shaded pipes "
+    "with ambient\nocclusion on the CPU, without OpenGL. It accepts the "
+    "--size, --angle and\n--threads options above, along with:\n");
+  printf("  --samples <count>: The number of rays per pixel. Default: %d.\n",
+    DEFAULT_TRACE_SAMPLES);
+  printf("  --ao-samples <count>: The number of ambient occlusion rays per "
+    "hit, or 0\n    to disable ambient occlusion. Default: %d.\n",
+    DEFAULT_AO_SAMPLES);
+  printf("\nThe --export mode writes the segments and their colors to a "
+    "file, without\nOpenGL. Options:\n");
+  printf("  --export-format <ply|obj>: The file format. Default: obj if the "
+    "path ends\n    in .obj, otherwise binary ply.\n");
+  printf("\nThe --tube-mesh mode writes a closed triangle mesh of tubes "
+    "around the\nsegments, without OpenGL. It accepts the --threads option "
+    "above, along with:\n");
+  printf("  --tube-format <stl|ply>: The file format. Default: ply if the "
+    "path ends in\n    .ply, otherwise stl.\n");
+  printf("  --tube-sides <count>: The number of sides of each tube. Default: "
+    "%d.\n", DEFAULT_TUBE_SIDES);
+  printf("  --tube-radius <radius>: The tubes' radius, in the same units as "
+    "the\n    config's move_forward actions. Default: %g.\n",
+    DEFAULT_GEOMETRY_THICKNESS * 0.5);
+  printf("\nThe --gltf mode writes the segments to a .gltf file and a .bin "
+    "file next to it,\nwithout OpenGL. Options:\n");
+  printf("  --gltf-instancing <nodes|extension|off>: How repeated subtrees are "
+    "written:\n    as a node per copy, using EXT_mesh_gpu_instancing, or not "
+    "at all.\n    Default: nodes.\n");
+  printf("\nEvery mode also accepts the --memory-budget and --trace-events "
+    "options above.\nThe --headless, --poster and --bench-render modes also "
+    "accept\n--gpu-memory-budget.\n");
+}
+
+// Parses a non-negative integer argument. Returns 0 if it's invalid.
+static int ParseCount(const char *arg, uint32_t *value) {
+  char *end = NULL;
+  unsigned long v;
+  errno = 0;
+  v = strtoul(arg, &end, 10);
+  if ((errno != 0) || (end == arg) || (*end != 0) || (arg[0] == '-') ||
+    (v > UINT32_MAX)) {
+    printf("Invalid number: %s\n", arg);
+    return 0;
+  }
+  *value = v;
+  return 1;
+}
+
+// Parses an image size in the form <width>x<height>. Returns 0 if it's
+// invalid.
+static int ParseSize(const char *arg, int *width, int *height) {
+  uint32_t w, h;
+  if ((sscanf(arg, "%ux%u", &w, &h) != 2) || (w == 0) || (h == 0) ||
+    (w > INT32_MAX) || (h > INT32_MAX)) {
+    printf("Invalid size: %s\n", arg);
+    return 0;
+  }
+  *width = w;
+  *height = h;
+  return 1;
+}
+
+// Parses a memory budget given in MB, where 0 means no limit. Returns 0 if
+// it's invalid.
+static int ParseMemoryBudget(const char *arg, uint64_t *bytes) {
+  uint32_t mb;
+  if (!ParseCount(arg, &mb)) return 0;
+  *bytes = ((uint64_t) mb) * 1024 * 1024;
+  return 1;
+}
+
+// Parses the --gpu-memory-budget argument, in MB. Returns 0 if it's invalid.
+static int ParseGPUMemoryBudget(const char *arg, uint64_t *bytes) {
+  if (!ParseMemoryBudget(arg, bytes)) return 0;
+  if (*bytes == 0) {
+    printf("The GPU memory budget must be at least 1 MB.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Sets the path that trace events are written to. Returns 0 on error.
+static int SetTraceEventsPath(ApplicationState *s, const char *path) {
+  free(s->trace_events_path);
+  s->trace_events_path = strdup(path);
+  if (!s->trace_events_path) {
+    printf("Failed copying trace path.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Parses the name of a rendering mode. Returns 0 if it's invalid.
+static int ParseRenderingMode(const char *arg, RenderingMode *mode) {
+  int i;
+  for (i = 0; i < RENDERING_MODE_COUNT; i++) {
+    if (strcmp(arg, RenderingModeArgument(i)) == 0) {
+      *mode = i;
+      return 1;
+    }
+  }
+  printf("Invalid rendering mode: %s\n", arg);
+  return 0;
+}
+
+// Parses the arguments for the --headless, --poster, --bench-render,
+// --cpu-render, --path-trace, --export, --tube-mesh, or --gltf modes, starting
+// with the number of iterations. Sets *next to the index of the first argument
+// that isn't one of the mode's options. Returns 0 on error.
+static int ParseHeadlessArguments(ApplicationState *s, int argc, char **argv,
+    int *next) {
+  int poster = strcmp(argv[1], "--poster") == 0;
+  int bench = strcmp(argv[1], "--bench-render") == 0;
+  int cpu = strcmp(argv[1], "--cpu-render") == 0;
+  int trace = strcmp(argv[1], "--path-trace") == 0;
+  int exporting = strcmp(argv[1], "--export") == 0;
+  int tube = strcmp(argv[1], "--tube-mesh") == 0;
+  int gltf = strcmp(argv[1], "--gltf") == 0;
+  char *end = NULL;
+  int i = 2;
+  if (argc < 4) return 0;
+  if (!ParseCount(argv[i], &(s->headless_iterations))) return 0;
+  if (poster) {
+    s->poster_path = strdup(argv[i + 1]);
+  } else if (bench) {
+    s->bench_report_path = strdup(argv[i + 1]);
+  } else if (cpu) {
+    s->cpu_image_path = strdup(argv[i + 1]);
+  } else if (trace) {
+    s->trace_image_path = strdup(argv[i + 1]);
+  } else if (exporting) {
+    s->export_path = strdup(argv[i + 1]);
+    if (s->export_path) {
+      s->export_format = SegmentFormatFromPath(s->export_path);
+    }
+  } else if (tube) {
+    s->tube_mesh_path = strdup(argv[i + 1]);
+    if (s->tube_mesh_path) {
+      s->tube_format = TubeFormatFromPath(s->tube_mesh_path);
+    }
+  } else if (gltf) {
+    s->gltf_path = strdup(argv[i + 1]);
+  } else {
+    s->output_prefix = strdup(argv[i + 1]);
+  }
+  if (!s->poster_path && !s->bench_report_path && !s->cpu_image_path &&
+    !s->trace_image_path && !s->export_path && !s->tube_mesh_path &&
+    !s->gltf_path && !s->output_prefix) {
+    printf("Failed copying output path.\n");
+    return 0;
+  }
+  s->headless_views = DEFAULT_HEADLESS_VIEWS;
+  s->bench_frames = DEFAULT_BENCH_FRAMES;
+  i += 2;
+  while ((i + 1) < argc) {
+    if (s->output_prefix && (strcmp(argv[i], "--views") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->headless_views))) return 0;
+      if (s->headless_views == 0) {
+        printf("At least one view must be rendered.\n");
+        return 0;
+      }
+    } else if (!exporting && !tube && !gltf &&
+      (strcmp(argv[i], "--size") == 0)) {
+      if (!ParseSize(argv[i + 1], &(s->window_width), &(s->window_height))) {
+        return 0;
+      }
+      s->aspect_ratio = ((float) s->window_width) /
+        ((float) s->window_height);
+    } else if ((s->output_prefix || poster) &&
+      (strcmp(argv[i], "--mode") == 0)) {
+      if (!ParseRenderingMode(argv[i + 1], &(s->headless_rendering_mode))) {
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--memory-budget") == 0) {
+      if (!ParseMemoryBudget(argv[i + 1], &(s->memory_budget))) return 0;
+    } else if ((s->output_prefix || poster || bench) &&
+      (strcmp(argv[i], "--gpu-memory-budget") == 0)) {
+      if (!ParseGPUMemoryBudget(argv[i + 1], &(s->gpu_memory_budget))) {
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--trace-events") == 0) {
+      if (!SetTraceEventsPath(s, argv[i + 1])) return 0;
+    } else if (bench && (strcmp(argv[i], "--frames") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->bench_frames))) return 0;
+      if ((s->bench_frames == 0) || (s->bench_frames > INT32_MAX / 3)) {
+        printf("Invalid frame count: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (poster && (strcmp(argv[i], "--tile-size") == 0)) {
+      if (!ParseSize(argv[i + 1], &(s->tile_width), &(s->tile_height))) {
+        return 0;
+      }
+    } else if ((poster || cpu || trace) &&
+      (strcmp(argv[i], "--angle") == 0)) {
+      s->headless_angle = strtof(argv[i + 1], &end);
+      if ((end == argv[i + 1]) || (*end != 0)) {
+        printf("Invalid angle: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if ((cpu || trace || tube) &&
+      (strcmp(argv[i], "--threads") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->cpu_threads))) return 0;
+      if ((s->cpu_threads == 0) || (s->cpu_threads > INT32_MAX)) {
+        printf("Invalid thread count: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (trace && (strcmp(argv[i], "--samples") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->trace_samples))) return 0;
+      if ((s->trace_samples == 0) || (s->trace_samples > INT32_MAX)) {
+        printf("At least one sample per pixel is required.\n");
+        return 0;
+      }
+    } else if (trace && (strcmp(argv[i], "--ao-samples") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->trace_ao_samples))) return 0;
+      if (s->trace_ao_samples > INT32_MAX) {
+        printf("Invalid ambient occlusion sample count: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (exporting && (strcmp(argv[i], "--export-format") == 0)) {
+      if (strcmp(argv[i + 1], "ply") == 0) {
+        s->export_format = SEGMENT_FORMAT_PLY;
+      } else if (strcmp(argv[i + 1], "obj") == 0) {
+        s->export_format = SEGMENT_FORMAT_OBJ;
+      } else {
+        printf("Invalid export format: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (tube && (strcmp(argv[i], "--tube-format") == 0)) {
+      if (strcmp(argv[i + 1], "stl") == 0) {
+        s->tube_format = TUBE_FORMAT_STL;
+      } else if (strcmp(argv[i + 1], "ply") == 0) {
+        s->tube_format = TUBE_FORMAT_PLY;
+      } else {
+        printf("Invalid tube mesh format: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (tube && (strcmp(argv[i], "--tube-sides") == 0)) {
+      if (!ParseCount(argv[i + 1], &(s->tube_sides))) return 0;
+      if ((s->tube_sides < MIN_TUBE_SIDES) ||
+        (s->tube_sides > MAX_TUBE_SIDES)) {
+        printf("Tubes must have between %d and %d sides.\n", MIN_TUBE_SIDES,
+          MAX_TUBE_SIDES);
+        return 0;
+      }
+    } else if (tube && (strcmp(argv[i], "--tube-radius") == 0)) {
+      s->tube_radius = strtof(argv[i + 1], &end);
+      if ((end == argv[i + 1]) || (*end != 0) || !(s->tube_radius > 0)) {
+        printf("Invalid tube radius: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (gltf && (strcmp(argv[i], "--gltf-instancing") == 0)) {
+      if (strcmp(argv[i + 1], "nodes") == 0) {
+        s->gltf_instancing = GLTF_INSTANCING_NODES;
+      } else if (strcmp(argv[i + 1], "extension") == 0) {
+        s->gltf_instancing = GLTF_INSTANCING_EXTENSION;
+      } else if (strcmp(argv[i + 1], "off") == 0) {
+        s->gltf_instancing = GLTF_INSTANCING_OFF;
+      } else {
+        printf("Invalid glTF instancing mode: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else {
+      break;
+    }
+    i += 2;
+  }
+  *next = i;
+  return 1;
+}
+
+// Parses the options used when drawing in a window. Sets *next to the index
+// of the first argument that isn't an option. Returns 0 on error.
+static int ParseWindowArguments(ApplicationState *s, int argc, char **argv,
+    int *next) {
+  int i = 1;
+  while ((i + 1) < argc) {
+    if (strcmp(argv[i], "--capture") == 0) {
+      free(s->capture_prefix);
+      s->capture_prefix = strdup(argv[i + 1]);
+      if (!s->capture_prefix) {
+        printf("Failed copying capture prefix.\n");
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--capture-format") == 0) {
+      if (strcmp(argv[i + 1], "png") == 0) {
+        s->capture_format = CAPTURE_FORMAT_PNG;
+      } else if (strcmp(argv[i + 1], "raw") == 0) {
+        s->capture_format = CAPTURE_FORMAT_RAW;
+      } else {
+        printf("Invalid capture format: %s\n", argv[i + 1]);
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--memory-budget") == 0) {
+      if (!ParseMemoryBudget(argv[i + 1], &(s->memory_budget))) return 0;
+    } else if (strcmp(argv[i], "--gpu-memory-budget") == 0) {
+      if (!ParseGPUMemoryBudget(argv[i + 1], &(s->gpu_memory_budget))) {
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--trace-events") == 0) {
+      if (!SetTraceEventsPath(s, argv[i + 1])) return 0;
+    } else if (strcmp(argv[i], "--record-input") == 0) {
+      free(s->record_input_path);
+      s->record_input_path = strdup(argv[i + 1]);
+      if (!s->record_input_path) {
+        printf("Failed copying input recording path.\n");
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--replay-input") == 0) {
+      free(s->replay_input_path);
+      s->replay_input_path = strdup(argv[i + 1]);
+      if (!s->replay_input_path) {
+        printf("Failed copying input replay path.\n");
+        return 0;
+      }
+    } else {
+      break;
+    }
+    i += 2;
+  }
+  *next = i;
+  return 1;
+}
+
+// Parses the command-line arguments. Returns 0 and prints the usage message
+// if they're invalid.
+static int ParseArguments(ApplicationState *s, int argc, char **argv) {
+  const char *config_path = "./config.txt";
+  int i = 1;
+  int result;
+  if ((argc > 1) && ((strcmp(argv[1], "--headless") == 0) ||
+    (strcmp(argv[1], "--poster") == 0) ||
+    (strcmp(argv[1], "--bench-render") == 0) ||
+    (strcmp(argv[1], "--cpu-render") == 0) ||
+    (strcmp(argv[1], "--path-trace") == 0) ||
+    (strcmp(argv[1], "--export") == 0) ||
+    (strcmp(argv[1], "--tube-mesh") == 0) ||
+    (strcmp(argv[1], "--gltf") == 0))) {
+    result = ParseHeadlessArguments(s, argc, argv, &i);
+  } else {
+    result = ParseWindowArguments(s, argc, argv, &i);
+  }
+  if (!result) {
+    PrintUsage(argv[0]);
+    return 0;
+  }
+  if (i < argc) {
+    config_path = argv[i];
+    i++;
+  }
+  if (i < argc) {
+    PrintUsage(argv[0]);
+    return 0;
+  }
+  s->config_file_path = strdup(config_path);
+  if (!s->config_file_path) {
+    printf("Failed copying config file path.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Creates the turtle, loads the config, and sets the L-system string to its
+// initial value. Returns 0 on error.
+static int LoadLSystem(ApplicationState *s) {
+  double start_time;
+  s->turtle = CreateTurtle3D();
+  if (!s->turtle) {
+    printf("Failed creating the \"turtle\" for drawing.\n");
+    return 0;
+  }
+  start_time = BeginTraceEvent();
+  s->config = LoadLSystemConfig(s->config_file_path);
+  EndTraceEvent("Load config", start_time);
+  if (!s->config) {
+    printf("Error parsing %s\n", s->config_file_path);
+    return 0;
+  }
+  printf("Config %s loaded OK!\n", s->config_file_path);
+  s->l_system_string = (uint8_t *) TrackedStrdup(MEMORY_STRINGS,
+    s->config->init);
+  if (!s->l_system_string) {
+    printf("Error initializing L-system string.\n");
+    return 0;
+  }
+  s->l_system_length = strlen(s->config->init);
   return 1;
 }
 
 int main(int argc, char **argv) {
   int to_return = 0;
+  GLADloadproc loader = NULL;
   ApplicationState *s = NULL;
-  if (!glfwInit()) {
-    printf("Failed initializing GLFW.\n");
-    return 1;
-  }
   s = AllocateApplicationState();
   if (!s) {
     printf("Failed allocating application state.\n");
     return 1;
   }
-  if (argc > 2) {
-    printf("Usage: %s [config file path]\n", argv[0]);
+  if (!ParseArguments(s, argc, argv)) {
     FreeApplicationState(s);
     return 1;
   }
-  if (argc == 2) {
-    s->config_file_path = strdup(argv[1]);
-  } else {
-    // Using strdup so that we can "free" it no matter what.
-    s->config_file_path = strdup("./config.txt");
+  if (s->trace_events_path) {
+    StartTracing();
+    SetTraceThreadName("Main thread");
   }
-  if (!s->config_file_path) {
-    printf("Failed copying config file path.\n");
-    FreeApplicationState(s);
-    return 1;
+  SetMemoryBudget(s->memory_budget);
+  SetMemoryPressureCallback(ReleaseCachedMemory, s);
+  if (s->cpu_image_path) {
+    // The CPU renderer doesn't need OpenGL at all.
+    if (!LoadLSystem(s) || !RenderCPUImage(s)) {
+      printf("Failed rendering the image on the CPU.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+    goto cleanup;
   }
-  if (!SetupWindow(s)) {
-    printf("Failed setting up window.\n");
-    FreeApplicationState(s);
-    return 1;
+  if (s->trace_image_path) {
+    if (!LoadLSystem(s) || !RenderTracedImage(s)) {
+      printf("Failed path tracing the image.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+    goto cleanup;
+  }
+  if (s->export_path) {
+    if (!LoadLSystem(s) || !ExportSegments(s)) {
+      printf("Failed exporting the segments.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+    goto cleanup;
   }
-  if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+  if (s->tube_mesh_path) {
+    if (!LoadLSystem(s) || !WriteTubeMesh(s)) {
+      printf("Failed writing the tube mesh.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+    goto cleanup;
+  }
+  if (s->gltf_path) {
+    if (!LoadLSystem(s) || !ExportGLTF(s)) {
+      printf("Failed exporting the glTF file.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+    goto cleanup;
+  }
+  if (s->output_prefix || s->poster_path || s->bench_report_path) {
+    s->headless = CreateHeadlessContext();
+    if (!s->headless) {
+      printf("Failed setting up headless rendering.\n");
+      FreeApplicationState(s);
+      return 1;
+    }
+    loader = (GLADloadproc) GetHeadlessProcAddress;
+  } else {
+    if (!glfwInit()) {
+      printf("Failed initializing GLFW.\n");
+      FreeApplicationState(s);
+      return 1;
+    }
+    if (!SetupWindow(s)) {
+      printf("Failed setting up window.\n");
+      FreeApplicationState(s);
+      return 1;
+    }
+    loader = (GLADloadproc) glfwGetProcAddress;
+  }
+  if (!gladLoadGLLoader(loader)) {
     printf("Failed initializing GLAD.\n");
     to_return = 1;
     goto cleanup;
   }
-  glViewport(0, 0, s->window_width, s->window_height);
-  glfwSetFramebufferSizeCallback(s->window, FramebufferResizedCallback);
+  if (s->window) {
+    glViewport(0, 0, s->window_width, s->window_height);
+    glfwSetFramebufferSizeCallback(s->window, FramebufferResizedCallback);
+  }
   if (!SetupUniformBuffer(s)) {
     printf("Failed setting up uniform buffer.\n");
     to_return = 1;
@@ -414,6 +1889,7 @@ int main(int argc, char **argv) {
     to_return = 1;
     goto cleanup;
   }
+  s->mesh->gpu_memory_budget = s->gpu_memory_budget;
 
   if (!CheckGLErrors()) {
     printf("OpenGL errors detected during initialization.\n");
@@ -421,38 +1897,48 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
 
-  s->turtle = CreateTurtle3D();
-  if (!s->turtle) {
-    printf("Failed creating the \"turtle\" for drawing.\n");
-    to_return = 1;
-    goto cleanup;
-  }
-  s->config = LoadLSystemConfig(s->config_file_path);
-  if (!s->config) {
-    printf("Error parsing %s\n", s->config_file_path);
-    to_return = 1;
-    goto cleanup;
-  }
-  printf("Config %s loaded OK!\n", s->config_file_path);
-  s->l_system_string = (uint8_t *) strdup(s->config->init);
-  if (!s->l_system_string) {
-    printf("Error initializing L-system string.\n");
+  if (!LoadLSystem(s)) {
     to_return = 1;
     goto cleanup;
   }
-  s->l_system_length = strlen(s->config->init);
-  if (!GenerateVertices(s)) {
+  // The poster, benchmark and headless images generate their own vertices,
+  // once the L-system has been expanded, so they're only generated here for
+  // the window.
+  if (s->poster_path) {
+    if (!RenderPoster(s)) {
+      printf("Failed rendering poster image.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+  } else if (s->bench_report_path) {
+    if (!BenchmarkRendering(s)) {
+      printf("Failed benchmarking rendering.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+  } else if (s->headless) {
+    if (!RenderHeadlessImages(s)) {
+      printf("Failed rendering headless images.\n");
+      to_return = 1;
+    } else {
+      printf("Everything done OK.\n");
+    }
+  } else if (!GenerateVertices(s)) {
     printf("Failed generating vertices.\n");
     to_return = 1;
-    goto cleanup;
-  }
-  if (!RunMainLoop(s)) {
+  } else if (!RunMainLoop(s)) {
     printf("Application ended with an error.\n");
     to_return = 1;
   } else {
     printf("Everything done OK.\n");
   }
 cleanup:
+  if (TracingEnabled()) {
+    if (!WriteTrace(s->trace_events_path)) to_return = 1;
+    StopTracing();
+  }
   FreeApplicationState(s);
   glfwTerminate();
   return to_return;
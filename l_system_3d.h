@@ -2,8 +2,15 @@
 #include <GLFW/glfw3.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
+#include "adaptive_expansion.h"
+#include "frame_capture.h"
+#include "gltf_writer.h"
+#include "headless_context.h"
+#include "input_script.h"
 #include "l_system_mesh.h"
 #include "parse_config.h"
+#include "segment_writer.h"
+#include "tube_mesh.h"
 #include "turtle_3d.h"
 
 // Uniforms shared with all shaders. Must match the layout in
@@ -25,6 +32,10 @@ typedef struct {
   int window_height;
   float aspect_ratio;
   double frame_start;
+  // The number of seconds from input_start_time to frame_start. The camera and
+  // the adaptive vertices follow this rather than glfwGetTime, so replaying a
+  // recording moves them the same way relative to its key presses.
+  double scene_time;
   double frame_duration;
   char *config_file_path;
   LSystemMesh *mesh;
@@ -36,5 +47,83 @@ typedef struct {
   uint32_t l_system_iterations;
   uint32_t l_system_length;
   uint8_t *l_system_string;
+  // If nonzero, vertices are generated using adaptive expansion rather than
+  // from l_system_string. The adaptive depth replaces l_system_iterations
+  // while this is enabled.
+  int adaptive_mode;
+  uint32_t adaptive_depth;
+  AdaptiveExpander *expander;
+  // The scene_time of the frame in which the adaptive vertices were last
+  // generated.
+  double last_adaptive_update;
+  // Used instead of the window when rendering images using --headless.
+  HeadlessContext *headless;
+  // The number of iterations and camera angles to render in headless mode,
+  // and the start of each output image's file name.
+  uint32_t headless_iterations;
+  uint32_t headless_views;
+  char *output_prefix;
+  // Set when rendering a single image, larger than the maximum framebuffer
+  // size, in tiles using --poster. The image's size is stored in
+  // window_width and window_height.
+  char *poster_path;
+  int tile_width;
+  int tile_height;
+  // Set when measuring the frame times in every rendering mode using
+  // --bench-render, along with the number of frames drawn in each mode. The
+  // images' size is stored in window_width and window_height.
+  char *bench_report_path;
+  uint32_t bench_frames;
+  // Set when rendering a single image on the CPU, without OpenGL, using
+  // --cpu-render. The image's size is stored in window_width and
+  // window_height.
+  char *cpu_image_path;
+  uint32_t cpu_threads;
+  // Set when ray tracing a single image on the CPU using --path-trace, along
+  // with the number of rays per pixel and ambient occlusion rays per hit.
+  // Also uses cpu_threads.
+  char *trace_image_path;
+  uint32_t trace_samples;
+  uint32_t trace_ao_samples;
+  // Set when writing the segments to a file using --export.
+  char *export_path;
+  SegmentFormat export_format;
+  // Set when writing a triangle mesh of tubes around the segments using
+  // --tube-mesh. Also uses cpu_threads.
+  char *tube_mesh_path;
+  TubeFormat tube_format;
+  uint32_t tube_sides;
+  float tube_radius;
+  // Set when writing the segments to a glTF file using --gltf.
+  char *gltf_path;
+  GLTFInstancing gltf_instancing;
+  // The camera's angle along its orbit, in degrees, for --poster,
+  // --cpu-render and --path-trace images.
+  float headless_angle;
+  // The rendering mode used for --headless and --poster images.
+  RenderingMode headless_rendering_mode;
+  // Set when saving every frame drawn in the window, using --capture.
+  char *capture_prefix;
+  CaptureFormat capture_format;
+  FrameCapture *capture;
+  // The most memory, in bytes, that the L-system's string, turtle, config and
+  // mesh may use together, or 0 for no limit. Set using --memory-budget.
+  uint64_t memory_budget;
+  // The most GPU memory, in bytes, the mesh's vertices may use before it's
+  // streamed instead. Set using --gpu-memory-budget.
+  uint64_t gpu_memory_budget;
+  // Set when recording trace events using --trace-events. The trace is
+  // written here on exit, or when T is pressed.
+  char *trace_events_path;
+  // Set when recording the keys pressed in the window using --record-input.
+  char *record_input_path;
+  InputRecorder *input_recorder;
+  // Set when pressing keys from a recording using --replay-input, instead of
+  // reading them from the window.
+  char *replay_input_path;
+  InputReplay *input_replay;
+  // The time the main loop started. Recorded key presses are relative to
+  // this.
+  double input_start_time;
 } ApplicationState;
 
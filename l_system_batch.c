@@ -0,0 +1,537 @@
+// Evaluates many L-system configs at once, without OpenGL, for screening
+// large numbers of generated grammars. Each config is expanded to a number
+// of iterations, or as many as fit in a memory budget, and the turtle is run
+// over it on a pool of threads. One CSV row is written per config, in the
+// order they were given, with the string's length, the number of segments,
+// their bounds, the time taken by each step, the string's hash matching the
+// one in golden_checksums.txt, and a hash of the vertices.
+//
+// Configs predicted to take the longest are started first, so that a single
+// large config doesn't leave the other threads idle at the end.
+//
+// Usage: l_system_batch [options] <output.csv> <config files or
+//   directories...>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "benchmark_corpus.h"
+#include "l_system_library.h"
+#include "thread_group.h"
+#include "utilities.h"
+
+#define DEFAULT_BATCH_BUDGET_MB (256)
+#define DEFAULT_BATCH_MAX_ITERATIONS (CORPUS_MAX_ITERATIONS)
+
+// The longest line allowed in a --list file.
+#define MAX_LIST_LINE (4096)
+
+typedef struct {
+  char *path;
+  // Set before anything is evaluated. The predicted bytes are used to order
+  // the configs, with the largest first.
+  int loaded;
+  uint32_t iterations;
+  uint64_t predicted_bytes;
+  // Set once the config has been evaluated. ok is nonzero if every step
+  // succeeded.
+  int ok;
+  uint32_t length;
+  uint64_t segment_count;
+  vec3 min_bounds;
+  vec3 max_bounds;
+  double load_seconds;
+  double expand_seconds;
+  // The time spent running the turtle, not including hashing its vertices,
+  // which is counted separately.
+  double draw_seconds;
+  double hash_seconds;
+  uint64_t string_hash;
+  uint64_t vertex_hash;
+} BatchEntry;
+
+typedef struct {
+  uint32_t max_iterations;
+  // The memory budget for each config, or 0 if the configs are always
+  // expanded to max_iterations.
+  uint64_t budget_bytes;
+  uint32_t threads;
+  const char *output_path;
+  BatchEntry *entries;
+  uint32_t entry_count;
+  uint32_t entry_capacity;
+  // The indices of the entries to evaluate, largest predicted first.
+  uint32_t *jobs;
+  uint32_t job_count;
+  // The index in jobs of the next entry to evaluate. Updated atomically.
+  uint32_t next_job;
+} BatchState;
+
+// Each thread's argument to RunThreadGroup.
+typedef struct {
+  BatchState *b;
+  // The total time this thread spent evaluating configs.
+  double busy_seconds;
+} BatchWorker;
+
+static void FreeBatchState(BatchState *b) {
+  uint32_t i;
+  for (i = 0; i < b->entry_count; i++) {
+    free(b->entries[i].path);
+  }
+  free(b->entries);
+  free(b->jobs);
+  memset(b, 0, sizeof(*b));
+}
+
+// Adds a config to the end of the list. Returns 0 on error.
+static int AddEntry(BatchState *b, const char *path) {
+  BatchEntry *new_entries = NULL;
+  uint32_t new_capacity;
+  if (b->entry_count >= b->entry_capacity) {
+    new_capacity = b->entry_capacity ? (b->entry_capacity * 2) : 64;
+    new_entries = (BatchEntry *) realloc(b->entries, new_capacity *
+      sizeof(BatchEntry));
+    if (!new_entries) {
+      printf("Failed allocating the list of configs.\n");
+      return 0;
+    }
+    b->entries = new_entries;
+    b->entry_capacity = new_capacity;
+  }
+  memset(b->entries + b->entry_count, 0, sizeof(BatchEntry));
+  b->entries[b->entry_count].path = strdup(path);
+  if (!b->entries[b->entry_count].path) {
+    printf("Failed copying config path.\n");
+    return 0;
+  }
+  b->entry_count++;
+  return 1;
+}
+
+static int CompareStrings(const void *a, const void *b) {
+  return strcmp(*((char * const *) a), *((char * const *) b));
+}
+
+// Returns nonzero if the name ends in .txt.
+static int IsConfigName(const char *name) {
+  size_t length = strlen(name);
+  return (length > 4) && (strcmp(name + length - 4, ".txt") == 0);
+}
+
+// Adds every file ending in .txt in the directory, sorted by name. Returns 0
+// on error.
+static int AddDirectory(BatchState *b, const char *directory) {
+  DIR *d = NULL;
+  struct dirent *entry = NULL;
+  char **names = NULL;
+  char **new_names = NULL;
+  char *path = NULL;
+  uint32_t count = 0, capacity = 0, i;
+  size_t length;
+  int to_return = 0;
+  d = opendir(directory);
+  if (!d) {
+    printf("Failed opening %s: %s\n", directory, strerror(errno));
+    return 0;
+  }
+  while ((entry = readdir(d)) != NULL) {
+    if (!IsConfigName(entry->d_name)) continue;
+    if (count >= capacity) {
+      capacity = capacity ? (capacity * 2) : 64;
+      new_names = (char **) realloc(names, capacity * sizeof(char *));
+      if (!new_names) {
+        printf("Failed allocating the list of files in %s.\n", directory);
+        goto cleanup;
+      }
+      names = new_names;
+    }
+    names[count] = strdup(entry->d_name);
+    if (!names[count]) {
+      printf("Failed copying file name.\n");
+      goto cleanup;
+    }
+    count++;
+  }
+  qsort(names, count, sizeof(char *), CompareStrings);
+  for (i = 0; i < count; i++) {
+    length = strlen(directory) + strlen(names[i]) + 2;
+    path = (char *) calloc(length, 1);
+    if (!path) {
+      printf("Failed allocating path.\n");
+      goto cleanup;
+    }
+    snprintf(path, length, "%s/%s", directory, names[i]);
+    if (!AddEntry(b, path)) goto cleanup;
+    free(path);
+    path = NULL;
+  }
+  to_return = 1;
+cleanup:
+  free(path);
+  for (i = 0; i < count; i++) {
+    free(names[i]);
+  }
+  free(names);
+  closedir(d);
+  return to_return;
+}
+
+// Adds a config file, or every config in a directory. Returns 0 on error.
+static int AddPath(BatchState *b, const char *path) {
+  DIR *d = opendir(path);
+  if (!d) return AddEntry(b, path);
+  closedir(d);
+  return AddDirectory(b, path);
+}
+
+// Adds every config or directory listed in the file, one per line. Blank
+// lines and lines starting with '#' are ignored. Returns 0 on error.
+static int AddListedPaths(BatchState *b, const char *list_path) {
+  char line[MAX_LIST_LINE];
+  char *start = NULL;
+  size_t length;
+  int to_return = 1;
+  FILE *f = fopen(list_path, "rb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", list_path, strerror(errno));
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    start = line;
+    while ((*start == ' ') || (*start == '\t')) start++;
+    length = strlen(start);
+    while ((length > 0) && ((start[length - 1] == '\n') ||
+      (start[length - 1] == '\r') || (start[length - 1] == ' ') ||
+      (start[length - 1] == '\t'))) {
+      length--;
+    }
+    start[length] = 0;
+    if ((length == 0) || (start[0] == '#')) continue;
+    if (!AddPath(b, start)) {
+      to_return = 0;
+      break;
+    }
+  }
+  if (ferror(f)) {
+    printf("Failed reading %s.\n", list_path);
+    to_return = 0;
+  }
+  fclose(f);
+  return to_return;
+}
+
+// Loads each config to choose its number of iterations and predict its cost,
+// and fills in the list of jobs. Configs that fail to load are left out of
+// the jobs. Returns 0 on error.
+static int PredictEntries(BatchState *b) {
+  LSystemConfig *config = NULL;
+  BatchEntry *e = NULL;
+  uint64_t budget = b->budget_bytes ? b->budget_bytes : UINT64_MAX;
+  uint32_t i;
+  b->jobs = (uint32_t *) calloc(b->entry_count, sizeof(uint32_t));
+  if (!b->jobs) {
+    printf("Failed allocating the list of jobs.\n");
+    return 0;
+  }
+  for (i = 0; i < b->entry_count; i++) {
+    e = b->entries + i;
+    config = LoadLSystemConfig(e->path);
+    if (!config) {
+      printf("Failed loading %s.\n", e->path);
+      continue;
+    }
+    // The vertices are only hashed, so just the strings need to fit.
+    PredictIterationsForBudget(config, b->max_iterations, budget, 0,
+      &(e->iterations), &(e->predicted_bytes));
+    DestroyLSystemConfig(config);
+    e->loaded = 1;
+    b->jobs[b->job_count] = i;
+    b->job_count++;
+  }
+  return 1;
+}
+
+// The state whose jobs are being sorted, since qsort's comparison function
+// only gets the elements.
+static BatchState *sorting_state = NULL;
+
+static int CompareJobs(const void *a, const void *b) {
+  uint32_t index_a = *((const uint32_t *) a);
+  uint32_t index_b = *((const uint32_t *) b);
+  uint64_t bytes_a = sorting_state->entries[index_a].predicted_bytes;
+  uint64_t bytes_b = sorting_state->entries[index_b].predicted_bytes;
+  if (bytes_a > bytes_b) return -1;
+  if (bytes_a < bytes_b) return 1;
+  if (index_a < index_b) return -1;
+  if (index_a > index_b) return 1;
+  return 0;
+}
+
+// Sorts the jobs with the largest predicted cost first. Ties keep the order
+// the configs were given in.
+static void SortJobs(BatchState *b) {
+  sorting_state = b;
+  qsort(b->jobs, b->job_count, sizeof(uint32_t), CompareJobs);
+  sorting_state = NULL;
+}
+
+// Hashes the turtle's vertices, like VertexHashSink, and counts the time it
+// takes, so that it isn't mistaken for the turtle's.
+typedef struct {
+  VertexHash hash;
+  double seconds;
+} TimedVertexHash;
+
+static int TimedVertexHashSink(void *data, MeshVertex *vertices,
+    uint32_t count) {
+  TimedVertexHash *h = (TimedVertexHash *) data;
+  double start = CurrentSeconds();
+  UpdateVertexHash(&(h->hash), vertices, count);
+  h->seconds += CurrentSeconds() - start;
+  return 1;
+}
+
+// Expands the config, runs the turtle over it, and fills in the results. On
+// error, e->ok is left at 0.
+static void EvaluateEntry(BatchEntry *e) {
+  LSystemGenerator *g = NULL;
+  LSystemDrawInfo info;
+  StreamHash string_hash;
+  TimedVertexHash vertex_hash;
+  double start = CurrentSeconds();
+  g = LoadLSystemGenerator(e->path);
+  e->load_seconds = CurrentSeconds() - start;
+  if (!g) return;
+  start = CurrentSeconds();
+  if (!ExpandLSystemTo(g, e->iterations)) goto cleanup;
+  e->expand_seconds = CurrentSeconds() - start;
+  e->length = g->length;
+  InitStreamHash(&string_hash);
+  UpdateStreamHash(&string_hash, g->string, g->length);
+  e->string_hash = string_hash.hash;
+  InitVertexHash(&(vertex_hash.hash), DEFAULT_HASH_QUANTUM);
+  vertex_hash.seconds = 0;
+  start = CurrentSeconds();
+  if (!DrawLSystem(g, TimedVertexHashSink, &vertex_hash, &info)) {
+    goto cleanup;
+  }
+  e->hash_seconds = vertex_hash.seconds;
+  e->draw_seconds = CurrentSeconds() - start - e->hash_seconds;
+  e->vertex_hash = vertex_hash.hash.stream.hash;
+  e->segment_count = info.segment_count;
+  glm_vec3_copy(info.min_bounds, e->min_bounds);
+  glm_vec3_copy(info.max_bounds, e->max_bounds);
+  e->ok = 1;
+cleanup:
+  DestroyLSystemGenerator(g);
+}
+
+// Run by each thread in the pool: evaluates the next job until there are
+// none left.
+static void* RunBatchWorker(void *arg) {
+  BatchWorker *w = (BatchWorker *) arg;
+  BatchState *b = w->b;
+  BatchEntry *e = NULL;
+  double start;
+  uint32_t job;
+  while (1) {
+    job = __atomic_fetch_add(&(b->next_job), 1, __ATOMIC_RELAXED);
+    if (job >= b->job_count) break;
+    e = b->entries + b->jobs[job];
+    start = CurrentSeconds();
+    EvaluateEntry(e);
+    w->busy_seconds += CurrentSeconds() - start;
+    if (!e->ok) {
+      printf("%s: failed at %u iterations.\n", e->path,
+        (unsigned) e->iterations);
+      continue;
+    }
+    printf("%s: %u iterations, %u symbols, %llu segments in %.03f ms.\n",
+      e->path, (unsigned) e->iterations, (unsigned) e->length,
+      (unsigned long long) e->segment_count, (e->load_seconds +
+      e->expand_seconds + e->draw_seconds + e->hash_seconds) * 1000.0);
+  }
+  return NULL;
+}
+
+// Writes a row for every config, in the order they were given. Paths are
+// written as-is, so they shouldn't contain commas or quotes. Returns 0 on
+// error.
+static int WriteResults(BatchState *b) {
+  BatchEntry *e = NULL;
+  uint32_t i;
+  int to_return = 1;
+  FILE *f = fopen(b->output_path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", b->output_path, strerror(errno));
+    return 0;
+  }
+  fprintf(f, "config,status,iterations,predicted_bytes,length,segments,"
+    "min_x,min_y,min_z,max_x,max_y,max_z,load_s,expand_s,draw_s,hash_s,"
+    "string_hash,vertex_hash\n");
+  for (i = 0; i < b->entry_count; i++) {
+    e = b->entries + i;
+    if (!e->ok) {
+      fprintf(f, "%s,%s,%u,%llu,,,,,,,,,%.9f,%.9f,%.9f,%.9f,,\n", e->path,
+        e->loaded ? "failed" : "invalid", (unsigned) e->iterations,
+        (unsigned long long) e->predicted_bytes, e->load_seconds,
+        e->expand_seconds, e->draw_seconds, e->hash_seconds);
+      continue;
+    }
+    fprintf(f, "%s,ok,%u,%llu,%u,%llu,%g,%g,%g,%g,%g,%g,%.9f,%.9f,%.9f,%.9f,"
+      "%016llx,%016llx\n", e->path, (unsigned) e->iterations,
+      (unsigned long long) e->predicted_bytes, (unsigned) e->length,
+      (unsigned long long) e->segment_count, e->min_bounds[0],
+      e->min_bounds[1], e->min_bounds[2], e->max_bounds[0], e->max_bounds[1],
+      e->max_bounds[2], e->load_seconds, e->expand_seconds, e->draw_seconds,
+      e->hash_seconds, (unsigned long long) e->string_hash,
+      (unsigned long long) e->vertex_hash);
+  }
+  if (ferror(f)) to_return = 0;
+  if (fclose(f) != 0) to_return = 0;
+  if (!to_return) printf("Failed writing %s.\n", b->output_path);
+  return to_return;
+}
+
+// Evaluates every job on the thread pool, and prints a summary. Returns 0 on
+// error.
+static int EvaluateEntries(BatchState *b) {
+  BatchWorker *workers = NULL;
+  double start, elapsed, busy = 0;
+  uint32_t failed = 0, i;
+  if (b->threads > b->job_count) b->threads = b->job_count;
+  if (b->threads == 0) b->threads = 1;
+  workers = (BatchWorker *) calloc(b->threads, sizeof(BatchWorker));
+  if (!workers) {
+    printf("Failed allocating worker threads.\n");
+    return 0;
+  }
+  for (i = 0; i < b->threads; i++) {
+    workers[i].b = b;
+  }
+  start = CurrentSeconds();
+  if (!RunThreadGroup("Evaluate configs", b->threads, RunBatchWorker,
+    workers, sizeof(BatchWorker))) {
+    printf("Failed running worker threads.\n");
+    free(workers);
+    return 0;
+  }
+  elapsed = CurrentSeconds() - start;
+  for (i = 0; i < b->threads; i++) {
+    busy += workers[i].busy_seconds;
+  }
+  free(workers);
+  for (i = 0; i < b->entry_count; i++) {
+    if (!b->entries[i].ok) failed++;
+  }
+  printf("Evaluated %u configs, of which %u failed, on %u threads in %.03f "
+    "seconds.\n", (unsigned) b->entry_count, (unsigned) failed,
+    (unsigned) b->threads, elapsed);
+  if (elapsed > 0) {
+    printf("The threads were busy %.01f%% of the time.\n", 100.0 * busy /
+      (elapsed * b->threads));
+  }
+  return 1;
+}
+
+static void PrintUsage(const char *program) {
+  printf("Usage: %s [options] <output.csv> <config files or "
+    "directories...>\n", program);
+  printf("\nExpands every config and runs the turtle over it on a pool of "
+    "threads,\nwithout OpenGL, and writes the results to a CSV file. "
+    "Directories include every\nfile in them ending in .txt. Options:\n");
+  printf("  --iterations <count>: The most iterations to expand each config "
+    "to.\n    Default: %d.\n", DEFAULT_BATCH_MAX_ITERATIONS);
+  printf("  --budget <MB>: Expand each config to the most iterations whose "
+    "previous and\n    current strings are estimated to fit in this much "
+    "memory, or 0 to always\n    expand to --iterations. Default: %d.\n",
+    DEFAULT_BATCH_BUDGET_MB);
+  printf("  --threads <count>: The number of threads. Default: the number of "
+    "processors.\n");
+  printf("  --list <path>: Also evaluate every config file or directory "
+    "listed in the\n    file, one per line.\n");
+}
+
+// Parses a non-negative integer argument. Returns 0 if it's invalid.
+static int ParseCount(const char *arg, uint32_t *value) {
+  char *end = NULL;
+  unsigned long v;
+  errno = 0;
+  v = strtoul(arg, &end, 10);
+  if ((errno != 0) || (end == arg) || (*end != 0) || (arg[0] == '-') ||
+    (v > UINT32_MAX)) {
+    printf("Invalid number: %s\n", arg);
+    return 0;
+  }
+  *value = v;
+  return 1;
+}
+
+// Parses the options, the output path and the configs to evaluate. Returns 0
+// on error.
+static int ParseArguments(BatchState *b, int argc, char **argv) {
+  uint32_t budget_mb = DEFAULT_BATCH_BUDGET_MB;
+  int i = 1;
+  while ((i + 1) < argc) {
+    if (strcmp(argv[i], "--iterations") == 0) {
+      if (!ParseCount(argv[i + 1], &(b->max_iterations))) return 0;
+    } else if (strcmp(argv[i], "--budget") == 0) {
+      if (!ParseCount(argv[i + 1], &budget_mb)) return 0;
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      if (!ParseCount(argv[i + 1], &(b->threads))) return 0;
+      if (b->threads == 0) {
+        printf("At least one thread is required.\n");
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--list") == 0) {
+      if (!AddListedPaths(b, argv[i + 1])) return 0;
+    } else {
+      break;
+    }
+    i += 2;
+  }
+  b->budget_bytes = ((uint64_t) budget_mb) * 1024 * 1024;
+  if (i >= argc) return 0;
+  b->output_path = argv[i];
+  for (i++; i < argc; i++) {
+    if (!AddPath(b, argv[i])) return 0;
+  }
+  if (b->entry_count == 0) {
+    printf("No configs were given.\n");
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  BatchState b;
+  int to_return = 0;
+  memset(&b, 0, sizeof(b));
+  b.max_iterations = DEFAULT_BATCH_MAX_ITERATIONS;
+  b.threads = ProcessorCount();
+  if (!ParseArguments(&b, argc, argv)) {
+    PrintUsage(argv[0]);
+    FreeBatchState(&b);
+    return 1;
+  }
+  // The estimates leave out the turtle's stacks and the configs themselves,
+  // so the budget isn't enforced exactly. This keeps a bad estimate from
+  // running the system out of memory, though.
+  if (b.budget_bytes != 0) SetMemoryBudget(b.budget_bytes * 2 * b.threads);
+  if (!PredictEntries(&b)) {
+    to_return = 1;
+    goto cleanup;
+  }
+  SortJobs(&b);
+  if (!EvaluateEntries(&b) || !WriteResults(&b)) {
+    to_return = 1;
+    goto cleanup;
+  }
+  printf("Wrote results to %s.\n", b.output_path);
+cleanup:
+  FreeBatchState(&b);
+  return to_return;
+}
@@ -0,0 +1,580 @@
+// A benchmark for generating L-systems, without OpenGL or a window. For each
+// config, it repeatedly parses the config, expands the string one iteration
+// at a time, and runs the turtle over it, timing each step. The results are
+// written as CSV or JSON, with one row per config and number of iterations.
+// Configs from the benchmark corpus are only reported at the number of
+// iterations listed in the corpus's index.
+//
+// With --profile, each config is instead run once through the instrumented
+// turtle, and a profile of what it did is printed.
+//
+// Usage: l_system_bench [options] <output.csv|output.json> [config paths...]
+//    or: l_system_bench --profile <iterations> <config paths...>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <cglm/cglm.h>
+#include "benchmark_corpus.h"
+#include "l_system_string.h"
+#include "memory_budget.h"
+#include "parse_config.h"
+#include "trace.h"
+#include "turtle_3d.h"
+#include "turtle_profile.h"
+#include "utilities.h"
+
+#define DEFAULT_RUNS (5)
+#define DEFAULT_MIN_ITERATIONS (0)
+#define DEFAULT_MAX_ITERATIONS (8)
+
+typedef enum {
+  BENCH_FORMAT_CSV = 0,
+  BENCH_FORMAT_JSON,
+} BenchFormat;
+
+// The times taken for a single number of iterations, with one entry per run.
+typedef struct {
+  // The time taken to expand the string from the previous iteration.
+  double *expand;
+  // The time taken to run the turtle over the string, keeping the vertices.
+  double *generate;
+  // The time taken to run the turtle over the string without keeping the
+  // vertices, and compute the mesh's transform from its bounds.
+  double *bounds;
+  uint32_t symbol_count;
+  uint64_t segment_count;
+  // The most tracked memory allocated at once while expanding the string to
+  // this number of iterations and running the turtle over it, in any run.
+  uint64_t peak_tracked_bytes;
+  // The peak resident set size of the whole process so far, in KB, after the
+  // last run. This only grows, so it includes every earlier config and number
+  // of iterations.
+  long process_peak_rss_kb;
+} IterationSamples;
+
+typedef struct {
+  uint32_t runs;
+  uint32_t min_iterations;
+  uint32_t max_iterations;
+  BenchFormat format;
+  // The index written by l_system_corpus, if the corpus is benchmarked.
+  const char *corpus_path;
+  // Where to write trace events, or NULL if they aren't recorded.
+  const char *trace_events_path;
+  const char *output_path;
+  FILE *output;
+  // The number of rows written so far.
+  uint32_t row_count;
+  // The samples for the config being benchmarked. parse holds the time taken
+  // to parse the config in each run.
+  double *parse;
+  IterationSamples *iterations;
+  // Used when sorting the samples to get percentiles.
+  double *sorted;
+} BenchState;
+
+// Returns the process's peak resident set size so far, in KB.
+static long PeakRSSKB(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+// A turtle vertex sink that discards everything.
+static int DiscardVertices(void *data, MeshVertex *vertices, uint32_t count) {
+  return 1;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *((const double *) a);
+  double y = *((const double *) b);
+  if (x < y) return -1;
+  if (x > y) return 1;
+  return 0;
+}
+
+// Returns the given percentile, between 0 and 100, of the samples using the
+// nearest-rank method.
+static double Percentile(BenchState *b, double *samples, double percentile) {
+  uint32_t rank;
+  memcpy(b->sorted, samples, b->runs * sizeof(double));
+  qsort(b->sorted, b->runs, sizeof(double), CompareDoubles);
+  rank = (uint32_t) ceil((percentile / 100.0) * b->runs);
+  if (rank < 1) rank = 1;
+  return b->sorted[rank - 1];
+}
+
+static void FreeSamples(BenchState *b) {
+  uint32_t i;
+  if (b->iterations) {
+    for (i = 0; i <= b->max_iterations; i++) {
+      free(b->iterations[i].expand);
+      free(b->iterations[i].generate);
+      free(b->iterations[i].bounds);
+    }
+  }
+  free(b->iterations);
+  free(b->parse);
+  free(b->sorted);
+  b->iterations = NULL;
+  b->parse = NULL;
+  b->sorted = NULL;
+}
+
+// Allocates the arrays holding every run's samples. Returns 0 on error.
+static int AllocateSamples(BenchState *b) {
+  IterationSamples *s = NULL;
+  uint32_t i;
+  b->parse = (double *) calloc(b->runs, sizeof(double));
+  b->sorted = (double *) calloc(b->runs, sizeof(double));
+  b->iterations = (IterationSamples *) calloc(b->max_iterations + 1,
+    sizeof(IterationSamples));
+  if (!b->parse || !b->sorted || !b->iterations) {
+    printf("Failed allocating benchmark samples.\n");
+    return 0;
+  }
+  for (i = 0; i <= b->max_iterations; i++) {
+    s = b->iterations + i;
+    s->expand = (double *) calloc(b->runs, sizeof(double));
+    s->generate = (double *) calloc(b->runs, sizeof(double));
+    s->bounds = (double *) calloc(b->runs, sizeof(double));
+    if (!s->expand || !s->generate || !s->bounds) {
+      printf("Failed allocating benchmark samples.\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Times running the turtle over the string, both keeping the vertices and
+// only computing the bounds, and records the times for the given run. Returns
+// 0 on error.
+static int TimeTurtle(LSystemConfig *config, Turtle3D *t, const uint8_t *s,
+    uint32_t length, IterationSamples *samples, uint32_t run) {
+  mat4 model;
+  mat3 normal;
+  vec3 offset;
+  float size_scale;
+  double start_time;
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, NULL, NULL);
+  start_time = CurrentSeconds();
+  if (!RunLSystemString(config, t, s, length)) return 0;
+  samples->generate[run] = CurrentSeconds() - start_time;
+  samples->segment_count = t->vertex_count / 2;
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, DiscardVertices, NULL);
+  start_time = CurrentSeconds();
+  if (!RunLSystemString(config, t, s, length) || !FlushTurtleVertices(t)) {
+    return 0;
+  }
+  if (!SetTransformInfo(t, model, normal, offset, &size_scale)) {
+    printf("Failed getting transform matrices.\n");
+    return 0;
+  }
+  samples->bounds[run] = CurrentSeconds() - start_time;
+  SetTurtleVertexSink(t, NULL, NULL);
+  return 1;
+}
+
+// Runs the whole benchmark for the config once, recording the times for the
+// given run. Returns 0 on error.
+static int RunBenchmark(BenchState *b, const char *config_path,
+    uint32_t run) {
+  LSystemConfig *config = NULL;
+  Turtle3D *t = NULL;
+  IterationSamples *samples = NULL;
+  uint8_t *s = NULL;
+  uint8_t *new_s = NULL;
+  uint32_t length, new_length, i;
+  double start_time;
+  double run_start_time = BeginTraceEvent();
+  int to_return = 0;
+  start_time = CurrentSeconds();
+  config = LoadLSystemConfig(config_path);
+  if (!config) return 0;
+  b->parse[run] = CurrentSeconds() - start_time;
+  t = CreateTurtle3D();
+  s = (uint8_t *) TrackedStrdup(MEMORY_STRINGS, config->init);
+  if (!t || !s) {
+    printf("Failed allocating the turtle or L-system string.\n");
+    goto cleanup;
+  }
+  length = strlen(config->init);
+  for (i = 0; i <= b->max_iterations; i++) {
+    samples = b->iterations + i;
+    ResetPeakTrackedBytes();
+    if (i > 0) {
+      start_time = CurrentSeconds();
+      new_s = ExpandLSystemString(config, s, length, &new_length);
+      if (!new_s) goto cleanup;
+      samples->expand[run] = CurrentSeconds() - start_time;
+      TrackedFree(s);
+      s = new_s;
+      length = new_length;
+    }
+    samples->symbol_count = length;
+    if (i < b->min_iterations) continue;
+    if (!TimeTurtle(config, t, s, length, samples, run)) goto cleanup;
+    if (run == 0) samples->peak_tracked_bytes = 0;
+    if (PeakTotalTrackedBytes() > samples->peak_tracked_bytes) {
+      samples->peak_tracked_bytes = PeakTotalTrackedBytes();
+    }
+    samples->process_peak_rss_kb = PeakRSSKB();
+  }
+  EndTraceEventArg("Benchmark run", run_start_time, "run", run);
+  to_return = 1;
+cleanup:
+  TrackedFree(s);
+  if (t) DestroyTurtle3D(t);
+  DestroyLSystemConfig(config);
+  return to_return;
+}
+
+// Writes the start of the output file. Returns 0 on error.
+static int WriteHeader(BenchState *b) {
+  if (b->format == BENCH_FORMAT_JSON) {
+    fprintf(b->output, "{\"runs\": %u, \"results\": [", (unsigned) b->runs);
+  } else {
+    fprintf(b->output, "config,iterations,runs,symbols,segments,"
+      "parse_median_s,expand_median_s,expand_p95_s,generate_median_s,"
+      "generate_p95_s,bounds_median_s,bounds_p95_s,symbols_per_s,"
+      "segments_per_s,peak_tracked_bytes,process_peak_rss_kb\n");
+  }
+  return !ferror(b->output);
+}
+
+// Writes the end of the output file. Returns 0 on error.
+static int WriteFooter(BenchState *b) {
+  if (b->format == BENCH_FORMAT_JSON) fprintf(b->output, "\n]}\n");
+  return !ferror(b->output);
+}
+
+// Writes the summary of a single number of iterations of a config, and
+// prints it. The config's path is written as-is, so it shouldn't contain
+// commas or quotes. Returns 0 on error.
+static int WriteRow(BenchState *b, const char *config_path,
+    uint32_t iterations) {
+  IterationSamples *s = b->iterations + iterations;
+  double parse = Percentile(b, b->parse, 50);
+  double expand = Percentile(b, s->expand, 50);
+  double expand_p95 = Percentile(b, s->expand, 95);
+  double generate = Percentile(b, s->generate, 50);
+  double generate_p95 = Percentile(b, s->generate, 95);
+  double bounds = Percentile(b, s->bounds, 50);
+  double bounds_p95 = Percentile(b, s->bounds, 95);
+  // Rates are 0 if the step was too fast to measure, or skipped.
+  double symbols_per_s = expand > 0 ? s->symbol_count / expand : 0;
+  double segments_per_s = generate > 0 ? s->segment_count / generate : 0;
+  if (b->format == BENCH_FORMAT_JSON) {
+    fprintf(b->output, "%s\n  {\"config\": \"%s\", \"iterations\": %u, "
+      "\"symbols\": %u, \"segments\": %llu, \"parse_median_s\": %.9f, "
+      "\"expand_median_s\": %.9f, \"expand_p95_s\": %.9f, "
+      "\"generate_median_s\": %.9f, \"generate_p95_s\": %.9f, "
+      "\"bounds_median_s\": %.9f, \"bounds_p95_s\": %.9f, "
+      "\"symbols_per_s\": %.1f, \"segments_per_s\": %.1f, "
+      "\"peak_tracked_bytes\": %llu, \"process_peak_rss_kb\": %ld}",
+      b->row_count > 0 ? "," : "", config_path, (unsigned) iterations,
+      (unsigned) s->symbol_count, (unsigned long long) s->segment_count,
+      parse, expand, expand_p95, generate, generate_p95, bounds, bounds_p95,
+      symbols_per_s, segments_per_s,
+      (unsigned long long) s->peak_tracked_bytes, s->process_peak_rss_kb);
+  } else {
+    fprintf(b->output, "%s,%u,%u,%u,%llu,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f,"
+      "%.1f,%.1f,%llu,%ld\n", config_path, (unsigned) iterations,
+      (unsigned) b->runs, (unsigned) s->symbol_count,
+      (unsigned long long) s->segment_count, parse, expand, expand_p95,
+      generate, generate_p95, bounds, bounds_p95, symbols_per_s,
+      segments_per_s, (unsigned long long) s->peak_tracked_bytes,
+      s->process_peak_rss_kb);
+  }
+  b->row_count++;
+  printf("%s, %u iterations: %u symbols, %llu segments. Expanding: %.03f ms "
+    "(%.02f million symbols/s). Generating: %.03f ms (%.02f million "
+    "segments/s). Bounds: %.03f ms. Peak memory: %.02f MB (process RSS "
+    "%.02f MB).\n", config_path, (unsigned) iterations,
+    (unsigned) s->symbol_count, (unsigned long long) s->segment_count,
+    expand * 1000.0, symbols_per_s / 1e6, generate * 1000.0,
+    segments_per_s / 1e6, bounds * 1000.0,
+    ((double) s->peak_tracked_bytes) / (1024.0 * 1024.0),
+    ((double) s->process_peak_rss_kb) / 1024.0);
+  return !ferror(b->output);
+}
+
+// Benchmarks a single config, and writes its rows. Returns 0 on error.
+static int BenchmarkConfig(BenchState *b, const char *config_path) {
+  uint32_t run, i;
+  int to_return = 0;
+  if (!AllocateSamples(b)) goto cleanup;
+  for (run = 0; run < b->runs; run++) {
+    if (!RunBenchmark(b, config_path, run)) {
+      printf("Failed benchmarking %s.\n", config_path);
+      goto cleanup;
+    }
+  }
+  for (i = b->min_iterations; i <= b->max_iterations; i++) {
+    if (!WriteRow(b, config_path, i)) {
+      printf("Failed writing results to %s: %s\n", b->output_path,
+        strerror(errno));
+      goto cleanup;
+    }
+  }
+  to_return = 1;
+cleanup:
+  FreeSamples(b);
+  return to_return;
+}
+
+static void PrintUsage(const char *program) {
+  printf("Usage: %s [options] <output.csv|output.json> [config paths...]\n",
+    program);
+  printf("   or: %s --profile <iterations> <config paths...>\n", program);
+  printf("\nExpands each config and runs the turtle over it, without OpenGL, "
+    "timing each\nstep. Options:\n");
+  printf("  --runs <count>: The number of times to repeat everything. "
+    "Default: %d.\n", DEFAULT_RUNS);
+  printf("  --iterations <min>-<max>: The numbers of iterations to report. "
+    "Default:\n    %d-%d.\n", DEFAULT_MIN_ITERATIONS, DEFAULT_MAX_ITERATIONS);
+  printf("  --format <csv|json>: The output format. Default: json if the "
+    "output path\n    ends in .json, otherwise csv.\n");
+  printf("  --corpus <index>: Also benchmark every config in the index "
+    "written by\n    l_system_corpus, at the iterations listed for it.\n");
+  printf("  --trace-events <path>: Record how long each run, expansion and "
+    "run of the\n    turtle takes, and write it as Chrome trace-event "
+    "JSON.\n");
+  printf("\nWith --profile, each config is expanded to the given number of "
+    "iterations and\nrun once through an instrumented turtle, which prints "
+    "how often each action\nand symbol ran, ranked by cost.\n");
+}
+
+// Parses a positive integer argument. Returns 0 if it's invalid.
+static int ParseCount(const char *arg, uint32_t *value) {
+  char *end = NULL;
+  unsigned long v;
+  errno = 0;
+  v = strtoul(arg, &end, 10);
+  if ((errno != 0) || (end == arg) || (*end != 0) || (arg[0] == '-') ||
+    (v > UINT32_MAX)) {
+    printf("Invalid number: %s\n", arg);
+    return 0;
+  }
+  *value = v;
+  return 1;
+}
+
+// Parses an iteration range, either a single number or "<min>-<max>".
+// Returns 0 if it's invalid.
+static int ParseIterations(const char *arg, uint32_t *min, uint32_t *max) {
+  const char *start = arg;
+  char *end = NULL;
+  unsigned long a, b;
+  errno = 0;
+  a = strtoul(start, &end, 10);
+  b = a;
+  if ((errno == 0) && (end != start) && (*end == '-')) {
+    start = end + 1;
+    b = strtoul(start, &end, 10);
+  }
+  if ((errno != 0) || (end == start) || (*end != 0) || (arg[0] == '-') ||
+    (a > b) || (b > UINT32_MAX)) {
+    printf("Invalid iteration range: %s\n", arg);
+    return 0;
+  }
+  *min = a;
+  *max = b;
+  return 1;
+}
+
+// Parses the options and output path. Sets *next to the index of the first
+// config path. Returns 0 on error.
+static int ParseArguments(BenchState *b, int argc, char **argv, int *next) {
+  size_t length;
+  int format_set = 0;
+  int i = 1;
+  while ((i + 1) < argc) {
+    if (strcmp(argv[i], "--runs") == 0) {
+      if (!ParseCount(argv[i + 1], &(b->runs))) return 0;
+      if (b->runs == 0) {
+        printf("At least one run is required.\n");
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--iterations") == 0) {
+      if (!ParseIterations(argv[i + 1], &(b->min_iterations),
+        &(b->max_iterations))) {
+        return 0;
+      }
+    } else if (strcmp(argv[i], "--format") == 0) {
+      if (strcmp(argv[i + 1], "csv") == 0) {
+        b->format = BENCH_FORMAT_CSV;
+      } else if (strcmp(argv[i + 1], "json") == 0) {
+        b->format = BENCH_FORMAT_JSON;
+      } else {
+        printf("Invalid output format: %s\n", argv[i + 1]);
+        return 0;
+      }
+      format_set = 1;
+    } else if (strcmp(argv[i], "--corpus") == 0) {
+      b->corpus_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--trace-events") == 0) {
+      b->trace_events_path = argv[i + 1];
+    } else {
+      break;
+    }
+    i += 2;
+  }
+  // At least one config path must follow the output path, unless the corpus
+  // is benchmarked.
+  if (i >= argc) return 0;
+  if (!b->corpus_path && ((i + 1) >= argc)) return 0;
+  b->output_path = argv[i];
+  length = strlen(b->output_path);
+  if (!format_set && (length >= 5) &&
+    (strcmp(b->output_path + length - 5, ".json") == 0)) {
+    b->format = BENCH_FORMAT_JSON;
+  }
+  *next = i + 1;
+  return 1;
+}
+
+// Benchmarks every config in the corpus at the number of iterations listed
+// for it. Returns 0 on error.
+static int BenchmarkCorpusConfigs(BenchState *b) {
+  BenchmarkCorpus *c = NULL;
+  CorpusEntry *e = NULL;
+  uint32_t min_iterations = b->min_iterations;
+  uint32_t max_iterations = b->max_iterations;
+  uint32_t i;
+  int result = 1;
+  c = LoadBenchmarkCorpus(b->corpus_path);
+  if (!c) return 0;
+  for (i = 0; result && (i < c->entry_count); i++) {
+    e = c->entries + i;
+    if (!e->has_iterations) {
+      printf("%s doesn't list the iterations for %s. Use the index written "
+        "by\nl_system_corpus rather than the manifest.\n", b->corpus_path,
+        e->name);
+      result = 0;
+      break;
+    }
+    b->min_iterations = e->iterations;
+    b->max_iterations = e->iterations;
+    result = BenchmarkConfig(b, e->config_path);
+  }
+  b->min_iterations = min_iterations;
+  b->max_iterations = max_iterations;
+  DestroyBenchmarkCorpus(c);
+  return result;
+}
+
+// Expands the config to the given number of iterations, runs the turtle over
+// it while profiling, and prints the profile. Returns 0 on error.
+static int ProfileConfig(const char *config_path, uint32_t iterations) {
+  LSystemConfig *config = NULL;
+  Turtle3D *t = NULL;
+  uint8_t *s = NULL;
+  uint8_t *new_s = NULL;
+  uint32_t length, new_length, i;
+  TurtleProfile profile;
+  int to_return = 0;
+  config = LoadLSystemConfig(config_path);
+  if (!config) return 0;
+  t = CreateTurtle3D();
+  s = (uint8_t *) TrackedStrdup(MEMORY_STRINGS, config->init);
+  if (!t || !s) {
+    printf("Failed allocating the turtle or L-system string.\n");
+    goto cleanup;
+  }
+  length = strlen(config->init);
+  for (i = 0; i < iterations; i++) {
+    new_s = ExpandLSystemString(config, s, length, &new_length);
+    if (!new_s) goto cleanup;
+    TrackedFree(s);
+    s = new_s;
+    length = new_length;
+  }
+  // Vertices are passed to a sink in batches, the same as in the viewer.
+  InitTurtleProfile(&profile);
+  SetTurtleVertexSink(t, DiscardVertices, NULL);
+  if (!RunProfiledLSystemString(config, t, s, length, &profile) ||
+    !FlushTurtleVertices(t)) {
+    goto cleanup;
+  }
+  printf("\nProfile of %s at %u iterations:\n", config_path,
+    (unsigned) iterations);
+  PrintTurtleProfile(&profile);
+  to_return = 1;
+cleanup:
+  TrackedFree(s);
+  if (t) DestroyTurtle3D(t);
+  DestroyLSystemConfig(config);
+  return to_return;
+}
+
+// Runs the --profile mode. Returns the program's exit code.
+static int ProfileConfigs(int argc, char **argv) {
+  uint32_t iterations;
+  int i;
+  if ((argc < 4) || !ParseCount(argv[2], &iterations)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  for (i = 3; i < argc; i++) {
+    if (!ProfileConfig(argv[i], iterations)) {
+      printf("Failed profiling %s.\n", argv[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  BenchState b;
+  int i, to_return = 0;
+  if ((argc > 1) && (strcmp(argv[1], "--profile") == 0)) {
+    return ProfileConfigs(argc, argv);
+  }
+  memset(&b, 0, sizeof(b));
+  b.runs = DEFAULT_RUNS;
+  b.min_iterations = DEFAULT_MIN_ITERATIONS;
+  b.max_iterations = DEFAULT_MAX_ITERATIONS;
+  if (!ParseArguments(&b, argc, argv, &i)) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  b.output = fopen(b.output_path, "wb");
+  if (!b.output) {
+    printf("Failed opening %s: %s\n", b.output_path, strerror(errno));
+    return 1;
+  }
+  if (b.trace_events_path) {
+    StartTracing();
+    SetTraceThreadName("Main thread");
+  }
+  if (!WriteHeader(&b)) {
+    printf("Failed writing to %s: %s\n", b.output_path, strerror(errno));
+    to_return = 1;
+  }
+  if (!to_return && b.corpus_path && !BenchmarkCorpusConfigs(&b)) to_return = 1;
+  for (; !to_return && (i < argc); i++) {
+    if (!BenchmarkConfig(&b, argv[i])) to_return = 1;
+  }
+  if (!to_return && !WriteFooter(&b)) {
+    printf("Failed writing to %s: %s\n", b.output_path, strerror(errno));
+    to_return = 1;
+  }
+  if (fclose(b.output) != 0) to_return = 1;
+  if (!to_return) printf("Wrote results to %s.\n", b.output_path);
+  if (TracingEnabled()) {
+    if (!WriteTrace(b.trace_events_path)) to_return = 1;
+    StopTracing();
+  }
+  return to_return;
+}
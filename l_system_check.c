@@ -0,0 +1,481 @@
+// Checks that configs still expand and draw to the same output, by comparing
+// a hash of the expanded string and summaries of the turtle's vertices
+// against a file of golden checksums. Doesn't use OpenGL.
+//
+// Each entry in the golden file is a line containing a config path, relative
+// to the current directory, and a number of iterations, followed by the
+// string's length, the number of segments and the string's hash. It's
+// followed by a "block" line for each VertexBlockSummary of the vertices: the
+// number of vertices, the minimum and maximum location, and the sum of each
+// component. A "quantum" line sets the tolerance used when comparing the
+// blocks. Blank lines and lines starting with '#' are ignored. With --update,
+// the lengths, counts, hashes and blocks are recomputed and written back to
+// the file, keeping everything else, which is also how new entries are added.
+//
+// --perturb moves every vertex component by the given number of ulps before
+// summarizing it, to check that such small differences are tolerated.
+//
+// Usage: l_system_check [--update | --perturb <ulps>] <golden file>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "l_system_string.h"
+#include "memory_budget.h"
+#include "output_hash.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+#include "utilities.h"
+
+// The longest config path allowed in the golden file.
+#define MAX_GOLDEN_PATH (1024)
+
+// The most ulps that --perturb may move each vertex component.
+#define MAX_PERTURB_ULPS (64)
+
+// A single line of the golden file, listing a config's expected output.
+typedef struct {
+  char path[MAX_GOLDEN_PATH];
+  uint32_t iterations;
+  // Nonzero if the line includes the expected output. Otherwise, only
+  // --update can be used.
+  int has_output;
+  uint64_t length;
+  uint64_t segments;
+  uint64_t string_hash;
+  VertexSummary vertices;
+} GoldenEntry;
+
+// Passed to PerturbedSummarySink.
+typedef struct {
+  VertexSummary *summary;
+  int ulps;
+} PerturbedSummary;
+
+static void PrintUsage(const char *program) {
+  printf("Usage: %s [--update | --perturb <ulps>] <golden file>\n",
+    program);
+  printf("\nExpands each config listed in the golden file and runs the "
+    "turtle over it,\nwithout OpenGL, and checks that the string's hash "
+    "and a summary of the\nvertices match the file. --update rewrites the "
+    "file with the current output\ninstead. --perturb moves each vertex "
+    "component by the given number of ulps\nbefore checking it.\n");
+}
+
+// Parses an entry from the golden file, not including its vertex blocks.
+// Returns 0 if it's invalid.
+static int ParseGoldenEntry(const char *line, GoldenEntry *e) {
+  unsigned long long length, segments, string_hash;
+  unsigned iterations;
+  char format[64];
+  int count;
+  memset(e, 0, sizeof(*e));
+  snprintf(format, sizeof(format), "%%%ds %%u %%llu %%llu %%llx",
+    MAX_GOLDEN_PATH - 1);
+  count = sscanf(line, format, e->path, &iterations, &length, &segments,
+    &string_hash);
+  if ((count != 2) && (count != 5)) return 0;
+  e->iterations = iterations;
+  if (count == 5) {
+    e->has_output = 1;
+    e->length = length;
+    e->segments = segments;
+    e->string_hash = string_hash;
+  }
+  return 1;
+}
+
+// Returns nonzero if the line, with leading whitespace skipped, is one of an
+// entry's vertex blocks.
+static int IsBlockLine(const char *line) {
+  line += strspn(line, " \t");
+  return (strncmp(line, "block", 5) == 0) && ((line[5] == ' ') ||
+    (line[5] == '\t'));
+}
+
+// Parses one of the entry's vertex blocks, and appends it to the entry's
+// summary. Returns 0 if it's invalid.
+static int ParseVertexBlock(const char *line, GoldenEntry *e) {
+  VertexBlockSummary block;
+  VertexSummary *s = &(e->vertices);
+  double values[6 + VERTEX_SUMMARY_COMPONENTS];
+  unsigned long count;
+  char *end = NULL;
+  void *tmp = NULL;
+  int i;
+  line += strspn(line, " \t") + 5;
+  count = strtoul(line, &end, 10);
+  if ((end == line) || (count == 0) || (count > VERTEX_SUMMARY_BLOCK_SIZE)) {
+    return 0;
+  }
+  for (i = 0; i < (6 + VERTEX_SUMMARY_COMPONENTS); i++) {
+    line = end;
+    values[i] = strtod(line, &end);
+    if (end == line) return 0;
+  }
+  if (end[strspn(end, " \t\r")] != 0) return 0;
+  memset(&block, 0, sizeof(block));
+  block.vertex_count = count;
+  for (i = 0; i < 3; i++) {
+    block.min_location[i] = values[i];
+    block.max_location[i] = values[3 + i];
+  }
+  for (i = 0; i < VERTEX_SUMMARY_COMPONENTS; i++) {
+    block.sums[i] = values[6 + i];
+  }
+  if (s->block_count >= s->block_capacity) {
+    tmp = TrackedRealloc(MEMORY_TURTLE, s->blocks, (s->block_capacity + 16) *
+      sizeof(VertexBlockSummary));
+    if (!tmp) {
+      printf("Failed allocating golden vertex blocks.\n");
+      return 0;
+    }
+    s->blocks = (VertexBlockSummary *) tmp;
+    s->block_capacity += 16;
+  }
+  s->blocks[s->block_count] = block;
+  s->block_count++;
+  s->vertex_count += count;
+  return 1;
+}
+
+// A TurtleVertexSink that moves each component of a copy of every vertex by
+// a number of ulps, away from zero, before adding it to a VertexSummary. The
+// data must be a PerturbedSummary.
+static int PerturbedSummarySink(void *data, MeshVertex *vertices,
+    uint32_t count) {
+  PerturbedSummary *p = (PerturbedSummary *) data;
+  MeshVertex v;
+  float *values[4];
+  int sizes[4] = {3, 3, 3, 4};
+  uint32_t i;
+  int j, k, n;
+  for (i = 0; i < count; i++) {
+    v = vertices[i];
+    values[0] = v.location;
+    values[1] = v.forward;
+    values[2] = v.up;
+    values[3] = v.color;
+    for (j = 0; j < 4; j++) {
+      for (k = 0; k < sizes[j]; k++) {
+        for (n = 0; n < p->ulps; n++) {
+          values[j][k] = nextafterf(values[j][k], (values[j][k] < 0) ?
+            -INFINITY : INFINITY);
+        }
+      }
+    }
+    if (!UpdateVertexSummary(p->summary, &v, 1)) return 0;
+  }
+  return 1;
+}
+
+// Expands the entry's config and runs the turtle over it, and fills in the
+// entry's output. If perturb_ulps is nonzero, the vertices are perturbed by
+// PerturbedSummarySink. Returns 0 on error.
+static int ComputeOutput(GoldenEntry *e, int perturb_ulps) {
+  LSystemConfig *config = NULL;
+  Turtle3D *t = NULL;
+  uint8_t *s = NULL;
+  uint8_t *new_s = NULL;
+  uint32_t length, new_length, i;
+  StreamHash string_hash;
+  PerturbedSummary perturbed;
+  int result = 0;
+  config = LoadLSystemConfig(e->path);
+  if (!config) return 0;
+  t = CreateTurtle3D();
+  s = (uint8_t *) TrackedStrdup(MEMORY_STRINGS, config->init);
+  if (!t || !s) {
+    printf("Failed allocating the turtle or L-system string.\n");
+    goto cleanup;
+  }
+  length = strlen(config->init);
+  for (i = 0; i < e->iterations; i++) {
+    new_s = ExpandLSystemString(config, s, length, &new_length);
+    if (!new_s) goto cleanup;
+    TrackedFree(s);
+    s = new_s;
+    length = new_length;
+  }
+  InitStreamHash(&string_hash);
+  UpdateStreamHash(&string_hash, s, length);
+  if (perturb_ulps) {
+    perturbed.summary = &(e->vertices);
+    perturbed.ulps = perturb_ulps;
+    SetTurtleVertexSink(t, PerturbedSummarySink, &perturbed);
+  } else {
+    SetTurtleVertexSink(t, VertexSummarySink, &(e->vertices));
+  }
+  if (!RunLSystemString(config, t, s, length) || !FlushTurtleVertices(t)) {
+    goto cleanup;
+  }
+  e->has_output = 1;
+  e->length = length;
+  e->segments = e->vertices.vertex_count / 2;
+  e->string_hash = string_hash.hash;
+  result = 1;
+cleanup:
+  TrackedFree(s);
+  if (t) DestroyTurtle3D(t);
+  DestroyLSystemConfig(config);
+  return result;
+}
+
+// Compares the computed output to the golden output, printing any
+// differences. Vertex blocks are compared using the quantum as the
+// tolerance. Returns 0 if they differ.
+static int CompareOutput(GoldenEntry *golden, GoldenEntry *current,
+    double quantum) {
+  VertexSummary *a = &(golden->vertices);
+  VertexSummary *b = &(current->vertices);
+  uint32_t i, mismatched_blocks = 0;
+  int result = 1;
+  if (current->length != golden->length) {
+    printf("  String length: expected %llu, got %llu.\n",
+      (unsigned long long) golden->length,
+      (unsigned long long) current->length);
+    result = 0;
+  }
+  if (current->segments != golden->segments) {
+    printf("  Segments: expected %llu, got %llu.\n",
+      (unsigned long long) golden->segments,
+      (unsigned long long) current->segments);
+    result = 0;
+  }
+  if (current->string_hash != golden->string_hash) {
+    printf("  String hash: expected %016llx, got %016llx.\n",
+      (unsigned long long) golden->string_hash,
+      (unsigned long long) current->string_hash);
+    result = 0;
+  }
+  if (b->block_count != a->block_count) {
+    printf("  Vertex blocks: expected %u, got %u.\n",
+      (unsigned) a->block_count, (unsigned) b->block_count);
+    return 0;
+  }
+  for (i = 0; i < a->block_count; i++) {
+    if (VertexBlocksMatch(a->blocks + i, b->blocks + i, quantum)) continue;
+    if (mismatched_blocks == 0) {
+      printf("  Vertices %llu to %llu differ by more than the quantum.\n",
+        ((unsigned long long) i) * VERTEX_SUMMARY_BLOCK_SIZE,
+        ((unsigned long long) i) * VERTEX_SUMMARY_BLOCK_SIZE +
+        a->blocks[i].vertex_count - 1);
+    }
+    mismatched_blocks++;
+  }
+  if (mismatched_blocks != 0) {
+    printf("  %u of %u vertex blocks differ.\n", (unsigned) mismatched_blocks,
+      (unsigned) a->block_count);
+    result = 0;
+  }
+  return result;
+}
+
+// Writes the entry as a line of the golden file, followed by its vertex
+// blocks. Bounds are written with enough digits to represent each float
+// exactly.
+static void WriteGoldenEntry(FILE *f, GoldenEntry *e) {
+  VertexBlockSummary *b = NULL;
+  uint32_t i;
+  int j;
+  fprintf(f, "%s %u %llu %llu %016llx\n", e->path,
+    (unsigned) e->iterations, (unsigned long long) e->length,
+    (unsigned long long) e->segments, (unsigned long long) e->string_hash);
+  for (i = 0; i < e->vertices.block_count; i++) {
+    b = e->vertices.blocks + i;
+    fprintf(f, "  block %u", (unsigned) b->vertex_count);
+    for (j = 0; j < 3; j++) fprintf(f, " %.9g", b->min_location[j]);
+    for (j = 0; j < 3; j++) fprintf(f, " %.9g", b->max_location[j]);
+    for (j = 0; j < VERTEX_SUMMARY_COMPONENTS; j++) {
+      fprintf(f, " %.12g", b->sums[j]);
+    }
+    fprintf(f, "\n");
+  }
+}
+
+// Splits off the line starting at *next, and advances *next to the following
+// line, or to NULL if there isn't one. Returns the line.
+static char* SplitLine(char **next) {
+  char *line = *next;
+  char *end = strchr(line, '\n');
+  *next = NULL;
+  if (end) {
+    *end = 0;
+    *next = end + 1;
+  }
+  return line;
+}
+
+// Checks or updates every entry in the golden file, whose content is
+// modified in place. If output isn't NULL, the updated file is written to
+// it. Sets *mismatches to the number of entries that didn't match. Returns 0
+// on error.
+static int CheckGoldenFile(char *content, const char *path, FILE *output,
+    int perturb_ulps, uint32_t *mismatches) {
+  GoldenEntry golden, current;
+  double quantum = DEFAULT_HASH_QUANTUM;
+  char *line = NULL;
+  char *next = content;
+  char *end = NULL;
+  const char *start = NULL;
+  uint32_t line_number = 0;
+  double start_time;
+  int result = 0;
+  memset(&golden, 0, sizeof(golden));
+  memset(&current, 0, sizeof(current));
+  *mismatches = 0;
+  while (next) {
+    line = SplitLine(&next);
+    line_number++;
+    start = line + strspn(line, " \t\r");
+    if ((*start == 0) || (*start == '#')) {
+      if (output && (next || (*line != 0))) fprintf(output, "%s\n", line);
+      continue;
+    }
+    if (strncmp(start, "quantum", 7) == 0) {
+      quantum = strtod(start + 7, &end);
+      if ((end == (start + 7)) || !(quantum > 0) ||
+        (end[strspn(end, " \t\r")] != 0)) {
+        printf("Invalid quantum on line %u of %s.\n", (unsigned) line_number,
+          path);
+        return 0;
+      }
+      if (output) fprintf(output, "%s\n", line);
+      continue;
+    }
+    if (IsBlockLine(start)) {
+      printf("Vertex block on line %u of %s doesn't follow an entry.\n",
+        (unsigned) line_number, path);
+      return 0;
+    }
+    if (!ParseGoldenEntry(start, &golden)) {
+      printf("Invalid entry on line %u of %s.\n", (unsigned) line_number,
+        path);
+      return 0;
+    }
+    while (next && IsBlockLine(next)) {
+      line = SplitLine(&next);
+      line_number++;
+      if (!ParseVertexBlock(line, &golden)) {
+        printf("Invalid vertex block on line %u of %s.\n",
+          (unsigned) line_number, path);
+        goto cleanup;
+      }
+    }
+    current = golden;
+    InitVertexSummary(&(current.vertices));
+    start_time = CurrentSeconds();
+    if (!ComputeOutput(&current, perturb_ulps)) {
+      printf("Failed generating %s at %u iterations.\n", golden.path,
+        (unsigned) golden.iterations);
+      goto cleanup;
+    }
+    if (output) {
+      WriteGoldenEntry(output, &current);
+      printf("%s, %u iterations: %llu symbols, %llu segments.\n",
+        current.path, (unsigned) current.iterations,
+        (unsigned long long) current.length,
+        (unsigned long long) current.segments);
+    } else if (!golden.has_output) {
+      printf("%s, %u iterations: no golden output. Run with --update to add "
+        "it.\n", golden.path, (unsigned) golden.iterations);
+      (*mismatches)++;
+    } else if (!CompareOutput(&golden, &current, quantum)) {
+      printf("%s, %u iterations: MISMATCH.\n", golden.path,
+        (unsigned) golden.iterations);
+      (*mismatches)++;
+    } else {
+      printf("%s, %u iterations: OK (%.03f seconds).\n", golden.path,
+        (unsigned) golden.iterations, CurrentSeconds() - start_time);
+    }
+    FreeVertexSummary(&(golden.vertices));
+    FreeVertexSummary(&(current.vertices));
+  }
+  result = 1;
+cleanup:
+  FreeVertexSummary(&(golden.vertices));
+  FreeVertexSummary(&(current.vertices));
+  return result;
+}
+
+// Rewrites the golden file with the current output. The new file is written
+// next to the old one, and then replaces it. Returns 0 on error.
+static int UpdateGoldenFile(char *content, const char *path) {
+  char *temp_path = NULL;
+  FILE *f = NULL;
+  uint32_t mismatches;
+  int result = 1;
+  temp_path = (char *) calloc(strlen(path) + 5, 1);
+  if (!temp_path) {
+    printf("Failed allocating path.\n");
+    return 0;
+  }
+  sprintf(temp_path, "%s.tmp", path);
+  f = fopen(temp_path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", temp_path, strerror(errno));
+    free(temp_path);
+    return 0;
+  }
+  result = CheckGoldenFile(content, path, f, 0, &mismatches);
+  if (ferror(f)) result = 0;
+  if (fclose(f) != 0) result = 0;
+  if (result) {
+    remove(path);
+    if (rename(temp_path, path) != 0) {
+      printf("Failed replacing %s: %s\n", path, strerror(errno));
+      result = 0;
+    }
+  }
+  if (!result) {
+    remove(temp_path);
+  } else {
+    printf("Updated %s.\n", path);
+  }
+  free(temp_path);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  char *content = NULL;
+  char *end = NULL;
+  uint32_t mismatches = 0;
+  long perturb_ulps = 0;
+  int update = 0;
+  int to_return = 0;
+  if ((argc == 3) && (strcmp(argv[1], "--update") == 0)) {
+    update = 1;
+    path = argv[2];
+  } else if ((argc == 4) && (strcmp(argv[1], "--perturb") == 0)) {
+    perturb_ulps = strtol(argv[2], &end, 10);
+    if ((*end != 0) || (perturb_ulps < 1) ||
+      (perturb_ulps > MAX_PERTURB_ULPS)) {
+      printf("--perturb must be between 1 and %d ulps.\n", MAX_PERTURB_ULPS);
+      return 1;
+    }
+    path = argv[3];
+  } else if (argc == 2) {
+    path = argv[1];
+  } else {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  content = ReadFullFile(path);
+  if (!content) return 1;
+  if (update) {
+    if (!UpdateGoldenFile(content, path)) to_return = 1;
+  } else if (!CheckGoldenFile(content, path, NULL, perturb_ulps,
+    &mismatches)) {
+    to_return = 1;
+  } else if (mismatches != 0) {
+    printf("%u configs didn't match %s.\n", (unsigned) mismatches, path);
+    to_return = 1;
+  } else {
+    printf("Every config matched %s.\n", path);
+  }
+  free(content);
+  return to_return;
+}
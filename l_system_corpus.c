@@ -0,0 +1,174 @@
+// Generates the benchmark corpus: a config for every entry in a corpus
+// manifest, generated from the entry's shape and seed, along with an index
+// listing the number of iterations each config can be expanded to within the
+// manifest's memory budget. Doesn't use OpenGL.
+//
+// Usage: l_system_corpus [options] <manifest> <output directory>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "benchmark_corpus.h"
+#include "parse_config.h"
+
+// The name of the index written to the output directory.
+#define CORPUS_INDEX_NAME "index.lst"
+
+static void PrintUsage(const char *program) {
+  printf("Usage: %s [options] <manifest> <output directory>\n", program);
+  printf("\nWrites a config for every entry in the manifest, and an index "
+    "listing each\nconfig's iterations, to the output directory. Options:\n");
+  printf("  --budget <MB>: The memory budget for each config, overriding the "
+    "manifest's.\n    Default: %d.\n", DEFAULT_CORPUS_BUDGET_MB);
+}
+
+// Parses a positive integer argument. Returns 0 if it's invalid.
+static int ParseCount(const char *arg, uint32_t *value) {
+  char *end = NULL;
+  unsigned long v;
+  errno = 0;
+  v = strtoul(arg, &end, 10);
+  if ((errno != 0) || (end == arg) || (*end != 0) || (arg[0] == '-') ||
+    (v > UINT32_MAX)) {
+    printf("Invalid number: %s\n", arg);
+    return 0;
+  }
+  *value = v;
+  return 1;
+}
+
+// Returns a new string containing the directory and name joined by a slash,
+// followed by the suffix, which must be freed by the caller. Returns NULL on
+// error.
+static char* JoinPath(const char *directory, const char *name,
+    const char *suffix) {
+  size_t length = strlen(directory) + strlen(name) + strlen(suffix) + 2;
+  char *path = (char *) calloc(length, 1);
+  if (!path) {
+    printf("Failed allocating path.\n");
+    return NULL;
+  }
+  snprintf(path, length, "%s/%s%s", directory, name, suffix);
+  return path;
+}
+
+// Writes the config for a single entry, and finds its iterations. Returns 0
+// on error.
+static int GenerateEntry(CorpusEntry *e, const char *directory,
+    uint64_t budget_bytes) {
+  LSystemConfig *config = NULL;
+  char *path = NULL;
+  FILE *f = NULL;
+  int result = 1;
+  // The entry's config_path is next to the manifest rather than in the
+  // output directory, so it isn't used here.
+  path = JoinPath(directory, e->name, ".txt");
+  if (!path) return 0;
+  f = fopen(path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    free(path);
+    return 0;
+  }
+  if (!WriteCorpusConfig(e->shape, e->seed, f)) result = 0;
+  if (fclose(f) != 0) result = 0;
+  if (!result) {
+    printf("Failed writing %s.\n", path);
+    free(path);
+    return 0;
+  }
+  config = LoadLSystemConfig(path);
+  if (!config) {
+    printf("Failed loading the generated config %s.\n", path);
+    free(path);
+    return 0;
+  }
+  CorpusIterationsForBudget(config, budget_bytes, &(e->iterations),
+    &(e->estimated_bytes));
+  e->has_iterations = 1;
+  printf("%s: %s, seed %llu, %u iterations (%.02f MB).\n", path,
+    CorpusShapeName(e->shape), (unsigned long long) e->seed,
+    (unsigned) e->iterations, ((double) e->estimated_bytes) / 1048576.0);
+  DestroyLSystemConfig(config);
+  free(path);
+  return 1;
+}
+
+// Writes the index of the corpus, in the same format as the manifest but
+// with every entry's iterations and estimated bytes. Returns 0 on error.
+static int WriteIndex(BenchmarkCorpus *c, const char *manifest_path,
+    const char *directory) {
+  char *path = JoinPath(directory, CORPUS_INDEX_NAME, "");
+  CorpusEntry *e = NULL;
+  FILE *f = NULL;
+  uint32_t i;
+  int result = 1;
+  if (!path) return 0;
+  f = fopen(path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    free(path);
+    return 0;
+  }
+  fprintf(f, "# Generated by l_system_corpus from %s.\n# name shape seed "
+    "iterations estimated_bytes\nbudget %llu\n", manifest_path,
+    (unsigned long long) (c->budget_bytes >> 20));
+  for (i = 0; i < c->entry_count; i++) {
+    e = c->entries + i;
+    fprintf(f, "%s %s %llu %u %llu\n", e->name, CorpusShapeName(e->shape),
+      (unsigned long long) e->seed, (unsigned) e->iterations,
+      (unsigned long long) e->estimated_bytes);
+  }
+  if (ferror(f)) result = 0;
+  if (fclose(f) != 0) result = 0;
+  if (!result) {
+    printf("Failed writing %s.\n", path);
+  } else {
+    printf("Wrote the index to %s.\n", path);
+  }
+  free(path);
+  return result;
+}
+
+int main(int argc, char **argv) {
+  BenchmarkCorpus *c = NULL;
+  const char *manifest_path = NULL;
+  const char *directory = NULL;
+  uint32_t budget_mb = 0;
+  uint32_t i;
+  int arg = 1;
+  int to_return = 0;
+  if ((argc > 2) && (strcmp(argv[1], "--budget") == 0)) {
+    if (!ParseCount(argv[2], &budget_mb) || (budget_mb == 0)) {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+    arg = 3;
+  }
+  if ((argc - arg) != 2) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  manifest_path = argv[arg];
+  directory = argv[arg + 1];
+  c = LoadBenchmarkCorpus(manifest_path);
+  if (!c) return 1;
+  if (budget_mb != 0) c->budget_bytes = ((uint64_t) budget_mb) << 20;
+  if ((mkdir(directory, 0755) != 0) && (errno != EEXIST)) {
+    printf("Failed creating %s: %s\n", directory, strerror(errno));
+    DestroyBenchmarkCorpus(c);
+    return 1;
+  }
+  for (i = 0; i < c->entry_count; i++) {
+    if (!GenerateEntry(c->entries + i, directory, c->budget_bytes)) {
+      to_return = 1;
+      break;
+    }
+  }
+  if (!to_return && !WriteIndex(c, manifest_path, directory)) to_return = 1;
+  DestroyBenchmarkCorpus(c);
+  return to_return;
+}
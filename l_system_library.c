@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "l_system_library.h"
+#include "l_system_string.h"
+#include "memory_budget.h"
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// Sets the generator's string to the config's initial string. Returns 0 on
+// error.
+static int ResetLSystemString(LSystemGenerator *g) {
+  // Cleared before allocating, so that the memory pressure callback never
+  // sees the freed string.
+  TrackedFree(g->string);
+  g->string = NULL;
+  g->length = 0;
+  g->iterations = 0;
+  g->string = (uint8_t *) TrackedStrdup(MEMORY_STRINGS, g->config->init);
+  if (!g->string) {
+    printf("Failed copying the initial L-system string.\n");
+    return 0;
+  }
+  g->length = strlen(g->config->init);
+  return 1;
+}
+
+// Finishes setting up a generator for the given config, which it takes
+// ownership of. Returns NULL on error, in which case the config is freed.
+static LSystemGenerator* CreateLSystemGenerator(LSystemConfig *config) {
+  LSystemGenerator *g = NULL;
+  if (!config) return NULL;
+  g = (LSystemGenerator *) TrackedCalloc(MEMORY_CONFIG, 1, sizeof(*g));
+  if (!g) {
+    printf("Failed allocating L-system generator.\n");
+    DestroyLSystemConfig(config);
+    return NULL;
+  }
+  g->config = config;
+  g->turtle = CreateTurtle3D();
+  if (!g->turtle) {
+    printf("Failed creating the turtle.\n");
+    DestroyLSystemGenerator(g);
+    return NULL;
+  }
+  if (!ResetLSystemString(g)) {
+    DestroyLSystemGenerator(g);
+    return NULL;
+  }
+  return g;
+}
+
+LSystemGenerator* LoadLSystemGenerator(const char *path) {
+  return CreateLSystemGenerator(LoadLSystemConfig(path));
+}
+
+LSystemGenerator* ParseLSystemGenerator(const char *content,
+    const char *name) {
+  return CreateLSystemGenerator(ParseLSystemConfig(content, name));
+}
+
+void DestroyLSystemGenerator(LSystemGenerator *g) {
+  if (!g) return;
+  TrackedFree(g->string);
+  if (g->turtle) DestroyTurtle3D(g->turtle);
+  if (g->config) DestroyLSystemConfig(g->config);
+  memset(g, 0, sizeof(*g));
+  TrackedFree(g);
+}
+
+int ExpandLSystemTo(LSystemGenerator *g, uint32_t iterations) {
+  uint8_t *new_string = NULL;
+  uint32_t new_length = 0;
+  if (g->iterations > iterations) {
+    if (!ResetLSystemString(g)) return 0;
+  }
+  while (g->iterations < iterations) {
+    new_string = ExpandLSystemString(g->config, g->string, g->length,
+      &new_length);
+    if (!new_string) {
+      printf("Failed expanding the L-system to %u iterations.\n",
+        (unsigned) (g->iterations + 1));
+      return 0;
+    }
+    TrackedFree(g->string);
+    g->string = new_string;
+    g->length = new_length;
+    g->iterations++;
+  }
+  return 1;
+}
+
+int DrawLSystem(LSystemGenerator *g, TurtleVertexSink sink, void *data,
+    LSystemDrawInfo *info) {
+  Turtle3D *t = g->turtle;
+  ResetTurtle3D(t);
+  SetTurtleVertexSink(t, sink, data);
+  if (!RunLSystemString(g->config, t, g->string, g->length)) return 0;
+  if (sink && !FlushTurtleVertices(t)) return 0;
+  if (!info) return 1;
+  memset(info, 0, sizeof(*info));
+  info->segment_count = (t->flushed_vertex_count + t->vertex_count) / 2;
+  if (info->segment_count != 0) {
+    glm_vec3_copy(t->min_bounds, info->min_bounds);
+    glm_vec3_copy(t->max_bounds, info->max_bounds);
+  }
+  return 1;
+}
+
+const MeshVertex* LSystemVertices(LSystemGenerator *g, uint32_t *count) {
+  *count = g->turtle->vertex_count;
+  return g->turtle->vertices;
+}
+
+int VertexArraySink(void *data, MeshVertex *vertices, uint32_t count) {
+  LSystemVertexArray *a = (LSystemVertexArray *) data;
+  if (count > (a->capacity - a->count)) {
+    printf("The vertex array is full, after %llu vertices.\n",
+      (unsigned long long) a->count);
+    return 0;
+  }
+  memcpy(a->vertices + a->count, vertices, count * sizeof(MeshVertex));
+  a->count += count;
+  return 1;
+}
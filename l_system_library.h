@@ -0,0 +1,90 @@
+// The public interface of liblsystem, a static library containing the
+// config parser, string expansion and turtle, for generating L-systems in
+// other programs. Nothing in the library uses OpenGL or GLFW. Programs using
+// it need the cglm headers, and must link with -lm and -lpthread.
+//
+// A generator holds a single config and its expanded string. Drawing runs
+// the turtle over the string, passing its vertices to a sink: either a
+// caller-provided function, one of the sinks below or in segment_writer.h
+// and output_hash.h, or none, in which case the generator keeps them.
+//
+// The library's memory is tracked by memory_budget.h, so a budget can be set
+// with SetMemoryBudget, and it can be allocated by the caller's own functions
+// using SetMemoryAllocator. The only exceptions are stdio's file buffers, and
+// trace events, which are only recorded after StartTracing from trace.h is
+// called, and always use the C library's allocator, since they're kept until
+// StopTracing. Separate generators can be used on separate threads at once.
+// Errors are printed to stdout.
+#ifndef L_SYSTEM_LIBRARY_H
+#define L_SYSTEM_LIBRARY_H
+#include <stdint.h>
+#include "memory_budget.h"
+#include "mesh_vertex.h"
+#include "output_hash.h"
+#include "parse_config.h"
+#include "segment_writer.h"
+#include "turtle_3d.h"
+
+typedef struct {
+  LSystemConfig *config;
+  Turtle3D *turtle;
+  // The expanded string, which is null-terminated, and its length.
+  uint8_t *string;
+  uint32_t length;
+  // The number of times the config's rules have been applied to string.
+  uint32_t iterations;
+} LSystemGenerator;
+
+// Information about the segments drawn by DrawLSystem.
+typedef struct {
+  uint64_t segment_count;
+  // The box containing every segment, or all zeros if there weren't any.
+  vec3 min_bounds;
+  vec3 max_bounds;
+} LSystemDrawInfo;
+
+// A vertex array allocated by the caller, for use with VertexArraySink.
+typedef struct {
+  MeshVertex *vertices;
+  // The number of vertices the array can hold, and the number written so
+  // far. The count must be set to 0 before drawing.
+  uint64_t capacity;
+  uint64_t count;
+} LSystemVertexArray;
+
+// Loads the config file at the given path, and returns a generator with its
+// initial string. Returns NULL on error.
+LSystemGenerator* LoadLSystemGenerator(const char *path);
+
+// Like LoadLSystemGenerator, but parses a config that's already in memory.
+// The name is only used in error messages.
+LSystemGenerator* ParseLSystemGenerator(const char *content,
+    const char *name);
+
+// Frees the generator, including its string and any vertices it's kept. Does
+// nothing if g is NULL.
+void DestroyLSystemGenerator(LSystemGenerator *g);
+
+// Expands the string to the given number of iterations, starting over from
+// the initial string if it's already been expanded further. Returns 0 on
+// error, including if the string would exceed the memory budget, in which
+// case the string is left at the last iteration that was reached.
+int ExpandLSystemTo(LSystemGenerator *g, uint32_t iterations);
+
+// Runs the turtle over the current string. Each batch of vertices, in pairs
+// making up segments, is passed to the sink along with data. If sink is NULL,
+// every vertex is kept by the generator instead, until it's drawn again, and
+// can be read using LSystemVertices. If info isn't NULL, it's filled in.
+// Returns 0 on error, including if the sink fails.
+int DrawLSystem(LSystemGenerator *g, TurtleVertexSink sink, void *data,
+    LSystemDrawInfo *info);
+
+// Returns the vertices kept by the last call to DrawLSystem without a sink,
+// and sets *count to their number.
+const MeshVertex* LSystemVertices(LSystemGenerator *g, uint32_t *count);
+
+// A TurtleVertexSink that copies the vertices into an LSystemVertexArray,
+// passed as data. Fails if the array is full.
+int VertexArraySink(void *data, MeshVertex *vertices, uint32_t count);
+
+#endif  // L_SYSTEM_LIBRARY_H
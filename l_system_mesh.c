@@ -1,9 +1,16 @@
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
+#include "gl_utilities.h"
+#include "mesh_buffers.h"
+#include "mesh_lod.h"
+#include "mesh_residency.h"
+#include "shader_cache.h"
+#include "trace.h"
 #include "utilities.h"
 #include "l_system_mesh.h"
 
@@ -24,170 +31,170 @@ void DebugPrintVertex(MeshVertex *v) {
   printf(".\n");
 }
 
-// Loads and compiles a shader from the given file path. Returns 0 on error.
-static GLuint LoadShader(const char *path, GLenum shader_type) {
-  GLuint to_return = 0;
-  GLint compile_result = 0;
-  GLchar shader_log[512];
-  char *shader_src_orig = NULL;
-  char *shared_uniform_code = NULL;
-  char *final_src = NULL;
-
-  // First do some preprocessing to insert the common uniform definitions in
-  // place of the special comment in the main shader source.
-  shader_src_orig = ReadFullFile(path);
-  if (!shader_src_orig) return 0;
-  shared_uniform_code = ReadFullFile("./shared_uniforms.glsl");
-  if (!shared_uniform_code) {
-    free(shader_src_orig);
-    return 0;
-  }
-  final_src = StringReplace(shader_src_orig, "//INCLUDE_SHARED_UNIFORMS\n",
-    shared_uniform_code);
-  if (!final_src) {
-    printf("Failed preprocessing shader source code.\n");
-    free(shader_src_orig);
-    free(shared_uniform_code);
+// Sets *index to the index of the named uniform in the program. Returns 0 and
+// prints a message on error.
+static int UniformIndex(GLuint program, const char *name, GLint *index) {
+  *index = glGetUniformLocation(program, name);
+  if (*index < 0) {
+    printf("Failed getting location of uniform %s.\n", name);
     return 0;
   }
-  free(shader_src_orig);
-  free(shared_uniform_code);
-  shader_src_orig = NULL;
-  shared_uniform_code = NULL;
-
-  to_return = glCreateShader(shader_type);
-  glShaderSource(to_return, 1, (const char**) &final_src, NULL);
-  glCompileShader(to_return);
-  free(final_src);
-  final_src = NULL;
+  return 1;
+}
 
-  // Check compilation success.
-  memset(shader_log, 0, sizeof(shader_log));
-  glGetShaderiv(to_return, GL_COMPILE_STATUS, &compile_result);
-  if (compile_result != GL_TRUE) {
-    glGetShaderInfoLog(to_return, sizeof(shader_log) - 1, NULL,
-      shader_log);
-    printf("Shader %s compile error:\n%s\n", path, shader_log);
-    glDeleteShader(to_return);
+// Looks up the program's uniform indices, and binds its shared uniform block.
+// Returns 0 on error.
+static int SetupProgramUniforms(MeshShaderProgram *s) {
+  GLuint p = s->program;
+  GLuint block_index;
+  if (!UniformIndex(p, "model", &(s->model_uniform_index))) return 0;
+  if (!UniformIndex(p, "normal", &(s->normal_uniform_index))) return 0;
+  if (!UniformIndex(p, "location_offset",
+    &(s->location_offset_uniform_index))) {
     return 0;
   }
-  if (!CheckGLErrors()) {
-    glDeleteShader(to_return);
+  block_index = glGetUniformBlockIndex(p, "SharedUniforms");
+  if (block_index == GL_INVALID_INDEX) {
+    printf("Failed getting index of shared uniform block.\n");
+    CheckGLErrors();
     return 0;
   }
-  return to_return;
+  glUniformBlockBinding(p, block_index, SHARED_UNIFORMS_BINDING);
+  return CheckGLErrors();
 }
 
-// Links and returns the shader program from the given source file names.
-// The geometry_src_file can be NULL if a geometry shader isn't used. A
-// vertex and fragment shader are always required.
-static GLuint CreateShaderProgram(const char *vertex_src_file,
-    const char *geometry_src_file, const char *fragment_src_file) {
-  GLchar link_log[512];
-  GLint link_result = 0;
-  GLuint vertex_shader, geometry_shader, fragment_shader, to_return;
-
-  vertex_shader = LoadShader(vertex_src_file, GL_VERTEX_SHADER);
-  if (!vertex_shader) {
-    printf("Couldn't load vertex shader.\n");
-    return 0;
-  }
-  fragment_shader = LoadShader(fragment_src_file, GL_FRAGMENT_SHADER);
-  if (!fragment_shader) {
-    printf("Couldn't load fragment shader.\n");
-    glDeleteShader(vertex_shader);
+// Loads the shaders for the given rendering mode's program, and looks up
+// uniform indices. The program is only stored in the mesh if everything
+// succeeds. Returns 0 on error.
+static int SetupShaderProgram(LSystemMesh *m, RenderingMode mode,
+    const char *vertex_src, const char *geometry_src,
+    const char *fragment_src) {
+  MeshShaderProgram s;
+  double start_time = BeginTraceEvent();
+  memset(&s, 0, sizeof(s));
+  s.program = LoadCachedProgram(m->shader_cache, vertex_src, geometry_src,
+    fragment_src);
+  EndTraceEvent("Load shader program", start_time);
+  if (!s.program) return 0;
+  if (!SetupProgramUniforms(&s)) {
+    glDeleteProgram(s.program);
     return 0;
   }
+  m->programs[mode] = s;
+  return 1;
+}
 
-  // Only load the geometry shader if requested.
-  geometry_shader = 0;
-  if (geometry_src_file != NULL) {
-    geometry_shader = LoadShader(geometry_src_file, GL_GEOMETRY_SHADER);
-    if (!geometry_shader) {
-      printf("Couldn't load geometry shader.\n");
-      glDeleteShader(vertex_shader);
-      glDeleteShader(fragment_shader);
-      return 0;
-    }
+// The names of each rendering mode, used when printing draw times.
+static const char *RenderingModeName(RenderingMode mode) {
+  switch (mode) {
+  case RENDERING_MODE_LINES:
+    return "lines";
+  case RENDERING_MODE_PIPES:
+    return "pipes (geometry shader)";
+  case RENDERING_MODE_CYLINDERS:
+    return "instanced cylinders";
+  case RENDERING_MODE_IMPOSTORS:
+    return "ray-cast impostors";
+  case RENDERING_MODE_COUNT:
+    break;
   }
+  return "unknown";
+}
 
-  to_return = glCreateProgram();
-  glAttachShader(to_return, vertex_shader);
-  if (geometry_shader) {
-    glAttachShader(to_return, geometry_shader);
-  }
-  glAttachShader(to_return, fragment_shader);
-  glLinkProgram(to_return);
-  glDeleteShader(vertex_shader);
-  glDeleteShader(geometry_shader);
-  glDeleteShader(fragment_shader);
-  glGetProgramiv(to_return, GL_LINK_STATUS, &link_result);
-  memset(link_log, 0, sizeof(link_log));
-  if (link_result != GL_TRUE) {
-    glGetProgramInfoLog(to_return, sizeof(link_log) - 1, NULL, link_log);
-    printf("GL program link error:\n%s\n", link_log);
-    glDeleteProgram(to_return);
-    return 0;
-  }
-  glUseProgram(to_return);
-  if (!CheckGLErrors()) {
-    glDeleteProgram(to_return);
-    return 0;
+// Loads the shader program for the given rendering mode, unless it was
+// already loaded. Returns 0 on error.
+static int SetupRenderingMode(LSystemMesh *m, RenderingMode mode) {
+  if (m->programs[mode].program) return 1;
+  switch (mode) {
+  case RENDERING_MODE_LINES:
+    return SetupShaderProgram(m, mode, "simple_shader.vert", NULL,
+      "simple_shader.frag");
+  case RENDERING_MODE_PIPES:
+    return SetupShaderProgram(m, mode, "pipes_shader.vert",
+      "pipes_shader.geom", "pipes_shader.frag");
+  case RENDERING_MODE_CYLINDERS:
+    return SetupShaderProgram(m, mode, "cylinder_shader.vert", NULL,
+      "cylinder_shader.frag");
+  case RENDERING_MODE_IMPOSTORS:
+    return SetupShaderProgram(m, mode, "impostor_shader.vert", NULL,
+      "impostor_shader.frag");
+  case RENDERING_MODE_COUNT:
+    break;
   }
-  return to_return;
+  printf("Invalid rendering mode: %d\n", (int) mode);
+  return 0;
 }
 
-// Sets *index to the index of the named uniform in s->shader_program. Returns
-// 0 and prints a message on error.
-static int UniformIndex(GLuint program, const char *name, GLint *index) {
-  *index = glGetUniformLocation(program, name);
-  if (*index < 0) {
-    printf("Failed getting location of uniform %s.\n", name);
-    return 0;
+void PrintMeshDrawTimes(LSystemMesh *m) {
+  int i;
+  printf("GPU draw time per frame:\n");
+  for (i = 0; i < RENDERING_MODE_COUNT; i++) {
+    printf("  %s%s: ", RenderingModeName(i),
+      (i == m->rendering_mode) ? " (current)" : "");
+    if (m->draw_time_ms[i] < 0) {
+      printf("not measured yet\n");
+      continue;
+    }
+    printf("%.03f ms\n", m->draw_time_ms[i]);
   }
-  return 1;
 }
 
-// Loads the shaders for the model, and looks up uniform indices. Returns 0 on
-// error.
-static int SetupShaderProgram(LSystemMesh *m, const char *vertex_src,
-    const char *geometry_src, const char *fragment_src) {
-  GLuint p;
-  GLuint block_index;
-  p = CreateShaderProgram(vertex_src, geometry_src, fragment_src);
-  if (!p) return 0;
-  m->shader_program = p;
-  if (!UniformIndex(p, "model", &(m->model_uniform_index))) return 0;
-  if (!UniformIndex(p, "normal", &(m->normal_uniform_index))) return 0;
-  if (!UniformIndex(p, "location_offset",
-    &(m->location_offset_uniform_index))) {
+int SetMeshRenderingMode(LSystemMesh *m, RenderingMode mode) {
+  if ((mode < 0) || (mode >= RENDERING_MODE_COUNT)) {
+    printf("Invalid rendering mode: %d\n", (int) mode);
     return 0;
   }
-  block_index = glGetUniformBlockIndex(p, "SharedUniforms");
-  if (block_index == GL_INVALID_INDEX) {
-    printf("Failed getting index of shared uniform block.\n");
-    CheckGLErrors();
-    return 0;
-  }
-  glUniformBlockBinding(p, block_index, SHARED_UNIFORMS_BINDING);
-  return CheckGLErrors();
+  if (!SetupRenderingMode(m, mode)) return 0;
+  m->rendering_mode = mode;
+  return 1;
 }
 
 int SwitchRenderingModes(LSystemMesh *m) {
-  glDeleteProgram(m->shader_program);
-  m->shader_program = 0;
-  if (m->using_geometry_shader) {
-    m->using_geometry_shader = 0;
-    return SetupShaderProgram(m, "simple_shader.vert", NULL,
-      "simple_shader.frag");
+  RenderingMode mode = (m->rendering_mode + 1) % RENDERING_MODE_COUNT;
+  if (!SetupRenderingMode(m, mode)) return 0;
+  m->rendering_mode = mode;
+  printf("Switched to %s rendering mode.\n", RenderingModeName(mode));
+  PrintMeshDrawTimes(m);
+  return 1;
+}
+
+// Creates the shared cylinder shape, and the vertex array object used to
+// draw an instance of it for each segment. The cylinder is a triangle strip
+// with a radius and length of 1, and no caps. Returns 0 on error.
+static int SetupCylinderMesh(LSystemMesh *m) {
+  float vertices[(CYLINDER_SIDES + 1) * 2][3];
+  float angle;
+  int i;
+  for (i = 0; i <= CYLINDER_SIDES; i++) {
+    angle = (2.0 * GLM_PI * i) / CYLINDER_SIDES;
+    vertices[i * 2][0] = cos(angle);
+    vertices[i * 2][1] = sin(angle);
+    vertices[i * 2][2] = 0;
+    vertices[i * 2 + 1][0] = vertices[i * 2][0];
+    vertices[i * 2 + 1][1] = vertices[i * 2][1];
+    vertices[i * 2 + 1][2] = 1;
+  }
+  glGenVertexArrays(1, &(m->cylinder_vao));
+  glBindVertexArray(m->cylinder_vao);
+  glGenBuffers(1, &(m->cylinder_vbo));
+  glBindBuffer(GL_ARRAY_BUFFER, m->cylinder_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+  glVertexAttribBinding(0, CYLINDER_SHAPE_BINDING);
+  glEnableVertexAttribArray(0);
+  glBindVertexBuffer(CYLINDER_SHAPE_BINDING, m->cylinder_vbo, 0,
+    3 * sizeof(float));
+  SetupSegmentInstanceFormat(1);
+  if (!CheckGLErrors()) {
+    printf("Failed setting up cylinder mesh.\n");
+    return 0;
   }
-  m->using_geometry_shader = 1;
-  return SetupShaderProgram(m, "pipes_shader.vert", "pipes_shader.geom",
-    "pipes_shader.frag");
+  return 1;
 }
 
 LSystemMesh* CreateLSystemMesh(void) {
   LSystemMesh *m = NULL;
+  int i;
 
   m = (LSystemMesh *) calloc(1, sizeof(*m));
   if (!m) {
@@ -195,65 +202,269 @@ LSystemMesh* CreateLSystemMesh(void) {
     return NULL;
   }
 
-  glGenVertexArrays(1, &(m->vao));
-  glBindVertexArray(m->vao);
-  glGenBuffers(1, &(m->vbo));
-  glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
-  // Setting up the location, direction, orientation, and color attributes
-  // (respectively).
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
-    (void *) offsetof(MeshVertex, location));
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
-    (void *) offsetof(MeshVertex, forward));
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
-    (void *) offsetof(MeshVertex, up));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
-    (void *) offsetof(MeshVertex, color));
-  glEnableVertexAttribArray(3);
-  if (!CheckGLErrors()) {
-    printf("Failed setting up mesh object.\n");
+  m->buffers = CreateMeshBufferSet();
+  if (!m->buffers) {
+    DestroyLSystemMesh(m);
+    return NULL;
+  }
+  if (!SetupCylinderMesh(m)) {
     DestroyLSystemMesh(m);
     return NULL;
   }
-  if (!SetupShaderProgram(m, "simple_shader.vert", NULL,
-    "simple_shader.frag")) {
+  glGenVertexArrays(1, &(m->impostor_vao));
+  m->shader_cache = CreateShaderCache();
+  if (!m->shader_cache) {
     DestroyLSystemMesh(m);
     return NULL;
   }
+  m->rendering_mode = RENDERING_MODE_LINES;
+  if (!SetupRenderingMode(m, m->rendering_mode)) {
+    DestroyLSystemMesh(m);
+    return NULL;
+  }
+  glGenQueries(DRAW_TIMER_QUERIES, m->timer_queries);
+  for (i = 0; i < RENDERING_MODE_COUNT; i++) {
+    m->draw_time_ms[i] = -1;
+  }
+  m->lod = CreateMeshLOD();
+  if (!m->lod) {
+    DestroyLSystemMesh(m);
+    return NULL;
+  }
+  m->lod_enabled = 1;
+  m->lod_pixel_error = DEFAULT_LOD_PIXEL_ERROR;
+  m->gpu_memory_budget = DEFAULT_GPU_MEMORY_BUDGET;
   glm_mat4_identity(m->model);
   glm_mat3_identity(m->normal);
   return m;
 }
 
 void DestroyLSystemMesh(LSystemMesh *m) {
+  int i;
   if (!m) return;
-  glDeleteBuffers(1, &(m->vbo));
-  glDeleteVertexArrays(1, &(m->vao));
-  glDeleteProgram(m->shader_program);
+  DestroyMeshResidency(m->residency);
+  DestroyMeshBufferSet(m->buffers);
+  glDeleteVertexArrays(1, &(m->cylinder_vao));
+  glDeleteBuffers(1, &(m->cylinder_vbo));
+  glDeleteVertexArrays(1, &(m->impostor_vao));
+  glDeleteQueries(DRAW_TIMER_QUERIES, m->timer_queries);
+  for (i = 0; i < RENDERING_MODE_COUNT; i++) {
+    glDeleteProgram(m->programs[i].program);
+  }
+  DestroyShaderCache(m->shader_cache);
+  DestroyMeshLOD(m->lod);
+  free(m->draw_firsts);
+  free(m->draw_counts);
   memset(m, 0, sizeof(*m));
   free(m);
 }
 
+// Sets up the buffers as a page pool and starts streaming the LOD tree's
+// nodes into it. If an upload already failed, the pool is limited to the
+// vertices that were uploaded, since the budget evidently doesn't fit.
+// Returns 0 on error.
+static int StartStreamingMesh(LSystemMesh *m) {
+  uint64_t pool_bytes = m->gpu_memory_budget;
+  uint64_t page_count;
+  if (m->needs_streaming && (((uint64_t) m->uploaded_vertex_count) *
+    sizeof(MeshVertex) < pool_bytes)) {
+    pool_bytes = ((uint64_t) m->uploaded_vertex_count) * sizeof(MeshVertex);
+  }
+  page_count = pool_bytes / (RESIDENCY_PAGE_VERTICES * sizeof(MeshVertex));
+  // Leave room for at least a full frame's worth of uploads besides the root.
+  if (page_count <= RESIDENCY_UPLOADS_PER_FRAME) {
+    page_count = RESIDENCY_UPLOADS_PER_FRAME + 1;
+  }
+  if (page_count > UINT32_MAX) page_count = UINT32_MAX;
+  m->residency = CreateMeshResidency(m->buffers, page_count);
+  if (!m->residency) return 0;
+  printf("Streaming the mesh through %u pages of GPU memory.\n",
+    (unsigned) m->residency->page_count);
+  return ResetMeshResidency(m->residency, m->lod);
+}
+
+// Copies the LOD tree's vertices before the given index that haven't been
+// uploaded yet into the buffers. Does nothing if the vertices don't fit in the
+// memory budget, since the mesh will need to be streamed anyway. If the
+// upload fails, e.g. because the GPU is out of memory, sets needs_streaming
+// rather than failing, and nothing more is uploaded until the mesh is
+// streamed by FinishMeshVertices.
+static void UploadFinishedVertices(LSystemMesh *m, uint32_t end) {
+  MeshLOD *l = m->lod;
+  uint32_t start = m->uploaded_vertex_count;
+  double start_time;
+  if (m->needs_streaming || (end <= start)) return;
+  if (((uint64_t) end) * sizeof(MeshVertex) > m->gpu_memory_budget) return;
+  start_time = BeginTraceEvent();
+  if (!ReserveMeshBuffers(m->buffers, end) ||
+    !WriteMeshBuffers(m->buffers, start, l->vertices + start, end - start)) {
+    // Clear any errors that weren't already reported, so they aren't
+    // mistaken for later failures.
+    CheckGLErrors();
+    printf("Failed uploading %.02f MB of vertices. The mesh will be streamed "
+      "instead.\n", ((float) end) * sizeof(MeshVertex) / (1024.0 * 1024.0));
+    m->needs_streaming = 1;
+    return;
+  }
+  m->uploaded_vertex_count = end;
+  EndTraceEventArg("Upload vertices", start_time, "vertices", end - start);
+}
+
+void BeginMeshVertices(LSystemMesh *m) {
+  DestroyMeshResidency(m->residency);
+  m->residency = NULL;
+  ResetMeshLOD(m->lod);
+  m->vertex_count = 0;
+  m->uploaded_vertex_count = 0;
+  m->needs_streaming = 0;
+}
+
+int AppendMeshVertices(LSystemMesh *m, MeshVertex *vertices, uint32_t count) {
+  if (!AppendLODSegments(m->lod, vertices, count)) return 0;
+  // Everything before the leaf that's currently being filled is final.
+  UploadFinishedVertices(m, m->lod->leaf_start);
+  return 1;
+}
+
+int FinishMeshVertices(LSystemMesh *m) {
+  MeshLOD *l = m->lod;
+  double start_time = BeginTraceEvent();
+  if (!FinishMeshLOD(l)) return 0;
+  EndTraceEventArg("Build LOD tree", start_time, "nodes", l->node_count);
+  m->vertex_count = l->full_vertex_count;
+  if (((uint64_t) l->vertex_count) * sizeof(MeshVertex) >
+    m->gpu_memory_budget) {
+    return StartStreamingMesh(m);
+  }
+  UploadFinishedVertices(m, l->vertex_count);
+  if (m->needs_streaming) return StartStreamingMesh(m);
+  TrimMeshBuffers(m->buffers, l->vertex_count);
+  return 1;
+}
+
 int SetMeshVertices(LSystemMesh *m, MeshVertex *vertices, uint32_t count) {
-  glBindVertexArray(m->vao);
-  glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
-  glBufferData(GL_ARRAY_BUFFER, count * sizeof(MeshVertex), vertices,
-    GL_STATIC_DRAW);
-  m->vertex_count = count;
-  return CheckGLErrors();
+  double start_time = BeginTraceEvent();
+  BeginMeshVertices(m);
+  if (!AppendMeshVertices(m, vertices, count)) return 0;
+  if (!FinishMeshVertices(m)) return 0;
+  EndTraceEventArg("Set mesh vertices", start_time, "vertices", count);
+  return 1;
+}
+
+void SetMeshViewInfo(LSystemMesh *m, mat4 projection, mat4 view,
+    int viewport_height) {
+  float pixel_error = m->lod_enabled ? m->lod_pixel_error : 0;
+  SetupLODView(&(m->lod_view), projection, view, m->model,
+    m->location_offset, viewport_height, pixel_error);
+}
+
+void ToggleMeshLOD(LSystemMesh *m) {
+  m->lod_enabled = !m->lod_enabled;
+  m->lod_view.pixel_error = m->lod_enabled ? m->lod_pixel_error : 0;
+  if (m->lod_enabled) {
+    printf("Level of detail enabled (max error %.02f pixels).\n",
+      m->lod_pixel_error);
+  } else {
+    printf("Level of detail disabled.\n");
+  }
+}
+
+// Converts the LOD nodes chosen by SelectLODNodes into the arrays of ranges
+// to draw from the mesh's buffers. If the mesh is being streamed, the ranges
+// refer to resident pages instead. Returns 0 on error.
+static int SetupDrawRanges(LSystemMesh *m) {
+  MeshLOD *l = m->lod;
+  LODNode *n = NULL;
+  uint32_t i, new_capacity;
+  void *tmp = NULL;
+  if (l->selected_count > m->draw_capacity) {
+    new_capacity = l->selected_capacity;
+    tmp = realloc(m->draw_firsts, new_capacity * sizeof(uint32_t));
+    if (!tmp) {
+      printf("Failed allocating list of draw ranges.\n");
+      return 0;
+    }
+    m->draw_firsts = (uint32_t *) tmp;
+    tmp = realloc(m->draw_counts, new_capacity * sizeof(uint32_t));
+    if (!tmp) {
+      printf("Failed allocating list of draw counts.\n");
+      return 0;
+    }
+    m->draw_counts = (uint32_t *) tmp;
+    m->draw_capacity = new_capacity;
+  }
+  if (m->residency) {
+    return SelectResidentNodes(m->residency, l, &(m->lod_view),
+      m->draw_firsts, m->draw_counts, &(m->draw_count));
+  }
+  for (i = 0; i < l->selected_count; i++) {
+    n = l->nodes + l->selected[i];
+    m->draw_firsts[i] = n->first_vertex;
+    m->draw_counts[i] = n->vertex_count;
+  }
+  m->draw_count = l->selected_count;
+  return 1;
+}
+
+// Reads the result of the next timer query, if it's available, and starts a
+// new query if possible. Returns nonzero if a query was started. Never waits
+// for a result.
+static int StartDrawTimer(LSystemMesh *m) {
+  uint32_t i = m->next_timer_query;
+  GLint available = 0;
+  GLuint64 elapsed = 0;
+  float *average = NULL;
+  if (m->timer_query_pending[i]) {
+    glGetQueryObjectiv(m->timer_queries[i], GL_QUERY_RESULT_AVAILABLE,
+      &available);
+    if (!available) return 0;
+    glGetQueryObjectui64v(m->timer_queries[i], GL_QUERY_RESULT, &elapsed);
+    m->timer_query_pending[i] = 0;
+    average = m->draw_time_ms + m->timer_query_modes[i];
+    if (*average < 0) {
+      *average = ((double) elapsed) / 1.0e6;
+    } else {
+      *average = 0.9 * (*average) + 0.1 * (((double) elapsed) / 1.0e6);
+    }
+  }
+  glBeginQuery(GL_TIME_ELAPSED, m->timer_queries[i]);
+  m->timer_query_modes[i] = m->rendering_mode;
+  return 1;
+}
+
+// Ends the query started by StartDrawTimer.
+static void EndDrawTimer(LSystemMesh *m) {
+  glEndQuery(GL_TIME_ELAPSED);
+  m->timer_query_pending[m->next_timer_query] = 1;
+  m->next_timer_query = (m->next_timer_query + 1) % DRAW_TIMER_QUERIES;
 }
 
 int DrawMesh(LSystemMesh *m) {
-  glUseProgram(m->shader_program);
-  glBindVertexArray(m->vao);
-  glUniformMatrix4fv(m->model_uniform_index, 1, GL_FALSE, (float *) m->model);
-  glUniformMatrix3fv(m->normal_uniform_index, 1, GL_FALSE,
+  MeshShaderProgram *s = m->programs + m->rendering_mode;
+  int timing, result;
+  if (!SelectLODNodes(m->lod, &(m->lod_view))) return 0;
+  if (!SetupDrawRanges(m)) return 0;
+  glUseProgram(s->program);
+  glUniformMatrix4fv(s->model_uniform_index, 1, GL_FALSE, (float *) m->model);
+  glUniformMatrix3fv(s->normal_uniform_index, 1, GL_FALSE,
     (float *) m->normal);
-  glUniform3fv(m->location_offset_uniform_index, 1,
+  glUniform3fv(s->location_offset_uniform_index, 1,
     (float *) m->location_offset);
-  glDrawArrays(GL_LINES, 0, m->vertex_count);
-  return CheckGLErrors();
+  timing = StartDrawTimer(m);
+  if (m->rendering_mode == RENDERING_MODE_CYLINDERS) {
+    result = DrawMeshBufferSegments(m->buffers, m->cylinder_vao,
+      GL_TRIANGLE_STRIP, (CYLINDER_SIDES + 1) * 2, m->draw_firsts,
+      m->draw_counts, m->draw_count);
+  } else if (m->rendering_mode == RENDERING_MODE_IMPOSTORS) {
+    result = DrawMeshBufferStorage(m->buffers, m->impostor_vao,
+      IMPOSTOR_STORAGE_BINDING, GL_TRIANGLES, IMPOSTOR_QUAD_VERTICES,
+      m->draw_firsts, m->draw_counts, m->draw_count);
+  } else {
+    result = DrawMeshBuffers(m->buffers, GL_LINES, m->draw_firsts,
+      m->draw_counts, m->draw_count);
+  }
+  if (timing) EndDrawTimer(m);
+  if (!result) return 0;
+  if (m->residency) FinishResidencyFrame(m->residency);
+  return 1;
 }
@@ -4,45 +4,130 @@
 #include <stdint.h>
 #include <cglm/cglm.h>
 #include <glad/glad.h>
+#include "mesh_buffers.h"
+#include "mesh_lod.h"
+#include "mesh_residency.h"
+#include "mesh_vertex.h"
+#include "shader_cache.h"
 
 // The binding point for the shared uniform block.
 #define SHARED_UNIFORMS_BINDING (0)
 
-// Defines a single vertex within the mesh.
+// The default maximum screen-space error, in pixels, of the LOD nodes chosen
+// for drawing.
+#define DEFAULT_LOD_PIXEL_ERROR (1.0)
+
+// The default amount of GPU memory, in bytes, that a mesh may use. Meshes
+// with more vertex data than this are streamed through a page pool of this
+// size instead of being uploaded all at once.
+#define DEFAULT_GPU_MEMORY_BUDGET (1024ull * 1024ull * 1024ull)
+
+// The number of sides of the cylinders drawn in RENDERING_MODE_CYLINDERS.
+#define CYLINDER_SIDES (8)
+
+// The binding index used for the cylinder shape's vertices.
+#define CYLINDER_SHAPE_BINDING (1)
+
+// The shader storage binding used for the mesh's vertices in
+// RENDERING_MODE_IMPOSTORS. Must match impostor_shader.vert.
+#define IMPOSTOR_STORAGE_BINDING (0)
+
+// The number of vertices in the quad drawn for each segment in
+// RENDERING_MODE_IMPOSTORS.
+#define IMPOSTOR_QUAD_VERTICES (6)
+
+// The number of timer queries used to measure how long DrawMesh takes on the
+// GPU. Results are read a few frames after the query, to avoid stalling.
+#define DRAW_TIMER_QUERIES (4)
+
+// The ways in which the mesh can be drawn, cycled by SwitchRenderingModes.
+typedef enum {
+  // Draws each segment as a single-pixel line.
+  RENDERING_MODE_LINES = 0,
+  // Uses a geometry shader to draw each segment as a flat, camera-facing
+  // strip.
+  RENDERING_MODE_PIPES,
+  // Draws an instance of a shared cylinder mesh for each segment.
+  RENDERING_MODE_CYLINDERS,
+  // Reads segments directly from the mesh's buffers in the vertex shader,
+  // drawing a screen-aligned quad for each one, and ray-casts an exact
+  // capped cylinder in the fragment shader.
+  RENDERING_MODE_IMPOSTORS,
+  RENDERING_MODE_COUNT,
+} RenderingMode;
+
+// A shader program used by one of the rendering modes, along with the
+// locations of its uniforms.
 typedef struct {
-  vec3 location;
-  float pad1;
-  // Points in the direction of the next vertex. May be 0 if this is at the
-  // end of a sequence of lines.
-  vec3 forward;
-  float pad2;
-  // Points "upward"; must be orthogonal to the direction and normalized.
-  // Basically just gives a consistent way to orient geometry.
-  vec3 up;
-  float pad3;
-  // The color of the vertex.
-  vec4 color;
-} MeshVertex;
+  // 0 if the program hasn't been loaded yet.
+  GLuint program;
+  GLint model_uniform_index;
+  GLint normal_uniform_index;
+  GLint location_offset_uniform_index;
+} MeshShaderProgram;
 
 // Holds information about a full mesh to render.
 typedef struct {
-  // We copy the vertices into the buffer only when SetMeshVertices is called.
+  // The number of full-detail vertices. The buffers also contain the
+  // simplified vertices for every LOD level.
   uint32_t vertex_count;
-  // OpenGL stuff needed for drawing this mesh.
-  GLuint shader_program;
-  // If nonzero, the shader program is currently the more complex geometry
-  // version. If zero, we're just rendering the wireframe.
-  int using_geometry_shader;
-  GLuint vao;
-  GLuint vbo;
+  // The LOD tree for the mesh. Its vertex array is what's copied into the
+  // buffers.
+  MeshLOD *lod;
+  // The number of the LOD tree's vertices that have been copied into the
+  // buffers so far. Vertices are uploaded while the tree is being built.
+  uint32_t uploaded_vertex_count;
+  // Set if uploading the vertices failed while the tree was being built, in
+  // which case the rest aren't uploaded, and the mesh is streamed instead.
+  int needs_streaming;
+  // The view used when selecting which LOD nodes to draw.
+  LODView lod_view;
+  // If zero, the full-detail mesh is always drawn.
+  int lod_enabled;
+  float lod_pixel_error;
+  // The ranges of vertices to draw from the buffers, one per selected LOD
+  // node.
+  uint32_t *draw_firsts;
+  uint32_t *draw_counts;
+  uint32_t draw_count;
+  uint32_t draw_capacity;
+  // The maximum size of the buffers, which defaults to
+  // DEFAULT_GPU_MEMORY_BUDGET and may be changed before setting the vertices.
+  // If the LOD tree's vertices don't fit, the buffers instead hold a pool of
+  // pages managed by the residency object. The residency object is NULL
+  // whenever the full vertex array is uploaded.
+  uint64_t gpu_memory_budget;
+  MeshResidency *residency;
+  // OpenGL stuff needed for drawing this mesh. Each rendering mode's program
+  // is loaded the first time the mode is used, and then kept until the mesh
+  // is destroyed.
+  ShaderCache *shader_cache;
+  MeshShaderProgram programs[RENDERING_MODE_COUNT];
+  // Determines which shader program is in use.
+  RenderingMode rendering_mode;
+  // The cylinder drawn for every segment in RENDERING_MODE_CYLINDERS. The
+  // vertex array object reads the shape from cylinder_vbo and one segment
+  // per instance from the mesh's buffers.
+  GLuint cylinder_vao;
+  GLuint cylinder_vbo;
+  // An empty vertex array object, used in RENDERING_MODE_IMPOSTORS since the
+  // impostor shader has no vertex attributes.
+  GLuint impostor_vao;
+  // Timer queries measuring the GPU time taken to draw the mesh, along with
+  // the rendering mode used for each pending query.
+  GLuint timer_queries[DRAW_TIMER_QUERIES];
+  RenderingMode timer_query_modes[DRAW_TIMER_QUERIES];
+  int timer_query_pending[DRAW_TIMER_QUERIES];
+  uint32_t next_timer_query;
+  // A running average of the draw time, in milliseconds, in each rendering
+  // mode. Negative if the mode hasn't been measured yet.
+  float draw_time_ms[RENDERING_MODE_COUNT];
+  MeshBufferSet *buffers;
   // The model and normal matrices used when drawing this mesh.
   mat4 model;
   mat3 normal;
   // The offset to add to every vertex's location to center the mesh.
   vec3 location_offset;
-  GLint model_uniform_index;
-  GLint normal_uniform_index;
-  GLint location_offset_uniform_index;
 } LSystemMesh;
 
 // Prints the vertex's info to stdout.
@@ -59,14 +144,47 @@ void DestroyLSystemMesh(LSystemMesh *m);
 
 // Updates the vertices to render in the mesh. Returns 0 on error. The list of
 // vertices should specify *lines*; i.e. this should be a list of pairs of
-// vertices.
+// vertices. Equivalent to calling BeginMeshVertices, AppendMeshVertices, and
+// FinishMeshVertices.
 int SetMeshVertices(LSystemMesh *m, MeshVertex *vertices, uint32_t count);
 
+// Discards the mesh's vertices so that new ones can be appended.
+void BeginMeshVertices(LSystemMesh *m);
+
+// Appends line segments to the mesh. Vertices are copied into the mesh's
+// buffers as they're appended, so this can be used to route the turtle's
+// output into the mesh while it's being generated. If the buffers can't hold
+// them, e.g. because the GPU runs out of memory, the vertices are still
+// appended, and FinishMeshVertices streams the mesh instead. Returns 0 on
+// error.
+int AppendMeshVertices(LSystemMesh *m, MeshVertex *vertices, uint32_t count);
+
+// Must be called after the last AppendMeshVertices call, before the mesh is
+// drawn. Returns 0 on error.
+int FinishMeshVertices(LSystemMesh *m);
+
+// Sets the camera information used to choose the mesh's level of detail.
+// Must be called before DrawMesh whenever the view, projection, viewport, or
+// mesh's model matrix changes.
+void SetMeshViewInfo(LSystemMesh *m, mat4 projection, mat4 view,
+    int viewport_height);
+
+// Toggles whether the mesh is drawn using the LOD tree or at full detail.
+void ToggleMeshLOD(LSystemMesh *m);
+
 // Draws the mesh. Returns 0 on error, including any GL errors if they occur.
 int DrawMesh(LSystemMesh *m);
 
+// Switches to the given rendering mode, loading its shader program if
+// needed. Returns 0 on error, in which case the mode is left unchanged.
+int SetMeshRenderingMode(LSystemMesh *m, RenderingMode mode);
+
 // Cycles between rendering modes (i.e. shader programs) that may be used to
-// render the given mesh. Returns 0 on error.
+// render the given mesh, and prints the draw times measured so far in each
+// mode. Returns 0 on error, in which case the mode is left unchanged.
 int SwitchRenderingModes(LSystemMesh *m);
 
+// Prints the most recent GPU draw time measured in each rendering mode.
+void PrintMeshDrawTimes(LSystemMesh *m);
+
 #endif  // L_SYSTEM_MESH_H
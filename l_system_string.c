@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "l_system_string.h"
+#include "memory_budget.h"
+#include "parse_config.h"
+#include "trace.h"
+#include "turtle_3d.h"
+
+uint64_t ExpandedLSystemLength(LSystemConfig *config, const uint8_t *s,
+    uint32_t length) {
+  uint64_t expanded_length = 0;
+  ReplacementRule *r = NULL;
+  uint32_t i;
+  for (i = 0; i < length; i++) {
+    r = config->replacements + s[i];
+    if (!r->used) {
+      expanded_length++;
+      continue;
+    }
+    expanded_length += r->length;
+  }
+  return expanded_length;
+}
+
+uint8_t* ExpandLSystemString(LSystemConfig *config, const uint8_t *s,
+    uint32_t length, uint32_t *new_length) {
+  uint64_t expanded_length = 0;
+  ReplacementRule *r = NULL;
+  uint8_t *new_buffer = NULL;
+  uint8_t *dst = NULL;
+  double start_time = BeginTraceEvent();
+  uint32_t i;
+  uint8_t c;
+  // First iterate over the string to pre-calcuate the size of the buffer we'll
+  // need.
+  expanded_length = ExpandedLSystemLength(config, s, length);
+  if (expanded_length > UINT32_MAX) {
+    printf("The expanded L-system string would be too long: %llu bytes.\n",
+      (unsigned long long) expanded_length);
+    return NULL;
+  }
+  // +1 to ensure a null terminator.
+  new_buffer = (uint8_t *) TrackedCalloc(MEMORY_STRINGS, 1,
+    expanded_length + 1);
+  if (!new_buffer) {
+    printf("Failed allocating new %.02f MB L-system string.\n",
+      ((double) expanded_length) / (1024.0 * 1024.0));
+    return NULL;
+  }
+  // Iterate over the string again, this time populating the new buffer.
+  dst = new_buffer;
+  for (i = 0; i < length; i++) {
+    c = s[i];
+    r = config->replacements + c;
+    if (!r->used) {
+      // Keep the same char if no replacement was defined.
+      *dst = c;
+      dst++;
+      continue;
+    }
+    memcpy(dst, r->replacement, r->length);
+    dst += r->length;
+  }
+  *new_length = expanded_length;
+  EndTraceEventArg("Expand string", start_time, "symbols", expanded_length);
+  return new_buffer;
+}
+
+int RunLSystemString(LSystemConfig *config, Turtle3D *t, const uint8_t *s,
+    uint32_t length) {
+  ActionRule *r = NULL;
+  double start_time = BeginTraceEvent();
+  int result;
+  uint32_t char_index, inst_index;
+  uint8_t c;
+  for (char_index = 0; char_index < length; char_index++) {
+    c = s[char_index];
+    r = config->actions + c;
+    for (inst_index = 0; inst_index < r->length; inst_index++) {
+      result = r->instructions[inst_index](t, r->args[inst_index]);
+      if (!result) {
+        printf("Failed running instruction %d for char %c.\n", (int) inst_index,
+          (char) c);
+        return 0;
+      }
+    }
+  }
+  EndTraceEventArg("Run turtle", start_time, "symbols", length);
+  return 1;
+}
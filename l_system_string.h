@@ -0,0 +1,28 @@
+// Expands L-system strings and runs the turtle over them. Unlike the rest of
+// the viewer, this doesn't depend on OpenGL or GLFW, so it's shared with the
+// l_system_bench program.
+#ifndef L_SYSTEM_STRING_H
+#define L_SYSTEM_STRING_H
+#include <stdint.h>
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// Returns the length the string would have after applying the config's
+// replacement rules once, without expanding it.
+uint64_t ExpandedLSystemLength(LSystemConfig *config, const uint8_t *s,
+    uint32_t length);
+
+// Applies the config's replacement rules once to every character in the
+// given string. Returns a new null-terminated string, which must be freed by
+// the caller using TrackedFree, and sets *new_length to its length. Returns
+// NULL on error, including if the new string would be longer than UINT32_MAX
+// or exceed the memory budget.
+uint8_t* ExpandLSystemString(LSystemConfig *config, const uint8_t *s,
+    uint32_t length, uint32_t *new_length);
+
+// Runs the turtle's instructions for every character in the string. Returns 0
+// on error.
+int RunLSystemString(LSystemConfig *config, Turtle3D *t, const uint8_t *s,
+    uint32_t length);
+
+#endif  // L_SYSTEM_STRING_H
@@ -0,0 +1,76 @@
+// Small vectors of floats, used to process several pixels or segments at
+// once. These use GCC's vector extensions, so the same code compiles to SSE,
+// NEON, etc. depending on the target, rather than using intrinsics for one
+// instruction set.
+#ifndef LANES_H
+#define LANES_H
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+// The number of values in each vector.
+#define LANE_COUNT (4)
+
+typedef float LaneFloats __attribute__((vector_size(LANE_COUNT * 4)));
+
+// The result of comparing two LaneFloats: each lane is -1 if the comparison
+// was true, or 0 if not.
+typedef int32_t LaneMask __attribute__((vector_size(LANE_COUNT * 4)));
+
+// Returns a where the mask is set, and b elsewhere.
+static inline LaneFloats SelectLanes(LaneMask m, LaneFloats a, LaneFloats b) {
+  return (LaneFloats) ((m & (LaneMask) a) | (~m & (LaneMask) b));
+}
+
+static inline LaneFloats MinLanes(LaneFloats a, LaneFloats b) {
+  return SelectLanes(a < b, a, b);
+}
+
+static inline LaneFloats MaxLanes(LaneFloats a, LaneFloats b) {
+  return SelectLanes(a > b, a, b);
+}
+
+static inline LaneFloats Clamp01Lanes(LaneFloats v) {
+  LaneFloats zero = {0};
+  return MaxLanes(MinLanes(v, zero + 1.0f), zero);
+}
+
+static inline LaneFloats AbsLanes(LaneFloats v) {
+  return (LaneFloats) ((LaneMask) v & 0x7fffffff);
+}
+
+// Returns the square root of each lane. Lanes must not be negative.
+static inline LaneFloats SqrtLanes(LaneFloats v) {
+#ifdef __SSE__
+  return (LaneFloats) _mm_sqrt_ps((__m128) v);
+#else
+  int i;
+  for (i = 0; i < LANE_COUNT; i++) v[i] = sqrtf(v[i]);
+  return v;
+#endif
+}
+
+// Returns nonzero if any lane of the mask is set.
+static inline int AnyLanes(LaneMask m) {
+  int i;
+  for (i = 0; i < LANE_COUNT; i++) {
+    if (m[i]) return 1;
+  }
+  return 0;
+}
+
+// Loads or stores LANE_COUNT floats, which don't need to be aligned.
+static inline LaneFloats LoadLanes(const float *p) {
+  LaneFloats v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void StoreLanes(float *p, LaneFloats v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+#endif  // LANES_H
@@ -0,0 +1,477 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cglm/cglm.h>
+#include "lanes.h"
+#include "line_rasterizer.h"
+#include "mesh_vertex.h"
+#include "thread_group.h"
+
+// The number of segments allocated when the first one is added.
+#define INITIAL_SEGMENT_CAPACITY (64 * 1024)
+
+// The number of floats in each plane of a thread's tile copy.
+#define TILE_PIXELS (RASTER_TILE_SIZE * RASTER_TILE_SIZE + LANE_COUNT)
+
+// The offset of each lane's pixel from the first one.
+static const LaneFloats lane_offsets = {0, 1, 2, 3};
+
+LineRasterizer* CreateLineRasterizer(int width, int height,
+    int thread_count) {
+  LineRasterizer *r = NULL;
+  RasterizerThread *t = NULL;
+  uint64_t tile_count;
+  int i;
+  if ((width <= 0) || (height <= 0) || (thread_count <= 0)) {
+    printf("Invalid rasterizer size or thread count.\n");
+    return NULL;
+  }
+  r = (LineRasterizer *) calloc(1, sizeof(*r));
+  if (!r) {
+    printf("Failed allocating rasterizer.\n");
+    return NULL;
+  }
+  r->width = width;
+  r->height = height;
+  r->thread_count = thread_count;
+  r->tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  r->tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  tile_count = ((uint64_t) r->tiles_x) * r->tiles_y;
+  pthread_mutex_init(&(r->lock), NULL);
+  glm_mat4_identity(r->clip_transform);
+  r->threads = (RasterizerThread *) calloc(thread_count, sizeof(*t));
+  r->bin_counts = (uint64_t *) calloc(tile_count * thread_count,
+    sizeof(uint64_t));
+  r->bin_cursors = (uint64_t *) calloc(tile_count * thread_count,
+    sizeof(uint64_t));
+  r->bin_starts = (uint64_t *) calloc(tile_count + 1, sizeof(uint64_t));
+  r->pixels = (uint8_t *) calloc(((uint64_t) width) * height, 3);
+  if (!r->threads || !r->bin_counts || !r->bin_cursors || !r->bin_starts ||
+    !r->pixels) {
+    printf("Failed allocating buffers for a %dx%d rasterized image.\n", width,
+      height);
+    DestroyLineRasterizer(r);
+    return NULL;
+  }
+  for (i = 0; i < thread_count; i++) {
+    t = r->threads + i;
+    t->r = r;
+    t->index = i;
+    t->depth = (float *) calloc(TILE_PIXELS, sizeof(float));
+    t->red = (float *) calloc(TILE_PIXELS, sizeof(float));
+    t->green = (float *) calloc(TILE_PIXELS, sizeof(float));
+    t->blue = (float *) calloc(TILE_PIXELS, sizeof(float));
+    if (!t->depth || !t->red || !t->green || !t->blue) {
+      printf("Failed allocating rasterizer tile buffers.\n");
+      DestroyLineRasterizer(r);
+      return NULL;
+    }
+  }
+  return r;
+}
+
+void DestroyLineRasterizer(LineRasterizer *r) {
+  RasterizerThread *t = NULL;
+  int i;
+  if (!r) return;
+  if (r->threads) {
+    for (i = 0; i < r->thread_count; i++) {
+      t = r->threads + i;
+      free(t->depth);
+      free(t->red);
+      free(t->green);
+      free(t->blue);
+    }
+  }
+  free(r->threads);
+  free(r->segments);
+  free(r->bin_counts);
+  free(r->bin_cursors);
+  free(r->bin_starts);
+  free(r->bin_segments);
+  free(r->pixels);
+  pthread_mutex_destroy(&(r->lock));
+  memset(r, 0, sizeof(*r));
+  free(r);
+}
+
+void BeginRasterizedLines(LineRasterizer *r, mat4 clip_transform) {
+  glm_mat4_copy(clip_transform, r->clip_transform);
+  r->segment_count = 0;
+}
+
+// Packs a floating-point color into 8-bit RGBA.
+static uint32_t PackColor(vec4 color) {
+  uint32_t packed = 0;
+  float v;
+  int i;
+  for (i = 0; i < 4; i++) {
+    v = color[i];
+    if (v < 0) v = 0;
+    if (v > 1) v = 1;
+    packed |= ((uint32_t) (v * 255.0 + 0.5)) << (i * 8);
+  }
+  return packed;
+}
+
+// Clips the segment between the clip-space points a and b to the view
+// volume, setting *t0 and *t1 to the fraction of the way from a to b that the
+// visible part starts and ends. Returns 0 if no part is visible.
+static int ClipSegment(vec4 a, vec4 b, float *t0, float *t1) {
+  float da, db, t;
+  int i;
+  *t0 = 0;
+  *t1 = 1;
+  // Each plane is w + c >= 0 or w - c >= 0, for c = x, y, or z.
+  for (i = 0; i < 6; i++) {
+    if (i & 1) {
+      da = a[3] - a[i / 2];
+      db = b[3] - b[i / 2];
+    } else {
+      da = a[3] + a[i / 2];
+      db = b[3] + b[i / 2];
+    }
+    if ((da < 0) && (db < 0)) return 0;
+    if ((da >= 0) && (db >= 0)) continue;
+    t = da / (da - db);
+    if (da < 0) {
+      if (t > *t0) *t0 = t;
+    } else {
+      if (t < *t1) *t1 = t;
+    }
+    if (*t0 >= *t1) return 0;
+  }
+  return 1;
+}
+
+// Converts a clip-space point to pixel coordinates and depth.
+static void ToScreen(LineRasterizer *r, vec4 clip, float *x, float *y,
+    float *z) {
+  float inverse_w = 1.0 / clip[3];
+  *x = (clip[0] * inverse_w * 0.5 + 0.5) * r->width;
+  *y = (0.5 - clip[1] * inverse_w * 0.5) * r->height;
+  *z = clip[2] * inverse_w * 0.5 + 0.5;
+}
+
+// Makes room for at least one more segment. Returns 0 on error.
+static int ReserveSegment(LineRasterizer *r) {
+  uint32_t new_capacity;
+  RasterSegment *tmp = NULL;
+  if (r->segment_count < r->segment_capacity) return 1;
+  new_capacity = r->segment_capacity * 2;
+  if (new_capacity == 0) new_capacity = INITIAL_SEGMENT_CAPACITY;
+  if (new_capacity <= r->segment_capacity) {
+    printf("Too many segments to rasterize.\n");
+    return 0;
+  }
+  tmp = (RasterSegment *) realloc(r->segments, new_capacity * sizeof(*tmp));
+  if (!tmp) {
+    printf("Failed allocating space for %u rasterized segments.\n",
+      (unsigned) new_capacity);
+    return 0;
+  }
+  r->segments = tmp;
+  r->segment_capacity = new_capacity;
+  return 1;
+}
+
+int AddRasterizedLines(void *rasterizer, MeshVertex *vertices,
+    uint32_t count) {
+  LineRasterizer *r = (LineRasterizer *) rasterizer;
+  RasterSegment *s = NULL;
+  MeshVertex *a = NULL;
+  MeshVertex *b = NULL;
+  vec4 location, clip_a, clip_b, start, end, color;
+  float t0, t1;
+  uint32_t i;
+  for (i = 0; (i + 1) < count; i += 2) {
+    a = vertices + i;
+    b = vertices + i + 1;
+    glm_vec4(a->location, 1.0, location);
+    glm_mat4_mulv(r->clip_transform, location, clip_a);
+    glm_vec4(b->location, 1.0, location);
+    glm_mat4_mulv(r->clip_transform, location, clip_b);
+    if (!ClipSegment(clip_a, clip_b, &t0, &t1)) continue;
+    if (!ReserveSegment(r)) return 0;
+    s = r->segments + r->segment_count;
+    r->segment_count++;
+    glm_vec4_lerp(clip_a, clip_b, t0, start);
+    glm_vec4_lerp(clip_a, clip_b, t1, end);
+    ToScreen(r, start, &(s->x0), &(s->y0), &(s->z0));
+    ToScreen(r, end, &(s->x1), &(s->y1), &(s->z1));
+    glm_vec4_lerp(a->color, b->color, t0, color);
+    s->color0 = PackColor(color);
+    glm_vec4_lerp(a->color, b->color, t1, color);
+    s->color1 = PackColor(color);
+  }
+  return 1;
+}
+
+// Either counts the tiles touched by the segment, or, if cursors isn't NULL,
+// writes the segment's index into each tile's bin. A tile is touched if it's
+// within a pixel of the segment. counts and cursors are the thread's arrays,
+// with one entry per tile.
+static void BinSegment(LineRasterizer *r, uint32_t index, uint64_t *counts,
+    uint64_t *cursors) {
+  RasterSegment *s = r->segments + index;
+  float min_x = fminf(s->x0, s->x1) - 1;
+  float max_x = fmaxf(s->x0, s->x1) + 1;
+  float min_y = fminf(s->y0, s->y1) - 1;
+  float max_y = fmaxf(s->y0, s->y1) + 1;
+  float dx = s->x1 - s->x0;
+  float dy = s->y1 - s->y0;
+  float length = sqrtf(dx * dx + dy * dy);
+  float half_diagonal = RASTER_TILE_SIZE * 0.7072 + 1.0;
+  float nx = 0, ny = 0, cx, cy;
+  int tx0, tx1, ty0, ty1, tx, ty;
+  uint32_t tile;
+  if (length > 1.0e-6) {
+    nx = -dy / length;
+    ny = dx / length;
+  }
+  tx0 = (int) (fmaxf(min_x, 0) / RASTER_TILE_SIZE);
+  ty0 = (int) (fmaxf(min_y, 0) / RASTER_TILE_SIZE);
+  tx1 = (int) (fminf(max_x, r->width - 1) / RASTER_TILE_SIZE);
+  ty1 = (int) (fminf(max_y, r->height - 1) / RASTER_TILE_SIZE);
+  for (ty = ty0; ty <= ty1; ty++) {
+    for (tx = tx0; tx <= tx1; tx++) {
+      // Skip tiles that the bounding box touches but the line doesn't.
+      cx = (tx + 0.5) * RASTER_TILE_SIZE - s->x0;
+      cy = (ty + 0.5) * RASTER_TILE_SIZE - s->y0;
+      if (fabsf(cx * nx + cy * ny) > half_diagonal) continue;
+      tile = ty * r->tiles_x + tx;
+      if (cursors) {
+        r->bin_segments[cursors[tile]] = index;
+        cursors[tile]++;
+      } else {
+        counts[tile]++;
+      }
+    }
+  }
+}
+
+// Returns the range of segments binned by the given thread.
+static void ThreadSegmentRange(RasterizerThread *t, uint32_t *start,
+    uint32_t *end) {
+  LineRasterizer *r = t->r;
+  uint64_t count = r->segment_count;
+  *start = (count * t->index) / r->thread_count;
+  *end = (count * (t->index + 1)) / r->thread_count;
+}
+
+static void* CountBinsThread(void *arg) {
+  RasterizerThread *t = (RasterizerThread *) arg;
+  LineRasterizer *r = t->r;
+  uint64_t tile_count = ((uint64_t) r->tiles_x) * r->tiles_y;
+  uint64_t *counts = r->bin_counts + t->index * tile_count;
+  uint32_t i, start, end;
+  memset(counts, 0, tile_count * sizeof(uint64_t));
+  ThreadSegmentRange(t, &start, &end);
+  for (i = start; i < end; i++) {
+    BinSegment(r, i, counts, NULL);
+  }
+  return NULL;
+}
+
+static void* FillBinsThread(void *arg) {
+  RasterizerThread *t = (RasterizerThread *) arg;
+  LineRasterizer *r = t->r;
+  uint64_t tile_count = ((uint64_t) r->tiles_x) * r->tiles_y;
+  uint64_t *cursors = r->bin_cursors + t->index * tile_count;
+  uint32_t i, start, end;
+  ThreadSegmentRange(t, &start, &end);
+  for (i = start; i < end; i++) {
+    BinSegment(r, i, NULL, cursors);
+  }
+  return NULL;
+}
+
+// Unpacks one channel of a packed color to the range [0, 1].
+static float ColorChannel(uint32_t color, int channel) {
+  return ((float) ((color >> (channel * 8)) & 0xff)) / 255.0;
+}
+
+// Draws the part of the segment that's within the thread's current tile,
+// whose top left pixel is at (tile_x, tile_y). Each pixel's coverage falls
+// off linearly with its distance from the segment, so the line is about a
+// pixel wide, and pixels only update the depth if they're at least half
+// covered.
+static void DrawSegmentInTile(RasterizerThread *t, RasterSegment *s,
+    int tile_x, int tile_y) {
+  LaneFloats zero = {0};
+  LaneFloats px, along, across, coverage, f, z, old, value;
+  LaneMask visible;
+  float dx = s->x1 - s->x0;
+  float dy = s->y1 - s->y0;
+  float length = sqrtf(dx * dx + dy * dy);
+  float ux = 1, uy = 0, inverse_length = 0;
+  float nx, ny, py, lo, hi, tmp;
+  float min_x, max_x, min_y, max_y, start_x, end_x;
+  float red0, green0, blue0, red1, green1, blue1;
+  int x, y, row;
+  if (length > 1.0e-6) {
+    ux = dx / length;
+    uy = dy / length;
+    inverse_length = 1.0 / length;
+  }
+  nx = -uy;
+  ny = ux;
+  // The bounds of the pixels that may be covered, relative to the tile.
+  min_x = fmaxf(floorf(fminf(s->x0, s->x1) - 1) - tile_x, 0);
+  max_x = fminf(ceilf(fmaxf(s->x0, s->x1) + 1) - tile_x,
+    RASTER_TILE_SIZE - 1);
+  min_y = fmaxf(floorf(fminf(s->y0, s->y1) - 1) - tile_y, 0);
+  max_y = fminf(ceilf(fmaxf(s->y0, s->y1) + 1) - tile_y,
+    RASTER_TILE_SIZE - 1);
+  red0 = ColorChannel(s->color0, 0);
+  green0 = ColorChannel(s->color0, 1);
+  blue0 = ColorChannel(s->color0, 2);
+  red1 = ColorChannel(s->color1, 0);
+  green1 = ColorChannel(s->color1, 1);
+  blue1 = ColorChannel(s->color1, 2);
+  for (y = min_y; y <= max_y; y++) {
+    py = tile_y + y + 0.5 - s->y0;
+    // Only visit the span of the row within a pixel of the line.
+    start_x = min_x;
+    end_x = max_x;
+    if (fabsf(nx) > 1.0e-6) {
+      lo = (-1.0 - py * ny) / nx;
+      hi = (1.0 - py * ny) / nx;
+      if (lo > hi) {
+        tmp = lo;
+        lo = hi;
+        hi = tmp;
+      }
+      lo = floorf(lo + s->x0 - tile_x - 0.5);
+      hi = ceilf(hi + s->x0 - tile_x - 0.5);
+      if (lo > start_x) start_x = lo;
+      if (hi < end_x) end_x = hi;
+    }
+    row = y * RASTER_TILE_SIZE;
+    for (x = start_x; x <= end_x; x += LANE_COUNT) {
+      px = lane_offsets + (tile_x + x + 0.5f - s->x0);
+      along = px * ux + py * uy;
+      across = AbsLanes(px * nx + py * ny);
+      coverage = Clamp01Lanes(1.0f - across) * Clamp01Lanes(
+        MinLanes(along, length - along) + 0.5f);
+      f = Clamp01Lanes(along * inverse_length);
+      z = s->z0 + (s->z1 - s->z0) * f;
+      old = LoadLanes(t->depth + row + x);
+      visible = (coverage > zero) & (z < old) &
+        ((lane_offsets + (float) x) <= end_x);
+      StoreLanes(t->depth + row + x, SelectLanes(visible & (coverage >=
+        0.5f), z, old));
+      old = LoadLanes(t->red + row + x);
+      value = red0 + (red1 - red0) * f;
+      StoreLanes(t->red + row + x, SelectLanes(visible, old + (value - old) *
+        coverage, old));
+      old = LoadLanes(t->green + row + x);
+      value = green0 + (green1 - green0) * f;
+      StoreLanes(t->green + row + x, SelectLanes(visible, old + (value - old) *
+        coverage, old));
+      old = LoadLanes(t->blue + row + x);
+      value = blue0 + (blue1 - blue0) * f;
+      StoreLanes(t->blue + row + x, SelectLanes(visible, old + (value - old) *
+        coverage, old));
+    }
+  }
+}
+
+// Converts a color channel to 8 bits.
+static uint8_t ToByte(float v) {
+  if (v <= 0) return 0;
+  if (v >= 1) return 255;
+  return (uint8_t) (v * 255.0 + 0.5);
+}
+
+// Draws every segment in the tile's bin, and copies the result into the
+// image.
+static void DrawTile(RasterizerThread *t, uint32_t tile) {
+  LineRasterizer *r = t->r;
+  int tile_x = (tile % r->tiles_x) * RASTER_TILE_SIZE;
+  int tile_y = (tile / r->tiles_x) * RASTER_TILE_SIZE;
+  uint64_t i;
+  uint8_t *dst = NULL;
+  int x, y, width, height;
+  for (i = 0; i < TILE_PIXELS; i++) {
+    t->depth[i] = 1.0;
+    t->red[i] = 0;
+    t->green[i] = 0;
+    t->blue[i] = 0;
+  }
+  for (i = r->bin_starts[tile]; i < r->bin_starts[tile + 1]; i++) {
+    DrawSegmentInTile(t, r->segments + r->bin_segments[i], tile_x, tile_y);
+  }
+  width = r->width - tile_x;
+  if (width > RASTER_TILE_SIZE) width = RASTER_TILE_SIZE;
+  height = r->height - tile_y;
+  if (height > RASTER_TILE_SIZE) height = RASTER_TILE_SIZE;
+  for (y = 0; y < height; y++) {
+    dst = r->pixels + (((uint64_t) (tile_y + y)) * r->width + tile_x) * 3;
+    for (x = 0; x < width; x++) {
+      i = y * RASTER_TILE_SIZE + x;
+      dst[x * 3] = ToByte(t->red[i]);
+      dst[x * 3 + 1] = ToByte(t->green[i]);
+      dst[x * 3 + 2] = ToByte(t->blue[i]);
+    }
+  }
+}
+
+static void* DrawTilesThread(void *arg) {
+  RasterizerThread *t = (RasterizerThread *) arg;
+  LineRasterizer *r = t->r;
+  uint32_t tile_count = r->tiles_x * r->tiles_y;
+  uint32_t tile;
+  while (1) {
+    pthread_mutex_lock(&(r->lock));
+    tile = r->next_tile;
+    r->next_tile++;
+    pthread_mutex_unlock(&(r->lock));
+    if (tile >= tile_count) break;
+    DrawTile(t, tile);
+  }
+  return NULL;
+}
+
+// Runs the function on each of the rasterizer's threads. The name is used in
+// the trace. Returns 0 on error.
+static int RunRasterizerThreads(LineRasterizer *r, const char *name,
+    ThreadGroupFunction f) {
+  return RunThreadGroup(name, r->thread_count, f, r->threads,
+    sizeof(RasterizerThread));
+}
+
+int RasterizeLines(LineRasterizer *r) {
+  uint64_t tile_count = ((uint64_t) r->tiles_x) * r->tiles_y;
+  uint64_t total = 0;
+  uint64_t tile;
+  uint32_t *tmp = NULL;
+  int i;
+  if (!RunRasterizerThreads(r, "Count line bins", CountBinsThread)) return 0;
+  // Lay out each tile's bin so that every thread's indices come after those
+  // of the previous thread, keeping the segments in order.
+  for (tile = 0; tile < tile_count; tile++) {
+    r->bin_starts[tile] = total;
+    for (i = 0; i < r->thread_count; i++) {
+      r->bin_cursors[i * tile_count + tile] = total;
+      total += r->bin_counts[i * tile_count + tile];
+    }
+  }
+  r->bin_starts[tile_count] = total;
+  if (total > r->bin_capacity) {
+    tmp = (uint32_t *) realloc(r->bin_segments, total * sizeof(uint32_t));
+    if (!tmp) {
+      printf("Failed allocating %llu binned segment indices.\n",
+        (unsigned long long) total);
+      return 0;
+    }
+    r->bin_segments = tmp;
+    r->bin_capacity = total;
+  }
+  if (!RunRasterizerThreads(r, "Fill line bins", FillBinsThread)) return 0;
+  r->next_tile = 0;
+  return RunRasterizerThreads(r, "Draw line tiles", DrawTilesThread);
+}
@@ -0,0 +1,102 @@
+// A multithreaded CPU renderer that draws the turtle's segments as
+// anti-aliased, one-pixel-wide lines with a depth buffer, for rendering
+// images on machines without a GPU. It doesn't use OpenGL.
+//
+// Segments are projected and clipped as they're added, and kept in a compact
+// screen-space form. Rasterizing then happens in three parallel passes: each
+// thread counts how many of its segments touch every tile of the image, then
+// writes the segments' indices into per-tile bins, and finally the threads
+// take turns claiming tiles and drawing every segment in each tile's bin, in
+// the order they were added. Each tile's pixels are shaded LANE_COUNT at a
+// time using vector instructions.
+#ifndef LINE_RASTERIZER_H
+#define LINE_RASTERIZER_H
+#include <pthread.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "lanes.h"
+#include "mesh_vertex.h"
+
+// The width and height, in pixels, of the tiles that segments are binned
+// into. Each thread keeps a floating-point copy of one tile's color and
+// depth.
+#define RASTER_TILE_SIZE (64)
+
+// A segment after projection, in pixels from the top left corner of the
+// image. Depths are in the range [0, 1], with 0 being the near plane.
+typedef struct {
+  float x0, y0, z0;
+  float x1, y1, z1;
+  // The colors at each end, as 8-bit RGBA values packed into the bytes of
+  // the integer, with red in the lowest byte.
+  uint32_t color0;
+  uint32_t color1;
+} RasterSegment;
+
+struct LineRasterizer;
+
+// The state of one of the rasterizer's threads.
+typedef struct {
+  struct LineRasterizer *r;
+  int index;
+  // The thread's copy of the tile being drawn, one value per pixel, with
+  // LANE_COUNT values of padding at the end.
+  float *depth;
+  float *red;
+  float *green;
+  float *blue;
+} RasterizerThread;
+
+typedef struct LineRasterizer {
+  int width;
+  int height;
+  int thread_count;
+  RasterizerThread *threads;
+  int tiles_x;
+  int tiles_y;
+  // Transforms vertex locations to clip space.
+  mat4 clip_transform;
+  // The segments that survived clipping.
+  RasterSegment *segments;
+  uint32_t segment_count;
+  uint32_t segment_capacity;
+  // The number of segments each thread found in each tile, indexed by
+  // thread * tile count + tile, followed by where each thread writes its
+  // next index into each tile's bin.
+  uint64_t *bin_counts;
+  uint64_t *bin_cursors;
+  // The start of each tile's bin in bin_segments. Has an extra entry at the
+  // end holding the total number of indices.
+  uint64_t *bin_starts;
+  uint32_t *bin_segments;
+  uint64_t bin_capacity;
+  // Protects next_tile while drawing.
+  pthread_mutex_t lock;
+  uint32_t next_tile;
+  // The finished image: 8-bit RGB, with the top row first.
+  uint8_t *pixels;
+} LineRasterizer;
+
+// Allocates a rasterizer for images of the given size, drawn using the given
+// number of threads. Returns NULL on error.
+LineRasterizer* CreateLineRasterizer(int width, int height, int thread_count);
+
+// Frees the rasterizer. The pointer is no longer valid after this returns.
+void DestroyLineRasterizer(LineRasterizer *r);
+
+// Discards any segments, and sets the transform from vertex locations to clip
+// space (i.e. the projection, view and model matrices combined).
+void BeginRasterizedLines(LineRasterizer *r, mat4 clip_transform);
+
+// Projects and clips the given segments and adds them to the image. The
+// vertices are a list of pairs, like in a mesh. The arguments match a
+// TurtleVertexSink, so this can receive vertices straight from the turtle.
+// Returns 0 on error.
+int AddRasterizedLines(void *rasterizer, MeshVertex *vertices,
+    uint32_t count);
+
+// Draws every segment added since BeginRasterizedLines into r->pixels.
+// Returns 0 on error.
+int RasterizeLines(LineRasterizer *r);
+
+#endif  // LINE_RASTERIZER_H
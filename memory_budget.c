@@ -0,0 +1,250 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_budget.h"
+
+// Stored in front of every tracked allocation, so it can be freed without
+// the caller knowing its size or category.
+typedef union {
+  struct {
+    uint64_t size;
+    MemoryCategory category;
+  } info;
+  // Keeps the memory following the header aligned for any type.
+  long double align_float;
+  void *align_pointer;
+  uint64_t align_int;
+} TrackedHeader;
+
+// All of the counters are updated atomically, since some allocations happen
+// on worker threads.
+static uint64_t current_bytes[MEMORY_CATEGORY_COUNT];
+static uint64_t peak_bytes[MEMORY_CATEGORY_COUNT];
+// The totals counted towards the budget.
+static uint64_t total_bytes = 0;
+static uint64_t total_peak_bytes = 0;
+static uint64_t memory_budget = 0;
+static MemoryPressureCallback pressure_callback = NULL;
+static void *pressure_callback_data = NULL;
+// Used for every tracked allocation if its functions are set.
+static MemoryAllocator allocator;
+
+static float ToMB(uint64_t bytes) {
+  return ((float) bytes) / (1024.0 * 1024.0);
+}
+
+const char* MemoryCategoryName(MemoryCategory c) {
+  switch (c) {
+  case MEMORY_STRINGS:
+    return "strings";
+  case MEMORY_TURTLE:
+    return "turtle";
+  case MEMORY_CONFIG:
+    return "config";
+  case MEMORY_MESH:
+    return "mesh";
+  case MEMORY_GPU_BUFFERS:
+    return "GPU buffers";
+  default:
+    break;
+  }
+  return "unknown";
+}
+
+// Raises *peak to value if it's lower.
+static void UpdatePeak(uint64_t *peak, uint64_t value) {
+  uint64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (value > old) {
+    if (__atomic_compare_exchange_n(peak, &old, value, 1, __ATOMIC_RELAXED,
+      __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+
+void AddTrackedBytes(MemoryCategory c, int64_t bytes) {
+  uint64_t value;
+  value = __atomic_add_fetch(current_bytes + c, (uint64_t) bytes,
+    __ATOMIC_RELAXED);
+  UpdatePeak(peak_bytes + c, value);
+  if (c == MEMORY_GPU_BUFFERS) return;
+  value = __atomic_add_fetch(&total_bytes, (uint64_t) bytes,
+    __ATOMIC_RELAXED);
+  UpdatePeak(&total_peak_bytes, value);
+}
+
+void SetMemoryBudget(uint64_t bytes) {
+  __atomic_store_n(&memory_budget, bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t GetMemoryBudget(void) {
+  return __atomic_load_n(&memory_budget, __ATOMIC_RELAXED);
+}
+
+int MemoryBudgetAllows(uint64_t bytes) {
+  uint64_t budget = GetMemoryBudget();
+  uint64_t used = TotalTrackedBytes();
+  if (budget == 0) return 1;
+  if (used > budget) return 0;
+  return bytes <= (budget - used);
+}
+
+void SetMemoryPressureCallback(MemoryPressureCallback callback, void *data) {
+  pressure_callback = callback;
+  pressure_callback_data = data;
+}
+
+// Returns nonzero if the given number of additional bytes may be allocated in
+// the category, calling the memory pressure callback to make room if
+// necessary. Prints a message and returns 0 if they may not. Several threads
+// allocating at once may together go slightly over the budget.
+static int CheckBudget(MemoryCategory c, uint64_t bytes) {
+  if (c == MEMORY_GPU_BUFFERS) return 1;
+  if (MemoryBudgetAllows(bytes)) return 1;
+  if (pressure_callback && pressure_callback(pressure_callback_data, bytes) &&
+    MemoryBudgetAllows(bytes)) {
+    return 1;
+  }
+  printf("Allocating %.02f MB for the %s would exceed the memory budget of "
+    "%.02f MB, with %.02f MB already in use.\n", ToMB(bytes),
+    MemoryCategoryName(c), ToMB(GetMemoryBudget()),
+    ToMB(TotalTrackedBytes()));
+  return 0;
+}
+
+int SetMemoryAllocator(const MemoryAllocator *a) {
+  int i;
+  if (a && (!a->allocate || !a->reallocate || !a->release)) {
+    printf("A memory allocator needs all three functions.\n");
+    return 0;
+  }
+  for (i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    if (i == MEMORY_GPU_BUFFERS) continue;
+    if (TrackedBytes(i) != 0) {
+      printf("Can't change the memory allocator while %s memory is "
+        "allocated.\n", MemoryCategoryName(i));
+      return 0;
+    }
+  }
+  if (a) {
+    allocator = *a;
+  } else {
+    memset(&allocator, 0, sizeof(allocator));
+  }
+  return 1;
+}
+
+// Returns zeroed memory from the allocator, or NULL on error.
+static void* AllocateZeroed(size_t size) {
+  void *p = NULL;
+  if (!allocator.allocate) return calloc(1, size);
+  p = allocator.allocate(allocator.data, size);
+  if (p) memset(p, 0, size);
+  return p;
+}
+
+static void* Reallocate(void *p, size_t size) {
+  if (!allocator.reallocate) return realloc(p, size);
+  return allocator.reallocate(allocator.data, p, size);
+}
+
+static void Release(void *p) {
+  if (!allocator.release) {
+    free(p);
+    return;
+  }
+  allocator.release(allocator.data, p);
+}
+
+void* TrackedCalloc(MemoryCategory c, size_t count, size_t size) {
+  TrackedHeader *h = NULL;
+  size_t bytes;
+  if ((size != 0) && (count > ((SIZE_MAX - sizeof(*h)) / size))) return NULL;
+  bytes = count * size;
+  if (!CheckBudget(c, bytes)) return NULL;
+  h = (TrackedHeader *) AllocateZeroed(sizeof(*h) + bytes);
+  if (!h) return NULL;
+  h->info.size = bytes;
+  h->info.category = c;
+  AddTrackedBytes(c, bytes);
+  return h + 1;
+}
+
+void* TrackedRealloc(MemoryCategory c, void *p, size_t size) {
+  TrackedHeader *h = NULL;
+  uint64_t old_size;
+  if (!p) return TrackedCalloc(c, 1, size);
+  if (size > (SIZE_MAX - sizeof(*h))) return NULL;
+  h = ((TrackedHeader *) p) - 1;
+  c = h->info.category;
+  old_size = h->info.size;
+  if ((size > old_size) && !CheckBudget(c, size - old_size)) return NULL;
+  h = (TrackedHeader *) Reallocate(h, sizeof(*h) + size);
+  if (!h) return NULL;
+  h->info.size = size;
+  AddTrackedBytes(c, ((int64_t) size) - ((int64_t) old_size));
+  return h + 1;
+}
+
+char* TrackedStrdup(MemoryCategory c, const char *s) {
+  size_t length = strlen(s);
+  char *to_return = (char *) TrackedCalloc(c, length + 1, 1);
+  if (!to_return) return NULL;
+  memcpy(to_return, s, length);
+  return to_return;
+}
+
+void TrackedFree(void *p) {
+  TrackedHeader *h = NULL;
+  if (!p) return;
+  h = ((TrackedHeader *) p) - 1;
+  AddTrackedBytes(h->info.category, -((int64_t) h->info.size));
+  Release(h);
+}
+
+uint64_t TrackedBytes(MemoryCategory c) {
+  return __atomic_load_n(current_bytes + c, __ATOMIC_RELAXED);
+}
+
+uint64_t PeakTrackedBytes(MemoryCategory c) {
+  return __atomic_load_n(peak_bytes + c, __ATOMIC_RELAXED);
+}
+
+uint64_t TotalTrackedBytes(void) {
+  return __atomic_load_n(&total_bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t PeakTotalTrackedBytes(void) {
+  return __atomic_load_n(&total_peak_bytes, __ATOMIC_RELAXED);
+}
+
+void ResetPeakTrackedBytes(void) {
+  int i;
+  for (i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    __atomic_store_n(peak_bytes + i, TrackedBytes(i), __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&total_peak_bytes, TotalTrackedBytes(), __ATOMIC_RELAXED);
+}
+
+void PrintMemoryReport(void) {
+  uint64_t budget = GetMemoryBudget();
+  int i;
+  printf("Memory use, current / peak:");
+  for (i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    if (i == MEMORY_GPU_BUFFERS) continue;
+    printf(" %s %.02f / %.02f MB,", MemoryCategoryName(i),
+      ToMB(TrackedBytes(i)), ToMB(PeakTrackedBytes(i)));
+  }
+  printf(" total %.02f / %.02f MB", ToMB(TotalTrackedBytes()),
+    ToMB(PeakTotalTrackedBytes()));
+  if (budget != 0) {
+    printf(" of a %.02f MB budget.\n", ToMB(budget));
+  } else {
+    printf(" with no budget.\n");
+  }
+  printf("GPU buffers: %.02f MB, peak %.02f MB.\n",
+    ToMB(TrackedBytes(MEMORY_GPU_BUFFERS)),
+    ToMB(PeakTrackedBytes(MEMORY_GPU_BUFFERS)));
+}
@@ -0,0 +1,125 @@
+// Keeps track of how much memory each part of the program is using, and
+// enforces a limit on the total so that generating too many iterations fails
+// cleanly instead of getting the process killed. Doesn't use OpenGL.
+//
+// Memory allocated with TrackedCalloc, TrackedRealloc or TrackedStrdup is
+// counted towards its category until it's passed to TrackedFree, and must not
+// be passed to free() or realloc(). Memory allocated elsewhere, e.g. OpenGL
+// buffers, can be counted using AddTrackedBytes.
+//
+// Allocations that would take the total above the budget first call the
+// memory pressure callback, if one is set, which can free caches to make
+// room. If that doesn't free enough, the allocation fails and returns NULL,
+// the same as if malloc had failed. Callers that can fall back to something
+// cheaper should check MemoryBudgetAllows before allocating instead.
+//
+// Tracked memory comes from the C library's allocator unless a different one
+// is set using SetMemoryAllocator, e.g. by a program embedding liblsystem.
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+#include <stddef.h>
+#include <stdint.h>
+
+// The parts of the program whose memory is tracked separately.
+typedef enum {
+  // Expanded L-system strings.
+  MEMORY_STRINGS = 0,
+  // The turtle's vertex array and stacks, and buffers for its output.
+  MEMORY_TURTLE,
+  // Parsed config files.
+  MEMORY_CONFIG,
+  // The CPU-side copy of the mesh and its LOD tree.
+  MEMORY_MESH,
+  // OpenGL vertex buffers. This is GPU memory, so it's reported but isn't
+  // counted towards the budget, which is for the process's own memory.
+  MEMORY_GPU_BUFFERS,
+  MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+// Called when an allocation of the given number of bytes would exceed the
+// budget. It should free any tracked memory that can be recreated later, and
+// return nonzero if it freed anything, in which case the allocation is tried
+// again. It's called on the allocating thread, and must not allocate tracked
+// memory itself.
+typedef int (*MemoryPressureCallback)(void *data, uint64_t needed);
+
+// Functions that tracked memory is allocated with, in place of malloc,
+// realloc and free. They must behave the same way as those functions, except
+// that they're passed the data pointer, and must be safe to call from any
+// thread.
+typedef struct {
+  void* (*allocate)(void *data, size_t size);
+  void* (*reallocate)(void *data, void *p, size_t size);
+  void (*release)(void *data, void *p);
+  void *data;
+} MemoryAllocator;
+
+// Returns a short name for the category, e.g. "strings".
+const char* MemoryCategoryName(MemoryCategory c);
+
+// Like calloc, but counts the memory towards the given category. Returns NULL
+// on error, or if the memory would exceed the budget.
+void* TrackedCalloc(MemoryCategory c, size_t count, size_t size);
+
+// Like realloc, but for tracked memory, which stays in the same category. If
+// p is NULL this allocates new memory in the given category. Any new space
+// isn't zeroed. Returns NULL on error, or if the memory would exceed the
+// budget, in which case p is unchanged.
+void* TrackedRealloc(MemoryCategory c, void *p, size_t size);
+
+// Returns a tracked copy of the null-terminated string, or NULL on error.
+char* TrackedStrdup(MemoryCategory c, const char *s);
+
+// Frees memory allocated by TrackedCalloc, TrackedRealloc or TrackedStrdup.
+// Does nothing if p is NULL.
+void TrackedFree(void *p);
+
+// Makes all tracked memory use the given allocator, which is copied, or the C
+// library's again if a is NULL. Returns 0, without changing the allocator,
+// if any of a's functions are NULL, or if any tracked memory is currently
+// allocated, since it couldn't be freed afterwards.
+int SetMemoryAllocator(const MemoryAllocator *a);
+
+// Adds the given (possibly negative) number of bytes to the category, for
+// memory that isn't allocated using the functions above. Doesn't enforce the
+// budget.
+void AddTrackedBytes(MemoryCategory c, int64_t bytes);
+
+// Sets the most memory, in bytes, that every category other than
+// MEMORY_GPU_BUFFERS may use in total. 0 means there's no limit, which is
+// the default. Memory already allocated isn't affected.
+void SetMemoryBudget(uint64_t bytes);
+
+// Returns the current budget, or 0 if there's no limit.
+uint64_t GetMemoryBudget(void);
+
+// Returns nonzero if the given number of additional bytes would fit within the
+// budget. Doesn't call the memory pressure callback.
+int MemoryBudgetAllows(uint64_t bytes);
+
+// Sets the function called when an allocation would exceed the budget. The
+// callback may be NULL, to remove it.
+void SetMemoryPressureCallback(MemoryPressureCallback callback, void *data);
+
+// Returns the number of bytes currently allocated in the category.
+uint64_t TrackedBytes(MemoryCategory c);
+
+// Returns the most bytes that have been allocated in the category at once.
+uint64_t PeakTrackedBytes(MemoryCategory c);
+
+// Returns the number of bytes counted towards the budget, i.e. in every
+// category other than MEMORY_GPU_BUFFERS.
+uint64_t TotalTrackedBytes(void);
+
+// Returns the most bytes that have been counted towards the budget at once.
+uint64_t PeakTotalTrackedBytes(void);
+
+// Lowers every peak to the number of bytes currently allocated, so that the
+// peaks only cover what's allocated afterwards, e.g. during a single
+// benchmark run.
+void ResetPeakTrackedBytes(void);
+
+// Prints the current and peak memory used by each category, and the budget.
+void PrintMemoryReport(void);
+
+#endif  // MEMORY_BUDGET_H
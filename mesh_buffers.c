@@ -0,0 +1,349 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "gl_utilities.h"
+#include "memory_budget.h"
+#include "mesh_buffers.h"
+#include "mesh_vertex.h"
+#include "utilities.h"
+
+MeshBufferSet* CreateMeshBufferSet(void) {
+  MeshBufferSet *b = NULL;
+  GLint64 max_block_size = 0;
+  b = (MeshBufferSet *) calloc(1, sizeof(*b));
+  if (!b) {
+    printf("Failed allocating mesh buffer list.\n");
+    return NULL;
+  }
+  glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &max_block_size);
+  max_block_size /= sizeof(MeshVertex);
+  if (max_block_size > MESH_BUFFER_VERTICES) {
+    max_block_size = MESH_BUFFER_VERTICES;
+  }
+  b->storage_window_vertices = max_block_size - (max_block_size %
+    STORAGE_WINDOW_ALIGNMENT);
+  if (b->storage_window_vertices == 0) {
+    b->storage_window_vertices = STORAGE_WINDOW_ALIGNMENT;
+  }
+  glGenVertexArrays(1, &(b->vao));
+  glBindVertexArray(b->vao);
+  // Setting up the location, direction, orientation, and color attributes
+  // (respectively). They all come from the same buffer binding, so switching
+  // buffers doesn't require setting them up again.
+  glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, location));
+  glVertexAttribBinding(0, MESH_BUFFER_BINDING);
+  glEnableVertexAttribArray(0);
+  glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, forward));
+  glVertexAttribBinding(1, MESH_BUFFER_BINDING);
+  glEnableVertexAttribArray(1);
+  glVertexAttribFormat(2, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, up));
+  glVertexAttribBinding(2, MESH_BUFFER_BINDING);
+  glEnableVertexAttribArray(2);
+  glVertexAttribFormat(3, 4, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, color));
+  glVertexAttribBinding(3, MESH_BUFFER_BINDING);
+  glEnableVertexAttribArray(3);
+  if (!CheckGLErrors()) {
+    printf("Failed setting up mesh vertex format.\n");
+    DestroyMeshBufferSet(b);
+    return NULL;
+  }
+  return b;
+}
+
+void DestroyMeshBufferSet(MeshBufferSet *b) {
+  if (!b) return;
+  TrimMeshBuffers(b, 0);
+  glDeleteVertexArrays(1, &(b->vao));
+  free(b->buffers);
+  free(b->buffer_sizes);
+  free(b->firsts);
+  free(b->counts);
+  memset(b, 0, sizeof(*b));
+  free(b);
+}
+
+// Creates a buffer with space for the given number of vertices, bound to
+// GL_COPY_WRITE_BUFFER. Returns 0 on error.
+static GLuint NewBuffer(uint32_t size) {
+  GLuint to_return = 0;
+  glGenBuffers(1, &to_return);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, to_return);
+  glBufferData(GL_COPY_WRITE_BUFFER, ((GLsizeiptr) size) * sizeof(MeshVertex),
+    NULL, GL_STATIC_DRAW);
+  if (!CheckGLErrors()) {
+    printf("Failed allocating a %.02f MB vertex buffer.\n",
+      ((float) size) * sizeof(MeshVertex) / (1024.0 * 1024.0));
+    glDeleteBuffers(1, &to_return);
+    return 0;
+  }
+  AddTrackedBytes(MEMORY_GPU_BUFFERS, ((int64_t) size) * sizeof(MeshVertex));
+  return to_return;
+}
+
+// Replaces buffer i with a larger one, copying over its contents. Returns 0
+// on error.
+static int GrowBuffer(MeshBufferSet *b, uint32_t i, uint32_t size) {
+  GLuint new_buffer = NewBuffer(size);
+  if (!new_buffer) return 0;
+  glBindBuffer(GL_COPY_READ_BUFFER, b->buffers[i]);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+    ((GLsizeiptr) b->buffer_sizes[i]) * sizeof(MeshVertex));
+  glDeleteBuffers(1, b->buffers + i);
+  AddTrackedBytes(MEMORY_GPU_BUFFERS, -((int64_t) b->buffer_sizes[i]) *
+    ((int64_t) sizeof(MeshVertex)));
+  b->buffers[i] = new_buffer;
+  b->buffer_sizes[i] = size;
+  return CheckGLErrors();
+}
+
+int ReserveMeshBuffers(MeshBufferSet *b, uint64_t vertex_count) {
+  uint64_t needed = (vertex_count + MESH_BUFFER_VERTICES - 1) /
+    MESH_BUFFER_VERTICES;
+  uint64_t required;
+  uint32_t i, size;
+  void *tmp = NULL;
+  if (needed > UINT32_MAX) {
+    printf("Too many vertices for the mesh buffers.\n");
+    return 0;
+  }
+  if (needed > b->buffer_capacity) {
+    tmp = realloc(b->buffers, needed * sizeof(GLuint));
+    if (!tmp) {
+      printf("Failed allocating list of %u buffers.\n", (unsigned) needed);
+      return 0;
+    }
+    b->buffers = (GLuint *) tmp;
+    tmp = realloc(b->buffer_sizes, needed * sizeof(uint32_t));
+    if (!tmp) {
+      printf("Failed allocating list of %u buffer sizes.\n",
+        (unsigned) needed);
+      return 0;
+    }
+    b->buffer_sizes = (uint32_t *) tmp;
+    b->buffer_capacity = needed;
+  }
+  for (i = 0; i < needed; i++) {
+    required = vertex_count - ((uint64_t) i) * MESH_BUFFER_VERTICES;
+    if (required > MESH_BUFFER_VERTICES) required = MESH_BUFFER_VERTICES;
+    size = MESH_BUFFER_MIN_VERTICES;
+    if (i < b->buffer_count) {
+      if (b->buffer_sizes[i] >= required) continue;
+      size = b->buffer_sizes[i];
+    }
+    while (size < required) size *= 2;
+    if (size > MESH_BUFFER_VERTICES) size = MESH_BUFFER_VERTICES;
+    if (i < b->buffer_count) {
+      if (!GrowBuffer(b, i, size)) return 0;
+      continue;
+    }
+    b->buffers[i] = NewBuffer(size);
+    if (!b->buffers[i]) return 0;
+    b->buffer_sizes[i] = size;
+    b->buffer_count++;
+  }
+  return 1;
+}
+
+void TrimMeshBuffers(MeshBufferSet *b, uint64_t vertex_count) {
+  uint64_t needed = (vertex_count + MESH_BUFFER_VERTICES - 1) /
+    MESH_BUFFER_VERTICES;
+  uint32_t i;
+  if (needed >= b->buffer_count) return;
+  glDeleteBuffers(b->buffer_count - needed, b->buffers + needed);
+  for (i = needed; i < b->buffer_count; i++) {
+    AddTrackedBytes(MEMORY_GPU_BUFFERS, -((int64_t) b->buffer_sizes[i]) *
+      ((int64_t) sizeof(MeshVertex)));
+  }
+  b->buffer_count = needed;
+}
+
+// Returns the number of vertices, up to count, that can be stored in a single
+// buffer starting at the given index, and sets *buffer and *offset to the
+// buffer holding the index and the vertex offset within it. Returns 0 if the
+// index isn't in any buffer.
+static uint32_t BufferRange(MeshBufferSet *b, uint64_t first, uint32_t count,
+    uint32_t *buffer, uint32_t *offset) {
+  uint64_t i = first / MESH_BUFFER_VERTICES;
+  uint32_t available;
+  if (i >= b->buffer_count) return 0;
+  *buffer = i;
+  *offset = first % MESH_BUFFER_VERTICES;
+  if (*offset >= b->buffer_sizes[i]) return 0;
+  available = b->buffer_sizes[i] - *offset;
+  return count < available ? count : available;
+}
+
+int WriteMeshBuffers(MeshBufferSet *b, uint64_t first, MeshVertex *vertices,
+    uint32_t count) {
+  uint32_t buffer, offset, n;
+  while (count > 0) {
+    n = BufferRange(b, first, count, &buffer, &offset);
+    if (n == 0) {
+      printf("Vertex %llu is past the end of the mesh buffers.\n",
+        (unsigned long long) first);
+      return 0;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, b->buffers[buffer]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, ((GLintptr) offset) *
+      sizeof(MeshVertex), ((GLsizeiptr) n) * sizeof(MeshVertex), vertices);
+    vertices += n;
+    first += n;
+    count -= n;
+  }
+  return CheckGLErrors();
+}
+
+int CopyToMeshBuffers(MeshBufferSet *b, uint64_t first, GLintptr src_offset,
+    uint32_t count) {
+  uint32_t buffer, offset, n;
+  while (count > 0) {
+    n = BufferRange(b, first, count, &buffer, &offset);
+    if (n == 0) {
+      printf("Vertex %llu is past the end of the mesh buffers.\n",
+        (unsigned long long) first);
+      return 0;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, b->buffers[buffer]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src_offset,
+      ((GLintptr) offset) * sizeof(MeshVertex),
+      ((GLsizeiptr) n) * sizeof(MeshVertex));
+    src_offset += ((GLintptr) n) * sizeof(MeshVertex);
+    first += n;
+    count -= n;
+  }
+  return CheckGLErrors();
+}
+
+void SetupSegmentInstanceFormat(GLuint first_attribute) {
+  GLuint i;
+  glVertexAttribFormat(first_attribute, 3, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, location));
+  glVertexAttribFormat(first_attribute + 1, 3, GL_FLOAT, GL_FALSE,
+    sizeof(MeshVertex) + offsetof(MeshVertex, location));
+  glVertexAttribFormat(first_attribute + 2, 3, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, forward));
+  glVertexAttribFormat(first_attribute + 3, 3, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, up));
+  glVertexAttribFormat(first_attribute + 4, 4, GL_FLOAT, GL_FALSE,
+    offsetof(MeshVertex, color));
+  for (i = 0; i < SEGMENT_INSTANCE_ATTRIBUTES; i++) {
+    glVertexAttribBinding(first_attribute + i, MESH_BUFFER_BINDING);
+    glEnableVertexAttribArray(first_attribute + i);
+  }
+  glVertexBindingDivisor(MESH_BUFFER_BINDING, 1);
+}
+
+// Makes sure the scratch arrays of draw ranges can hold the given number of
+// ranges. Returns 0 on error.
+static int ReserveRanges(MeshBufferSet *b, uint32_t count) {
+  void *tmp = NULL;
+  if (count <= b->range_capacity) return 1;
+  tmp = realloc(b->firsts, count * sizeof(GLint));
+  if (!tmp) {
+    printf("Failed allocating list of draw ranges.\n");
+    return 0;
+  }
+  b->firsts = (GLint *) tmp;
+  tmp = realloc(b->counts, count * sizeof(GLsizei));
+  if (!tmp) {
+    printf("Failed allocating list of draw counts.\n");
+    return 0;
+  }
+  b->counts = (GLsizei *) tmp;
+  b->range_capacity = count;
+  return 1;
+}
+
+int DrawMeshBuffers(MeshBufferSet *b, GLenum mode, uint32_t *firsts,
+    uint32_t *counts, uint32_t range_count) {
+  uint64_t start, end, range_start, range_end;
+  uint32_t i, j, n;
+  if (!ReserveRanges(b, range_count)) return 0;
+  glBindVertexArray(b->vao);
+  for (i = 0; i < b->buffer_count; i++) {
+    start = ((uint64_t) i) * MESH_BUFFER_VERTICES;
+    end = start + b->buffer_sizes[i];
+    n = 0;
+    for (j = 0; j < range_count; j++) {
+      range_start = firsts[j];
+      range_end = range_start + counts[j];
+      if (range_start < start) range_start = start;
+      if (range_end > end) range_end = end;
+      if (range_start >= range_end) continue;
+      b->firsts[n] = range_start - start;
+      b->counts[n] = range_end - range_start;
+      n++;
+    }
+    if (n == 0) continue;
+    glBindVertexBuffer(MESH_BUFFER_BINDING, b->buffers[i], 0,
+      sizeof(MeshVertex));
+    glMultiDrawArrays(mode, b->firsts, b->counts, n);
+  }
+  return CheckGLErrors();
+}
+
+int DrawMeshBufferSegments(MeshBufferSet *b, GLuint vao, GLenum mode,
+    GLsizei shape_vertices, uint32_t *firsts, uint32_t *counts,
+    uint32_t range_count) {
+  uint64_t start, end, range_start, range_end;
+  uint32_t i, j;
+  glBindVertexArray(vao);
+  for (i = 0; i < b->buffer_count; i++) {
+    start = ((uint64_t) i) * MESH_BUFFER_VERTICES;
+    end = start + b->buffer_sizes[i];
+    glBindVertexBuffer(MESH_BUFFER_BINDING, b->buffers[i], 0,
+      2 * sizeof(MeshVertex));
+    for (j = 0; j < range_count; j++) {
+      range_start = firsts[j];
+      range_end = range_start + counts[j];
+      if (range_start < start) range_start = start;
+      if (range_end > end) range_end = end;
+      if (range_start >= range_end) continue;
+      glDrawArraysInstancedBaseInstance(mode, 0, shape_vertices,
+        (range_end - range_start) / 2, (range_start - start) / 2);
+    }
+  }
+  return CheckGLErrors();
+}
+
+int DrawMeshBufferStorage(MeshBufferSet *b, GLuint vao, GLuint binding,
+    GLenum mode, GLsizei shape_vertices, uint32_t *firsts, uint32_t *counts,
+    uint32_t range_count) {
+  uint64_t start, end, range_start, range_end;
+  uint32_t i, j, n, window;
+  if (!ReserveRanges(b, range_count)) return 0;
+  glBindVertexArray(vao);
+  for (i = 0; i < b->buffer_count; i++) {
+    for (window = 0; window < b->buffer_sizes[i];
+      window += b->storage_window_vertices) {
+      start = ((uint64_t) i) * MESH_BUFFER_VERTICES + window;
+      end = start + b->storage_window_vertices;
+      if (end > ((uint64_t) i) * MESH_BUFFER_VERTICES + b->buffer_sizes[i]) {
+        end = ((uint64_t) i) * MESH_BUFFER_VERTICES + b->buffer_sizes[i];
+      }
+      n = 0;
+      for (j = 0; j < range_count; j++) {
+        range_start = firsts[j];
+        range_end = range_start + counts[j];
+        if (range_start < start) range_start = start;
+        if (range_end > end) range_end = end;
+        if (range_start >= range_end) continue;
+        b->firsts[n] = ((range_start - start) / 2) * shape_vertices;
+        b->counts[n] = ((range_end - range_start) / 2) * shape_vertices;
+        n++;
+      }
+      if (n == 0) continue;
+      glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, b->buffers[i],
+        ((GLintptr) window) * sizeof(MeshVertex),
+        ((GLsizeiptr) (end - start)) * sizeof(MeshVertex));
+      glMultiDrawArrays(mode, b->firsts, b->counts, n);
+    }
+  }
+  return CheckGLErrors();
+}
@@ -0,0 +1,107 @@
+// Stores a mesh's vertices in a list of vertex buffers, none of which is
+// larger than MESH_BUFFER_VERTICES, since drivers may refuse to allocate (or
+// silently fail to use) single buffers of several GB. Vertices are addressed
+// by a single index across every buffer: buffer i holds the vertices starting
+// at i * MESH_BUFFER_VERTICES. All of the buffers share one vertex array
+// object, and are swapped using glBindVertexBuffer when drawing.
+#ifndef MESH_BUFFERS_H
+#define MESH_BUFFERS_H
+#include <stdint.h>
+#include <glad/glad.h>
+#include "mesh_vertex.h"
+
+// The maximum number of vertices in a single buffer. Must be even, so that
+// line segments are never split between buffers.
+#define MESH_BUFFER_VERTICES (4 * 1024 * 1024)
+
+// The number of vertices a buffer holds when it's first allocated. Buffers
+// double in size until they reach MESH_BUFFER_VERTICES.
+#define MESH_BUFFER_MIN_VERTICES (64 * 1024)
+
+// The binding index used for the vertex buffers in the vertex array objects.
+#define MESH_BUFFER_BINDING (0)
+
+// Shader storage windows are rounded down to a multiple of this many
+// vertices, which keeps their offsets aligned for any driver.
+#define STORAGE_WINDOW_ALIGNMENT (1024)
+
+// The number of vertex attributes set up by SetupSegmentInstanceFormat.
+#define SEGMENT_INSTANCE_ATTRIBUTES (5)
+
+typedef struct {
+  // The vertex array object describing the MeshVertex format.
+  GLuint vao;
+  GLuint *buffers;
+  // The number of vertices each buffer can hold. Every buffer apart from the
+  // last one always holds MESH_BUFFER_VERTICES.
+  uint32_t *buffer_sizes;
+  uint32_t buffer_count;
+  uint32_t buffer_capacity;
+  // Scratch space used when splitting draw ranges between buffers.
+  GLint *firsts;
+  GLsizei *counts;
+  uint32_t range_capacity;
+  // The largest number of vertices that can be bound as a shader storage
+  // block at once. Buffers larger than this are drawn in several windows by
+  // DrawMeshBufferStorage.
+  uint32_t storage_window_vertices;
+} MeshBufferSet;
+
+// Creates the vertex array object for a new, empty, set of buffers. Returns
+// NULL on error.
+MeshBufferSet* CreateMeshBufferSet(void);
+
+// Deletes all of the buffers and the vertex array object. The pointer is no
+// longer valid after this returns.
+void DestroyMeshBufferSet(MeshBufferSet *b);
+
+// Makes sure the buffers can hold at least the given number of vertices,
+// allocating or growing buffers as needed. Existing contents are preserved.
+// Returns 0 on error, including if the GPU is out of memory.
+int ReserveMeshBuffers(MeshBufferSet *b, uint64_t vertex_count);
+
+// Deletes any buffers that aren't needed to hold the given number of
+// vertices.
+void TrimMeshBuffers(MeshBufferSet *b, uint64_t vertex_count);
+
+// Copies vertices from the CPU to the buffers, starting at the given index.
+// The buffers must already have enough space. Returns 0 on error.
+int WriteMeshBuffers(MeshBufferSet *b, uint64_t first, MeshVertex *vertices,
+    uint32_t count);
+
+// Like WriteMeshBuffers, but copies the vertices from the given offset, in
+// bytes, in another buffer bound to GL_COPY_READ_BUFFER. Returns 0 on error.
+int CopyToMeshBuffers(MeshBufferSet *b, uint64_t first, GLintptr src_offset,
+    uint32_t count);
+
+// Sets up attributes in the currently-bound vertex array object to read one
+// line segment per instance from MESH_BUFFER_BINDING, starting at the given
+// attribute index. In order, the attributes are the segment's start location,
+// end location, forward vector, up vector, and color.
+void SetupSegmentInstanceFormat(GLuint first_attribute);
+
+// Draws the given ranges of vertices. The ranges may cross buffer boundaries.
+// Binds the vertex array object; the caller must set up the shader program.
+// Returns 0 on error.
+int DrawMeshBuffers(MeshBufferSet *b, GLenum mode, uint32_t *firsts,
+    uint32_t *counts, uint32_t range_count);
+
+// Draws one instance of a shape per line segment in the given ranges, using
+// the given vertex array object. The vertex array object must have been set
+// up using SetupSegmentInstanceFormat, with the shape's vertices coming from
+// a different binding. Returns 0 on error.
+int DrawMeshBufferSegments(MeshBufferSet *b, GLuint vao, GLenum mode,
+    GLsizei shape_vertices, uint32_t *firsts, uint32_t *counts,
+    uint32_t range_count);
+
+// Draws the given number of vertices per line segment in the given ranges,
+// with the buffers bound as a shader storage block at the given binding
+// rather than as vertex attributes. The vertex shader finds its segment
+// using gl_VertexID / shape_vertices, relative to the start of the bound
+// block. The given vertex array object must not have any enabled attributes.
+// Returns 0 on error.
+int DrawMeshBufferStorage(MeshBufferSet *b, GLuint vao, GLuint binding,
+    GLenum mode, GLsizei shape_vertices, uint32_t *firsts, uint32_t *counts,
+    uint32_t range_count);
+
+#endif  // MESH_BUFFERS_H
@@ -0,0 +1,510 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cglm/cglm.h>
+#include "memory_budget.h"
+#include "mesh_lod.h"
+
+// The number of vertices a single node may contain.
+#define NODE_VERTICES (LOD_NODE_SEGMENTS * 2)
+
+// The number of vertices in the concatenated geometry of a full set of
+// siblings. The scratch buffer holds two arrays of this size.
+#define SIBLING_VERTICES (NODE_VERTICES * LOD_BRANCHING)
+
+// The number of slots in the hash table used to find duplicate segments when
+// simplifying. Must be a power of two, and at least twice the number of
+// segments in SIBLING_VERTICES.
+#define LOD_CLUSTER_TABLE_SIZE (SIBLING_VERTICES)
+
+// The grid cell size used by the first attempt at simplifying a node, relative
+// to the size of the node's bounding box.
+#define INITIAL_RELATIVE_CELL_SIZE (1.0 / 1024.0)
+
+MeshLOD* CreateMeshLOD(void) {
+  MeshLOD *l = NULL;
+  l = (MeshLOD *) TrackedCalloc(MEMORY_MESH, 1, sizeof(*l));
+  if (!l) {
+    printf("Failed allocating LOD tree.\n");
+    return NULL;
+  }
+  l->scratch_capacity = 2 * SIBLING_VERTICES;
+  l->scratch = (MeshVertex *) TrackedCalloc(MEMORY_MESH, l->scratch_capacity,
+    sizeof(MeshVertex));
+  l->cluster_table = (uint32_t *) TrackedCalloc(MEMORY_MESH,
+    LOD_CLUSTER_TABLE_SIZE, sizeof(uint32_t));
+  l->cluster_keys = (int32_t *) TrackedCalloc(MEMORY_MESH, SIBLING_VERTICES / 2,
+    6 * sizeof(int32_t));
+  if (!l->scratch || !l->cluster_table || !l->cluster_keys) {
+    printf("Failed allocating LOD scratch buffers.\n");
+    DestroyMeshLOD(l);
+    return NULL;
+  }
+  return l;
+}
+
+void DestroyMeshLOD(MeshLOD *l) {
+  if (!l) return;
+  TrackedFree(l->nodes);
+  TrackedFree(l->vertices);
+  TrackedFree(l->scratch);
+  TrackedFree(l->cluster_table);
+  TrackedFree(l->cluster_keys);
+  TrackedFree(l->selected);
+  memset(l, 0, sizeof(*l));
+  TrackedFree(l);
+}
+
+void ResetMeshLOD(MeshLOD *l) {
+  l->node_count = 0;
+  l->root = 0;
+  l->vertex_count = 0;
+  l->full_vertex_count = 0;
+  l->leaf_start = 0;
+  l->selected_count = 0;
+  memset(l->pending_count, 0, sizeof(l->pending_count));
+}
+
+// Makes sure the vertex array can hold at least count more vertices. Returns
+// 0 on error.
+static int ReserveVertices(MeshLOD *l, uint32_t count) {
+  MeshVertex *new_buffer = NULL;
+  uint32_t new_capacity = l->vertex_capacity;
+  uint32_t required = l->vertex_count + count;
+  if (required < l->vertex_count) {
+    printf("LOD vertex count overflow.\n");
+    return 0;
+  }
+  if (required <= l->vertex_capacity) return 1;
+  if (new_capacity == 0) new_capacity = NODE_VERTICES;
+  while (new_capacity < required) {
+    if ((new_capacity * 2) < new_capacity) {
+      new_capacity = required;
+      break;
+    }
+    new_capacity *= 2;
+  }
+  new_buffer = (MeshVertex *) TrackedRealloc(MEMORY_MESH, l->vertices,
+    new_capacity * sizeof(MeshVertex));
+  if (!new_buffer) {
+    printf("Failed expanding LOD vertex array: out of memory.\n");
+    return 0;
+  }
+  l->vertices = new_buffer;
+  l->vertex_capacity = new_capacity;
+  return 1;
+}
+
+// Allocates a new node at the end of the node array, returning its index in
+// *index. The new node is zeroed other than its parent index. Returns 0 on
+// error.
+static int NewNode(MeshLOD *l, uint32_t *index) {
+  LODNode *new_nodes = NULL;
+  uint32_t new_capacity;
+  if (l->node_count >= l->node_capacity) {
+    new_capacity = l->node_capacity * 2;
+    if (new_capacity == 0) new_capacity = 64;
+    if (new_capacity < l->node_capacity) {
+      printf("LOD node count overflow.\n");
+      return 0;
+    }
+    new_nodes = (LODNode *) TrackedRealloc(MEMORY_MESH, l->nodes,
+      new_capacity * sizeof(LODNode));
+    if (!new_nodes) {
+      printf("Failed expanding LOD node array: out of memory.\n");
+      return 0;
+    }
+    l->nodes = new_nodes;
+    l->node_capacity = new_capacity;
+  }
+  *index = l->node_count;
+  memset(l->nodes + *index, 0, sizeof(LODNode));
+  l->nodes[*index].parent = UINT32_MAX;
+  l->node_count++;
+  return 1;
+}
+
+// Sets the node's bounds to enclose all of the given vertices.
+static void ComputeBounds(LODNode *n, MeshVertex *v, uint32_t count) {
+  uint32_t i;
+  glm_vec3_broadcast(FLT_MAX, n->min_bounds);
+  glm_vec3_broadcast(-FLT_MAX, n->max_bounds);
+  for (i = 0; i < count; i++) {
+    glm_vec3_minv(n->min_bounds, v[i].location, n->min_bounds);
+    glm_vec3_maxv(n->max_bounds, v[i].location, n->max_bounds);
+  }
+}
+
+// Snaps the point p to the nearest corner of a grid with the given cell size
+// and origin. Writes the integer grid coordinates to cell, and the snapped
+// location to snapped.
+static void SnapToGrid(vec3 p, vec3 origin, float cell_size, int32_t *cell,
+    vec3 snapped) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    cell[i] = (int32_t) floorf(((p[i] - origin[i]) / cell_size) + 0.5);
+    snapped[i] = origin[i] + ((float) cell[i]) * cell_size;
+  }
+}
+
+// Returns nonzero if the grid coordinates a come before b in an arbitrary,
+// but consistent, order.
+static int CellLess(int32_t *a, int32_t *b) {
+  if (a[0] != b[0]) return a[0] < b[0];
+  if (a[1] != b[1]) return a[1] < b[1];
+  return a[2] < b[2];
+}
+
+// Hashes a segment between two grid cells, which must already be ordered
+// using CellLess.
+static uint32_t HashCells(int32_t *a, int32_t *b) {
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < 3; i++) {
+    h = (h ^ ((uint32_t) a[i])) * 16777619u;
+    h = (h ^ ((uint32_t) b[i])) * 16777619u;
+  }
+  return h;
+}
+
+// Sets up a simplified segment in dst. Both vertices take the attributes of
+// src, but are moved to the locations a and b.
+static void WriteClusteredSegment(MeshVertex *src, vec3 a, vec3 b,
+    MeshVertex *dst) {
+  vec3 forward, up;
+  dst[0] = *src;
+  dst[1] = *src;
+  glm_vec3_copy(a, dst[0].location);
+  glm_vec3_copy(b, dst[1].location);
+  glm_vec3_sub(b, a, forward);
+  if (glm_vec3_norm2(forward) <= 0) return;
+  glm_vec3_normalize(forward);
+  // Keep the old up vector as close as possible, while making it orthogonal
+  // to the new direction.
+  glm_vec3_scale(forward, glm_vec3_dot(src->up, forward), up);
+  glm_vec3_sub(src->up, up, up);
+  if (glm_vec3_norm2(up) > 0) {
+    glm_vec3_normalize(up);
+    glm_vec3_copy(up, dst[0].up);
+    glm_vec3_copy(up, dst[1].up);
+  }
+  glm_vec3_copy(forward, dst[0].forward);
+  glm_vec3_copy(forward, dst[1].forward);
+}
+
+// Simplifies segments using vertex clustering: every endpoint is snapped to a
+// grid with the given cell size, and duplicate segments are removed. Segments
+// that collapse to a single grid point are kept as a short stub, so sub-pixel
+// detail still covers a pixel. Returns the number of vertices written to dst.
+static uint32_t ClusterSegments(MeshLOD *l, MeshVertex *src, uint32_t count,
+    MeshVertex *dst, vec3 origin, float cell_size) {
+  MeshVertex *v = NULL;
+  int32_t cells[6], tmp_cells[3];
+  int32_t *key = NULL;
+  vec3 a, b, stub, tmp;
+  uint32_t i, slot, out = 0;
+  uint32_t mask = LOD_CLUSTER_TABLE_SIZE - 1;
+  memset(l->cluster_table, 0, LOD_CLUSTER_TABLE_SIZE * sizeof(uint32_t));
+  for (i = 0; i < count; i += 2) {
+    v = src + i;
+    SnapToGrid(v[0].location, origin, cell_size, cells, a);
+    SnapToGrid(v[1].location, origin, cell_size, cells + 3, b);
+    // Segments are undirected, so order the endpoints consistently.
+    if (CellLess(cells + 3, cells)) {
+      memcpy(tmp_cells, cells, sizeof(tmp_cells));
+      memcpy(cells, cells + 3, sizeof(tmp_cells));
+      memcpy(cells + 3, tmp_cells, sizeof(tmp_cells));
+      glm_vec3_copy(a, tmp);
+      glm_vec3_copy(b, a);
+      glm_vec3_copy(tmp, b);
+    }
+    // Look for an identical segment that's already been written. The table
+    // holds output segment indices plus one, so 0 marks an empty slot.
+    slot = HashCells(cells, cells + 3) & mask;
+    while (l->cluster_table[slot] != 0) {
+      key = l->cluster_keys + ((l->cluster_table[slot] - 1) * 6);
+      if (memcmp(key, cells, sizeof(cells)) == 0) break;
+      slot = (slot + 1) & mask;
+    }
+    if (l->cluster_table[slot] != 0) continue;
+    l->cluster_table[slot] = (out / 2) + 1;
+    memcpy(l->cluster_keys + ((out / 2) * 6), cells, sizeof(cells));
+    if (glm_vec3_eqv(a, b)) {
+      glm_vec3_scale(v->forward, cell_size * 0.5, stub);
+      glm_vec3_add(a, stub, stub);
+      WriteClusteredSegment(v, a, stub, dst + out);
+    } else {
+      WriteClusteredSegment(v, a, b, dst + out);
+    }
+    out += 2;
+  }
+  return out;
+}
+
+// Simplifies the segments in the first half of the scratch buffer until at
+// most NODE_VERTICES remain, using progressively larger grid cells. Sets
+// *result to the simplified segments and returns the number of vertices in
+// them. On input, *error must be the largest error of the input segments; the
+// error introduced by the simplification is added to it. The size is the
+// length of the diagonal of the segments' bounding box.
+static uint32_t SimplifySegments(MeshLOD *l, uint32_t count, vec3 origin,
+    float size, MeshVertex **result, float *error) {
+  MeshVertex *src = l->scratch;
+  MeshVertex *dst = l->scratch + SIBLING_VERTICES;
+  float cell_size = size * INITIAL_RELATIVE_CELL_SIZE;
+  uint32_t new_count = count;
+  *result = src;
+  if (count <= NODE_VERTICES) return count;
+  if (cell_size < *error) cell_size = *error;
+  if (cell_size <= 0) cell_size = 1.0;
+  while (1) {
+    new_count = ClusterSegments(l, src, count, dst, origin, cell_size);
+    if (new_count <= NODE_VERTICES) break;
+    cell_size *= 2.0;
+  }
+  // Snapping moves each point by at most half of a cell's diagonal, and stubs
+  // extend half a cell from a snapped point.
+  *error += cell_size * 0.8660254 + cell_size * 0.5;
+  *result = dst;
+  return new_count;
+}
+
+static int PushPendingNode(MeshLOD *l, uint32_t level, uint32_t index);
+
+// Combines all of the pending nodes at the given level into a single parent
+// node, which is pushed onto the next level. Returns 0 on error.
+static int BuildParentNode(MeshLOD *l, uint32_t level) {
+  LODNode *parent = NULL;
+  LODNode *child = NULL;
+  MeshVertex *simplified = NULL;
+  uint32_t i, parent_index, count = 0;
+  vec3 size;
+  float error = 0;
+  if (!NewNode(l, &parent_index)) return 0;
+  parent = l->nodes + parent_index;
+  glm_vec3_broadcast(FLT_MAX, parent->min_bounds);
+  glm_vec3_broadcast(-FLT_MAX, parent->max_bounds);
+  for (i = 0; i < l->pending_count[level]; i++) {
+    child = l->nodes + l->pending[level][i];
+    child->parent = parent_index;
+    parent->children[i] = l->pending[level][i];
+    glm_vec3_minv(parent->min_bounds, child->min_bounds, parent->min_bounds);
+    glm_vec3_maxv(parent->max_bounds, child->max_bounds, parent->max_bounds);
+    if (child->error > error) error = child->error;
+    memcpy(l->scratch + count, l->vertices + child->first_vertex,
+      child->vertex_count * sizeof(MeshVertex));
+    count += child->vertex_count;
+  }
+  parent->child_count = l->pending_count[level];
+  l->pending_count[level] = 0;
+  glm_vec3_sub(parent->max_bounds, parent->min_bounds, size);
+  count = SimplifySegments(l, count, parent->min_bounds, glm_vec3_norm(size),
+    &simplified, &error);
+  parent->error = error;
+  if (!ReserveVertices(l, count)) return 0;
+  // Reserving vertices doesn't move the node array, but re-fetch the parent
+  // anyway for clarity.
+  parent = l->nodes + parent_index;
+  parent->first_vertex = l->vertex_count;
+  parent->vertex_count = count;
+  memcpy(l->vertices + l->vertex_count, simplified,
+    count * sizeof(MeshVertex));
+  l->vertex_count += count;
+  return PushPendingNode(l, level + 1, parent_index);
+}
+
+// Adds the node to the list of nodes awaiting a parent at the given level,
+// building the parent if the level is full. Returns 0 on error.
+static int PushPendingNode(MeshLOD *l, uint32_t level, uint32_t index) {
+  if (level >= LOD_MAX_DEPTH) {
+    printf("The LOD tree is too deep.\n");
+    return 0;
+  }
+  l->pending[level][l->pending_count[level]] = index;
+  l->pending_count[level]++;
+  if (l->pending_count[level] < LOD_BRANCHING) return 1;
+  return BuildParentNode(l, level);
+}
+
+// Turns the vertices since l->leaf_start into a new leaf node. Returns 0 on
+// error.
+static int CloseLeaf(MeshLOD *l) {
+  LODNode *leaf = NULL;
+  uint32_t index;
+  if (l->vertex_count == l->leaf_start) return 1;
+  if (!NewNode(l, &index)) return 0;
+  leaf = l->nodes + index;
+  leaf->first_vertex = l->leaf_start;
+  leaf->vertex_count = l->vertex_count - l->leaf_start;
+  ComputeBounds(leaf, l->vertices + leaf->first_vertex, leaf->vertex_count);
+  if (!PushPendingNode(l, 0, index)) return 0;
+  // Any parent nodes built by pushing the leaf were appended after it.
+  l->leaf_start = l->vertex_count;
+  return 1;
+}
+
+int AppendLODSegments(MeshLOD *l, MeshVertex *vertices, uint32_t count) {
+  uint32_t space, to_copy;
+  if (count & 1) {
+    printf("Got an odd number of vertices for line segments.\n");
+    return 0;
+  }
+  while (count > 0) {
+    space = NODE_VERTICES - (l->vertex_count - l->leaf_start);
+    to_copy = count < space ? count : space;
+    if (!ReserveVertices(l, to_copy)) return 0;
+    memcpy(l->vertices + l->vertex_count, vertices,
+      to_copy * sizeof(MeshVertex));
+    l->vertex_count += to_copy;
+    l->full_vertex_count += to_copy;
+    vertices += to_copy;
+    count -= to_copy;
+    if ((l->vertex_count - l->leaf_start) >= NODE_VERTICES) {
+      if (!CloseLeaf(l)) return 0;
+    }
+  }
+  return 1;
+}
+
+int FinishMeshLOD(MeshLOD *l) {
+  uint32_t level, i;
+  int higher_pending;
+  if (!CloseLeaf(l)) return 0;
+  for (level = 0; level < LOD_MAX_DEPTH; level++) {
+    if (l->pending_count[level] == 0) continue;
+    higher_pending = 0;
+    for (i = level + 1; i < LOD_MAX_DEPTH; i++) {
+      if (l->pending_count[i] != 0) higher_pending = 1;
+    }
+    if (l->pending_count[level] == 1) {
+      if (!higher_pending) {
+        l->root = l->pending[level][0];
+        l->pending_count[level] = 0;
+        return 1;
+      }
+      // A lone node doesn't need its own parent; just move it up a level.
+      l->pending_count[level] = 0;
+      if (!PushPendingNode(l, level + 1, l->pending[level][0])) return 0;
+      continue;
+    }
+    if (!BuildParentNode(l, level)) return 0;
+    // The new parent may be the only node remaining, so check the next level
+    // (where it was pushed) normally.
+  }
+  if (l->node_count == 0) return 1;
+  printf("Internal error: the LOD tree has no root.\n");
+  return 0;
+}
+
+void SetupLODView(LODView *v, mat4 projection, mat4 view, mat4 model,
+    vec3 location_offset, int viewport_height, float pixel_error) {
+  mat4 tmp, inverse;
+  vec4 camera;
+  glm_mat4_mul(projection, view, tmp);
+  glm_mat4_mul(tmp, model, v->clip_transform);
+  glm_translate(v->clip_transform, location_offset);
+  // The camera is at the origin in view space.
+  glm_mat4_mul(view, model, tmp);
+  glm_translate(tmp, location_offset);
+  glm_mat4_inv(tmp, inverse);
+  glm_vec4_copy(inverse[3], camera);
+  glm_vec3_scale(camera, 1.0 / camera[3], v->camera_position);
+  // projection[1][1] is 1 / tan(fov / 2), and the viewport covers two units
+  // of normalized device coordinates vertically. The model matrix's scale
+  // cancels out, since both errors and distances are in turtle coordinates.
+  v->pixels_per_unit = projection[1][1] * ((float) viewport_height) * 0.5;
+  v->pixel_error = pixel_error;
+}
+
+int BoxOutsideLODView(LODView *v, vec3 min, vec3 max) {
+  vec4 corner, c;
+  int i, outside[6];
+  for (i = 0; i < 6; i++) outside[i] = 1;
+  for (i = 0; i < 8; i++) {
+    corner[0] = (i & 1) ? max[0] : min[0];
+    corner[1] = (i & 2) ? max[1] : min[1];
+    corner[2] = (i & 4) ? max[2] : min[2];
+    corner[3] = 1.0;
+    glm_mat4_mulv(v->clip_transform, corner, c);
+    if (c[0] >= -c[3]) outside[0] = 0;
+    if (c[0] <= c[3]) outside[1] = 0;
+    if (c[1] >= -c[3]) outside[2] = 0;
+    if (c[1] <= c[3]) outside[3] = 0;
+    if (c[2] >= -c[3]) outside[4] = 0;
+    if (c[2] <= c[3]) outside[5] = 0;
+  }
+  for (i = 0; i < 6; i++) {
+    if (outside[i]) return 1;
+  }
+  return 0;
+}
+
+// Returns the distance from p to the closest point in the box, or 0 if p is
+// inside the box.
+static float DistanceToBox(vec3 p, vec3 min, vec3 max) {
+  vec3 d;
+  int i;
+  for (i = 0; i < 3; i++) {
+    d[i] = 0;
+    if (p[i] < min[i]) d[i] = min[i] - p[i];
+    if (p[i] > max[i]) d[i] = p[i] - max[i];
+  }
+  return glm_vec3_norm(d);
+}
+
+float ProjectedLODSize(LODView *v, vec3 min, vec3 max, float length) {
+  float distance = DistanceToBox(v->camera_position, min, max);
+  if (distance <= 0) return FLT_MAX;
+  return length * v->pixels_per_unit / distance;
+}
+
+// Returns nonzero if the node's error covers more than v->pixel_error pixels
+// at its closest point to the camera.
+static int NeedsRefinement(LODNode *n, LODView *v) {
+  if (n->child_count == 0) return 0;
+  if (v->pixel_error <= 0) return 1;
+  return ProjectedLODSize(v, n->min_bounds, n->max_bounds, n->error) >
+    v->pixel_error;
+}
+
+// Appends a node index to the list of selected nodes. Returns 0 on error.
+static int AppendSelected(MeshLOD *l, uint32_t index) {
+  uint32_t *new_list = NULL;
+  uint32_t new_capacity;
+  if (l->selected_count >= l->selected_capacity) {
+    new_capacity = l->selected_capacity * 2;
+    if (new_capacity == 0) new_capacity = 256;
+    new_list = (uint32_t *) TrackedRealloc(MEMORY_MESH, l->selected,
+      new_capacity * sizeof(uint32_t));
+    if (!new_list) {
+      printf("Failed expanding list of selected LOD nodes.\n");
+      return 0;
+    }
+    l->selected = new_list;
+    l->selected_capacity = new_capacity;
+  }
+  l->selected[l->selected_count] = index;
+  l->selected_count++;
+  return 1;
+}
+
+static int SelectNode(MeshLOD *l, LODView *v, uint32_t index) {
+  LODNode *n = l->nodes + index;
+  uint32_t i;
+  if (BoxOutsideLODView(v, n->min_bounds, n->max_bounds)) {
+    return 1;
+  }
+  if (!NeedsRefinement(n, v)) return AppendSelected(l, index);
+  for (i = 0; i < n->child_count; i++) {
+    if (!SelectNode(l, v, n->children[i])) return 0;
+  }
+  return 1;
+}
+
+int SelectLODNodes(MeshLOD *l, LODView *v) {
+  l->selected_count = 0;
+  if (l->node_count == 0) return 1;
+  return SelectNode(l, v, l->root);
+}
@@ -0,0 +1,133 @@
+// Builds and queries a hierarchical level-of-detail (LOD) structure over the
+// line segments produced by the turtle. Leaves hold the full-detail segments,
+// and every internal node holds a simplified copy of everything beneath it.
+// At draw time, the coarsest nodes whose error projects to less than a given
+// number of pixels are selected. This code doesn't depend on OpenGL.
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "mesh_vertex.h"
+
+// The maximum number of full-detail line segments in a single leaf node.
+// Internal nodes are simplified until they contain at most this many segments
+// as well.
+#define LOD_NODE_SEGMENTS (4096)
+
+// The maximum number of children for each internal node.
+#define LOD_BRANCHING (8)
+
+// The maximum number of levels in the tree. With LOD_BRANCHING children per
+// node this is far more than 32-bit vertex counts can ever require.
+#define LOD_MAX_DEPTH (16)
+
+// A single node in the LOD tree.
+typedef struct {
+  // The bounding box, in the turtle's coordinates, of all of the full-detail
+  // segments under this node.
+  vec3 min_bounds;
+  vec3 max_bounds;
+  // An upper bound on the distance between this node's segments and the
+  // full-detail segments they stand in for. Always 0 for leaf nodes.
+  float error;
+  // The range of vertices in the MeshLOD's vertex array holding this node's
+  // segments.
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  // The index of this node's parent, or UINT32_MAX for the root.
+  uint32_t parent;
+  // Indices of this node's children. Leaf nodes have no children.
+  uint32_t child_count;
+  uint32_t children[LOD_BRANCHING];
+} LODNode;
+
+// Holds the information needed to select nodes for a single view.
+typedef struct {
+  // Transforms turtle coordinates directly to clip space. (This is the
+  // projection, view, and model matrices combined with the mesh's location
+  // offset.)
+  mat4 clip_transform;
+  // The camera's position in the turtle's coordinates.
+  vec3 camera_position;
+  // The number of pixels covered by one unit of length located one unit of
+  // distance in front of the camera. Depends only on the projection and the
+  // viewport's height, since the model matrix only applies a uniform scale.
+  float pixels_per_unit;
+  // Nodes with a projected error larger than this many pixels are refined.
+  // Setting this to 0 always selects the full-detail leaves.
+  float pixel_error;
+} LODView;
+
+// Holds the full LOD tree, along with the vertices for every node.
+typedef struct {
+  LODNode *nodes;
+  uint32_t node_count;
+  uint32_t node_capacity;
+  // The index of the root node. Only valid after FinishMeshLOD succeeds, and
+  // if node_count is nonzero.
+  uint32_t root;
+  // The vertices for every node in the tree, concatenated. Each pair of
+  // vertices is a line segment.
+  MeshVertex *vertices;
+  uint32_t vertex_count;
+  uint32_t vertex_capacity;
+  // The number of full-detail vertices appended to the tree.
+  uint32_t full_vertex_count;
+  // The first vertex of the leaf that's currently being filled.
+  uint32_t leaf_start;
+  // Nodes that have been built but not yet given a parent, for each level in
+  // the tree. Level 0 holds leaves.
+  uint32_t pending[LOD_MAX_DEPTH][LOD_BRANCHING];
+  uint32_t pending_count[LOD_MAX_DEPTH];
+  // Scratch space used when simplifying segments.
+  MeshVertex *scratch;
+  uint32_t scratch_capacity;
+  // A hash table used to find duplicate segments while simplifying, and the
+  // grid cells of each segment it refers to.
+  uint32_t *cluster_table;
+  int32_t *cluster_keys;
+  // The list of node indices chosen by the most recent SelectLODNodes call.
+  uint32_t *selected;
+  uint32_t selected_count;
+  uint32_t selected_capacity;
+} MeshLOD;
+
+// Allocates a new, empty, LOD tree. Returns NULL on error.
+MeshLOD* CreateMeshLOD(void);
+
+// Frees the given LOD tree. The pointer is no longer valid after this returns.
+void DestroyMeshLOD(MeshLOD *l);
+
+// Removes all nodes and vertices from the tree without freeing its buffers,
+// so that a new tree can be built.
+void ResetMeshLOD(MeshLOD *l);
+
+// Appends full-detail line segments to the tree. The count must be even.
+// Segments are grouped into leaves in the order they're appended, so callers
+// may append segments in several batches. Returns 0 on error.
+int AppendLODSegments(MeshLOD *l, MeshVertex *vertices, uint32_t count);
+
+// Builds the remaining internal nodes after all segments have been appended.
+// Returns 0 on error.
+int FinishMeshLOD(MeshLOD *l);
+
+// Fills in the view-dependent fields in the given LODView. The model matrix
+// must only apply a uniform scale.
+void SetupLODView(LODView *v, mat4 projection, mat4 view, mat4 model,
+    vec3 location_offset, int viewport_height, float pixel_error);
+
+// Returns nonzero if the box, in turtle coordinates, is entirely outside of
+// the view frustum.
+int BoxOutsideLODView(LODView *v, vec3 min, vec3 max);
+
+// Returns the number of pixels that the given length may cover on screen, if
+// it's located somewhere in the given box. Returns FLT_MAX if the camera is
+// inside the box.
+float ProjectedLODSize(LODView *v, vec3 min, vec3 max, float length);
+
+// Selects the coarsest set of nodes whose error projects to at most
+// v->pixel_error pixels, skipping nodes outside of the view frustum. The
+// chosen node indices are written to l->selected. Returns 0 on error.
+int SelectLODNodes(MeshLOD *l, LODView *v);
+
+#endif  // MESH_LOD_H
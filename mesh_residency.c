@@ -0,0 +1,317 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cglm/cglm.h>
+#include <glad/glad.h>
+#include "gl_utilities.h"
+#include "memory_budget.h"
+#include "mesh_buffers.h"
+#include "mesh_lod.h"
+#include "mesh_residency.h"
+#include "mesh_vertex.h"
+#include "utilities.h"
+
+// The number of vertices in each frame's region of the staging buffer.
+#define STAGING_FRAME_VERTICES (RESIDENCY_PAGE_VERTICES * \
+  RESIDENCY_UPLOADS_PER_FRAME)
+
+// The flags used for the persistently-mapped staging buffer.
+#define STAGING_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | \
+  GL_MAP_COHERENT_BIT)
+
+// The number of nanoseconds to wait for a fence before checking again.
+#define FENCE_WAIT_TIMEOUT (1000000000ull)
+
+MeshResidency* CreateMeshResidency(MeshBufferSet *buffers,
+    uint32_t page_count) {
+  MeshResidency *r = NULL;
+  GLsizeiptr staging_size = RESIDENCY_FRAMES * STAGING_FRAME_VERTICES *
+    sizeof(MeshVertex);
+  uint64_t pool_vertices = ((uint64_t) page_count) * RESIDENCY_PAGE_VERTICES;
+  r = (MeshResidency *) calloc(1, sizeof(*r));
+  if (!r) {
+    printf("Failed allocating mesh residency info.\n");
+    return NULL;
+  }
+  r->buffers = buffers;
+  r->page_count = page_count;
+  r->page_nodes = (uint32_t *) calloc(page_count, sizeof(uint32_t));
+  r->page_last_used = (uint64_t *) calloc(page_count, sizeof(uint64_t));
+  r->page_drawn = (uint64_t *) calloc(page_count, sizeof(uint64_t));
+  if (!r->page_nodes || !r->page_last_used || !r->page_drawn) {
+    printf("Failed allocating page list for %u pages.\n",
+      (unsigned) page_count);
+    DestroyMeshResidency(r);
+    return NULL;
+  }
+
+  if (!ReserveMeshBuffers(buffers, pool_vertices)) {
+    printf("Failed allocating a page pool of %u pages.\n",
+      (unsigned) page_count);
+    DestroyMeshResidency(r);
+    return NULL;
+  }
+  TrimMeshBuffers(buffers, pool_vertices);
+
+  glGenBuffers(1, &(r->staging_buffer));
+  glBindBuffer(GL_COPY_READ_BUFFER, r->staging_buffer);
+  glBufferStorage(GL_COPY_READ_BUFFER, staging_size, NULL, STAGING_FLAGS);
+  r->staging = (MeshVertex *) glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+    staging_size, STAGING_FLAGS);
+  if (r->staging) AddTrackedBytes(MEMORY_GPU_BUFFERS, staging_size);
+  if (!r->staging || !CheckGLErrors()) {
+    printf("Failed mapping the mesh staging buffer.\n");
+    DestroyMeshResidency(r);
+    return NULL;
+  }
+  return r;
+}
+
+void DestroyMeshResidency(MeshResidency *r) {
+  int i;
+  if (!r) return;
+  for (i = 0; i < RESIDENCY_FRAMES; i++) {
+    if (r->fences[i]) glDeleteSync(r->fences[i]);
+  }
+  if (r->staging) {
+    glBindBuffer(GL_COPY_READ_BUFFER, r->staging_buffer);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    AddTrackedBytes(MEMORY_GPU_BUFFERS, -((int64_t) RESIDENCY_FRAMES *
+      STAGING_FRAME_VERTICES * sizeof(MeshVertex)));
+  }
+  glDeleteBuffers(1, &(r->staging_buffer));
+  free(r->page_nodes);
+  free(r->page_last_used);
+  free(r->page_drawn);
+  free(r->node_pages);
+  free(r->node_requested);
+  free(r->requests);
+  memset(r, 0, sizeof(*r));
+  free(r);
+}
+
+// Makes sure the per-node arrays can hold at least count nodes. Returns 0 on
+// error.
+static int ReserveNodes(MeshResidency *r, uint32_t count) {
+  void *tmp = NULL;
+  if (count <= r->node_capacity) return 1;
+  tmp = realloc(r->node_pages, count * sizeof(uint32_t));
+  if (tmp) {
+    r->node_pages = (uint32_t *) tmp;
+    tmp = realloc(r->node_requested, count * sizeof(uint64_t));
+  }
+  if (tmp) {
+    r->node_requested = (uint64_t *) tmp;
+    tmp = realloc(r->requests, count * sizeof(ResidencyRequest));
+  }
+  if (!tmp) {
+    printf("Failed allocating residency info for %u nodes.\n",
+      (unsigned) count);
+    return 0;
+  }
+  r->requests = (ResidencyRequest *) tmp;
+  r->node_capacity = count;
+  return 1;
+}
+
+int ResetMeshResidency(MeshResidency *r, MeshLOD *l) {
+  LODNode *root = NULL;
+  uint32_t i;
+  if (!ReserveNodes(r, l->node_count)) return 0;
+  for (i = 0; i < l->node_count; i++) {
+    r->node_pages[i] = UINT32_MAX;
+    r->node_requested[i] = UINT64_MAX;
+  }
+  for (i = 0; i < r->page_count; i++) {
+    r->page_nodes[i] = UINT32_MAX;
+    r->page_last_used[i] = 0;
+    r->page_drawn[i] = UINT64_MAX;
+  }
+  r->resident_count = 0;
+  r->total_uploads = 0;
+  r->total_evictions = 0;
+  if (l->node_count == 0) return 1;
+
+  // The root always stays in page 0, so every node has a resident ancestor.
+  root = l->nodes + l->root;
+  if (!WriteMeshBuffers(r->buffers, 0, l->vertices + root->first_vertex,
+    root->vertex_count)) {
+    return 0;
+  }
+  r->page_nodes[0] = l->root;
+  r->node_pages[l->root] = 0;
+  r->resident_count = 1;
+  return 1;
+}
+
+// Returns the distance from the point to the nearest point in the box.
+static float BoxDistance(vec3 min, vec3 max, vec3 point) {
+  vec3 nearest;
+  int i;
+  for (i = 0; i < 3; i++) {
+    nearest[i] = glm_clamp(point[i], min[i], max[i]);
+  }
+  return glm_vec3_distance(nearest, point);
+}
+
+// Adds the node to the list of nodes to upload this frame, if it isn't
+// already in the list.
+static void RequestNode(MeshResidency *r, MeshLOD *l, LODView *v,
+    uint32_t index) {
+  LODNode *n = l->nodes + index;
+  ResidencyRequest *q = NULL;
+  if (r->node_requested[index] == r->frame) return;
+  r->node_requested[index] = r->frame;
+  q = r->requests + r->request_count;
+  q->node = index;
+  q->priority = BoxDistance(n->min_bounds, n->max_bounds, v->camera_position);
+  r->request_count++;
+}
+
+static int CompareRequests(const void *a, const void *b) {
+  float pa = ((const ResidencyRequest *) a)->priority;
+  float pb = ((const ResidencyRequest *) b)->priority;
+  if (pa < pb) return -1;
+  if (pa > pb) return 1;
+  return 0;
+}
+
+// Returns a page that's free or holds the least-recently used node, evicting
+// the node. Pages drawn during the current frame and the root's page are
+// never chosen. Returns UINT32_MAX if no page is available.
+static uint32_t FindFreePage(MeshResidency *r) {
+  uint32_t i, best = UINT32_MAX;
+  uint64_t best_last_used = r->frame;
+  for (i = 1; i < r->page_count; i++) {
+    if (r->page_nodes[i] == UINT32_MAX) return i;
+    if (r->page_last_used[i] < best_last_used) {
+      best = i;
+      best_last_used = r->page_last_used[i];
+    }
+  }
+  if (best == UINT32_MAX) return best;
+  r->node_pages[r->page_nodes[best]] = UINT32_MAX;
+  r->page_nodes[best] = UINT32_MAX;
+  r->resident_count--;
+  r->total_evictions++;
+  return best;
+}
+
+// Waits until the GPU is done with the current frame's region of the staging
+// buffer. Returns 0 on error.
+static int WaitForStagingRegion(MeshResidency *r) {
+  int slot = r->frame % RESIDENCY_FRAMES;
+  GLenum result;
+  if (!r->fences[slot]) return 1;
+  while (1) {
+    result = glClientWaitSync(r->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+      FENCE_WAIT_TIMEOUT);
+    if ((result == GL_ALREADY_SIGNALED) ||
+      (result == GL_CONDITION_SATISFIED)) {
+      break;
+    }
+    if (result == GL_WAIT_FAILED) {
+      printf("Failed waiting for the mesh staging buffer.\n");
+      return 0;
+    }
+  }
+  glDeleteSync(r->fences[slot]);
+  r->fences[slot] = 0;
+  return 1;
+}
+
+// Uploads up to RESIDENCY_UPLOADS_PER_FRAME of the requested nodes, closest
+// to the camera first. Returns 0 on error.
+static int UploadRequestedNodes(MeshResidency *r, MeshLOD *l) {
+  MeshVertex *staging = NULL;
+  LODNode *n = NULL;
+  uint32_t i, page, index, uploads = 0;
+  if (r->request_count == 0) return 1;
+  qsort(r->requests, r->request_count, sizeof(ResidencyRequest),
+    CompareRequests);
+  if (!WaitForStagingRegion(r)) return 0;
+  staging = r->staging + (r->frame % RESIDENCY_FRAMES) *
+    STAGING_FRAME_VERTICES;
+  glBindBuffer(GL_COPY_READ_BUFFER, r->staging_buffer);
+  for (i = 0; i < r->request_count; i++) {
+    if (uploads >= RESIDENCY_UPLOADS_PER_FRAME) break;
+    index = r->requests[i].node;
+    n = l->nodes + index;
+    // This can't happen with the current LOD tree, but don't write past the
+    // end of a page if it ever does.
+    if (n->vertex_count > RESIDENCY_PAGE_VERTICES) continue;
+    page = FindFreePage(r);
+    if (page == UINT32_MAX) break;
+    memcpy(staging, l->vertices + n->first_vertex,
+      n->vertex_count * sizeof(MeshVertex));
+    if (!CopyToMeshBuffers(r->buffers, ((uint64_t) page) *
+      RESIDENCY_PAGE_VERTICES, (staging - r->staging) * sizeof(MeshVertex),
+      n->vertex_count)) {
+      return 0;
+    }
+    staging += RESIDENCY_PAGE_VERTICES;
+    r->page_nodes[page] = index;
+    r->page_last_used[page] = r->frame;
+    r->node_pages[index] = page;
+    r->resident_count++;
+    r->total_uploads++;
+    uploads++;
+  }
+  if (uploads > 0) r->uploaded_this_frame = 1;
+  return 1;
+}
+
+int SelectResidentNodes(MeshResidency *r, MeshLOD *l, LODView *v,
+    uint32_t *firsts, uint32_t *counts, uint32_t *draw_count) {
+  uint32_t i, index, child, page, count = 0;
+  *draw_count = 0;
+  r->request_count = 0;
+
+  // Mark the pages holding selected nodes as used, so they won't be evicted,
+  // and request the missing nodes. Pages holding ancestors that stand in for
+  // missing nodes may be evicted, since they're no longer needed once the
+  // missing nodes are uploaded. For nodes whose parent isn't resident either,
+  // request the ancestor just below the closest resident one, so that detail
+  // is added gradually from the top of the tree down.
+  for (i = 0; i < l->selected_count; i++) {
+    index = l->selected[i];
+    if (r->node_pages[index] != UINT32_MAX) {
+      r->page_last_used[r->node_pages[index]] = r->frame;
+      continue;
+    }
+    child = index;
+    index = l->nodes[index].parent;
+    while (r->node_pages[index] == UINT32_MAX) {
+      child = index;
+      index = l->nodes[index].parent;
+    }
+    RequestNode(r, l, v, child);
+  }
+  if (!UploadRequestedNodes(r, l)) return 0;
+
+  for (i = 0; i < l->selected_count; i++) {
+    index = l->selected[i];
+    while (r->node_pages[index] == UINT32_MAX) {
+      index = l->nodes[index].parent;
+    }
+    page = r->node_pages[index];
+    if (r->page_drawn[page] == r->frame) continue;
+    r->page_drawn[page] = r->frame;
+    r->page_last_used[page] = r->frame;
+    firsts[count] = page * RESIDENCY_PAGE_VERTICES;
+    counts[count] = l->nodes[index].vertex_count;
+    count++;
+  }
+  *draw_count = count;
+  return 1;
+}
+
+void FinishResidencyFrame(MeshResidency *r) {
+  int slot = r->frame % RESIDENCY_FRAMES;
+  if (r->uploaded_this_frame) {
+    r->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r->uploaded_this_frame = 0;
+  }
+  r->frame++;
+}
@@ -0,0 +1,100 @@
+// Streams the nodes of a mesh's LOD tree into a fixed-size pool of GPU memory,
+// for meshes that are too large to upload all at once. The full vertex data
+// stays in the LOD tree's host-side array. Each page in the pool holds a
+// single node; nodes are uploaded when they're selected for drawing, and the
+// least-recently drawn pages are reused once the pool is full. Until a node
+// has been uploaded, its closest resident ancestor is drawn in its place.
+#ifndef MESH_RESIDENCY_H
+#define MESH_RESIDENCY_H
+#include <stdint.h>
+#include <glad/glad.h>
+#include "mesh_buffers.h"
+#include "mesh_lod.h"
+#include "mesh_vertex.h"
+
+// The number of vertices held by a single page. This is enough for any node,
+// and MESH_BUFFER_VERTICES is a multiple of it, so pages never cross buffers.
+#define RESIDENCY_PAGE_VERTICES (LOD_NODE_SEGMENTS * 2)
+
+// The maximum number of pages uploaded in a single frame.
+#define RESIDENCY_UPLOADS_PER_FRAME (16)
+
+// The number of frames' worth of uploads that may be in flight at once. Each
+// frame writes its uploads to a separate part of the staging buffer.
+#define RESIDENCY_FRAMES (3)
+
+// A node that needs to be uploaded. Lower priorities are uploaded first.
+typedef struct {
+  uint32_t node;
+  float priority;
+} ResidencyRequest;
+
+// Tracks which LOD nodes are currently stored in the GPU-side page pool.
+typedef struct {
+  // The buffers holding the page pool. Owned by the caller. Page i starts at
+  // vertex i * RESIDENCY_PAGE_VERTICES.
+  MeshBufferSet *buffers;
+  uint32_t page_count;
+  // The node stored in each page, or UINT32_MAX if the page is free.
+  uint32_t *page_nodes;
+  // The frame in which each page was last drawn. Used to find the least-
+  // recently used page.
+  uint64_t *page_last_used;
+  // The last frame in which each page was added to the draw ranges, so that
+  // an ancestor standing in for several nodes is only drawn once.
+  uint64_t *page_drawn;
+  // The number of pages that currently hold a node.
+  uint32_t resident_count;
+  // The page holding each node, or UINT32_MAX if the node isn't resident.
+  uint32_t *node_pages;
+  // The last frame in which each node was requested, so that nodes are only
+  // requested once per frame.
+  uint64_t *node_requested;
+  uint32_t node_capacity;
+  // The nodes that need to be uploaded this frame.
+  ResidencyRequest *requests;
+  uint32_t request_count;
+  // A persistently-mapped buffer that uploads are copied through, with one
+  // region per frame in flight. Each region is only reused after the fence
+  // for the frame that last used it has been signaled.
+  GLuint staging_buffer;
+  MeshVertex *staging;
+  GLsync fences[RESIDENCY_FRAMES];
+  // Nonzero if anything was written to the staging buffer this frame.
+  int uploaded_this_frame;
+  // Incremented by FinishResidencyFrame.
+  uint64_t frame;
+  // Statistics since the last ResetMeshResidency call.
+  uint64_t total_uploads;
+  uint64_t total_evictions;
+} MeshResidency;
+
+// Allocates a page pool with the given number of pages in the given buffers,
+// replacing their previous contents. The buffers must remain valid for as
+// long as the returned object is used. Returns NULL on error.
+MeshResidency* CreateMeshResidency(MeshBufferSet *buffers,
+    uint32_t page_count);
+
+// Frees the residency information and the staging buffer. Doesn't delete
+// the page pool's buffers. The pointer is no longer valid after this returns.
+void DestroyMeshResidency(MeshResidency *r);
+
+// Forgets all resident pages, and prepares to stream nodes from the given
+// LOD tree. Must be called whenever the tree is rebuilt. The tree's root is
+// uploaded immediately and never evicted. Returns 0 on error.
+int ResetMeshResidency(MeshResidency *r, MeshLOD *l);
+
+// Replaces the nodes in l->selected with resident nodes, uploading as many
+// missing nodes as possible first, and writes the ranges of vertices to draw
+// from the page pool's buffers to firsts and counts. Both arrays must have
+// space for at least l->selected_count entries. The view is used to upload
+// nodes close to the camera first. Sets *draw_count to the number of ranges.
+// Returns 0 on error.
+int SelectResidentNodes(MeshResidency *r, MeshLOD *l, LODView *v,
+    uint32_t *firsts, uint32_t *counts, uint32_t *draw_count);
+
+// Must be called after the draw calls using the ranges from
+// SelectResidentNodes have been issued.
+void FinishResidencyFrame(MeshResidency *r);
+
+#endif  // MESH_RESIDENCY_H
@@ -0,0 +1,23 @@
+// Defines the vertex format shared by the turtle and the rendering code. This
+// header intentionally doesn't depend on OpenGL.
+#ifndef MESH_VERTEX_H
+#define MESH_VERTEX_H
+#include <cglm/cglm.h>
+
+// Defines a single vertex within the mesh.
+typedef struct {
+  vec3 location;
+  float pad1;
+  // Points in the direction of the next vertex. May be 0 if this is at the
+  // end of a sequence of lines.
+  vec3 forward;
+  float pad2;
+  // Points "upward"; must be orthogonal to the direction and normalized.
+  // Basically just gives a consistent way to orient geometry.
+  vec3 up;
+  float pad3;
+  // The color of the vertex.
+  vec4 color;
+} MeshVertex;
+
+#endif  // MESH_VERTEX_H
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "gl_utilities.h"
+#include "offscreen_target.h"
+#include "utilities.h"
+
+OffscreenTarget* CreateOffscreenTarget(int width, int height) {
+  OffscreenTarget *t = NULL;
+  GLint max_size = 0;
+  GLenum status;
+  glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+  if ((width <= 0) || (height <= 0) || (width > max_size) ||
+    (height > max_size)) {
+    printf("Can't create a %dx%d framebuffer. The maximum size is %dx%d.\n",
+      width, height, (int) max_size, (int) max_size);
+    return NULL;
+  }
+  t = (OffscreenTarget *) calloc(1, sizeof(*t));
+  if (!t) {
+    printf("Failed allocating offscreen target.\n");
+    return NULL;
+  }
+  t->width = width;
+  t->height = height;
+  glGenRenderbuffers(1, &(t->color));
+  glBindRenderbuffer(GL_RENDERBUFFER, t->color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &(t->depth));
+  glBindRenderbuffer(GL_RENDERBUFFER, t->depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  glGenFramebuffers(1, &(t->framebuffer));
+  glBindFramebuffer(GL_FRAMEBUFFER, t->framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+    GL_RENDERBUFFER, t->color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+    GL_RENDERBUFFER, t->depth);
+  status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    printf("Offscreen framebuffer is incomplete: status 0x%x.\n",
+      (unsigned) status);
+    DestroyOffscreenTarget(t);
+    return NULL;
+  }
+  if (!CheckGLErrors()) {
+    printf("Failed creating a %dx%d offscreen framebuffer.\n", width, height);
+    DestroyOffscreenTarget(t);
+    return NULL;
+  }
+  return t;
+}
+
+void DestroyOffscreenTarget(OffscreenTarget *t) {
+  if (!t) return;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &(t->framebuffer));
+  glDeleteRenderbuffers(1, &(t->color));
+  glDeleteRenderbuffers(1, &(t->depth));
+  memset(t, 0, sizeof(*t));
+  free(t);
+}
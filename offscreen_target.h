@@ -0,0 +1,25 @@
+// A framebuffer object with color and depth renderbuffers, used to render
+// images without drawing to a window.
+#ifndef OFFSCREEN_TARGET_H
+#define OFFSCREEN_TARGET_H
+#include <glad/glad.h>
+
+typedef struct {
+  GLuint framebuffer;
+  // An 8-bit RGBA color renderbuffer.
+  GLuint color;
+  GLuint depth;
+  int width;
+  int height;
+} OffscreenTarget;
+
+// Creates a framebuffer of the given size, and binds it for both drawing and
+// reading. Returns NULL on error, including if the size exceeds the
+// maximum supported by the driver.
+OffscreenTarget* CreateOffscreenTarget(int width, int height);
+
+// Deletes the framebuffer and its renderbuffers. The pointer is no longer
+// valid after this returns.
+void DestroyOffscreenTarget(OffscreenTarget *t);
+
+#endif  // OFFSCREEN_TARGET_H
@@ -0,0 +1,185 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory_budget.h"
+#include "mesh_vertex.h"
+#include "output_hash.h"
+
+#define FNV_OFFSET_BASIS (0xcbf29ce484222325ULL)
+#define FNV_PRIME (0x100000001b3ULL)
+
+// Stands in for NaNs and values too large to quantize, so they hash the same
+// way on every platform.
+#define QUANTIZED_INVALID (INT64_MIN)
+
+void InitStreamHash(StreamHash *h) {
+  h->hash = FNV_OFFSET_BASIS;
+  h->size = 0;
+}
+
+void UpdateStreamHash(StreamHash *h, const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *) data;
+  uint64_t hash = h->hash;
+  size_t i;
+  for (i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  h->hash = hash;
+  h->size += size;
+}
+
+void InitVertexHash(VertexHash *h, double quantum) {
+  InitStreamHash(&(h->stream));
+  h->quantum = quantum;
+  h->vertex_count = 0;
+}
+
+// Rounds the value to the nearest multiple of the quantum, and returns the
+// multiple.
+static int64_t Quantize(float value, double quantum) {
+  double q = floor(((double) value) / quantum + 0.5);
+  if (!(q > -9.0e18) || !(q < 9.0e18)) return QUANTIZED_INVALID;
+  return (int64_t) q;
+}
+
+// Hashes the quantized values a 64-bit word at a time, rather than a byte at
+// a time like UpdateStreamHash, since vertices make up most of the data. The
+// high half of each product is folded back into the low half, so that every
+// bit of a value affects the whole hash. The words are hashed as numbers, so
+// the result doesn't depend on the platform's byte order.
+static void HashQuantized(VertexHash *h, const float *values, int count) {
+  uint64_t hash = h->stream.hash;
+  int i;
+  for (i = 0; i < count; i++) {
+    hash ^= (uint64_t) Quantize(values[i], h->quantum);
+    hash *= FNV_PRIME;
+    hash ^= hash >> 32;
+  }
+  h->stream.hash = hash;
+  h->stream.size += count * 8;
+}
+
+void UpdateVertexHash(VertexHash *h, const MeshVertex *vertices,
+    uint32_t count) {
+  const MeshVertex *v = NULL;
+  uint32_t i;
+  for (i = 0; i < count; i++) {
+    v = vertices + i;
+    HashQuantized(h, v->location, 3);
+    HashQuantized(h, v->forward, 3);
+    HashQuantized(h, v->up, 3);
+    HashQuantized(h, v->color, 4);
+  }
+  h->vertex_count += count;
+}
+
+int VertexHashSink(void *data, MeshVertex *vertices, uint32_t count) {
+  UpdateVertexHash((VertexHash *) data, vertices, count);
+  return 1;
+}
+
+void InitVertexSummary(VertexSummary *s) {
+  memset(s, 0, sizeof(*s));
+}
+
+void FreeVertexSummary(VertexSummary *s) {
+  TrackedFree(s->blocks);
+  InitVertexSummary(s);
+}
+
+// Returns the block that the next vertex belongs in, starting a new one if
+// needed. Returns NULL on error.
+static VertexBlockSummary* CurrentBlock(VertexSummary *s) {
+  VertexBlockSummary *b = NULL;
+  uint32_t new_capacity;
+  void *tmp = NULL;
+  int i;
+  if (s->block_count != 0) {
+    b = s->blocks + s->block_count - 1;
+    if (b->vertex_count < VERTEX_SUMMARY_BLOCK_SIZE) return b;
+  }
+  if (s->block_count >= s->block_capacity) {
+    new_capacity = s->block_capacity ? (s->block_capacity * 2) : 16;
+    tmp = TrackedRealloc(MEMORY_TURTLE, s->blocks, new_capacity *
+      sizeof(VertexBlockSummary));
+    if (!tmp) {
+      printf("Failed allocating %u vertex block summaries.\n",
+        (unsigned) new_capacity);
+      return NULL;
+    }
+    s->blocks = (VertexBlockSummary *) tmp;
+    s->block_capacity = new_capacity;
+  }
+  b = s->blocks + s->block_count;
+  memset(b, 0, sizeof(*b));
+  for (i = 0; i < 3; i++) {
+    b->min_location[i] = INFINITY;
+    b->max_location[i] = -INFINITY;
+  }
+  s->block_count++;
+  return b;
+}
+
+int UpdateVertexSummary(VertexSummary *s, const MeshVertex *vertices,
+    uint32_t count) {
+  VertexBlockSummary *b = NULL;
+  const MeshVertex *v = NULL;
+  uint32_t i;
+  int j;
+  for (i = 0; i < count; i++) {
+    b = CurrentBlock(s);
+    if (!b) return 0;
+    v = vertices + i;
+    for (j = 0; j < 3; j++) {
+      if (v->location[j] < b->min_location[j]) {
+        b->min_location[j] = v->location[j];
+      }
+      if (v->location[j] > b->max_location[j]) {
+        b->max_location[j] = v->location[j];
+      }
+      b->sums[j] += v->location[j];
+      b->sums[3 + j] += v->forward[j];
+      b->sums[6 + j] += v->up[j];
+    }
+    for (j = 0; j < 4; j++) {
+      b->sums[9 + j] += v->color[j];
+    }
+    b->vertex_count++;
+  }
+  s->vertex_count += count;
+  return 1;
+}
+
+int VertexSummarySink(void *data, MeshVertex *vertices, uint32_t count) {
+  return UpdateVertexSummary((VertexSummary *) data, vertices, count);
+}
+
+// Returns nonzero if the values differ by at most the tolerance. NaNs and
+// infinities only match themselves.
+static int ValuesMatch(double a, double b, double tolerance) {
+  if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+  if (a == b) return 1;
+  return fabs(a - b) <= tolerance;
+}
+
+int VertexBlocksMatch(const VertexBlockSummary *a,
+    const VertexBlockSummary *b, double quantum) {
+  double sum_tolerance = quantum * a->vertex_count;
+  int i;
+  if (a->vertex_count != b->vertex_count) return 0;
+  for (i = 0; i < 3; i++) {
+    if (!ValuesMatch(a->min_location[i], b->min_location[i], quantum)) {
+      return 0;
+    }
+    if (!ValuesMatch(a->max_location[i], b->max_location[i], quantum)) {
+      return 0;
+    }
+  }
+  for (i = 0; i < VERTEX_SUMMARY_COMPONENTS; i++) {
+    if (!ValuesMatch(a->sums[i], b->sums[i], sum_tolerance)) return 0;
+  }
+  return 1;
+}
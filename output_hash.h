@@ -0,0 +1,98 @@
+// Computes hashes of the expanded L-system string and the turtle's vertices,
+// so that changes to how they're generated can be checked against known-good
+// output without storing it. The hashes are 64-bit FNV-1a, and are updated
+// as the data is produced. Vertices are hashed a quantized 64-bit value at a
+// time rather than a byte at a time, so their hashes are faster, but differ
+// from UpdateStreamHash over the same bytes. Doesn't use OpenGL.
+//
+// Vertex components are rounded to the nearest multiple of a quantum before
+// being hashed, so small floating-point differences, e.g. from reordering
+// arithmetic, don't change the hash. A value that lands within rounding error
+// of halfway between two multiples may still round either way, so the
+// quantum should be much larger than the expected error. Since even a 1-ulp
+// change can therefore change the hash, golden output is instead compared
+// using VertexSummary, which summarizes each block of vertices with values
+// that can be compared with a tolerance.
+#ifndef OUTPUT_HASH_H
+#define OUTPUT_HASH_H
+#include <stddef.h>
+#include <stdint.h>
+#include "mesh_vertex.h"
+
+// The quantum used if none is given, in the turtle's units.
+#define DEFAULT_HASH_QUANTUM (1.0e-3)
+
+typedef struct {
+  uint64_t hash;
+  // The number of bytes hashed so far.
+  uint64_t size;
+} StreamHash;
+
+// Hashes the location, forward and up vectors, and color of every vertex.
+// The padding isn't hashed.
+typedef struct {
+  StreamHash stream;
+  double quantum;
+  uint64_t vertex_count;
+} VertexHash;
+
+void InitStreamHash(StreamHash *h);
+
+void UpdateStreamHash(StreamHash *h, const void *data, size_t size);
+
+void InitVertexHash(VertexHash *h, double quantum);
+
+void UpdateVertexHash(VertexHash *h, const MeshVertex *vertices,
+    uint32_t count);
+
+// A TurtleVertexSink that passes the turtle's vertices to UpdateVertexHash.
+// The data must be a VertexHash. Always succeeds.
+int VertexHashSink(void *data, MeshVertex *vertices, uint32_t count);
+
+// The number of consecutive vertices summarized by each VertexBlockSummary.
+#define VERTEX_SUMMARY_BLOCK_SIZE (16384)
+
+// The number of values summed in each vertex: the location, forward and up
+// vectors, and color.
+#define VERTEX_SUMMARY_COMPONENTS (13)
+
+typedef struct {
+  uint32_t vertex_count;
+  // The box containing the location of every vertex in the block.
+  double min_location[3];
+  double max_location[3];
+  // The sum of each of the block's vertex components, in the order listed
+  // above.
+  double sums[VERTEX_SUMMARY_COMPONENTS];
+} VertexBlockSummary;
+
+// Summarizes every VERTEX_SUMMARY_BLOCK_SIZE vertices, with the last block
+// holding any that are left over.
+typedef struct {
+  VertexBlockSummary *blocks;
+  uint32_t block_count;
+  uint32_t block_capacity;
+  uint64_t vertex_count;
+} VertexSummary;
+
+void InitVertexSummary(VertexSummary *s);
+
+// Frees the summary's blocks and re-initializes it.
+void FreeVertexSummary(VertexSummary *s);
+
+// Adds the vertices to the summary. Returns 0 on error.
+int UpdateVertexSummary(VertexSummary *s, const MeshVertex *vertices,
+    uint32_t count);
+
+// A TurtleVertexSink that passes the turtle's vertices to
+// UpdateVertexSummary. The data must be a VertexSummary.
+int VertexSummarySink(void *data, MeshVertex *vertices, uint32_t count);
+
+// Returns nonzero if the blocks have the same number of vertices, their
+// bounds differ by at most the quantum, and their sums differ by at most the
+// quantum times the number of vertices, i.e. if they could be summaries of
+// the same vertices with every component moved by at most the quantum.
+int VertexBlocksMatch(const VertexBlockSummary *a,
+    const VertexBlockSummary *b, double quantum);
+
+#endif  // OUTPUT_HASH_H
@@ -3,16 +3,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "memory_budget.h"
 #include "parse_config.h"
-#include "utilities.h"
 
 // Frees the resources associated with the given file. After calling this, the
 // pointer is no longer valid.
 void FreeConfigFile(ConfigFile *f) {
-  free(f->file_content);
-  free(f->lines);
+  TrackedFree(f->file_content);
+  TrackedFree(f->lines);
   memset(f, 0, sizeof(*f));
-  free(f);
+  TrackedFree(f);
 }
 
 // Returns nonzero if c is a tab, space, or carriage return.
@@ -38,25 +38,23 @@ static void ReplaceWhitespaceBackwards(char *s, char *limit) {
   }
 }
 
-// Reads the file at the given path, and splits it into lines. Returns NULL on
-// error, including if the file contains non-ASCII characters.
-static ConfigFile *LoadConfigFile(const char *path) {
+// Splits the config's contents into lines. Takes ownership of the contents,
+// which must be tracked memory, and are freed on error. The name is only used
+// in error messages. Returns NULL on error, including if the contents include
+// non-ASCII characters.
+static ConfigFile *SplitConfigFile(char *content, const char *name) {
   ConfigFile *f = NULL;
   char *current = NULL;
   uint32_t line_index = 0;
-  f = (ConfigFile *) calloc(1, sizeof(*f));
+  f = (ConfigFile *) TrackedCalloc(MEMORY_CONFIG, 1, sizeof(*f));
   if (!f) {
     printf("Error allocating internal config-file struct.\n");
+    TrackedFree(content);
     return NULL;
   }
-  f->file_content = ReadFullFile(path);
-  if (!f->file_content) {
-    printf("Failed reading config file %s.\n", path);
-    free(f);
-    return NULL;
-  }
+  f->file_content = content;
   if (strlen(f->file_content) == 0) {
-    printf("The config file %s was empty.\n", path);
+    printf("The config file %s was empty.\n", name);
     FreeConfigFile(f);
     return NULL;
   }
@@ -65,7 +63,7 @@ static ConfigFile *LoadConfigFile(const char *path) {
   while (*current != 0) {
     if (*current == '\n') f->line_count++;
     if (*current >= 127) {
-      printf("The config file %s contains a non-ASCII character 0x%x.\n", path,
+      printf("The config file %s contains a non-ASCII character 0x%x.\n", name,
         (unsigned int) *current);
       FreeConfigFile(f);
       return NULL;
@@ -75,7 +73,8 @@ static ConfigFile *LoadConfigFile(const char *path) {
   // We always end the file with a "line", which will be blank if the file ends
   // with a newline. It keeps it simpler to have at least one line.
   f->line_count++;
-  f->lines = (char **) calloc(f->line_count, sizeof(char *));
+  f->lines = (char **) TrackedCalloc(MEMORY_CONFIG, f->line_count,
+    sizeof(char *));
   if (!f->lines) {
     printf("Failed allocating list of file lines.\n");
     FreeConfigFile(f);
@@ -132,7 +131,7 @@ static char* GetNextNonBlankLine(ConfigFile *f) {
 void DestroyLSystemConfig(LSystemConfig *c) {
   if (c->f) FreeConfigFile(c->f);
   memset(c, 0, sizeof(*c));
-  free(c);
+  TrackedFree(c);
 }
 
 // Returns nonzero if c is a non-whitespace, printable, ASCII character that
@@ -277,44 +276,57 @@ static int TryParseAction(LSystemConfig *config, const char *token,
   return 1;
 }
 
+// The name of each action in the config file, and the turtle instruction it
+// runs. "rotate" and "yaw" are the same instruction.
+static const char *action_names[] = {
+  "move_forward",
+  "move_forward_nodraw",
+  "rotate",
+  "yaw",
+  "pitch",
+  "roll",
+  "set_color_r",
+  "set_color_g",
+  "set_color_b",
+  "set_color_a",
+  "push_position",
+  "pop_position",
+  "push_color",
+  "pop_color",
+};
+static const TurtleInstruction action_fns[] = {
+  MoveTurtleForward,
+  MoveTurtleForwardNoDraw,
+  RotateTurtle,
+  RotateTurtle,
+  PitchTurtle,
+  RollTurtle,
+  SetTurtleRed,
+  SetTurtleGreen,
+  SetTurtleBlue,
+  SetTurtleAlpha,
+  PushTurtlePosition,
+  PopTurtlePosition,
+  PushTurtleColor,
+  PopTurtleColor,
+};
+
+#define ACTION_COUNT ((int) (sizeof(action_fns) / sizeof(TurtleInstruction)))
+
+const char* TurtleActionName(TurtleInstruction f) {
+  int i;
+  for (i = 0; i < ACTION_COUNT; i++) {
+    if (action_fns[i] == f) return action_names[i];
+  }
+  return "unknown";
+}
+
 // Parses the action rules from the config file. Expects to be on the line
 // immediately following the line containing "actions". Returns 0 on error.
 static int ParseActionRules(LSystemConfig *config) {
-  char *action_names[] = {
-    "move_forward",
-    "move_forward_nodraw",
-    "rotate",
-    "yaw",
-    "pitch",
-    "roll",
-    "set_color_r",
-    "set_color_g",
-    "set_color_b",
-    "set_color_a",
-    "push_position",
-    "pop_position",
-    "push_color",
-    "pop_color",
-  };
-  TurtleInstruction action_fns[] = {
-    MoveTurtleForward,
-    MoveTurtleForwardNoDraw,
-    RotateTurtle,
-    RotateTurtle,
-    PitchTurtle,
-    RollTurtle,
-    SetTurtleRed,
-    SetTurtleGreen,
-    SetTurtleBlue,
-    SetTurtleAlpha,
-    PushTurtlePosition,
-    PopTurtlePosition,
-    PushTurtleColor,
-    PopTurtleColor,
-  };
   char *current_line = NULL;
   uint8_t current_char = 0;
-  int possible_action_count = sizeof(action_fns) / sizeof(TurtleInstruction);
+  int possible_action_count = ACTION_COUNT;
   int result, i;
   while (1) {
     current_line = GetNextNonBlankLine(config->f);
@@ -354,14 +366,51 @@ static int ParseActionRules(LSystemConfig *config) {
   return 1;
 }
 
-LSystemConfig* LoadLSystemConfig(const char *path) {
+// Like ReadFullFile, but the contents are allocated as tracked memory.
+// Returns NULL on error.
+static char* ReadConfigFile(const char *path) {
+  char *to_return = NULL;
+  long size = 0;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  if ((fseek(f, 0, SEEK_END) != 0) || ((size = ftell(f)) < 0) ||
+    (fseek(f, 0, SEEK_SET) != 0)) {
+    printf("Failed getting size of %s: %s\n", path, strerror(errno));
+    fclose(f);
+    return NULL;
+  }
+  // Use size + 1 to null-terminate the data.
+  to_return = (char *) TrackedCalloc(MEMORY_CONFIG, 1, ((size_t) size) + 1);
+  if (!to_return) {
+    printf("Failed allocating buffer to hold contents of %s.\n", path);
+    fclose(f);
+    return NULL;
+  }
+  if ((size != 0) && (fread(to_return, size, 1, f) < 1)) {
+    printf("Failed reading %s: %s\n", path, strerror(errno));
+    fclose(f);
+    TrackedFree(to_return);
+    return NULL;
+  }
+  fclose(f);
+  return to_return;
+}
+
+// Parses the config's contents, taking ownership of them in the same way as
+// SplitConfigFile. Returns NULL on error.
+static LSystemConfig* ParseConfigContent(char *content, const char *name) {
   LSystemConfig *to_return = NULL;
-  to_return = (LSystemConfig *) calloc(1, sizeof(*to_return));
+  to_return = (LSystemConfig *) TrackedCalloc(MEMORY_CONFIG, 1,
+    sizeof(*to_return));
   if (!to_return) {
     printf("Failed allocating L-system config data.\n");
+    TrackedFree(content);
     return NULL;
   }
-  to_return->f = LoadConfigFile(path);
+  to_return->f = SplitConfigFile(content, name);
   if (!to_return->f) {
     DestroyLSystemConfig(to_return);
     return NULL;
@@ -376,3 +425,21 @@ LSystemConfig* LoadLSystemConfig(const char *path) {
   }
   return to_return;
 }
+
+LSystemConfig* LoadLSystemConfig(const char *path) {
+  char *content = ReadConfigFile(path);
+  if (!content) {
+    printf("Failed reading config file %s.\n", path);
+    return NULL;
+  }
+  return ParseConfigContent(content, path);
+}
+
+LSystemConfig* ParseLSystemConfig(const char *content, const char *name) {
+  char *copy = TrackedStrdup(MEMORY_CONFIG, content);
+  if (!copy) {
+    printf("Failed copying config file %s.\n", name);
+    return NULL;
+  }
+  return ParseConfigContent(copy, name);
+}
@@ -57,9 +57,17 @@ typedef struct {
 // LSystemConfig struct. Returns NULL if any error occurs.
 LSystemConfig* LoadLSystemConfig(const char *path);
 
+// Like LoadLSystemConfig, but parses a config that's already in memory. The
+// contents are copied. The name is only used in error messages.
+LSystemConfig* ParseLSystemConfig(const char *content, const char *name);
+
 // Any resources associated with the given config. The pointer becomes invalid
 // after this function is called.
 void DestroyLSystemConfig(LSystemConfig *c);
 
+// Returns the name used for the instruction in config files, e.g.
+// "move_forward", or "unknown" if it isn't one of the config's actions.
+const char* TurtleActionName(TurtleInstruction f);
+
 #endif  // PARSE_CONFIG_H
 
@@ -0,0 +1,270 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "path_tracer.h"
+#include "thread_group.h"
+
+PathTracer* CreatePathTracer(int width, int height, int thread_count,
+    float radius) {
+  PathTracer *p = NULL;
+  int i;
+  if ((width <= 0) || (height <= 0)) {
+    printf("Invalid path tracer image size: %dx%d\n", width, height);
+    return NULL;
+  }
+  if (thread_count < 1) thread_count = 1;
+  p = (PathTracer *) calloc(1, sizeof(*p));
+  if (!p) {
+    printf("Failed allocating path tracer.\n");
+    return NULL;
+  }
+  p->width = width;
+  p->height = height;
+  p->thread_count = thread_count;
+  p->samples = DEFAULT_TRACE_SAMPLES;
+  p->ao_samples = DEFAULT_AO_SAMPLES;
+  p->ao_distance = DEFAULT_AO_DISTANCE;
+  glm_mat4_identity(p->model_transform);
+  glm_mat4_identity(p->inverse_clip_transform);
+  pthread_mutex_init(&(p->lock), NULL);
+  p->threads = (PathTracerThread *) calloc(thread_count,
+    sizeof(PathTracerThread));
+  p->pixels = (uint8_t *) calloc(((uint64_t) width) * height, 3);
+  p->bvh = CreateCapsuleBVH(radius);
+  if (!p->threads || !p->pixels || !p->bvh) {
+    printf("Failed allocating path tracer buffers.\n");
+    DestroyPathTracer(p);
+    return NULL;
+  }
+  for (i = 0; i < thread_count; i++) {
+    p->threads[i].p = p;
+    p->threads[i].index = i;
+  }
+  return p;
+}
+
+void DestroyPathTracer(PathTracer *p) {
+  if (!p) return;
+  DestroyCapsuleBVH(p->bvh);
+  free(p->threads);
+  free(p->pixels);
+  pthread_mutex_destroy(&(p->lock));
+  memset(p, 0, sizeof(*p));
+  free(p);
+}
+
+void SetTracedModelTransform(PathTracer *p, mat4 model_transform) {
+  glm_mat4_copy(model_transform, p->model_transform);
+}
+
+static uint32_t PackColor(vec4 color) {
+  uint32_t packed = 0;
+  float v;
+  int i;
+  for (i = 0; i < 4; i++) {
+    v = color[i];
+    if (v < 0) v = 0;
+    if (v > 1) v = 1;
+    packed |= ((uint32_t) (v * 255.0 + 0.5)) << (i * 8);
+  }
+  return packed;
+}
+
+static void UnpackColor(uint32_t packed, vec3 color) {
+  int i;
+  for (i = 0; i < 3; i++) {
+    color[i] = ((float) ((packed >> (i * 8)) & 0xff)) / 255.0;
+  }
+}
+
+int AddTracedSegments(void *tracer, MeshVertex *vertices, uint32_t count) {
+  PathTracer *p = (PathTracer *) tracer;
+  MeshVertex *a = NULL;
+  MeshVertex *b = NULL;
+  vec3 start, end;
+  uint32_t i;
+  for (i = 0; (i + 1) < count; i += 2) {
+    a = vertices + i;
+    b = vertices + i + 1;
+    glm_mat4_mulv3(p->model_transform, a->location, 1.0, start);
+    glm_mat4_mulv3(p->model_transform, b->location, 1.0, end);
+    if (!AddCapsule(p->bvh, start, end, PackColor(a->color),
+      PackColor(b->color))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int BuildTracedScene(PathTracer *p) {
+  return BuildCapsuleBVH(p->bvh, p->thread_count);
+}
+
+// Returns a random number, using xorshift.
+static uint32_t NextRandom(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+// Returns a random number in the range [0, 1).
+static float RandomFloat(uint32_t *state) {
+  return ((float) (NextRandom(state) >> 8)) / 16777216.0f;
+}
+
+// Returns the initial random state for a pixel, so that the image doesn't
+// depend on which thread traced each tile.
+static uint32_t PixelSeed(int x, int y) {
+  uint32_t h = ((uint32_t) x) * 0x9e3779b1u ^ ((uint32_t) y) * 0x85ebca77u;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  return h ? h : 1;
+}
+
+// Gets the ray through the given point on the image, in pixels from its top
+// left corner. The ray starts at the near plane, and max_distance is set to
+// its distance to the far plane.
+static void GetCameraRay(PathTracer *p, float x, float y, vec3 origin,
+    vec3 direction, float *max_distance) {
+  vec4 ndc, near, far;
+  ndc[0] = (x / p->width) * 2 - 1;
+  ndc[1] = 1 - (y / p->height) * 2;
+  ndc[2] = -1;
+  ndc[3] = 1;
+  glm_mat4_mulv(p->inverse_clip_transform, ndc, near);
+  ndc[2] = 1;
+  glm_mat4_mulv(p->inverse_clip_transform, ndc, far);
+  glm_vec3_divs(near, near[3], origin);
+  glm_vec3_divs(far, far[3], direction);
+  glm_vec3_sub(direction, origin, direction);
+  *max_distance = glm_vec3_norm(direction);
+  glm_vec3_normalize(direction);
+}
+
+// Returns a random direction in the hemisphere around the normal, more
+// likely to be close to the normal, following Lambert's cosine law.
+static void CosineDirection(vec3 normal, uint32_t *rng, vec3 direction) {
+  vec3 helper = {1, 0, 0};
+  vec3 u, v;
+  float r = sqrtf(RandomFloat(rng));
+  float angle = RandomFloat(rng) * 2 * GLM_PI;
+  if (fabsf(normal[0]) > 0.9) {
+    helper[0] = 0;
+    helper[1] = 1;
+  }
+  glm_vec3_crossn(helper, normal, u);
+  glm_vec3_cross(normal, u, v);
+  glm_vec3_scale(normal, sqrtf(fmaxf(1 - r * r, 0)), direction);
+  glm_vec3_muladds(u, r * cosf(angle), direction);
+  glm_vec3_muladds(v, r * sinf(angle), direction);
+}
+
+// Gets the color seen by a camera ray that hit a segment.
+static void ShadeHit(PathTracerThread *t, uint32_t *rng, vec3 origin,
+    vec3 direction, CapsuleHit *hit, vec3 color) {
+  PathTracer *p = t->p;
+  vec3 point, normal, occlusion_origin, occlusion_direction, end_color;
+  float along, diffuse, visibility = 1;
+  int i, unoccluded = 0;
+  glm_vec3_copy(origin, point);
+  glm_vec3_muladds(direction, hit->distance, point);
+  along = CapsuleHitNormal(p->bvh, hit, point, normal);
+  UnpackColor(p->bvh->colors[hit->segment * 2], color);
+  UnpackColor(p->bvh->colors[hit->segment * 2 + 1], end_color);
+  glm_vec3_lerp(color, end_color, along, color);
+  // Light the capsules the same way as the impostors drawn by the GPU.
+  diffuse = fabsf(glm_vec3_dot(normal, direction));
+  glm_vec3_scale(color, 0.3 + 0.7 * diffuse, color);
+  if (p->ao_samples <= 0) return;
+  // Start the occlusion rays slightly outside the surface, so they can't hit
+  // the segment they start from.
+  glm_vec3_copy(point, occlusion_origin);
+  glm_vec3_muladds(normal, p->bvh->radius * 0.01 + 1e-5, occlusion_origin);
+  for (i = 0; i < p->ao_samples; i++) {
+    CosineDirection(normal, rng, occlusion_direction);
+    if (!CapsuleBVHOccluded(p->bvh, occlusion_origin, occlusion_direction,
+      p->ao_distance)) {
+      unoccluded++;
+    }
+  }
+  t->ray_count += p->ao_samples;
+  visibility = ((float) unoccluded) / ((float) p->ao_samples);
+  glm_vec3_scale(color, visibility, color);
+}
+
+// Traces every sample for a single pixel, and writes its RGB value.
+static void TracePixel(PathTracerThread *t, int x, int y, uint8_t *dst) {
+  PathTracer *p = t->p;
+  uint32_t rng = PixelSeed(x, y);
+  vec3 total = {0, 0, 0};
+  vec3 origin, direction, color;
+  CapsuleHit hit;
+  float jitter_x = 0.5, jitter_y = 0.5, max_distance, v;
+  int i;
+  for (i = 0; i < p->samples; i++) {
+    if (p->samples > 1) {
+      jitter_x = RandomFloat(&rng);
+      jitter_y = RandomFloat(&rng);
+    }
+    GetCameraRay(p, x + jitter_x, y + jitter_y, origin, direction,
+      &max_distance);
+    t->ray_count++;
+    if (!IntersectCapsuleBVH(p->bvh, origin, direction, max_distance, &hit)) {
+      continue;
+    }
+    ShadeHit(t, &rng, origin, direction, &hit, color);
+    glm_vec3_add(total, color, total);
+  }
+  for (i = 0; i < 3; i++) {
+    v = total[i] / p->samples;
+    if (v > 1) v = 1;
+    dst[i] = (uint8_t) (v * 255.0 + 0.5);
+  }
+}
+
+// Claims tiles and traces them until none are left.
+static void* TraceTilesThread(void *arg) {
+  PathTracerThread *t = (PathTracerThread *) arg;
+  PathTracer *p = t->p;
+  int tiles_x = (p->width + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+  int tiles_y = (p->height + TRACE_TILE_SIZE - 1) / TRACE_TILE_SIZE;
+  uint32_t tile;
+  int x, y, start_x, start_y, end_x, end_y;
+  while (1) {
+    pthread_mutex_lock(&(p->lock));
+    tile = p->next_tile;
+    p->next_tile++;
+    pthread_mutex_unlock(&(p->lock));
+    if (tile >= ((uint32_t) (tiles_x * tiles_y))) break;
+    start_x = (tile % tiles_x) * TRACE_TILE_SIZE;
+    start_y = (tile / tiles_x) * TRACE_TILE_SIZE;
+    end_x = start_x + TRACE_TILE_SIZE;
+    end_y = start_y + TRACE_TILE_SIZE;
+    if (end_x > p->width) end_x = p->width;
+    if (end_y > p->height) end_y = p->height;
+    for (y = start_y; y < end_y; y++) {
+      for (x = start_x; x < end_x; x++) {
+        TracePixel(t, x, y, p->pixels + (((uint64_t) y) * p->width + x) * 3);
+      }
+    }
+  }
+  return NULL;
+}
+
+int TraceImage(PathTracer *p, mat4 view_projection) {
+  int i;
+  glm_mat4_inv(view_projection, p->inverse_clip_transform);
+  p->next_tile = 0;
+  for (i = 0; i < p->thread_count; i++) {
+    p->threads[i].ray_count = 0;
+  }
+  return RunThreadGroup("Path trace tiles", p->thread_count, TraceTilesThread,
+    p->threads, sizeof(PathTracerThread));
+}
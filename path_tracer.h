@@ -0,0 +1,88 @@
+// A multithreaded CPU renderer that ray traces the turtle's segments as
+// capsules, lit with ambient occlusion, for rendering high-quality still
+// images on machines without a GPU. It doesn't use OpenGL.
+//
+// Segments are collected into a CapsuleBVH as they're added. Tracing then
+// splits the image into tiles, which the threads take turns claiming. Each
+// pixel averages several jittered primary rays, and at every hit the
+// fraction of cosine-distributed rays that escape without hitting another
+// segment within the occlusion distance scales the surface's lighting.
+#ifndef PATH_TRACER_H
+#define PATH_TRACER_H
+#include <pthread.h>
+#include <stdint.h>
+#include <cglm/cglm.h>
+#include "capsule_bvh.h"
+#include "mesh_vertex.h"
+
+// The width and height, in pixels, of the tiles claimed by each thread.
+#define TRACE_TILE_SIZE (32)
+
+// The defaults for the number of primary rays per pixel, and for the number
+// of ambient occlusion rays cast from each primary ray's hit.
+#define DEFAULT_TRACE_SAMPLES (4)
+#define DEFAULT_AO_SAMPLES (8)
+
+// How far, in world units, segments can be from a point and still occlude
+// it. The mesh is scaled to fit in a cube MESH_CUBE_SIZE units across.
+#define DEFAULT_AO_DISTANCE (0.5)
+
+struct PathTracer;
+
+// The state of one of the path tracer's threads.
+typedef struct {
+  struct PathTracer *p;
+  int index;
+  // The number of rays this thread has traced.
+  uint64_t ray_count;
+} PathTracerThread;
+
+typedef struct PathTracer {
+  int width;
+  int height;
+  int thread_count;
+  PathTracerThread *threads;
+  int samples;
+  int ao_samples;
+  float ao_distance;
+  // Transforms vertex locations to world space.
+  mat4 model_transform;
+  // Transforms normalized device coordinates back to world space.
+  mat4 inverse_clip_transform;
+  CapsuleBVH *bvh;
+  // Protects next_tile while tracing.
+  pthread_mutex_t lock;
+  uint32_t next_tile;
+  // The finished image: 8-bit RGB, with the top row first.
+  uint8_t *pixels;
+} PathTracer;
+
+// Allocates a path tracer for images of the given size, traced using the
+// given number of threads. Every segment is a capsule of the given radius, in
+// world units. The samples, ao_samples and ao_distance fields are set to
+// their defaults, and can be changed before calling TraceImage. Returns NULL
+// on error.
+PathTracer* CreatePathTracer(int width, int height, int thread_count,
+    float radius);
+
+// Frees the path tracer. The pointer is no longer valid after this returns.
+void DestroyPathTracer(PathTracer *p);
+
+// Sets the transform from vertex locations to world space (i.e. the model
+// matrix) used by AddTracedSegments. Must be called before adding segments.
+void SetTracedModelTransform(PathTracer *p, mat4 model_transform);
+
+// Adds the given segments to the scene. The vertices are a list of pairs,
+// like in a mesh. The arguments match a TurtleVertexSink, so this can receive
+// vertices straight from the turtle. Returns 0 on error.
+int AddTracedSegments(void *tracer, MeshVertex *vertices, uint32_t count);
+
+// Builds the BVH over every segment that was added. Must be called once,
+// after adding segments and before TraceImage. Returns 0 on error.
+int BuildTracedScene(PathTracer *p);
+
+// Traces the image seen through the given combined projection and view
+// matrices into p->pixels. Returns 0 on error.
+int TraceImage(PathTracer *p, mat4 view_projection);
+
+#endif  // PATH_TRACER_H
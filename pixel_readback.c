@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "gl_utilities.h"
+#include "pixel_readback.h"
+#include "utilities.h"
+
+// The flags used for the persistently-mapped pixel buffer. Client storage
+// asks the driver to keep the buffer in host memory, which is faster to read.
+#define READBACK_FLAGS (GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | \
+  GL_MAP_COHERENT_BIT)
+
+// The number of nanoseconds to wait for a fence before checking again.
+#define FENCE_WAIT_TIMEOUT (1000000000ull)
+
+PixelReadback* CreatePixelReadback(int width, int height) {
+  PixelReadback *r = NULL;
+  GLsizeiptr size;
+  r = (PixelReadback *) calloc(1, sizeof(*r));
+  if (!r) {
+    printf("Failed allocating pixel readback info.\n");
+    return NULL;
+  }
+  r->width = width;
+  r->height = height;
+  r->slot_size = ((uint64_t) width) * ((uint64_t) height) * 3;
+  size = r->slot_size * READBACK_SLOTS;
+  glGenBuffers(1, &(r->buffer));
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r->buffer);
+  glBufferStorage(GL_PIXEL_PACK_BUFFER, size, NULL, READBACK_FLAGS |
+    GL_CLIENT_STORAGE_BIT);
+  r->mapped = (uint8_t *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+    READBACK_FLAGS);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  if (!r->mapped || !CheckGLErrors()) {
+    printf("Failed mapping a %.02f MB pixel readback buffer.\n",
+      ((float) size) / (1024.0 * 1024.0));
+    DestroyPixelReadback(r);
+    return NULL;
+  }
+  return r;
+}
+
+// Waits for the given fence, then deletes it. Returns 0 on error.
+static int WaitForFence(GLsync fence) {
+  GLenum result;
+  while (1) {
+    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+      FENCE_WAIT_TIMEOUT);
+    if ((result == GL_ALREADY_SIGNALED) ||
+      (result == GL_CONDITION_SATISFIED)) {
+      break;
+    }
+    if (result == GL_WAIT_FAILED) {
+      printf("Failed waiting for a pixel readback.\n");
+      glDeleteSync(fence);
+      return 0;
+    }
+  }
+  glDeleteSync(fence);
+  return 1;
+}
+
+void DestroyPixelReadback(PixelReadback *r) {
+  int i;
+  if (!r) return;
+  for (i = 0; i < READBACK_SLOTS; i++) {
+    if (r->fences[i]) WaitForFence(r->fences[i]);
+  }
+  if (r->mapped) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r->buffer);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  glDeleteBuffers(1, &(r->buffer));
+  memset(r, 0, sizeof(*r));
+  free(r);
+}
+
+int PixelReadbackSlotFree(PixelReadback *r) {
+  return r->in_use < READBACK_SLOTS;
+}
+
+int StartPixelReadback(PixelReadback *r, int64_t tag) {
+  uint32_t slot = (r->first + r->in_use) % READBACK_SLOTS;
+  if (!PixelReadbackSlotFree(r)) {
+    printf("No free pixel readback slot.\n");
+    return 0;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, r->buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, r->width, r->height, GL_RGB, GL_UNSIGNED_BYTE,
+    (void *) (slot * r->slot_size));
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  r->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  r->tags[slot] = tag;
+  r->in_use++;
+  return CheckGLErrors();
+}
+
+int PixelReadbackPending(PixelReadback *r) {
+  return r->ready < r->in_use;
+}
+
+int PixelReadbackFinished(PixelReadback *r) {
+  uint32_t slot = (r->first + r->ready) % READBACK_SLOTS;
+  GLenum result;
+  if (!PixelReadbackPending(r)) return 0;
+  result = glClientWaitSync(r->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  return (result == GL_ALREADY_SIGNALED) || (result == GL_CONDITION_SATISFIED);
+}
+
+uint8_t* WaitPixelReadback(PixelReadback *r, int64_t *tag) {
+  uint32_t slot = (r->first + r->ready) % READBACK_SLOTS;
+  GLsync fence = r->fences[slot];
+  if (!PixelReadbackPending(r)) {
+    printf("No pixel readback is pending.\n");
+    return NULL;
+  }
+  r->fences[slot] = 0;
+  if (!WaitForFence(fence)) return NULL;
+  r->ready++;
+  *tag = r->tags[slot];
+  return r->mapped + slot * r->slot_size;
+}
+
+void ReleasePixelReadback(PixelReadback *r) {
+  if (r->ready == 0) return;
+  r->first = (r->first + 1) % READBACK_SLOTS;
+  r->in_use--;
+  r->ready--;
+}
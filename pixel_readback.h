@@ -0,0 +1,68 @@
+// Copies rendered images from the GPU without stalling the CPU. Each readback
+// copies the current read framebuffer into one of READBACK_SLOTS regions of a
+// pixel pack buffer, and the pixels are only accessed a few frames later, once
+// the copy has finished. The buffer is persistently mapped, so the pixels of
+// a finished readback can be read directly, even from another thread.
+//
+// Slots are used in order. Each one goes from free, to pending after
+// StartPixelReadback, to ready after WaitPixelReadback, and back to free
+// after ReleasePixelReadback.
+#ifndef PIXEL_READBACK_H
+#define PIXEL_READBACK_H
+#include <stdint.h>
+#include <glad/glad.h>
+
+// The number of images that may be pending or ready at once.
+#define READBACK_SLOTS (4)
+
+typedef struct {
+  int width;
+  int height;
+  // The size, in bytes, of each slot's image. Images are tightly-packed RGB,
+  // with the bottom row first, as returned by glReadPixels.
+  uint64_t slot_size;
+  GLuint buffer;
+  uint8_t *mapped;
+  GLsync fences[READBACK_SLOTS];
+  // A value provided by the caller for each readback, such as a frame number.
+  int64_t tags[READBACK_SLOTS];
+  // The oldest slot that isn't free.
+  uint32_t first;
+  // The number of slots that aren't free, and how many of those are ready.
+  // The ready slots always come first.
+  uint32_t in_use;
+  uint32_t ready;
+} PixelReadback;
+
+// Allocates the pixel buffer for images of the given size. Returns NULL on
+// error.
+PixelReadback* CreatePixelReadback(int width, int height);
+
+// Waits for any pending copies and frees the buffer. The pointer is no longer
+// valid after this returns.
+void DestroyPixelReadback(PixelReadback *r);
+
+// Returns nonzero if a slot is free for StartPixelReadback.
+int PixelReadbackSlotFree(PixelReadback *r);
+
+// Starts copying the bottom-left corner of the current read framebuffer into
+// the next slot, remembering the given tag. A slot must be free. Returns 0 on
+// error.
+int StartPixelReadback(PixelReadback *r, int64_t tag);
+
+// Returns nonzero if any readback is pending.
+int PixelReadbackPending(PixelReadback *r);
+
+// Returns nonzero if the oldest pending readback has finished, so that
+// WaitPixelReadback won't block. Returns 0 if nothing is pending.
+int PixelReadbackFinished(PixelReadback *r);
+
+// Waits for the oldest pending readback to finish and returns its pixels,
+// setting *tag to its tag. The pixels stay valid until the slot is released.
+// Returns NULL on error, or if nothing is pending.
+uint8_t* WaitPixelReadback(PixelReadback *r, int64_t *tag);
+
+// Frees the oldest ready slot, once the caller is done with its pixels.
+void ReleasePixelReadback(PixelReadback *r);
+
+#endif  // PIXEL_READBACK_H
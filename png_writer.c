@@ -0,0 +1,399 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "png_writer.h"
+
+// The maximum distance back to a repeated sequence in deflate's LZ77.
+#define WINDOW_SIZE (32768)
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+
+// The shortest and longest repeated sequences that deflate can encode.
+#define MIN_MATCH (3)
+#define MAX_MATCH (258)
+
+// The number of entries in the hash table of 3-byte sequences.
+#define HASH_BITS (15)
+#define HASH_SIZE (1 << HASH_BITS)
+
+// The number of earlier occurrences of a sequence to check for the longest
+// match. Higher values compress slightly better, but more slowly.
+#define MAX_CHAIN (16)
+
+// The first length represented by each of deflate's length codes (257 to
+// 285), and the number of extra bits following each code.
+static const uint16_t length_bases[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+  15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227,
+  258};
+static const uint8_t length_extra_bits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+  1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// The same, for deflate's distance codes.
+static const uint16_t distance_bases[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+  33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+  6145, 8193, 12289, 16385, 24577};
+static const uint8_t distance_extra_bits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
+  4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Updates a CRC-32, as used by PNG chunks, with the given bytes.
+static uint32_t UpdateCRC(uint32_t crc, const uint8_t *data, size_t size) {
+  static uint32_t table[256];
+  static int table_ready = 0;
+  uint32_t c;
+  size_t i;
+  int j;
+  if (!table_ready) {
+    for (i = 0; i < 256; i++) {
+      c = i;
+      for (j = 0; j < 8; j++) {
+        c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+      }
+      table[i] = c;
+    }
+    table_ready = 1;
+  }
+  crc = ~crc;
+  for (i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static void StoreBigEndian(uint8_t *dst, uint32_t v) {
+  dst[0] = v >> 24;
+  dst[1] = v >> 16;
+  dst[2] = v >> 8;
+  dst[3] = v;
+}
+
+// Writes a single PNG chunk. Returns 0 on error.
+static int WriteChunk(FILE *f, const char *type, const uint8_t *data,
+    uint32_t size) {
+  uint8_t header[8];
+  uint8_t crc_bytes[4];
+  uint32_t crc;
+  StoreBigEndian(header, size);
+  memcpy(header + 4, type, 4);
+  crc = UpdateCRC(0, header + 4, 4);
+  crc = UpdateCRC(crc, data, size);
+  StoreBigEndian(crc_bytes, crc);
+  if (fwrite(header, sizeof(header), 1, f) != 1) return 0;
+  if ((size != 0) && (fwrite(data, size, 1, f) != 1)) return 0;
+  if (fwrite(crc_bytes, sizeof(crc_bytes), 1, f) != 1) return 0;
+  return 1;
+}
+
+// Makes sure the output buffer can hold at least the given number of
+// additional bytes. Returns 0 on error.
+static int ReserveOutput(PNGWriter *w, size_t size) {
+  void *tmp = NULL;
+  size_t new_capacity;
+  if ((w->out_size + size) <= w->out_capacity) return 1;
+  new_capacity = w->out_size + size;
+  tmp = realloc(w->out, new_capacity);
+  if (!tmp) {
+    printf("Failed allocating %lu bytes for compressed PNG data.\n",
+      (unsigned long) new_capacity);
+    return 0;
+  }
+  w->out = (uint8_t *) tmp;
+  w->out_capacity = new_capacity;
+  return 1;
+}
+
+// Appends the lowest bit_count bits of value to the compressed data, least
+// significant bit first. The output buffer must have enough space.
+static void PutBits(PNGWriter *w, uint32_t value, int bit_count) {
+  w->bit_buffer |= ((uint64_t) value) << w->bit_count;
+  w->bit_count += bit_count;
+  while (w->bit_count >= 8) {
+    w->out[w->out_size] = w->bit_buffer & 0xff;
+    w->out_size++;
+    w->bit_buffer >>= 8;
+    w->bit_count -= 8;
+  }
+}
+
+// Returns the code with its lowest bit_count bits in reverse order. Deflate
+// stores Huffman codes most significant bit first.
+static uint32_t ReverseBits(uint32_t code, int bit_count) {
+  uint32_t reversed = 0;
+  int i;
+  for (i = 0; i < bit_count; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  return reversed;
+}
+
+// Appends a literal byte or length symbol using deflate's fixed codes.
+static void PutSymbol(PNGWriter *w, uint32_t symbol) {
+  static uint16_t codes[288];
+  static uint8_t code_lengths[288];
+  static int codes_ready = 0;
+  uint32_t i;
+  if (!codes_ready) {
+    for (i = 0; i < 288; i++) {
+      if (i < 144) {
+        code_lengths[i] = 8;
+        codes[i] = ReverseBits(0x30 + i, 8);
+      } else if (i < 256) {
+        code_lengths[i] = 9;
+        codes[i] = ReverseBits(0x190 + i - 144, 9);
+      } else if (i < 280) {
+        code_lengths[i] = 7;
+        codes[i] = ReverseBits(i - 256, 7);
+      } else {
+        code_lengths[i] = 8;
+        codes[i] = ReverseBits(0xc0 + i - 280, 8);
+      }
+    }
+    codes_ready = 1;
+  }
+  PutBits(w, codes[symbol], code_lengths[symbol]);
+}
+
+// Appends a reference to an earlier sequence of the given length, starting
+// the given distance back.
+static void PutMatch(PNGWriter *w, uint32_t length, uint32_t distance) {
+  int code = 28;
+  while (length_bases[code] > length) code--;
+  PutSymbol(w, 257 + code);
+  PutBits(w, length - length_bases[code], length_extra_bits[code]);
+  code = 29;
+  while (distance_bases[code] > distance) code--;
+  PutBits(w, ReverseBits(code, 5), 5);
+  PutBits(w, distance - distance_bases[code], distance_extra_bits[code]);
+}
+
+// Updates the adler-32 checksum of the uncompressed data.
+static void UpdateAdler(PNGWriter *w, const uint8_t *data, size_t size) {
+  size_t i, block;
+  while (size > 0) {
+    // This is the most bytes that can be added before the sums may overflow.
+    block = (size < 5552) ? size : 5552;
+    for (i = 0; i < block; i++) {
+      w->adler_a += data[i];
+      w->adler_b += w->adler_a;
+    }
+    w->adler_a %= 65521;
+    w->adler_b %= 65521;
+    data += block;
+    size -= block;
+  }
+}
+
+static uint32_t HashBytes(const uint8_t *data) {
+  uint32_t v = data[0] | (data[1] << 8) | (data[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Compresses the data as a single deflate block, using fixed Huffman codes.
+// Returns 0 on error.
+static int CompressBlock(PNGWriter *w, const uint8_t *data, size_t size,
+    int final) {
+  int64_t i, candidate, previous, best_distance, limit;
+  uint32_t length, best_length, hash;
+  int chain, j;
+  // Every symbol takes at most 9 bits, plus up to 31 bits of length and
+  // distance information per match of 3 or more bytes.
+  if (!ReserveOutput(w, (size * 9) / 8 + 64)) return 0;
+  for (j = 0; j < HASH_SIZE; j++) {
+    w->hash_heads[j] = -1;
+  }
+  PutBits(w, final ? 1 : 0, 1);
+  PutBits(w, 1, 2);
+  i = 0;
+  while (i < (int64_t) size) {
+    best_length = 0;
+    best_distance = 0;
+    limit = size - i;
+    if (limit > MAX_MATCH) limit = MAX_MATCH;
+    if (limit >= MIN_MATCH) {
+      hash = HashBytes(data + i);
+      candidate = w->hash_heads[hash];
+      chain = MAX_CHAIN;
+      while ((candidate >= 0) && ((i - candidate) <= WINDOW_SIZE) &&
+        (chain > 0)) {
+        length = 0;
+        while ((length < limit) && (data[candidate + length] ==
+          data[i + length])) {
+          length++;
+        }
+        if (length > best_length) {
+          best_length = length;
+          best_distance = i - candidate;
+          if (length == limit) break;
+        }
+        previous = candidate;
+        candidate = w->hash_prev[candidate & WINDOW_MASK];
+        if (candidate >= previous) break;
+        chain--;
+      }
+      w->hash_prev[i & WINDOW_MASK] = w->hash_heads[hash];
+      w->hash_heads[hash] = i;
+    }
+    if (best_length < MIN_MATCH) {
+      PutSymbol(w, data[i]);
+      i++;
+      continue;
+    }
+    PutMatch(w, best_length, best_distance);
+    // Add the rest of the matched positions to the hash chains.
+    for (j = 1; j < (int) best_length; j++) {
+      if ((i + j + MIN_MATCH) > (int64_t) size) break;
+      hash = HashBytes(data + i + j);
+      w->hash_prev[(i + j) & WINDOW_MASK] = w->hash_heads[hash];
+      w->hash_heads[hash] = i + j;
+    }
+    i += best_length;
+  }
+  PutSymbol(w, 256);
+  return 1;
+}
+
+PNGWriter* OpenPNGWriter(const char *path, uint32_t width, uint32_t height,
+    uint32_t channels) {
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+    '\n'};
+  PNGWriter *w = NULL;
+  uint8_t header[13];
+  if ((width == 0) || (height == 0) || ((channels != 3) && (channels != 4))) {
+    printf("Invalid PNG format: %ux%u, %u channels.\n", (unsigned) width,
+      (unsigned) height, (unsigned) channels);
+    return NULL;
+  }
+  w = (PNGWriter *) calloc(1, sizeof(*w));
+  if (!w) {
+    printf("Failed allocating PNG writer.\n");
+    return NULL;
+  }
+  w->width = width;
+  w->height = height;
+  w->channels = channels;
+  w->adler_a = 1;
+  w->hash_heads = (int64_t *) malloc(HASH_SIZE * sizeof(int64_t));
+  w->hash_prev = (int64_t *) malloc(WINDOW_SIZE * sizeof(int64_t));
+  if (!w->hash_heads || !w->hash_prev) {
+    printf("Failed allocating PNG compression tables.\n");
+    ClosePNGWriter(w);
+    return NULL;
+  }
+  w->f = fopen(path, "wb");
+  if (!w->f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    ClosePNGWriter(w);
+    return NULL;
+  }
+  StoreBigEndian(header, width);
+  StoreBigEndian(header + 4, height);
+  // 8 bits per channel, RGB or RGBA, the default compression and filtering
+  // methods, and no interlacing.
+  header[8] = 8;
+  header[9] = (channels == 4) ? 6 : 2;
+  header[10] = 0;
+  header[11] = 0;
+  header[12] = 0;
+  if ((fwrite(signature, sizeof(signature), 1, w->f) != 1) ||
+    !WriteChunk(w->f, "IHDR", header, sizeof(header))) {
+    printf("Failed writing PNG header to %s.\n", path);
+    ClosePNGWriter(w);
+    return NULL;
+  }
+  return w;
+}
+
+int WritePNGRows(PNGWriter *w, const uint8_t *pixels, int64_t row_stride,
+    uint32_t row_count) {
+  size_t row_bytes = ((size_t) w->width) * w->channels;
+  size_t size = (row_bytes + 1) * row_count;
+  uint8_t *dst = NULL;
+  void *tmp = NULL;
+  uint32_t i;
+  int final;
+  if (row_count == 0) return 1;
+  if ((w->rows_written + row_count) > w->height) {
+    printf("Too many rows written to a %u-row PNG image.\n",
+      (unsigned) w->height);
+    return 0;
+  }
+  if (size > w->filtered_capacity) {
+    tmp = realloc(w->filtered, size);
+    if (!tmp) {
+      printf("Failed allocating buffer for %u PNG rows.\n",
+        (unsigned) row_count);
+      return 0;
+    }
+    w->filtered = (uint8_t *) tmp;
+    w->filtered_capacity = size;
+  }
+  dst = w->filtered;
+  for (i = 0; i < row_count; i++) {
+    // Filter type 0 leaves the row unchanged.
+    *dst = 0;
+    memcpy(dst + 1, pixels + i * row_stride, row_bytes);
+    dst += row_bytes + 1;
+  }
+
+  // The zlib stream spans every IDAT chunk, so the header is only written
+  // before the first batch, and the checksum after the last one.
+  w->out_size = 0;
+  if (!ReserveOutput(w, 2)) return 0;
+  if (w->rows_written == 0) {
+    w->out[0] = 0x78;
+    w->out[1] = 0x01;
+    w->out_size = 2;
+  }
+  UpdateAdler(w, w->filtered, size);
+  w->rows_written += row_count;
+  final = w->rows_written == w->height;
+  if (!CompressBlock(w, w->filtered, size, final)) return 0;
+  if (final) {
+    if (w->bit_count > 0) PutBits(w, 0, 8 - w->bit_count);
+    if (!ReserveOutput(w, 4)) return 0;
+    StoreBigEndian(w->out + w->out_size, (w->adler_b << 16) | w->adler_a);
+    w->out_size += 4;
+  }
+  if (!WriteChunk(w->f, "IDAT", w->out, w->out_size)) {
+    printf("Failed writing PNG image data.\n");
+    return 0;
+  }
+  return 1;
+}
+
+int ClosePNGWriter(PNGWriter *w) {
+  int to_return = 1;
+  if (!w) return 0;
+  if (w->f) {
+    if (w->rows_written != w->height) {
+      printf("Only %u of %u PNG rows were written.\n",
+        (unsigned) w->rows_written, (unsigned) w->height);
+      to_return = 0;
+    } else if (!WriteChunk(w->f, "IEND", NULL, 0)) {
+      printf("Failed writing end of PNG file.\n");
+      to_return = 0;
+    }
+    if (fclose(w->f) != 0) {
+      printf("Failed closing PNG file: %s\n", strerror(errno));
+      to_return = 0;
+    }
+  }
+  free(w->out);
+  free(w->filtered);
+  free(w->hash_heads);
+  free(w->hash_prev);
+  memset(w, 0, sizeof(*w));
+  free(w);
+  return to_return;
+}
+
+int WritePNG(const char *path, const uint8_t *pixels, int64_t row_stride,
+    uint32_t width, uint32_t height, uint32_t channels) {
+  PNGWriter *w = OpenPNGWriter(path, width, height, channels);
+  if (!w) return 0;
+  if (!WritePNGRows(w, pixels, row_stride, height)) {
+    ClosePNGWriter(w);
+    return 0;
+  }
+  return ClosePNGWriter(w);
+}
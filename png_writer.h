@@ -0,0 +1,60 @@
+// A small PNG encoder, so that images can be saved without depending on any
+// image libraries. Images are written a batch of rows at a time, so images
+// far larger than the available memory can be streamed to disk. The pixel
+// data is compressed with a simple LZ77 pass using deflate's fixed Huffman
+// codes, which works well for the mostly-black images rendered here.
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+  FILE *f;
+  uint32_t width;
+  uint32_t height;
+  // 3 for RGB, or 4 for RGBA.
+  uint32_t channels;
+  uint32_t rows_written;
+  // The running adler-32 checksum of the uncompressed data.
+  uint32_t adler_a;
+  uint32_t adler_b;
+  // Bits that have been compressed but not yet written to out.
+  uint64_t bit_buffer;
+  int bit_count;
+  // The compressed data for the current IDAT chunk.
+  uint8_t *out;
+  size_t out_size;
+  size_t out_capacity;
+  // The current batch of rows, each preceded by its PNG filter type.
+  uint8_t *filtered;
+  size_t filtered_capacity;
+  // Hash chains used to find repeated byte sequences in the current batch.
+  int64_t *hash_heads;
+  int64_t *hash_prev;
+} PNGWriter;
+
+// Creates the file at the given path, and writes the PNG header for an image
+// with the given size. channels must be 3 (RGB) or 4 (RGBA), with 8 bits per
+// channel. Returns NULL on error.
+PNGWriter* OpenPNGWriter(const char *path, uint32_t width, uint32_t height,
+    uint32_t channels);
+
+// Compresses and writes the given number of rows, continuing from the last
+// row that was written. Rows are written from the top of the image down.
+// row_stride is the distance, in bytes, from the start of one row in pixels
+// to the next; it may be negative, for example to flip images read using
+// glReadPixels. Returns 0 on error.
+int WritePNGRows(PNGWriter *w, const uint8_t *pixels, int64_t row_stride,
+    uint32_t row_count);
+
+// Finishes writing the file and closes it, freeing the writer. Returns 0 on
+// error, including if fewer rows than the image's height were written. The
+// writer is freed even if an error occurs.
+int ClosePNGWriter(PNGWriter *w);
+
+// Writes an entire image to a PNG file in one call. Takes the same arguments
+// as OpenPNGWriter and WritePNGRows. Returns 0 on error.
+int WritePNG(const char *path, const uint8_t *pixels, int64_t row_stride,
+    uint32_t width, uint32_t height, uint32_t channels);
+
+#endif  // PNG_WRITER_H
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory_budget.h"
+#include "segment_writer.h"
+
+// The number of digits reserved for each count in the PLY header.
+#define PLY_COUNT_DIGITS (20)
+
+SegmentFormat SegmentFormatFromPath(const char *path) {
+  size_t length = strlen(path);
+  if ((length >= 4) && (strcmp(path + length - 4, ".obj") == 0)) {
+    return SEGMENT_FORMAT_OBJ;
+  }
+  return SEGMENT_FORMAT_PLY;
+}
+
+// Writes everything in the buffer to the file. Returns 0 on error.
+static int FlushBuffer(SegmentWriter *w) {
+  if (w->buffer_size == 0) return 1;
+  if (fwrite(w->buffer, w->buffer_size, 1, w->f) != 1) {
+    printf("Failed writing segments: %s\n", strerror(errno));
+    return 0;
+  }
+  w->buffer_size = 0;
+  return 1;
+}
+
+// Makes sure at least size bytes are free in the buffer. Returns 0 on error.
+static int ReserveBuffer(SegmentWriter *w, size_t size) {
+  if ((w->buffer_size + size) <= SEGMENT_WRITER_BUFFER_SIZE) return 1;
+  return FlushBuffer(w);
+}
+
+// Writes the PLY header, with placeholders for the counts. Returns 0 on
+// error.
+static int WritePLYHeader(SegmentWriter *w) {
+  uint16_t endian_test = 1;
+  const char *format = "binary_little_endian";
+  if (*((uint8_t *) &endian_test) == 0) format = "binary_big_endian";
+  if (fprintf(w->f, "ply\nformat %s 1.0\ncomment Written by l_system_3d\n"
+    "element vertex ", format) < 0) {
+    return 0;
+  }
+  w->vertex_count_offset = ftell(w->f);
+  if (fprintf(w->f, "%0*d\nproperty float x\nproperty float y\n"
+    "property float z\nproperty uchar red\nproperty uchar green\n"
+    "property uchar blue\nproperty uchar alpha\nelement edge ",
+    PLY_COUNT_DIGITS, 0) < 0) {
+    return 0;
+  }
+  w->edge_count_offset = ftell(w->f);
+  if (fprintf(w->f, "%0*d\nproperty uint vertex1\nproperty uint vertex2\n"
+    "end_header\n", PLY_COUNT_DIGITS, 0) < 0) {
+    return 0;
+  }
+  return (w->vertex_count_offset >= 0) && (w->edge_count_offset >= 0);
+}
+
+SegmentWriter* OpenSegmentWriter(const char *path, SegmentFormat format) {
+  SegmentWriter *w = NULL;
+  int result;
+  w = (SegmentWriter *) TrackedCalloc(MEMORY_TURTLE, 1, sizeof(*w));
+  if (!w) {
+    printf("Failed allocating segment writer.\n");
+    return NULL;
+  }
+  w->format = format;
+  w->buffer = (uint8_t *) TrackedCalloc(MEMORY_TURTLE, 1,
+    SEGMENT_WRITER_BUFFER_SIZE);
+  if (!w->buffer) {
+    printf("Failed allocating segment writer buffer.\n");
+    TrackedFree(w);
+    return NULL;
+  }
+  w->f = fopen(path, "wb");
+  if (!w->f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    TrackedFree(w->buffer);
+    TrackedFree(w);
+    return NULL;
+  }
+  if (format == SEGMENT_FORMAT_PLY) {
+    result = WritePLYHeader(w);
+  } else {
+    result = fprintf(w->f, "# Written by l_system_3d\n") >= 0;
+  }
+  if (!result) {
+    printf("Failed writing header to %s: %s\n", path, strerror(errno));
+    fclose(w->f);
+    w->f = NULL;
+    CloseSegmentWriter(w);
+    return NULL;
+  }
+  return w;
+}
+
+static uint8_t ColorByte(float v) {
+  if (v < 0) v = 0;
+  if (v > 1) v = 1;
+  return (uint8_t) (v * 255.0 + 0.5);
+}
+
+// Appends a single PLY vertex to the buffer, which must have space for it.
+static void AppendPLYVertex(SegmentWriter *w, MeshVertex *v) {
+  uint8_t *dst = w->buffer + w->buffer_size;
+  int i;
+  memcpy(dst, v->location, 3 * sizeof(float));
+  for (i = 0; i < 4; i++) {
+    dst[3 * sizeof(float) + i] = ColorByte(v->color[i]);
+  }
+  w->buffer_size += 3 * sizeof(float) + 4;
+}
+
+// Appends a single OBJ vertex to the buffer, which must have space for it.
+static void AppendOBJVertex(SegmentWriter *w, MeshVertex *v) {
+  w->buffer_size += sprintf((char *) w->buffer + w->buffer_size,
+    "v %.9g %.9g %.9g %.4g %.4g %.4g\n", v->location[0], v->location[1],
+    v->location[2], v->color[0], v->color[1], v->color[2]);
+}
+
+int WriteSegments(void *writer, MeshVertex *vertices, uint32_t count) {
+  SegmentWriter *w = (SegmentWriter *) writer;
+  uint32_t i;
+  for (i = 0; (i + 1) < count; i += 2) {
+    if (w->format == SEGMENT_FORMAT_PLY) {
+      if ((w->vertex_count + 1) > UINT32_MAX) {
+        printf("Too many vertices for a PLY file.\n");
+        return 0;
+      }
+      if (!ReserveBuffer(w, 2 * (3 * sizeof(float) + 4))) return 0;
+      AppendPLYVertex(w, vertices + i);
+      AppendPLYVertex(w, vertices + i + 1);
+    } else {
+      // Each vertex line takes at most about 100 characters.
+      if (!ReserveBuffer(w, 512)) return 0;
+      AppendOBJVertex(w, vertices + i);
+      AppendOBJVertex(w, vertices + i + 1);
+      // OBJ indices start at 1.
+      w->buffer_size += sprintf((char *) w->buffer + w->buffer_size,
+        "l %llu %llu\n", (unsigned long long) (w->vertex_count + 1),
+        (unsigned long long) (w->vertex_count + 2));
+    }
+    w->vertex_count += 2;
+  }
+  return 1;
+}
+
+// Writes a count at the given offset in the file, over one of the PLY
+// header's placeholders. Returns 0 on error.
+static int WritePLYCount(SegmentWriter *w, long offset, uint64_t count) {
+  if (fseek(w->f, offset, SEEK_SET) != 0) return 0;
+  return fprintf(w->f, "%0*llu", PLY_COUNT_DIGITS,
+    (unsigned long long) count) == PLY_COUNT_DIGITS;
+}
+
+// Writes the PLY file's edges, which just connect each pair of vertices, and
+// fills in the counts in the header. Returns 0 on error.
+static int FinishPLY(SegmentWriter *w) {
+  uint64_t edge_count = w->vertex_count / 2;
+  uint64_t i;
+  uint32_t edge[2];
+  for (i = 0; i < edge_count; i++) {
+    if (!ReserveBuffer(w, sizeof(edge))) return 0;
+    edge[0] = i * 2;
+    edge[1] = i * 2 + 1;
+    memcpy(w->buffer + w->buffer_size, edge, sizeof(edge));
+    w->buffer_size += sizeof(edge);
+  }
+  if (!FlushBuffer(w)) return 0;
+  if (!WritePLYCount(w, w->vertex_count_offset, w->vertex_count) ||
+    !WritePLYCount(w, w->edge_count_offset, edge_count)) {
+    printf("Failed updating PLY header: %s\n", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+int CloseSegmentWriter(SegmentWriter *w) {
+  int to_return = 1;
+  if (!w) return 1;
+  if (w->f) {
+    if (w->format == SEGMENT_FORMAT_PLY) {
+      to_return = FinishPLY(w);
+    } else {
+      to_return = FlushBuffer(w);
+    }
+    if (fclose(w->f) != 0) {
+      printf("Failed closing segment file: %s\n", strerror(errno));
+      to_return = 0;
+    }
+  }
+  TrackedFree(w->buffer);
+  memset(w, 0, sizeof(*w));
+  TrackedFree(w);
+  return to_return;
+}
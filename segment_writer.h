@@ -0,0 +1,55 @@
+// Writes the turtle's segments, with their colors, to a PLY or OBJ file as
+// they're generated, so the geometry can be used in other programs. Output is
+// collected in a large buffer and written in big chunks, and nothing else is
+// kept in memory, so the memory used doesn't depend on the number of
+// segments. It doesn't use OpenGL.
+//
+// PLY files are binary, with one vertex element per segment endpoint followed
+// by one edge element per segment. OBJ files are text, with "v x y z r g b"
+// vertices and "l" elements. Either way, every segment gets its own two
+// vertices, in the same order as the turtle's vertex array.
+#ifndef SEGMENT_WRITER_H
+#define SEGMENT_WRITER_H
+#include <stdint.h>
+#include <stdio.h>
+#include "mesh_vertex.h"
+
+// The size of the output buffer, in bytes.
+#define SEGMENT_WRITER_BUFFER_SIZE (4 * 1024 * 1024)
+
+typedef enum {
+  SEGMENT_FORMAT_PLY = 0,
+  SEGMENT_FORMAT_OBJ,
+} SegmentFormat;
+
+typedef struct {
+  FILE *f;
+  SegmentFormat format;
+  uint8_t *buffer;
+  size_t buffer_size;
+  // The number of vertices written so far.
+  uint64_t vertex_count;
+  // Where the PLY header's vertex and edge counts start in the file. They're
+  // written as placeholders, and filled in once the file is closed.
+  long vertex_count_offset;
+  long edge_count_offset;
+} SegmentWriter;
+
+// Picks the format from the path's extension: OBJ for paths ending in ".obj",
+// or PLY otherwise.
+SegmentFormat SegmentFormatFromPath(const char *path);
+
+// Creates the file at the given path, and writes its header. Returns NULL on
+// error.
+SegmentWriter* OpenSegmentWriter(const char *path, SegmentFormat format);
+
+// Writes the given segments. The vertices are a list of pairs, like in a
+// mesh. The arguments match a TurtleVertexSink, so this can receive vertices
+// straight from the turtle. Returns 0 on error.
+int WriteSegments(void *writer, MeshVertex *vertices, uint32_t count);
+
+// Finishes writing the file and closes it, freeing the writer. Returns 0 on
+// error. The writer is freed even if an error occurs.
+int CloseSegmentWriter(SegmentWriter *w);
+
+#endif  // SEGMENT_WRITER_H
@@ -0,0 +1,353 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+#include <glad/glad.h>
+#include "gl_utilities.h"
+#include "shader_cache.h"
+#include "trace.h"
+#include "utilities.h"
+
+// Identifies a saved program binary file.
+#define PROGRAM_BINARY_MAGIC (0x42505351)
+
+// The start of a saved program binary file. It's followed by the driver
+// string, without a NULL terminator, and then by the binary itself.
+typedef struct {
+  uint32_t magic;
+  uint32_t format;
+  uint32_t driver_length;
+  uint32_t binary_length;
+} ProgramBinaryHeader;
+
+// Used to hash the shader sources and driver string.
+#define FNV_OFFSET_BASIS (0xcbf29ce484222325ull)
+#define FNV_PRIME (0x100000001b3ull)
+
+ShaderCache* CreateShaderCache(void) {
+  ShaderCache *c = NULL;
+  const char *vendor, *renderer, *version;
+  GLint format_count = 0;
+  size_t length;
+  c = (ShaderCache *) calloc(1, sizeof(*c));
+  if (!c) {
+    printf("Failed allocating shader cache.\n");
+    return NULL;
+  }
+  vendor = (const char *) glGetString(GL_VENDOR);
+  renderer = (const char *) glGetString(GL_RENDERER);
+  version = (const char *) glGetString(GL_VERSION);
+  if (!vendor || !renderer || !version) {
+    printf("Failed getting the OpenGL driver's name.\n");
+    CheckGLErrors();
+    DestroyShaderCache(c);
+    return NULL;
+  }
+  length = strlen(vendor) + strlen(renderer) + strlen(version) + 3;
+  c->driver = (char *) calloc(length, 1);
+  if (!c->driver) {
+    printf("Failed allocating driver name.\n");
+    DestroyShaderCache(c);
+    return NULL;
+  }
+  snprintf(c->driver, length, "%s|%s|%s", vendor, renderer, version);
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  c->binaries_supported = format_count > 0;
+  if (!CheckGLErrors()) {
+    DestroyShaderCache(c);
+    return NULL;
+  }
+  return c;
+}
+
+void DestroyShaderCache(ShaderCache *c) {
+  uint32_t i;
+  if (!c) return;
+  for (i = 0; i < c->source_count; i++) {
+    free(c->sources[i].path);
+    free(c->sources[i].source);
+  }
+  free(c->sources);
+  free(c->shared_uniforms);
+  free(c->driver);
+  memset(c, 0, sizeof(*c));
+  free(c);
+}
+
+// Returns the preprocessed source code for the shader at the given path,
+// reading and preprocessing it if it isn't in the cache yet. The returned
+// string is owned by the cache. Returns NULL on error.
+static const char* GetShaderSource(ShaderCache *c, const char *path) {
+  CachedShaderSource *s = NULL;
+  char *original = NULL;
+  void *tmp = NULL;
+  uint32_t i;
+  for (i = 0; i < c->source_count; i++) {
+    if (strcmp(c->sources[i].path, path) == 0) return c->sources[i].source;
+  }
+  if (!c->shared_uniforms) {
+    c->shared_uniforms = ReadFullFile(SHARED_UNIFORMS_PATH);
+    if (!c->shared_uniforms) return NULL;
+  }
+  if (c->source_count >= c->source_capacity) {
+    tmp = realloc(c->sources, (c->source_capacity + 4) *
+      sizeof(CachedShaderSource));
+    if (!tmp) {
+      printf("Failed allocating list of shader sources.\n");
+      return NULL;
+    }
+    c->sources = (CachedShaderSource *) tmp;
+    c->source_capacity += 4;
+  }
+
+  // Insert the common uniform definitions in place of the special comment in
+  // the main shader source.
+  original = ReadFullFile(path);
+  if (!original) return NULL;
+  s = c->sources + c->source_count;
+  s->source = StringReplace(original, "//INCLUDE_SHARED_UNIFORMS\n",
+    c->shared_uniforms);
+  free(original);
+  if (!s->source) {
+    printf("Failed preprocessing shader source code.\n");
+    return NULL;
+  }
+  s->path = strdup(path);
+  if (!s->path) {
+    printf("Failed copying shader path.\n");
+    free(s->source);
+    s->source = NULL;
+    return NULL;
+  }
+  c->source_count++;
+  return s->source;
+}
+
+// Returns the FNV-1a hash of the string, including its NULL terminator,
+// continuing from the given hash.
+static uint64_t HashString(uint64_t hash, const char *s) {
+  do {
+    hash ^= (uint8_t) *s;
+    hash *= FNV_PRIME;
+  } while (*(s++));
+  return hash;
+}
+
+// Compiles a shader from the given preprocessed source. The path is only
+// used in error messages. Returns 0 on error.
+static GLuint CompileShader(const char *path, const char *source,
+    GLenum shader_type) {
+  GLuint to_return = 0;
+  GLint compile_result = 0;
+  GLchar shader_log[512];
+  to_return = glCreateShader(shader_type);
+  glShaderSource(to_return, 1, &source, NULL);
+  glCompileShader(to_return);
+
+  // Check compilation success.
+  memset(shader_log, 0, sizeof(shader_log));
+  glGetShaderiv(to_return, GL_COMPILE_STATUS, &compile_result);
+  if (compile_result != GL_TRUE) {
+    glGetShaderInfoLog(to_return, sizeof(shader_log) - 1, NULL,
+      shader_log);
+    printf("Shader %s compile error:\n%s\n", path, shader_log);
+    glDeleteShader(to_return);
+    return 0;
+  }
+  if (!CheckGLErrors()) {
+    glDeleteShader(to_return);
+    return 0;
+  }
+  return to_return;
+}
+
+// Compiles and links a program from the given preprocessed sources. The
+// geometry source may be NULL. Returns 0 on error.
+static GLuint BuildProgram(ShaderCache *c, const char *paths[3],
+    const char *sources[3]) {
+  static const GLenum types[3] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER,
+    GL_FRAGMENT_SHADER};
+  GLchar link_log[512];
+  GLint link_result = 0;
+  GLuint shaders[3] = {0, 0, 0};
+  GLuint to_return = 0;
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (!sources[i]) continue;
+    shaders[i] = CompileShader(paths[i], sources[i], types[i]);
+    if (!shaders[i]) {
+      glDeleteShader(shaders[0]);
+      glDeleteShader(shaders[1]);
+      return 0;
+    }
+  }
+
+  to_return = glCreateProgram();
+  for (i = 0; i < 3; i++) {
+    if (shaders[i]) glAttachShader(to_return, shaders[i]);
+  }
+  if (c->binaries_supported) {
+    glProgramParameteri(to_return, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+      GL_TRUE);
+  }
+  glLinkProgram(to_return);
+  for (i = 0; i < 3; i++) {
+    glDeleteShader(shaders[i]);
+  }
+  glGetProgramiv(to_return, GL_LINK_STATUS, &link_result);
+  memset(link_log, 0, sizeof(link_log));
+  if (link_result != GL_TRUE) {
+    glGetProgramInfoLog(to_return, sizeof(link_log) - 1, NULL, link_log);
+    printf("GL program link error:\n%s\n", link_log);
+    glDeleteProgram(to_return);
+    return 0;
+  }
+  if (!CheckGLErrors()) {
+    glDeleteProgram(to_return);
+    return 0;
+  }
+  return to_return;
+}
+
+// Tries loading a saved program binary from the given path. Returns 0 if the
+// file doesn't exist, was saved by a different driver, or is rejected by the
+// driver; none of these are errors.
+static GLuint LoadProgramBinary(ShaderCache *c, const char *path) {
+  ProgramBinaryHeader header;
+  GLint link_result = 0;
+  GLuint to_return = 0;
+  char *data = NULL;
+  size_t driver_length = strlen(c->driver);
+  FILE *f = fopen(path, "rb");
+  if (!f) return 0;
+  if ((fread(&header, sizeof(header), 1, f) != 1) ||
+    (header.magic != PROGRAM_BINARY_MAGIC) ||
+    (header.driver_length != driver_length)) {
+    fclose(f);
+    return 0;
+  }
+  data = (char *) malloc(header.driver_length + header.binary_length);
+  if (!data) {
+    fclose(f);
+    return 0;
+  }
+  if ((fread(data, header.driver_length + header.binary_length, 1, f) != 1) ||
+    (memcmp(data, c->driver, driver_length) != 0)) {
+    free(data);
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+  to_return = glCreateProgram();
+  glProgramBinary(to_return, header.format, data + header.driver_length,
+    header.binary_length);
+  free(data);
+  glGetProgramiv(to_return, GL_LINK_STATUS, &link_result);
+  // Errors here just mean the driver won't accept the binary.
+  while (glGetError() != GL_NO_ERROR) {
+    link_result = GL_FALSE;
+  }
+  if (link_result != GL_TRUE) {
+    glDeleteProgram(to_return);
+    return 0;
+  }
+  return to_return;
+}
+
+// Saves the linked program's binary to the given path. Failing to save the
+// binary isn't an error, since the program will simply be compiled again
+// next time, so this only prints a warning.
+static void SaveProgramBinary(ShaderCache *c, const char *path,
+    GLuint program) {
+  ProgramBinaryHeader header;
+  GLint length = 0;
+  GLenum format = 0;
+  char *binary = NULL;
+  FILE *f = NULL;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    CheckGLErrors();
+    return;
+  }
+  binary = (char *) malloc(length);
+  if (!binary) {
+    printf("Failed allocating %d bytes for a program binary.\n", (int) length);
+    return;
+  }
+  glGetProgramBinary(program, length, &length, &format, binary);
+  if (!CheckGLErrors()) {
+    free(binary);
+    return;
+  }
+#ifdef _WIN32
+  _mkdir(SHADER_CACHE_DIRECTORY);
+#else
+  mkdir(SHADER_CACHE_DIRECTORY, 0755);
+#endif
+  f = fopen(path, "wb");
+  if (!f) {
+    printf("Warning: failed opening %s: %s\n", path, strerror(errno));
+    free(binary);
+    return;
+  }
+  header.magic = PROGRAM_BINARY_MAGIC;
+  header.format = format;
+  header.driver_length = strlen(c->driver);
+  header.binary_length = length;
+  if ((fwrite(&header, sizeof(header), 1, f) != 1) ||
+    (fwrite(c->driver, header.driver_length, 1, f) != 1) ||
+    (fwrite(binary, length, 1, f) != 1)) {
+    printf("Warning: failed writing %s.\n", path);
+  }
+  fclose(f);
+  free(binary);
+}
+
+GLuint LoadCachedProgram(ShaderCache *c, const char *vertex_path,
+    const char *geometry_path, const char *fragment_path) {
+  const char *paths[3] = {vertex_path, geometry_path, fragment_path};
+  const char *sources[3] = {NULL, NULL, NULL};
+  char binary_path[128];
+  uint64_t hash = FNV_OFFSET_BASIS;
+  GLuint to_return = 0;
+  double start_time;
+  int i;
+  for (i = 0; i < 3; i++) {
+    if (!paths[i]) continue;
+    sources[i] = GetShaderSource(c, paths[i]);
+    if (!sources[i]) {
+      printf("Couldn't load shader %s.\n", paths[i]);
+      return 0;
+    }
+  }
+
+  hash = HashString(hash, c->driver);
+  for (i = 0; i < 3; i++) {
+    hash = HashString(hash, sources[i] ? sources[i] : "");
+  }
+  snprintf(binary_path, sizeof(binary_path), "%s/%016llx.bin",
+    SHADER_CACHE_DIRECTORY, (unsigned long long) hash);
+  if (c->binaries_supported) {
+    start_time = BeginTraceEvent();
+    to_return = LoadProgramBinary(c, binary_path);
+    EndTraceEvent("Load program binary", start_time);
+    if (to_return) {
+      c->binary_hits++;
+      return to_return;
+    }
+  }
+
+  start_time = BeginTraceEvent();
+  to_return = BuildProgram(c, paths, sources);
+  EndTraceEvent("Compile shader program", start_time);
+  if (!to_return) return 0;
+  c->binary_misses++;
+  if (c->binaries_supported) SaveProgramBinary(c, binary_path, to_return);
+  return to_return;
+}
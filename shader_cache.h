@@ -0,0 +1,59 @@
+// Builds shader programs, avoiding as much work as possible when the same
+// program is needed again. Preprocessed shader sources are kept in memory, so
+// each file (including shared_uniforms.glsl) is only read from disk once.
+// Linked programs are also saved to SHADER_CACHE_DIRECTORY using
+// glGetProgramBinary, and later loaded from there instead of compiling the
+// sources again. Saved programs are keyed by a hash of the sources and of the
+// driver's vendor, renderer, and version strings, so a changed shader or an
+// updated driver simply causes a new program to be compiled.
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+#include <stdint.h>
+#include <glad/glad.h>
+
+// The directory, relative to the working directory, containing the saved
+// program binaries. It's created if it doesn't exist.
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+
+// The file containing the shared uniform block, inserted into shaders in
+// place of the "//INCLUDE_SHARED_UNIFORMS" comment.
+#define SHARED_UNIFORMS_PATH "./shared_uniforms.glsl"
+
+typedef struct {
+  char *path;
+  // The source code, with the shared uniform block already inserted.
+  char *source;
+} CachedShaderSource;
+
+typedef struct {
+  CachedShaderSource *sources;
+  uint32_t source_count;
+  uint32_t source_capacity;
+  // The contents of SHARED_UNIFORMS_PATH. NULL until the first shader is
+  // loaded.
+  char *shared_uniforms;
+  // Identifies the driver that the saved program binaries were built by.
+  char *driver;
+  // Nonzero if the driver supports at least one program binary format.
+  int binaries_supported;
+  // The number of programs loaded from saved binaries, and the number that
+  // had to be compiled from source.
+  uint32_t binary_hits;
+  uint32_t binary_misses;
+} ShaderCache;
+
+// Allocates a new, empty, cache. Requires a current OpenGL context. Returns
+// NULL on error.
+ShaderCache* CreateShaderCache(void);
+
+// Frees the cache. This doesn't delete any of the programs it returned. The
+// pointer is no longer valid after this returns.
+void DestroyShaderCache(ShaderCache *c);
+
+// Returns a linked program using the given shader files. geometry_path may be
+// NULL if no geometry shader is needed. The caller owns the returned program.
+// Returns 0 on error.
+GLuint LoadCachedProgram(ShaderCache *c, const char *vertex_path,
+    const char *geometry_path, const char *fragment_path);
+
+#endif  // SHADER_CACHE_H
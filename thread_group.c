@@ -0,0 +1,71 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "thread_group.h"
+#include "trace.h"
+
+// What each thread runs, passed to RunTracedThread.
+typedef struct {
+  const char *name;
+  int index;
+  ThreadGroupFunction f;
+  void *arg;
+} ThreadStart;
+
+// Runs a thread's function, recording it as a trace event. Threads other
+// than the calling one are also named.
+static void* RunTracedThread(void *arg) {
+  ThreadStart *t = (ThreadStart *) arg;
+  double start_time;
+  if (t->index != 0) SetTraceThreadName(t->name);
+  start_time = BeginTraceEvent();
+  t->f(t->arg);
+  EndTraceEventArg(t->name, start_time, "thread", t->index);
+  return NULL;
+}
+
+int RunThreadGroup(const char *name, int thread_count, ThreadGroupFunction f,
+    void *args, size_t arg_size) {
+  pthread_t *threads = NULL;
+  ThreadStart *starts = NULL;
+  uint8_t *arg = (uint8_t *) args;
+  int i, started = 0;
+  int result = 1;
+  starts = (ThreadStart *) calloc(thread_count, sizeof(ThreadStart));
+  if (!starts) {
+    printf("Failed allocating list of thread arguments.\n");
+    return 0;
+  }
+  for (i = 0; i < thread_count; i++) {
+    starts[i].name = name;
+    starts[i].index = i;
+    starts[i].f = f;
+    starts[i].arg = arg + i * arg_size;
+  }
+  if (thread_count > 1) {
+    threads = (pthread_t *) calloc(thread_count, sizeof(pthread_t));
+    if (!threads) {
+      printf("Failed allocating list of threads.\n");
+      free(starts);
+      return 0;
+    }
+  }
+  for (i = 1; i < thread_count; i++) {
+    if (pthread_create(threads + i, NULL, RunTracedThread, starts + i) != 0) {
+      printf("Failed starting thread %d of %d.\n", i + 1, thread_count);
+      result = 0;
+      break;
+    }
+    started++;
+  }
+  // If some threads failed to start, the caller gives up anyway, so don't
+  // bother doing the first thread's work.
+  if (result) RunTracedThread(starts);
+  for (i = 1; i <= started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  free(starts);
+  return result;
+}
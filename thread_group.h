@@ -0,0 +1,20 @@
+// Runs the same function on several threads at once, and waits for them all
+// to finish. Used by the CPU renderers. Each thread's work is recorded as a
+// trace event, and the threads started for it are named in the trace.
+#ifndef THREAD_GROUP_H
+#define THREAD_GROUP_H
+#include <stddef.h>
+
+// The function run by each thread. The argument is the thread's own element
+// of the array passed to RunThreadGroup.
+typedef void* (*ThreadGroupFunction)(void *arg);
+
+// Runs f on thread_count threads, passing each one a pointer to its element
+// of args, which is an array of thread_count elements of arg_size bytes. The
+// calling thread runs the first element. The name is used for the trace
+// events and the threads, so it must be a string literal. Returns 0 on error,
+// in which case f may have only run for some of the elements.
+int RunThreadGroup(const char *name, int thread_count, ThreadGroupFunction f,
+    void *args, size_t arg_size);
+
+#endif  // THREAD_GROUP_H
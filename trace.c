@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "utilities.h"
+
+// Nonzero while events are being recorded.
+static int trace_enabled = 0;
+// The time StartTracing was called, in seconds.
+static double trace_start = 0;
+// Every thread that has recorded an event, most recent first.
+static TraceThread *trace_threads = NULL;
+static uint32_t next_thread_id = 1;
+// The calling thread's events, or NULL if it hasn't recorded any yet.
+static __thread TraceThread *current_thread = NULL;
+
+void StartTracing(void) {
+  trace_start = CurrentSeconds();
+  __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+int TracingEnabled(void) {
+  return __atomic_load_n(&trace_enabled, __ATOMIC_ACQUIRE);
+}
+
+// Returns the calling thread's events, adding it to the list of threads if
+// it hasn't recorded anything yet. Returns NULL on error.
+static TraceThread* GetTraceThread(void) {
+  TraceThread *t = current_thread;
+  if (t) return t;
+  t = (TraceThread *) calloc(1, sizeof(*t));
+  if (!t) return NULL;
+  t->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+  t->next = __atomic_load_n(&trace_threads, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&trace_threads, &(t->next), t, 1,
+    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    continue;
+  }
+  current_thread = t;
+  return t;
+}
+
+double BeginTraceEvent(void) {
+  if (!TracingEnabled()) return 0;
+  return CurrentSeconds();
+}
+
+// Returns the slot for the calling thread's next event, or NULL if it can't
+// record any more.
+static TraceEvent* NextTraceEvent(void) {
+  TraceThread *t = GetTraceThread();
+  TraceBuffer *b = NULL;
+  uint32_t capacity;
+  if (!t) return NULL;
+  if (t->event_count >= TRACE_MAX_THREAD_EVENTS) {
+    t->dropped_count++;
+    return NULL;
+  }
+  b = t->last;
+  if (!b || (b->count >= b->capacity)) {
+    capacity = b ? TRACE_BUFFER_EVENTS : TRACE_FIRST_BUFFER_EVENTS;
+    b = (TraceBuffer *) calloc(1, sizeof(*b) + capacity * sizeof(TraceEvent));
+    if (!b) {
+      t->dropped_count++;
+      return NULL;
+    }
+    b->capacity = capacity;
+    // Publish the buffer only after it's been zeroed.
+    if (t->last) {
+      __atomic_store_n(&(t->last->next), b, __ATOMIC_RELEASE);
+    } else {
+      __atomic_store_n(&(t->first), b, __ATOMIC_RELEASE);
+    }
+    t->last = b;
+  }
+  return b->events + b->count;
+}
+
+void EndTraceEventArg(const char *name, double start, const char *arg_name,
+    int64_t arg) {
+  TraceEvent *e = NULL;
+  double end;
+  if (!TracingEnabled()) return;
+  end = CurrentSeconds();
+  e = NextTraceEvent();
+  if (!e) return;
+  e->name = name;
+  e->arg_name = arg_name;
+  e->arg = arg;
+  e->start = (start - trace_start) * 1.0e6;
+  e->duration = (end - start) * 1.0e6;
+  current_thread->event_count++;
+  // The event must be complete before it's counted, since another thread may
+  // be writing the trace.
+  __atomic_store_n(&(current_thread->last->count),
+    current_thread->last->count + 1, __ATOMIC_RELEASE);
+}
+
+void EndTraceEvent(const char *name, double start) {
+  EndTraceEventArg(name, start, NULL, 0);
+}
+
+void SetTraceThreadName(const char *name) {
+  TraceThread *t = NULL;
+  if (!TracingEnabled()) return;
+  t = GetTraceThread();
+  if (t) __atomic_store_n(&(t->name), name, __ATOMIC_RELEASE);
+}
+
+// Writes the string as a JSON string, with quotes, escaping any quotes,
+// backslashes or control characters.
+static void WriteJSONString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if ((*s == '"') || (*s == '\\')) {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((uint8_t) *s < ' ') {
+      fprintf(f, "\\u%04x", (unsigned) (uint8_t) *s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+// Writes the thread's events, and its name if it has one. Sets *first to 0
+// once anything has been written. Returns the number of events written.
+static uint32_t WriteThreadEvents(FILE *f, TraceThread *t, int *first) {
+  const char *name = __atomic_load_n(&(t->name), __ATOMIC_ACQUIRE);
+  TraceBuffer *b = __atomic_load_n(&(t->first), __ATOMIC_ACQUIRE);
+  TraceEvent *e = NULL;
+  uint32_t count, written = 0, i;
+  if (name) {
+    fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+      "\"tid\": %u, \"args\": {\"name\": ", *first ? "" : ",",
+      (unsigned) t->id);
+    WriteJSONString(f, name);
+    fprintf(f, "}}");
+    *first = 0;
+  }
+  while (b) {
+    count = __atomic_load_n(&(b->count), __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; i++) {
+      e = b->events + i;
+      fprintf(f, "%s\n{\"name\": ", *first ? "" : ",");
+      WriteJSONString(f, e->name);
+      fprintf(f, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+        "\"dur\": %.3f", (unsigned) t->id, e->start, e->duration);
+      if (e->arg_name) {
+        fprintf(f, ", \"args\": {");
+        WriteJSONString(f, e->arg_name);
+        fprintf(f, ": %lld}", (long long) e->arg);
+      }
+      fputc('}', f);
+      *first = 0;
+      written++;
+    }
+    b = __atomic_load_n(&(b->next), __ATOMIC_ACQUIRE);
+  }
+  return written;
+}
+
+int WriteTrace(const char *path) {
+  TraceThread *t = __atomic_load_n(&trace_threads, __ATOMIC_ACQUIRE);
+  uint64_t event_count = 0, dropped_count = 0;
+  int first = 1;
+  int result = 1;
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (; t; t = t->next) {
+    event_count += WriteThreadEvents(f, t, &first);
+    dropped_count += __atomic_load_n(&(t->dropped_count), __ATOMIC_RELAXED);
+  }
+  fprintf(f, "\n]}\n");
+  if (ferror(f)) result = 0;
+  if (fclose(f) != 0) result = 0;
+  if (!result) {
+    printf("Failed writing %s.\n", path);
+    return 0;
+  }
+  printf("Wrote %llu trace events to %s.\n", (unsigned long long) event_count,
+    path);
+  if (dropped_count != 0) {
+    printf("Dropped %llu events after reaching the limit of %d per "
+      "thread.\n", (unsigned long long) dropped_count,
+      TRACE_MAX_THREAD_EVENTS);
+  }
+  return 1;
+}
+
+void StopTracing(void) {
+  TraceThread *t = trace_threads;
+  TraceThread *next_thread = NULL;
+  TraceBuffer *b = NULL;
+  TraceBuffer *next_buffer = NULL;
+  __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+  while (t) {
+    next_thread = t->next;
+    b = t->first;
+    while (b) {
+      next_buffer = b->next;
+      free(b);
+      b = next_buffer;
+    }
+    memset(t, 0, sizeof(*t));
+    free(t);
+    t = next_thread;
+  }
+  trace_threads = NULL;
+  // Only the calling thread's pointer can be cleared here; other threads
+  // must have exited.
+  current_thread = NULL;
+}
@@ -0,0 +1,100 @@
+// Records how long each stage of generating and drawing the L-system takes,
+// and writes the results as Chrome trace-event JSON, which can be opened in
+// chrome://tracing or ui.perfetto.dev.
+//
+// Tracing is off until StartTracing is called, and until then each marker
+// costs a single branch. Every thread records into its own buffers, which are
+// only written by that thread, so recording never takes a lock. Buffers are
+// kept after their thread exits, so short-lived worker threads show up in the
+// trace too. Markers are used in pairs:
+//
+//   double start = BeginTraceEvent();
+//   ...
+//   EndTraceEvent("Expand string", start);
+//
+// Event names and argument names must be string literals, or otherwise
+// outlive the trace, since only the pointers are recorded.
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+
+// The number of events in each of a thread's buffers. More buffers are
+// allocated as needed.
+#define TRACE_BUFFER_EVENTS (4096)
+
+// The number of events in a thread's first buffer. Worker threads are started
+// for each job and often record only a couple of events, so it's small.
+#define TRACE_FIRST_BUFFER_EVENTS (32)
+
+// Each thread records at most this many events. Later events are dropped and
+// counted, rather than using unbounded memory in long sessions.
+#define TRACE_MAX_THREAD_EVENTS (1024 * 1024)
+
+typedef struct {
+  const char *name;
+  // The name of the event's numeric argument, or NULL if it has none.
+  const char *arg_name;
+  int64_t arg;
+  // Both are in microseconds, with the start relative to StartTracing.
+  double start;
+  double duration;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+  // The number of events written so far. Only the owning thread modifies
+  // this, and it's updated after the event is written, so a thread writing
+  // the trace only reads finished events.
+  uint32_t count;
+  // The number of events the buffer can hold.
+  uint32_t capacity;
+  // The thread's next buffer, once this one is full.
+  struct TraceBuffer *next;
+  TraceEvent events[];
+} TraceBuffer;
+
+// The buffers recorded by a single thread.
+typedef struct TraceThread {
+  uint32_t id;
+  // A name shown for the thread in the trace. May be NULL.
+  const char *name;
+  TraceBuffer *first;
+  TraceBuffer *last;
+  uint32_t event_count;
+  uint32_t dropped_count;
+  // The thread that started recording before this one, forming a list.
+  struct TraceThread *next;
+} TraceThread;
+
+// Enables recording events, with times relative to now.
+void StartTracing(void);
+
+// Returns nonzero if StartTracing has been called.
+int TracingEnabled(void);
+
+// Returns the current time for the start of an event, or 0 if tracing is
+// disabled.
+double BeginTraceEvent(void);
+
+// Records an event starting at the time returned by BeginTraceEvent, and
+// ending now. Does nothing if tracing is disabled.
+void EndTraceEvent(const char *name, double start);
+
+// Like EndTraceEvent, but also records a number, e.g. the number of
+// vertices, shown in the event's details.
+void EndTraceEventArg(const char *name, double start, const char *arg_name,
+    int64_t arg);
+
+// Sets the name shown for the calling thread in the trace. The name must
+// outlive the trace. Does nothing if tracing is disabled.
+void SetTraceThreadName(const char *name);
+
+// Writes every event recorded so far, by every thread, to the given path.
+// Recording continues afterwards, so this can be called more than once; each
+// file contains every event since StartTracing. Returns 0 on error.
+int WriteTrace(const char *path);
+
+// Frees every recorded event and disables tracing. No other thread may be
+// recording when this is called.
+void StopTracing(void);
+
+#endif  // TRACE_H
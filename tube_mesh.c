@@ -0,0 +1,527 @@
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread_group.h"
+#include "tube_mesh.h"
+
+// The number of digits reserved for each count in the PLY header.
+#define PLY_COUNT_DIGITS (20)
+
+// Segments turning back on themselves by more than this (the cosine of the
+// angle between them) aren't joined, since the miter would be too long.
+#define MIN_JOINT_COSINE (-0.9)
+
+// The sizes of each vertex and triangle in the files.
+#define PLY_VERTEX_SIZE (3 * sizeof(float) + 4)
+#define PLY_FACE_SIZE (1 + 3 * sizeof(uint32_t))
+#define STL_TRIANGLE_SIZE (12 * sizeof(float) + sizeof(uint16_t))
+
+// The size of the STL header that comes before the triangle count.
+#define STL_HEADER_SIZE (80)
+
+TubeFormat TubeFormatFromPath(const char *path) {
+  size_t length = strlen(path);
+  if ((length >= 4) && (strcmp(path + length - 4, ".ply") == 0)) {
+    return TUBE_FORMAT_PLY;
+  }
+  return TUBE_FORMAT_STL;
+}
+
+// Writes the file's header, with placeholders for the counts. Returns 0 on
+// error.
+static int WriteTubeHeader(TubeWriter *w) {
+  uint8_t stl_header[STL_HEADER_SIZE + sizeof(uint32_t)];
+  uint16_t endian_test = 1;
+  const char *format = "binary_little_endian";
+  if (w->format == TUBE_FORMAT_STL) {
+    memset(stl_header, 0, sizeof(stl_header));
+    snprintf((char *) stl_header, STL_HEADER_SIZE,
+      "Binary STL written by l_system_3d");
+    w->triangle_count_offset = STL_HEADER_SIZE;
+    return fwrite(stl_header, sizeof(stl_header), 1, w->f) == 1;
+  }
+  if (*((uint8_t *) &endian_test) == 0) format = "binary_big_endian";
+  if (fprintf(w->f, "ply\nformat %s 1.0\ncomment Written by l_system_3d\n"
+    "element vertex ", format) < 0) {
+    return 0;
+  }
+  w->vertex_count_offset = ftell(w->f);
+  if (fprintf(w->f, "%0*d\nproperty float x\nproperty float y\n"
+    "property float z\nproperty uchar red\nproperty uchar green\n"
+    "property uchar blue\nproperty uchar alpha\nelement face ",
+    PLY_COUNT_DIGITS, 0) < 0) {
+    return 0;
+  }
+  w->triangle_count_offset = ftell(w->f);
+  if (fprintf(w->f, "%0*d\nproperty list uchar uint vertex_indices\n"
+    "end_header\n", PLY_COUNT_DIGITS, 0) < 0) {
+    return 0;
+  }
+  return (w->vertex_count_offset >= 0) && (w->triangle_count_offset >= 0);
+}
+
+// Frees the writer and its buffers, and closes its files without finishing
+// them.
+static void DestroyTubeWriter(TubeWriter *w) {
+  int i;
+  if (w->threads) {
+    for (i = 0; i < w->thread_count; i++) {
+      free(w->threads[i].vertices.data);
+      free(w->threads[i].triangles.data);
+    }
+  }
+  free(w->threads);
+  free(w->segments);
+  if (w->f) fclose(w->f);
+  if (w->faces) fclose(w->faces);
+  memset(w, 0, sizeof(*w));
+  free(w);
+}
+
+TubeWriter* OpenTubeWriter(const char *path, TubeFormat format, int sides,
+    float radius, int thread_count) {
+  TubeWriter *w = NULL;
+  double angle;
+  int i;
+  if ((sides < MIN_TUBE_SIDES) || (sides > MAX_TUBE_SIDES)) {
+    printf("Tubes must have between %d and %d sides, not %d.\n",
+      MIN_TUBE_SIDES, MAX_TUBE_SIDES, sides);
+    return NULL;
+  }
+  if (thread_count < 1) thread_count = 1;
+  w = (TubeWriter *) calloc(1, sizeof(*w));
+  if (!w) {
+    printf("Failed allocating tube writer.\n");
+    return NULL;
+  }
+  w->format = format;
+  w->sides = sides;
+  w->radius = radius;
+  w->thread_count = thread_count;
+  for (i = 0; i < sides; i++) {
+    angle = (2.0 * GLM_PI * i) / sides;
+    w->circle[i][0] = cos(angle);
+    w->circle[i][1] = sin(angle);
+  }
+  w->threads = (TubeThread *) calloc(thread_count, sizeof(TubeThread));
+  w->segments = (TubeSegment *) malloc((TUBE_CHUNK_SEGMENTS + 2) *
+    sizeof(TubeSegment));
+  if (!w->threads || !w->segments) {
+    printf("Failed allocating tube writer buffers.\n");
+    DestroyTubeWriter(w);
+    return NULL;
+  }
+  for (i = 0; i < thread_count; i++) {
+    w->threads[i].w = w;
+    w->threads[i].index = i;
+  }
+  w->f = fopen(path, "wb");
+  if (!w->f) {
+    printf("Failed opening %s: %s\n", path, strerror(errno));
+    DestroyTubeWriter(w);
+    return NULL;
+  }
+  if (format == TUBE_FORMAT_PLY) {
+    w->faces = tmpfile();
+    if (!w->faces) {
+      printf("Failed creating temporary file for PLY faces: %s\n",
+        strerror(errno));
+      DestroyTubeWriter(w);
+      return NULL;
+    }
+  }
+  if (!WriteTubeHeader(w)) {
+    printf("Failed writing header to %s: %s\n", path, strerror(errno));
+    DestroyTubeWriter(w);
+    return NULL;
+  }
+  return w;
+}
+
+static uint32_t PackColor(vec4 color) {
+  uint32_t packed = 0;
+  float v;
+  int i;
+  for (i = 0; i < 4; i++) {
+    v = color[i];
+    if (v < 0) v = 0;
+    if (v > 1) v = 1;
+    packed |= ((uint32_t) (v * 255.0 + 0.5)) << (i * 8);
+  }
+  return packed;
+}
+
+static int IsDegenerate(TubeSegment *s) {
+  return glm_vec3_eqv(s->start, s->end);
+}
+
+static void SegmentDirection(TubeSegment *s, vec3 direction) {
+  glm_vec3_sub(s->end, s->start, direction);
+  glm_vec3_normalize(direction);
+}
+
+// Returns nonzero if b continues the same path as a, i.e. it starts exactly
+// where a ends, without turning back too sharply to join them.
+static int ContinuesPath(TubeSegment *a, TubeSegment *b) {
+  vec3 a_direction, b_direction;
+  if (IsDegenerate(a) || IsDegenerate(b)) return 0;
+  if (memcmp(a->end, b->start, sizeof(vec3)) != 0) return 0;
+  SegmentDirection(a, a_direction);
+  SegmentDirection(b, b_direction);
+  return glm_vec3_dot(a_direction, b_direction) > MIN_JOINT_COSINE;
+}
+
+// Gets the ring of vertices around one end of a segment. If next isn't NULL,
+// the ring at the end is mitered so that it can be shared with the next
+// segment.
+static void GetRing(TubeWriter *w, TubeSegment *s, int at_end,
+    TubeSegment *next, vec3 *ring) {
+  vec3 forward, u, v, offset, miter, next_forward;
+  float *center = at_end ? s->end : s->start;
+  float miter_cosine = 1;
+  int i;
+  SegmentDirection(s, forward);
+  glm_vec3_copy(s->up, u);
+  glm_vec3_muladds(forward, -glm_vec3_dot(u, forward), u);
+  if (glm_vec3_norm2(u) < 1e-12) {
+    // The up vector should always be perpendicular, but just in case.
+    glm_vec3_zero(u);
+    u[fabsf(forward[0]) > 0.9 ? 1 : 0] = 1;
+    glm_vec3_muladds(forward, -glm_vec3_dot(u, forward), u);
+  }
+  glm_vec3_normalize(u);
+  glm_vec3_cross(forward, u, v);
+  if (at_end && next) {
+    SegmentDirection(next, next_forward);
+    glm_vec3_add(forward, next_forward, miter);
+    glm_vec3_normalize(miter);
+    miter_cosine = glm_vec3_dot(forward, miter);
+  }
+  for (i = 0; i < w->sides; i++) {
+    glm_vec3_scale(u, w->radius * w->circle[i][0], offset);
+    glm_vec3_muladds(v, w->radius * w->circle[i][1], offset);
+    glm_vec3_add(center, offset, ring[i]);
+    // Slide each point along the segment until it reaches the plane halfway
+    // between the two segments' directions.
+    if (miter_cosine != 1) {
+      glm_vec3_muladds(forward, -glm_vec3_dot(offset, miter) / miter_cosine,
+        ring[i]);
+    }
+  }
+}
+
+// Gets the neighbors of the segment at the given index in the chunk, and
+// whether its path starts or ends with it.
+static void GetNeighbors(TubeWriter *w, uint32_t index, TubeSegment **prev,
+    TubeSegment **next, int *starts_path, int *ends_path) {
+  TubeSegment *s = w->segments + index;
+  *prev = index > 0 ? s - 1 : NULL;
+  *next = (index + 1) < w->segment_count ? s + 1 : NULL;
+  *starts_path = !*prev || !ContinuesPath(*prev, s);
+  *ends_path = !*next || !ContinuesPath(s, *next);
+}
+
+// Counts the vertices and triangles in the thread's part of the chunk.
+static void* CountTubeThread(void *arg) {
+  TubeThread *t = (TubeThread *) arg;
+  TubeWriter *w = t->w;
+  TubeSegment *prev, *next;
+  int starts_path, ends_path;
+  uint32_t i;
+  t->vertex_count = 0;
+  t->triangle_count = 0;
+  for (i = t->first; i < (t->first + t->count); i++) {
+    if (IsDegenerate(w->segments + i)) continue;
+    GetNeighbors(w, i, &prev, &next, &starts_path, &ends_path);
+    t->vertex_count += w->sides;
+    t->triangle_count += 2 * w->sides;
+    if (starts_path) {
+      t->vertex_count += w->sides;
+      t->triangle_count += w->sides - 2;
+    }
+    if (ends_path) t->triangle_count += w->sides - 2;
+  }
+  return NULL;
+}
+
+// Makes sure the buffer can hold the given number of bytes. Returns 0 on
+// error.
+static int ReserveTubeBuffer(TubeBuffer *b, size_t size) {
+  uint8_t *tmp = NULL;
+  if (size <= b->capacity) return 1;
+  tmp = (uint8_t *) realloc(b->data, size);
+  if (!tmp) {
+    printf("Failed allocating %.02f MB for tube triangles.\n",
+      ((double) size) / (1024.0 * 1024.0));
+    return 0;
+  }
+  b->data = tmp;
+  b->capacity = size;
+  return 1;
+}
+
+// Appends a ring's vertices to the thread's PLY vertices.
+static void AppendRing(TubeThread *t, vec3 *ring, uint32_t color) {
+  uint8_t *dst = NULL;
+  int i;
+  if (t->w->format != TUBE_FORMAT_PLY) return;
+  for (i = 0; i < t->w->sides; i++) {
+    dst = t->vertices.data + t->vertices.size;
+    memcpy(dst, ring[i], 3 * sizeof(float));
+    memcpy(dst + 3 * sizeof(float), &color, 4);
+    t->vertices.size += PLY_VERTEX_SIZE;
+  }
+}
+
+// Appends a triangle, given as indices into the mesh's vertices and as the
+// corresponding points, to the thread's triangles.
+static void AppendTriangle(TubeThread *t, uint64_t a, uint64_t b, uint64_t c,
+    float *pa, float *pb, float *pc) {
+  uint8_t *dst = t->triangles.data + t->triangles.size;
+  uint32_t indices[3];
+  vec3 ab, ac, normal;
+  uint16_t attributes = 0;
+  if (t->w->format == TUBE_FORMAT_PLY) {
+    indices[0] = a;
+    indices[1] = b;
+    indices[2] = c;
+    dst[0] = 3;
+    memcpy(dst + 1, indices, sizeof(indices));
+    t->triangles.size += PLY_FACE_SIZE;
+    return;
+  }
+  glm_vec3_sub(pb, pa, ab);
+  glm_vec3_sub(pc, pa, ac);
+  glm_vec3_crossn(ab, ac, normal);
+  memcpy(dst, normal, sizeof(vec3));
+  memcpy(dst + 3 * sizeof(float), pa, sizeof(vec3));
+  memcpy(dst + 6 * sizeof(float), pb, sizeof(vec3));
+  memcpy(dst + 9 * sizeof(float), pc, sizeof(vec3));
+  memcpy(dst + 12 * sizeof(float), &attributes, sizeof(attributes));
+  t->triangles.size += STL_TRIANGLE_SIZE;
+}
+
+// Closes the end of a tube with a fan of triangles. If facing_forward is
+// nonzero, the cap faces along the ring's winding, otherwise it faces away.
+static void AppendCap(TubeThread *t, uint64_t first, vec3 *ring,
+    int facing_forward) {
+  int i, a, b;
+  for (i = 1; i < (t->w->sides - 1); i++) {
+    a = facing_forward ? i : i + 1;
+    b = facing_forward ? i + 1 : i;
+    AppendTriangle(t, first, first + a, first + b, ring[0], ring[a],
+      ring[b]);
+  }
+}
+
+// Generates the vertices and triangles for the thread's part of the chunk.
+static void* BuildTubeThread(void *arg) {
+  TubeThread *t = (TubeThread *) arg;
+  TubeWriter *w = t->w;
+  TubeSegment *s, *prev, *next;
+  vec3 start_ring[MAX_TUBE_SIDES];
+  vec3 end_ring[MAX_TUBE_SIDES];
+  uint64_t vertex = t->first_vertex;
+  uint64_t start_index, end_index;
+  int starts_path, ends_path, j, k;
+  uint32_t i;
+  size_t vertex_size = w->format == TUBE_FORMAT_PLY ? PLY_VERTEX_SIZE : 0;
+  size_t triangle_size = w->format == TUBE_FORMAT_PLY ? PLY_FACE_SIZE :
+    STL_TRIANGLE_SIZE;
+  t->vertices.size = 0;
+  t->triangles.size = 0;
+  if (!ReserveTubeBuffer(&(t->vertices), t->vertex_count * vertex_size) ||
+    !ReserveTubeBuffer(&(t->triangles), t->triangle_count * triangle_size)) {
+    t->error = 1;
+    return NULL;
+  }
+  for (i = t->first; i < (t->first + t->count); i++) {
+    s = w->segments + i;
+    if (IsDegenerate(s)) continue;
+    GetNeighbors(w, i, &prev, &next, &starts_path, &ends_path);
+    if (starts_path) {
+      GetRing(w, s, 0, NULL, start_ring);
+      AppendRing(t, start_ring, s->start_color);
+      start_index = vertex;
+      vertex += w->sides;
+      AppendCap(t, start_index, start_ring, 0);
+    } else {
+      // The previous segment's end ring is always the last thing it added.
+      GetRing(w, prev, 1, s, start_ring);
+      start_index = vertex - w->sides;
+    }
+    GetRing(w, s, 1, ends_path ? NULL : next, end_ring);
+    AppendRing(t, end_ring, s->end_color);
+    end_index = vertex;
+    vertex += w->sides;
+    for (j = 0; j < w->sides; j++) {
+      k = (j + 1) % w->sides;
+      AppendTriangle(t, start_index + j, start_index + k, end_index + k,
+        start_ring[j], start_ring[k], end_ring[k]);
+      AppendTriangle(t, start_index + j, end_index + k, end_index + j,
+        start_ring[j], end_ring[k], end_ring[j]);
+    }
+    if (ends_path) AppendCap(t, end_index, end_ring, 1);
+  }
+  return NULL;
+}
+
+// Generates and writes the tubes for the segments in the chunk, from first
+// up to, but not including, end. Returns 0 on error.
+static int WriteTubeChunk(TubeWriter *w, uint32_t first, uint32_t end) {
+  TubeThread *t = NULL;
+  uint32_t count = end - first;
+  uint64_t vertex = w->vertex_count;
+  FILE *triangle_file = w->format == TUBE_FORMAT_PLY ? w->faces : w->f;
+  int i;
+  for (i = 0; i < w->thread_count; i++) {
+    t = w->threads + i;
+    t->first = first + (((uint64_t) count) * i) / w->thread_count;
+    t->count = first + (((uint64_t) count) * (i + 1)) / w->thread_count -
+      t->first;
+  }
+  if (!RunThreadGroup("Count tube vertices", w->thread_count, CountTubeThread,
+    w->threads, sizeof(TubeThread))) {
+    return 0;
+  }
+  for (i = 0; i < w->thread_count; i++) {
+    w->threads[i].first_vertex = vertex;
+    vertex += w->threads[i].vertex_count;
+  }
+  if (!RunThreadGroup("Build tubes", w->thread_count, BuildTubeThread,
+    w->threads, sizeof(TubeThread))) {
+    return 0;
+  }
+  for (i = 0; i < w->thread_count; i++) {
+    t = w->threads + i;
+    if (t->error) return 0;
+    if ((t->vertices.size > 0) &&
+      (fwrite(t->vertices.data, t->vertices.size, 1, w->f) != 1)) {
+      printf("Failed writing tube vertices: %s\n", strerror(errno));
+      return 0;
+    }
+    if ((t->triangles.size > 0) &&
+      (fwrite(t->triangles.data, t->triangles.size, 1, triangle_file) != 1)) {
+      printf("Failed writing tube triangles: %s\n", strerror(errno));
+      return 0;
+    }
+    w->vertex_count += t->vertex_count;
+    w->triangle_count += t->triangle_count;
+  }
+  if ((w->format == TUBE_FORMAT_PLY) && (w->vertex_count > UINT32_MAX)) {
+    printf("Too many vertices for a PLY file.\n");
+    return 0;
+  }
+  if ((w->format == TUBE_FORMAT_STL) && (w->triangle_count > UINT32_MAX)) {
+    printf("Too many triangles for an STL file.\n");
+    return 0;
+  }
+  return 1;
+}
+
+// Writes every buffered segment except for the last, which is needed to know
+// whether the previous one's path continues. Keeps the last two segments as
+// the start of the next chunk. Returns 0 on error.
+static int WriteBufferedSegments(TubeWriter *w) {
+  uint32_t first = w->has_previous ? 1 : 0;
+  if ((w->segment_count - first) < 2) return 1;
+  if (!WriteTubeChunk(w, first, w->segment_count - 1)) return 0;
+  w->segments[0] = w->segments[w->segment_count - 2];
+  w->segments[1] = w->segments[w->segment_count - 1];
+  w->segment_count = 2;
+  w->has_previous = 1;
+  return 1;
+}
+
+int WriteTubeSegments(void *writer, MeshVertex *vertices, uint32_t count) {
+  TubeWriter *w = (TubeWriter *) writer;
+  TubeSegment *s = NULL;
+  uint32_t i;
+  for (i = 0; (i + 1) < count; i += 2) {
+    if (w->segment_count >= (TUBE_CHUNK_SEGMENTS + 2)) {
+      if (!WriteBufferedSegments(w)) return 0;
+    }
+    s = w->segments + w->segment_count;
+    glm_vec3_copy(vertices[i].location, s->start);
+    glm_vec3_copy(vertices[i + 1].location, s->end);
+    glm_vec3_copy(vertices[i].up, s->up);
+    s->start_color = PackColor(vertices[i].color);
+    s->end_color = PackColor(vertices[i + 1].color);
+    w->segment_count++;
+  }
+  return 1;
+}
+
+// Copies the PLY faces from the temporary file to the end of the output.
+// Returns 0 on error.
+static int AppendPLYFaces(TubeWriter *w) {
+  uint8_t *buffer = NULL;
+  size_t size;
+  int to_return = 1;
+  buffer = (uint8_t *) malloc(4 * 1024 * 1024);
+  if (!buffer) {
+    printf("Failed allocating buffer for copying PLY faces.\n");
+    return 0;
+  }
+  rewind(w->faces);
+  while ((size = fread(buffer, 1, 4 * 1024 * 1024, w->faces)) > 0) {
+    if (fwrite(buffer, size, 1, w->f) != 1) {
+      to_return = 0;
+      break;
+    }
+  }
+  if (ferror(w->faces)) to_return = 0;
+  if (!to_return) printf("Failed copying PLY faces: %s\n", strerror(errno));
+  free(buffer);
+  return to_return;
+}
+
+// Overwrites one of the header's placeholder counts. Returns 0 on error.
+static int WriteTubeCount(TubeWriter *w, long offset, uint64_t count) {
+  uint32_t stl_count = count;
+  if (fseek(w->f, offset, SEEK_SET) != 0) return 0;
+  if (w->format == TUBE_FORMAT_STL) {
+    return fwrite(&stl_count, sizeof(stl_count), 1, w->f) == 1;
+  }
+  return fprintf(w->f, "%0*llu", PLY_COUNT_DIGITS,
+    (unsigned long long) count) == PLY_COUNT_DIGITS;
+}
+
+// Writes the remaining segments and the rest of the file. Returns 0 on
+// error.
+static int FinishTubeMesh(TubeWriter *w) {
+  uint32_t first = w->has_previous ? 1 : 0;
+  if ((w->segment_count > first) &&
+    !WriteTubeChunk(w, first, w->segment_count)) {
+    return 0;
+  }
+  if (w->format == TUBE_FORMAT_PLY) {
+    if (!AppendPLYFaces(w)) return 0;
+    if (!WriteTubeCount(w, w->vertex_count_offset, w->vertex_count)) {
+      printf("Failed updating PLY header: %s\n", strerror(errno));
+      return 0;
+    }
+  }
+  if (!WriteTubeCount(w, w->triangle_count_offset, w->triangle_count)) {
+    printf("Failed updating triangle count: %s\n", strerror(errno));
+    return 0;
+  }
+  return 1;
+}
+
+int CloseTubeWriter(TubeWriter *w, uint64_t *triangle_count) {
+  int to_return;
+  if (!w) return 1;
+  to_return = FinishTubeMesh(w);
+  if (triangle_count) *triangle_count = w->triangle_count;
+  if (fclose(w->f) != 0) {
+    printf("Failed closing tube mesh file: %s\n", strerror(errno));
+    to_return = 0;
+  }
+  w->f = NULL;
+  DestroyTubeWriter(w);
+  return to_return;
+}
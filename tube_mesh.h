@@ -0,0 +1,122 @@
+// Sweeps a polygonal cross-section along the turtle's segments to build a
+// closed triangle mesh of tubes, e.g. for 3D printing, and streams it to a
+// binary STL or PLY file. It doesn't use OpenGL.
+//
+// Consecutive segments where one starts exactly where the previous one ended
+// are joined by a single shared ring of vertices, mitered so that the tubes
+// meet cleanly. Wherever a path ends, e.g. at the end of a branch before
+// PopTurtlePosition jumps back, or where it starts again, the tube is closed
+// with a flat cap. The cross-section is oriented using each segment's up
+// vector.
+//
+// Segments are buffered into chunks of TUBE_CHUNK_SEGMENTS. Each chunk is
+// split between the threads, which count and then generate the vertices and
+// triangles for their part of it in parallel, and the results are then
+// written in order. PLY faces have to come after every vertex, so they're
+// written to a temporary file and appended once all of the vertices are done.
+#ifndef TUBE_MESH_H
+#define TUBE_MESH_H
+#include <stdint.h>
+#include <stdio.h>
+#include <cglm/cglm.h>
+#include "mesh_vertex.h"
+
+// The number of segments buffered before generating their triangles.
+#define TUBE_CHUNK_SEGMENTS (64 * 1024)
+
+// The limits on the number of sides of the tubes' cross-section.
+#define MIN_TUBE_SIDES (3)
+#define MAX_TUBE_SIDES (64)
+#define DEFAULT_TUBE_SIDES (8)
+
+typedef enum {
+  TUBE_FORMAT_STL = 0,
+  TUBE_FORMAT_PLY,
+} TubeFormat;
+
+// The parts of a segment needed to build its tube.
+typedef struct {
+  vec3 start;
+  vec3 end;
+  vec3 up;
+  // The colors at each end, as 8-bit RGBA values packed into the bytes of
+  // the integer, with red in the lowest byte.
+  uint32_t start_color;
+  uint32_t end_color;
+} TubeSegment;
+
+// A growable array of bytes.
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} TubeBuffer;
+
+struct TubeWriter;
+
+// The state of one of the threads generating a chunk's triangles.
+typedef struct {
+  struct TubeWriter *w;
+  int index;
+  // The thread's range of segments in the chunk.
+  uint32_t first;
+  uint32_t count;
+  // The number of vertices and triangles generated for the range, and the
+  // index of the range's first vertex in the whole mesh.
+  uint64_t vertex_count;
+  uint64_t triangle_count;
+  uint64_t first_vertex;
+  // The generated vertices and triangles, already in the file's format.
+  TubeBuffer vertices;
+  TubeBuffer triangles;
+  int error;
+} TubeThread;
+
+typedef struct TubeWriter {
+  TubeFormat format;
+  FILE *f;
+  // Holds the PLY faces until every vertex has been written.
+  FILE *faces;
+  int sides;
+  float radius;
+  // The unit circle for the cross-section, as (cosine, sine) pairs.
+  float circle[MAX_TUBE_SIDES][2];
+  int thread_count;
+  TubeThread *threads;
+  // The buffered segments. The first one is the last segment of the previous
+  // chunk, if there was one, and is only used to tell whether the next
+  // segment continues its path. The last one is only used to tell whether
+  // the previous segment's path continues, and becomes the next chunk's
+  // first segment.
+  TubeSegment *segments;
+  uint32_t segment_count;
+  int has_previous;
+  uint64_t vertex_count;
+  uint64_t triangle_count;
+  // Where the counts are in the file's header. They're written as
+  // placeholders, and filled in once the file is closed.
+  long vertex_count_offset;
+  long triangle_count_offset;
+} TubeWriter;
+
+// Picks the format from the path's extension: PLY for paths ending in ".ply",
+// or STL otherwise.
+TubeFormat TubeFormatFromPath(const char *path);
+
+// Creates the file at the given path, and writes its header. The tubes'
+// cross-section is a regular polygon with the given number of sides, whose
+// corners are the given radius from the segments. Returns NULL on error.
+TubeWriter* OpenTubeWriter(const char *path, TubeFormat format, int sides,
+    float radius, int thread_count);
+
+// Adds the given segments to the mesh. The vertices are a list of pairs, like
+// in a mesh. The arguments match a TurtleVertexSink, so this can receive
+// vertices straight from the turtle. Returns 0 on error.
+int WriteTubeSegments(void *writer, MeshVertex *vertices, uint32_t count);
+
+// Finishes the mesh, writes the rest of the file and closes it, freeing the
+// writer. If triangle_count isn't NULL, it's set to the total number of
+// triangles. Returns 0 on error. The writer is freed even if an error occurs.
+int CloseTubeWriter(TubeWriter *w, uint64_t *triangle_count);
+
+#endif  // TUBE_MESH_H
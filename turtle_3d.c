@@ -3,12 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "l_system_mesh.h"
+#include "mesh_vertex.h"
+#include "memory_budget.h"
 #include "turtle_3d.h"
 
 // The number of vertices the turtle initially allocates space for.
 #define INITIAL_TURTLE_CAPACITY (1024)
 
+// The number of vertices the turtle accumulates before passing them to its
+// sink, if it has one.
+#define SINK_BATCH_VERTICES (256 * 1024)
+
 // The initial capacity of the turtle's position stack.
 #define INITIAL_STACK_CAPACITY (32)
 
@@ -21,8 +26,8 @@
 // Initializes the given stack of turtle positions. Returns 0 on error.
 static int InitializePositionStack(PositionStack *s) {
   s->size = 0;
-  s->buffer = (TurtlePosition *) calloc(INITIAL_STACK_CAPACITY,
-    sizeof(TurtlePosition));
+  s->buffer = (TurtlePosition *) TrackedCalloc(MEMORY_TURTLE,
+    INITIAL_STACK_CAPACITY, sizeof(TurtlePosition));
   if (!s->buffer) return 0;
   s->capacity = INITIAL_STACK_CAPACITY;
   return 1;
@@ -31,48 +36,49 @@ static int InitializePositionStack(PositionStack *s) {
 // Cleans up the stack of positions. Doesn't free s itself; just the buffer it
 // wraps.
 static void FreePositionStack(PositionStack *s) {
-  free(s->buffer);
+  TrackedFree(s->buffer);
   memset(s, 0, sizeof(*s));
 }
 
 static int InitializeColorStack(ColorStack *s) {
   s->size = 0;
-  s->buffer = (float *) calloc(INITIAL_STACK_CAPACITY, 4 * sizeof(float));
+  s->buffer = (float *) TrackedCalloc(MEMORY_TURTLE, INITIAL_STACK_CAPACITY,
+    4 * sizeof(float));
   if (!s->buffer) return 0;
   s->capacity = INITIAL_STACK_CAPACITY;
   return 1;
 }
 
 static void FreeColorStack(ColorStack *s) {
-  free(s->buffer);
+  TrackedFree(s->buffer);
   memset(s, 0, sizeof(*s));
 }
 
 Turtle3D* CreateTurtle3D(void) {
   Turtle3D *to_return = NULL;
-  to_return = (Turtle3D *) calloc(1, sizeof(*to_return));
+  to_return = (Turtle3D *) TrackedCalloc(MEMORY_TURTLE, 1, sizeof(*to_return));
   if (!to_return) {
     printf("Failed allocating Turtle3D struct.\n");
     return NULL;
   }
-  to_return->vertices = (MeshVertex *) calloc(INITIAL_TURTLE_CAPACITY,
-    sizeof(MeshVertex));
+  to_return->vertices = (MeshVertex *) TrackedCalloc(MEMORY_TURTLE,
+    INITIAL_TURTLE_CAPACITY, sizeof(MeshVertex));
   if (!to_return->vertices) {
     printf("Failed allocating the turtle's vertex array.\n");
-    free(to_return);
+    TrackedFree(to_return);
     return NULL;
   }
   if (!InitializePositionStack(&(to_return->position_stack))) {
     printf("Failed initializing stack of turtle positions.\n");
-    free(to_return->vertices);
-    free(to_return);
+    TrackedFree(to_return->vertices);
+    TrackedFree(to_return);
     return NULL;
   }
   if (!InitializeColorStack(&(to_return->color_stack))) {
     printf("Failed initializing stack of turtle colors.\n");
-    free(to_return->vertices);
-    free(to_return->position_stack.buffer);
-    free(to_return);
+    TrackedFree(to_return->vertices);
+    TrackedFree(to_return->position_stack.buffer);
+    TrackedFree(to_return);
     return NULL;
   }
   to_return->vertex_capacity = INITIAL_TURTLE_CAPACITY;
@@ -98,18 +104,35 @@ void ResetTurtle3D(Turtle3D *t) {
   // turtle to draw another iteration without needing to clear all the
   // vertices.
   t->vertex_count = 0;
+  t->flushed_vertex_count = 0;
   // Clear the stack. As with the vertex array, don't free it, though.
   t->position_stack.size = 0;
   t->color_stack.size = 0;
 }
 
+void SetTurtleVertexSink(Turtle3D *t, TurtleVertexSink sink, void *data) {
+  t->sink = sink;
+  t->sink_data = data;
+}
+
+int FlushTurtleVertices(Turtle3D *t) {
+  if (!t->sink || (t->vertex_count == 0)) return 1;
+  if (!t->sink(t->sink_data, t->vertices, t->vertex_count)) {
+    printf("Failed passing the turtle's vertices to its sink.\n");
+    return 0;
+  }
+  t->flushed_vertex_count += t->vertex_count;
+  t->vertex_count = 0;
+  return 1;
+}
+
 void DestroyTurtle3D(Turtle3D *t) {
   if (!t) return;
-  free(t->vertices);
+  TrackedFree(t->vertices);
   FreePositionStack(&(t->position_stack));
   FreeColorStack(&(t->color_stack));
   memset(t, 0, sizeof(*t));
-  free(t);
+  TrackedFree(t);
 }
 
 static float Max3(float a, float b, float c) {
@@ -159,11 +182,15 @@ int SetTransformInfo(Turtle3D *t, mat4 model, mat3 normal, vec3 loc_offset,
 
 // Checks if the internal array has space for two more vertices (another line
 // segment). If not, this attempts to reallocate the turtle's internal array of
-// vertices, doubling its capacity. Returns 0 on error.
+// vertices, doubling its capacity. If the turtle has a sink, full batches of
+// vertices are flushed to it instead. Returns 0 on error.
 static int IncreaseCapacityIfNeeded(Turtle3D *t) {
   void *new_buffer = NULL;
-  uint32_t new_capacity;
-  uint32_t required_capacity = t->vertex_count + 2;
+  uint32_t new_capacity, required_capacity;
+  if (t->sink && (t->vertex_count >= SINK_BATCH_VERTICES)) {
+    if (!FlushTurtleVertices(t)) return 0;
+  }
+  required_capacity = t->vertex_count + 2;
   if (required_capacity < t->vertex_count) {
     printf("Vertex capacity overflow: too many vertices.\n");
     return 0;
@@ -174,7 +201,8 @@ static int IncreaseCapacityIfNeeded(Turtle3D *t) {
     printf("Vertex capacity overflow: too many vertices.\n");
     return 0;
   }
-  new_buffer = realloc(t->vertices, new_capacity * sizeof(MeshVertex));
+  new_buffer = TrackedRealloc(MEMORY_TURTLE, t->vertices, new_capacity *
+    sizeof(MeshVertex));
   if (!new_buffer) {
     printf("Unable to increase number of vertices: out of memory.\n");
     return 0;
@@ -251,6 +279,21 @@ int MoveTurtleForward(Turtle3D *t, float distance) {
   return AppendSegment(t);
 }
 
+int JumpTurtle(Turtle3D *t, vec3 position, vec3 forward, vec3 up, int draw) {
+  glm_vec3_copy(t->p.position, t->p.prev_position);
+  glm_vec3_copy(position, t->p.position);
+  glm_vec3_copy(forward, t->p.forward);
+  glm_vec3_copy(up, t->p.up);
+  UpdateBounds(t);
+  if (!draw) return 1;
+  return AppendSegment(t);
+}
+
+void ExpandTurtleBounds(Turtle3D *t, vec3 min, vec3 max) {
+  glm_vec3_minv(t->min_bounds, min, t->min_bounds);
+  glm_vec3_maxv(t->max_bounds, max, t->max_bounds);
+}
+
 static float ToRadians(float degrees) {
   return degrees * (PI / 180.0);
 }
@@ -310,8 +353,8 @@ int PushTurtlePosition(Turtle3D *t, float ignored) {
       printf("Turtle position stack overflow.\n");
       return 0;
     }
-    new_buf = (TurtlePosition *) realloc(s->buffer, new_cap *
-      sizeof(TurtlePosition));
+    new_buf = (TurtlePosition *) TrackedRealloc(MEMORY_TURTLE, s->buffer,
+      new_cap * sizeof(TurtlePosition));
     if (!new_buf) {
       printf("Failed expanding position stack.\n");
       return 0;
@@ -346,7 +389,8 @@ int PushTurtleColor(Turtle3D *t, float ignored) {
       printf("Turtle color stack overflow.\n");
       return 0;
     }
-    new_buf = (float *) realloc(s->buffer, new_cap * 4 * sizeof(float));
+    new_buf = (float *) TrackedRealloc(MEMORY_TURTLE, s->buffer, new_cap * 4 *
+      sizeof(float));
     if (!new_buf) {
       printf("Failed expanding color stack.\n");
       return 0;
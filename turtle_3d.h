@@ -2,7 +2,7 @@
 #define TURTLE_3D_H
 #include <cglm/cglm.h>
 #include <stdint.h>
-#include "l_system_mesh.h"
+#include "mesh_vertex.h"
 
 // The length per edge of the centered cube that the turtle's resulting mesh
 // is scaled to fit into.
@@ -39,6 +39,11 @@ typedef struct {
   float *buffer;
 } ColorStack;
 
+// Receives batches of vertices from the turtle as they're generated. The data
+// pointer is whatever was passed to SetTurtleVertexSink. Returns 0 on error.
+typedef int (*TurtleVertexSink)(void *data, MeshVertex *vertices,
+    uint32_t count);
+
 // Holds the state of a 3D "turtle" that follows instructions relative to
 // itself in 3D space.
 typedef struct {
@@ -59,6 +64,13 @@ typedef struct {
   MeshVertex *vertices;
   uint32_t vertex_count;
   uint32_t vertex_capacity;
+  // If a sink is set, the vertices are periodically passed to it and removed
+  // from the list, rather than keeping every vertex in memory. This is the
+  // number of vertices that have been passed to the sink since the turtle was
+  // last reset.
+  TurtleVertexSink sink;
+  void *sink_data;
+  uint64_t flushed_vertex_count;
   PositionStack position_stack;
   ColorStack color_stack;
 } Turtle3D;
@@ -72,6 +84,15 @@ Turtle3D* CreateTurtle3D(void);
 // right. Clears the list of all generated vertices.
 void ResetTurtle3D(Turtle3D *t);
 
+// Sets the function that receives the turtle's vertices, or clears it if sink
+// is NULL. Any vertices that haven't been flushed yet are kept.
+void SetTurtleVertexSink(Turtle3D *t, TurtleVertexSink sink, void *data);
+
+// Passes any remaining vertices to the turtle's sink, and clears them. Must
+// be called after the turtle is done drawing, if a sink is set. Returns 0 on
+// error.
+int FlushTurtleVertices(Turtle3D *t);
+
 // Destroys the given turtle, freeing any resources and vertices. The given
 // pointer is no longer valid after this returns.
 void DestroyTurtle3D(Turtle3D *t);
@@ -127,5 +148,17 @@ int PopTurtlePosition(Turtle3D *t, float ignored);
 int PushTurtleColor(Turtle3D *t, float ignored);
 int PopTurtleColor(Turtle3D *t, float ignored);
 
+// Moves the turtle directly to the given position and orientation, rather
+// than by following a sequence of instructions. If draw is nonzero, this draws
+// a single straight segment from the turtle's old position to the new one.
+// The forward and up vectors must be normalized and orthogonal. Returns 0 on
+// error.
+int JumpTurtle(Turtle3D *t, vec3 position, vec3 forward, vec3 up, int draw);
+
+// Expands the turtle's bounds to include the given box, even if the turtle
+// never visits it. Used when skipping over instructions whose bounds are
+// known in advance.
+void ExpandTurtleBounds(Turtle3D *t, vec3 min, vec3 max);
+
 #endif  // TURTLE_3D_H
 
@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse_config.h"
+#include "turtle_3d.h"
+#include "turtle_profile.h"
+#include "utilities.h"
+
+// Used to sort the action types and symbols for printing.
+typedef struct {
+  uint32_t index;
+  double key;
+} RankedEntry;
+
+void InitTurtleProfile(TurtleProfile *p) {
+  memset(p, 0, sizeof(*p));
+}
+
+// Returns the index of the instruction in p->action_types, adding it if
+// necessary. Returns -1 if there are too many instruction types.
+static int ActionTypeIndex(TurtleProfile *p, TurtleInstruction f) {
+  uint32_t i;
+  for (i = 0; i < p->action_type_count; i++) {
+    if (p->action_types[i].instruction == f) return i;
+  }
+  if (p->action_type_count >= PROFILE_MAX_ACTION_TYPES) return -1;
+  p->action_types[i].instruction = f;
+  p->action_type_count++;
+  return i;
+}
+
+// Returns the total number of vertices the turtle has emitted since it was
+// reset.
+static uint64_t EmittedVertices(Turtle3D *t) {
+  return t->flushed_vertex_count + t->vertex_count;
+}
+
+// Runs the instructions for a single symbol, updating the profile after each
+// one. Returns 0 on error.
+static int RunProfiledSymbol(LSystemConfig *config, Turtle3D *t, uint8_t c,
+    uint8_t *action_types, TurtleProfile *p) {
+  ActionRule *r = config->actions + c;
+  SymbolProfile *sp = p->symbols + c;
+  uint64_t start_vertices = EmittedVertices(t);
+  uint32_t vertex_capacity, position_capacity, color_capacity;
+  uint64_t segments;
+  int i;
+  for (i = 0; i < r->length; i++) {
+    vertex_capacity = t->vertex_capacity;
+    position_capacity = t->position_stack.capacity;
+    color_capacity = t->color_stack.capacity;
+    if (!r->instructions[i](t, r->args[i])) {
+      printf("Failed running instruction %d for char %c.\n", i, (char) c);
+      return 0;
+    }
+    p->action_types[action_types[i]].count++;
+    if (t->vertex_capacity != vertex_capacity) p->vertex_reallocs++;
+    if (t->position_stack.capacity != position_capacity) {
+      p->position_stack_reallocs++;
+    }
+    if (t->color_stack.capacity != color_capacity) {
+      p->color_stack_reallocs++;
+    }
+    if (t->position_stack.size > p->max_position_depth) {
+      p->max_position_depth = t->position_stack.size;
+    }
+    if (t->color_stack.size > p->max_color_depth) {
+      p->max_color_depth = t->color_stack.size;
+    }
+  }
+  segments = (EmittedVertices(t) - start_vertices) / 2;
+  sp->count++;
+  sp->action_count += r->length;
+  sp->segment_count += segments;
+  p->symbol_count++;
+  p->action_count += r->length;
+  p->segment_count += segments;
+  return 1;
+}
+
+// Returns the number of symbols until the next one to time, which is random
+// but averages PROFILE_SAMPLE_INTERVAL. A fixed interval would only ever time
+// the same few symbols in strings that repeat with a period dividing it.
+static uint32_t NextSampleGap(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return 1 + (x % (2 * PROFILE_SAMPLE_INTERVAL - 1));
+}
+
+int RunProfiledLSystemString(LSystemConfig *config, Turtle3D *t,
+    const uint8_t *s, uint32_t length, TurtleProfile *p) {
+  // The index of each symbol's instructions in p->action_types, looked up
+  // ahead of time.
+  uint8_t action_types[128][MAX_ACTIONS_PER_CHAR];
+  ActionRule *r = NULL;
+  double start_time = CurrentSeconds();
+  double symbol_start;
+  // The sampling is seeded the same way every time, so runs are repeatable.
+  uint32_t random_state = 0x9e3779b9;
+  uint32_t until_sample = NextSampleGap(&random_state);
+  uint32_t i;
+  int c, j, type;
+  for (c = 0; c < 128; c++) {
+    r = config->actions + c;
+    for (j = 0; j < r->length; j++) {
+      type = ActionTypeIndex(p, r->instructions[j]);
+      if (type < 0) {
+        printf("Too many kinds of turtle instructions to profile.\n");
+        return 0;
+      }
+      action_types[c][j] = type;
+    }
+  }
+  for (i = 0; i < length; i++) {
+    c = s[i];
+    until_sample--;
+    if (until_sample != 0) {
+      if (!RunProfiledSymbol(config, t, c, action_types[c], p)) return 0;
+      continue;
+    }
+    until_sample = NextSampleGap(&random_state);
+    symbol_start = CurrentSeconds();
+    if (!RunProfiledSymbol(config, t, c, action_types[c], p)) return 0;
+    p->symbols[c].sampled_seconds += CurrentSeconds() - symbol_start;
+    p->symbols[c].sampled_count++;
+  }
+  p->seconds += CurrentSeconds() - start_time;
+  return 1;
+}
+
+// Sorts entries with the largest key first.
+static int CompareRankedEntries(const void *a, const void *b) {
+  double key_a = ((const RankedEntry *) a)->key;
+  double key_b = ((const RankedEntry *) b)->key;
+  uint32_t index_a = ((const RankedEntry *) a)->index;
+  uint32_t index_b = ((const RankedEntry *) b)->index;
+  if (key_a > key_b) return -1;
+  if (key_a < key_b) return 1;
+  if (index_a < index_b) return -1;
+  if (index_a > index_b) return 1;
+  return 0;
+}
+
+// Returns the estimated number of seconds spent running the symbol.
+static double EstimatedSeconds(SymbolProfile *sp) {
+  if (sp->sampled_count == 0) return 0;
+  return sp->sampled_seconds * ((double) sp->count) /
+    ((double) sp->sampled_count);
+}
+
+// Returns the percentage of total that value makes up.
+static double Percent(double value, double total) {
+  if (total <= 0) return 0;
+  return 100.0 * value / total;
+}
+
+void PrintTurtleProfile(TurtleProfile *p) {
+  RankedEntry ranked[128];
+  SymbolProfile *sp = NULL;
+  ActionTypeProfile *ap = NULL;
+  double total_estimate = 0;
+  uint32_t count = 0, i;
+  printf("Ran %llu symbols and %llu actions, drawing %llu segments, in "
+    "%.03f seconds.\n", (unsigned long long) p->symbol_count,
+    (unsigned long long) p->action_count,
+    (unsigned long long) p->segment_count, p->seconds);
+  printf("Deepest stacks: %u positions, %u colors.\n",
+    (unsigned) p->max_position_depth, (unsigned) p->max_color_depth);
+  printf("Reallocations: %u of the vertex array, %u of the position stack, "
+    "%u of the\ncolor stack.\n", (unsigned) p->vertex_reallocs,
+    (unsigned) p->position_stack_reallocs,
+    (unsigned) p->color_stack_reallocs);
+
+  for (i = 0; i < p->action_type_count; i++) {
+    ranked[i].index = i;
+    ranked[i].key = p->action_types[i].count;
+  }
+  qsort(ranked, p->action_type_count, sizeof(RankedEntry),
+    CompareRankedEntries);
+  printf("\nActions by count:\n");
+  printf("  %-20s %14s %8s\n", "action", "count", "share");
+  for (i = 0; i < p->action_type_count; i++) {
+    ap = p->action_types + ranked[i].index;
+    if (ap->count == 0) continue;
+    printf("  %-20s %14llu %7.02f%%\n", TurtleActionName(ap->instruction),
+      (unsigned long long) ap->count,
+      Percent(ap->count, p->action_count));
+  }
+
+  for (i = 0; i < 128; i++) {
+    sp = p->symbols + i;
+    if (sp->count == 0) continue;
+    ranked[count].index = i;
+    ranked[count].key = EstimatedSeconds(sp);
+    total_estimate += ranked[count].key;
+    count++;
+  }
+  qsort(ranked, count, sizeof(RankedEntry), CompareRankedEntries);
+  printf("\nSymbols by estimated time, timing about 1 in %d symbols:\n",
+    PROFILE_SAMPLE_INTERVAL);
+  printf("  %-6s %14s %14s %14s %12s %8s\n", "symbol", "count", "actions",
+    "segments", "time (ms)", "share");
+  for (i = 0; i < count; i++) {
+    sp = p->symbols + ranked[i].index;
+    printf("  %-6c %14llu %14llu %14llu %12.03f %7.02f%%\n",
+      (char) ranked[i].index, (unsigned long long) sp->count,
+      (unsigned long long) sp->action_count,
+      (unsigned long long) sp->segment_count, ranked[i].key * 1000.0,
+      Percent(ranked[i].key, total_estimate));
+  }
+}
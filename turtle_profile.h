@@ -0,0 +1,64 @@
+// An instrumented version of RunLSystemString, which counts what the turtle
+// does for each symbol, to show which rules are worth restructuring or
+// optimizing for a given config. It's much slower than RunLSystemString, so
+// it's only used when asked for. Doesn't use OpenGL.
+#ifndef TURTLE_PROFILE_H
+#define TURTLE_PROFILE_H
+#include <stdint.h>
+#include "parse_config.h"
+#include "turtle_3d.h"
+
+// On average, only one in this many symbols is timed, since reading the clock
+// for every symbol would take longer than running most of them. The time
+// taken by each symbol is estimated from its samples.
+#define PROFILE_SAMPLE_INTERVAL (64)
+
+// The most distinct turtle instructions that can be counted separately.
+#define PROFILE_MAX_ACTION_TYPES (32)
+
+typedef struct {
+  // The number of times the symbol was run.
+  uint64_t count;
+  uint64_t action_count;
+  uint64_t segment_count;
+  // The number of times the symbol was timed, and the total time taken.
+  uint64_t sampled_count;
+  double sampled_seconds;
+} SymbolProfile;
+
+typedef struct {
+  TurtleInstruction instruction;
+  uint64_t count;
+} ActionTypeProfile;
+
+typedef struct {
+  SymbolProfile symbols[128];
+  ActionTypeProfile action_types[PROFILE_MAX_ACTION_TYPES];
+  uint32_t action_type_count;
+  uint64_t symbol_count;
+  uint64_t action_count;
+  uint64_t segment_count;
+  // The deepest the turtle's stacks got.
+  uint32_t max_position_depth;
+  uint32_t max_color_depth;
+  // The number of times the turtle's arrays had to grow.
+  uint32_t vertex_reallocs;
+  uint32_t position_stack_reallocs;
+  uint32_t color_stack_reallocs;
+  // The total time taken, including the profiling itself.
+  double seconds;
+} TurtleProfile;
+
+// Clears the profile's counts.
+void InitTurtleProfile(TurtleProfile *p);
+
+// Like RunLSystemString, but adds what the turtle did to the profile. Can be
+// called more than once to add up several runs. Returns 0 on error.
+int RunProfiledLSystemString(LSystemConfig *config, Turtle3D *t,
+    const uint8_t *s, uint32_t length, TurtleProfile *p);
+
+// Prints the profile, with action types ranked by how often they ran and
+// symbols ranked by their estimated time.
+void PrintTurtleProfile(TurtleProfile *p);
+
+#endif  // TURTLE_PROFILE_H
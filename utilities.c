@@ -3,52 +3,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <glad/glad.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include "utilities.h"
 
-static void PrintGLErrorString(GLenum error) {
-  switch (error) {
-  case GL_NO_ERROR:
-    printf("No OpenGL error");
-    return;
-  case GL_INVALID_ENUM:
-    printf("Invalid enum");
-    return;
-  case GL_INVALID_VALUE:
-    printf("Invalid value");
-    return;
-  case GL_INVALID_OPERATION:
-    printf("Invalid operation");
-    return;
-  // GL_STACK_OVERFLOW is undefined; bug in GLAD
-  case 0x503:
-    printf("Stack overflow");
-    return;
-  // GL_STACK_UNDERFLOW is undefined; bug in GLAD
-  case 0x504:
-    printf("Stack underflow");
-    return;
-  case GL_OUT_OF_MEMORY:
-    printf("Out of memory");
-    return;
-  default:
-    break;
-  }
-  printf("Unknown OpenGL error: %d", (int) error);
-}
-
-int CheckGLErrors(void) {
-  GLenum error = glGetError();
-  if (error == GL_NO_ERROR) return 1;
-  while (error != GL_NO_ERROR) {
-    printf("Got OpenGL error: ");
-    PrintGLErrorString(error);
-    printf("\n");
-    error = glGetError();
-  }
-  return 0;
-}
-
 char* ReadFullFile(const char *path) {
   long size = 0;
   char *to_return = NULL;
@@ -151,3 +113,35 @@ char* StringReplace(const char *input, const char *match, const char *r) {
   return to_return;
 }
 
+double CurrentSeconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((double) t.tv_sec) + ((double) t.tv_nsec) * 1e-9;
+}
+
+int ProcessorCount(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  if (info.dwNumberOfProcessors < 1) return 1;
+  return info.dwNumberOfProcessors;
+#else
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (count < 1) return 1;
+  return count;
+#endif
+}
+
+uint64_t PhysicalMemoryBytes(void) {
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) return 0;
+  return status.ullTotalPhys;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if ((pages <= 0) || (page_size <= 0)) return 0;
+  return ((uint64_t) pages) * ((uint64_t) page_size);
+#endif
+}
@@ -1,13 +1,10 @@
 #ifndef OPENGL_TUTORIAL_UTILITIES_H
 #define OPENGL_TUTORIAL_UTILITIES_H
+#include <stdint.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Returns 0 if any OpenGL errors are detected. Otherwise, prints the errors
-// and returns nonzero.
-int CheckGLErrors(void);
-
 // Reads the file with the entire given name to a NULL-terminated buffer of
 // bytes. Returns NULL on error. The caller is responsible for freeing the
 // returned buffer when it's no longer needed.
@@ -19,6 +16,19 @@ char* ReadFullFile(const char *path);
 // will return a new copy of the input string.
 char* StringReplace(const char *input, const char *match, const char *r);
 
+// Returns the current time, in seconds, from a monotonic clock. Only useful
+// for measuring elapsed time. Unlike glfwGetTime, this doesn't require GLFW
+// to be initialized.
+double CurrentSeconds(void);
+
+// Returns the number of processors available to run threads on, which is at
+// least 1.
+int ProcessorCount(void);
+
+// Returns the amount of physical memory installed, in bytes, or 0 if it
+// can't be determined.
+uint64_t PhysicalMemoryBytes(void);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif